@@ -391,6 +391,7 @@ desktop-file-install --vendor netdirect \
 %attr(0755,root,root) %{_bindir}/brawchannel
 %attr(0755,root,root) %{_bindir}/bs11nread
 %attr(0755,root,root) %{_bindir}/bidentify
+%attr(0755,root,root) %{_bindir}/bping
 %attr(0755,root,root) %{_bindir}/brecsum
 %attr(0755,root,root) %{_bindir}/upldif
 %attr(0755,root,root) %{_libdir}/barry/hal-blackberry
@@ -406,6 +407,7 @@ desktop-file-install --vendor netdirect \
 %attr(0644,root,root) %{_mandir}/man1/brawchannel*
 %attr(0644,root,root) %{_mandir}/man1/bs11nread*
 %attr(0644,root,root) %{_mandir}/man1/bidentify*
+%attr(0644,root,root) %{_mandir}/man1/bping*
 %attr(0644,root,root) %{_mandir}/man1/bcharge*
 %attr(0644,root,root) %{_mandir}/man1/pppob*
 %attr(0644,root,root) %{_mandir}/man1/brecsum*
@@ -21,23 +21,67 @@
 
 #include "i18n.h"
 #include "backup.h"
+#include "backupmanifest.h"
+#include "backupindex.h"
 #include "tarfile.h"
 #include "error.h"
+#include "log.h"
+#include "m_desktop.h"
+#include "record.h"
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+
+// uncompressed bytes between restart points, within a database
+#define BACKUP_RESTART_SIZE	(1024 * 1024)
 
 namespace Barry {
 
+//
+// Backup::RecordWriter
+//
+/// Hands records from the pipeline thread back to Backup
+///
+class Backup::RecordWriter : public Barry::Parser
+{
+	Backup &m_backup;
+
+public:
+	explicit RecordWriter(Backup &backup)
+		: m_backup(backup)
+	{
+	}
+
+	virtual void ParseRecord(const Barry::DBData &data,
+				const Barry::IConverter *ic)
+	{
+		m_backup.WriteRecord(data);
+	}
+};
+
 Backup::Backup(const std::string &tarpath)
+	: m_tarpath(tarpath)
+	, m_written(false)
 {
 	try {
+		// format is chosen by extension; gzip is compressed on
+		// worker threads, so the thread reading from the device
+		// is not slowed down by deflate
 		m_tar.reset( new reuse::TarFile(tarpath.c_str(), true,
-				&reuse::gztar_ops_nonthread, true) );
+				reuse::TarFile::GetWriteOps(tarpath,
+					&reuse::gztar_ops_parallel), true) );
+
+		reuse::TarOffset pos;
+		if( m_tar->GetPosition(pos) )
+			m_index.reset( new BackupIndex );
 	}
 	catch( reuse::TarFile::TarError &te ) {
 		throw Barry::BackupError(te.what());
 	}
+
+	m_writer.reset( new RecordWriter(*this) );
+	m_pipeline.reset( new ThreadedParser(*m_writer) );
 }
 
 Backup::~Backup()
@@ -50,9 +94,39 @@ Backup::~Backup()
 	}
 }
 
+void Backup::WriteIndex(const BackupIndex &index)
+{
+	// the index gets a restart point of its own, so it can
+	// be read without anything else
+	reuse::TarOffset pos;
+	m_tar->GetPosition(pos, true);
+
+	std::ostringstream oss;
+	index.Write(oss);
+	m_tar->AppendFile(BackupIndex::TarName, oss.str());
+	m_tar->SetIndexPosition(pos);
+}
+
 void Backup::Close()
 {
+	if( m_pipeline.get() ) {
+		// only try once, even if the writer failed
+		std::auto_ptr<ThreadedParser> pipeline(m_pipeline);
+		barryverbose(_("Backup: ") << pipeline->GetStats());
+		try {
+			pipeline->Flush();
+		}
+		catch( Barry::Error &e ) {
+			throw Barry::BackupError(e.what());
+		}
+	}
+
 	if( m_tar.get() ) try {
+		// only try once, even if writing the index fails
+		std::auto_ptr<BackupIndex> index(m_index);
+		if( index.get() && !index->IsEmpty() )
+			WriteIndex(*index);
+
 		m_tar->Close();
 		m_tar.reset();
 	}
@@ -66,12 +140,138 @@ void Backup::ClearStats()
 	m_stats.clear();
 }
 
+ThreadedParser::Stats Backup::GetPipelineStats() const
+{
+	if( m_pipeline.get() )
+		return m_pipeline->GetStats();
+	return ThreadedParser::Stats();
+}
+
+void Backup::Incremental(Mode::Desktop &desktop,
+			const std::string &basepath,
+			const std::vector<std::string> &dbNames)
+{
+	if( m_written )
+		throw Barry::BackupError(_("Backup: incremental backup must start before any records are written"));
+
+	BackupManifest base;
+	base.Load(basepath);
+
+	BackupManifest manifest;
+	manifest.SetBase(BackupManifest::MakeBaseLink(m_tarpath, basepath));
+
+	// state table indices to fetch, per database ID
+	typedef std::vector<unsigned int>		IndexList;
+	typedef std::vector<std::pair<unsigned int, IndexList> > FetchList;
+	FetchList fetch;
+
+	for( std::vector<std::string>::const_iterator dbi = dbNames.begin();
+		dbi != dbNames.end();
+		++dbi )
+	{
+		unsigned int dbId = desktop.GetDBID(*dbi);
+		RecordStateTable table;
+		desktop.GetRecordStateTable(dbId, table);
+
+		// records the base knows about, by unique ID
+		typedef std::map<uint32_t, BackupManifest::Record> PrevMap;
+		PrevMap prev;
+		if( const BackupManifest::Database *old = base.FindDB(*dbi) ) {
+			for( BackupManifest::RecordArrayType::const_iterator
+					r = old->Records.begin();
+				r != old->Records.end();
+				++r )
+			{
+				if( r->Status != BackupManifest::Deleted )
+					prev[r->UniqueId] = *r;
+			}
+		}
+
+		BackupManifest::Database &db = manifest.AddDB(*dbi);
+		fetch.push_back(std::make_pair(dbId, IndexList()));
+		IndexList &indices = fetch.back().second;
+
+		for( RecordStateTable::StateMapType::const_iterator
+				s = table.StateMap.begin();
+			s != table.StateMap.end();
+			++s )
+		{
+			BackupManifest::Record rec;
+			rec.UniqueId = s->second.RecordId;
+			rec.RecType = (uint8_t) s->second.RecType;
+			rec.Status = BackupManifest::Inherited;
+
+			PrevMap::iterator p = prev.find(rec.UniqueId);
+			if( p == prev.end() || s->second.Dirty ||
+			    p->second.RecType != rec.RecType )
+			{
+				rec.Status = BackupManifest::Stored;
+				indices.push_back(s->second.Index);
+			}
+			if( p != prev.end() )
+				prev.erase(p);
+
+			db.Records.push_back(rec);
+		}
+
+		// whatever is left in the base is gone from the device
+		for( PrevMap::const_iterator p = prev.begin();
+			p != prev.end();
+			++p )
+		{
+			BackupManifest::Record rec = p->second;
+			rec.Status = BackupManifest::Deleted;
+			db.Records.push_back(rec);
+		}
+	}
+
+	// the manifest goes first, so Restore can find it cheaply
+	std::ostringstream oss;
+	manifest.Write(oss);
+	try {
+		m_tar->AppendFile(BackupManifest::TarName, oss.str());
+		m_written = true;
+	}
+	catch( reuse::TarFile::TarError &te ) {
+		throw Barry::BackupError(te.what());
+	}
+
+	for( FetchList::const_iterator f = fetch.begin(); f != fetch.end(); ++f ) {
+		if( f->second.size() )
+			desktop.GetRecordsByIndex(f->first, f->second, *this);
+	}
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 // Barry::Parser overrides
 
 void Backup::ParseRecord(const Barry::DBData &data,
 			  const Barry::IConverter *ic)
+{
+	if( data.GetDBName().size() == 0 )
+		throw Barry::BackupError(_("Backup: No database name available"));
+	if( !m_pipeline.get() )
+		throw Barry::BackupError(_("Backup: already closed"));
+
+	try {
+		m_pipeline->ParseRecord(data, ic);
+	}
+	catch( Barry::BackupError & ) {
+		throw;
+	}
+	catch( Barry::Error &e ) {
+		// the writer thread failed on an earlier record
+		throw Barry::BackupError(e.what());
+	}
+	m_written = true;
+
+	// add stats
+	m_stats[data.GetDBName()]++;
+}
+
+/// Called from the pipeline thread for each record
+void Backup::WriteRecord(const Barry::DBData &data)
 {
 	m_current_dbname = data.GetDBName();
 
@@ -89,12 +289,28 @@ void Backup::ParseRecord(const Barry::DBData &data,
 		(const char*)data.GetData().GetData() + data.GetOffset(),
 		data.GetData().GetSize() - data.GetOffset());
 
+	// note where it goes, starting a new restart point for each
+	// database, and whenever the current one gets too big
+	if( m_index.get() ) {
+		const BackupIndex::DatabaseArrayType &dbs = m_index->GetDatabases();
+		reuse::TarOffset pos;
+		m_tar->GetPosition(pos);
+		if( dbs.empty() || dbs.back().Name != m_current_dbname ||
+		    pos.skip >= BACKUP_RESTART_SIZE )
+			m_tar->GetPosition(pos, true);
+
+		m_index->Add(m_current_dbname, data.GetUniqueId(),
+			data.GetRecType(), pos);
+	}
+
 	// save to tarball
 	std::string tarname = m_current_dbname + "/" + m_tar_id_text;
-	m_tar->AppendFile(tarname.c_str(), m_record_data);
-
-	// add stats
-	m_stats[m_current_dbname]++;
+	try {
+		m_tar->AppendFile(tarname.c_str(), m_record_data);
+	}
+	catch( reuse::TarFile::TarError &te ) {
+		throw Barry::BackupError(te.what());
+	}
 }
 
 } // namespace Barry
@@ -24,7 +24,9 @@
 
 #include "dll.h"
 #include "parser.h"
+#include "threadedparser.h"
 #include <string>
+#include <vector>
 #include <memory>
 
 // forward declarations
@@ -34,28 +36,80 @@ namespace reuse {
 
 namespace Barry {
 
+namespace Mode {
+	class Desktop;
+}
+
+class BackupIndex;
+
 class BXEXPORT Backup : public Barry::Parser
 {
 public:
 	typedef std::map<std::string, int>		StatsType;
 
 private:
+	class RecordWriter;
+	friend class RecordWriter;
+
+	// records are written to the tarball from a thread of their
+	// own, so the device can be sending while we compress
+	std::auto_ptr<RecordWriter> m_writer;
+	std::auto_ptr<ThreadedParser> m_pipeline;
+
 	std::auto_ptr<reuse::TarFile> m_tar;
+	std::auto_ptr<BackupIndex> m_index;	//< null if tar can't seek
+	std::string m_tarpath;
+	bool m_written;		//< true once anything is in the tarball
 
 	std::string m_current_dbname;
 	std::string m_tar_id_text;
 	std::string m_record_data;
 	StatsType m_stats;
 
+protected:
+	void WriteIndex(const BackupIndex &index);
+	void WriteRecord(const Barry::DBData &data);
+
 public:
+	/// Creates a new backup file at tarpath.  The compression is
+	/// chosen by the file's extension (see reuse::TarFile).  gzip
+	/// backups get restart points at each database, and every
+	/// megabyte or so, plus an index of all records, so Restore
+	/// can jump to any database or record.
 	explicit Backup(const std::string &tarpath);
 	~Backup();
 
+	/// Waits for queued records to be written, and finishes
+	/// the tarball.  Throws BackupError on failure.
 	void Close();
 
 	void ClearStats();
 	const StatsType& GetStats() const { return m_stats; }
 
+	/// Counters for the device and tarball stages of the backup,
+	/// to show which one is holding the other up.  Also logged
+	/// by Close() in verbose mode.
+	ThreadedParser::Stats GetPipelineStats() const;
+
+	/// Backs up the given databases incrementally against the backup
+	/// at basepath, which may be a full backup or an earlier
+	/// incremental one.  Uses each database's record state table to
+	/// fetch only records that are new or dirty, or whose type has
+	/// changed, since the base.  Unchanged and deleted records are
+	/// only listed in the BackupManifest that is written as the first
+	/// file of this backup.  Restore follows the chain of bases to
+	/// rebuild the complete databases.
+	///
+	/// Must be called instead of Desktop::LoadDatabase(), before any
+	/// records have been written to this backup.  Dirty flags on
+	/// the device are left alone, so records that stay dirty are
+	/// transferred again on each run.
+	///
+	/// Throws BackupError if the base cannot be read, or if records
+	/// have already been written.
+	void Incremental(Mode::Desktop &desktop, const std::string &basepath,
+		const std::vector<std::string> &dbNames);
+
 	// Barry::Parser overrides
 	virtual void ParseRecord(const Barry::DBData &data,
 			const Barry::IConverter *ic);
@@ -0,0 +1,179 @@
+///
+/// \file	backupindex.cc
+///		Record index for seekable Barry Backup files
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "backupindex.h"
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#define INDEX_HEADER		"Barry Backup Index 1"
+#define INDEX_DB		"DB: "
+
+namespace Barry {
+
+const char *BackupIndex::TarName = "barry-index";
+
+BackupIndex::BackupIndex()
+{
+}
+
+BackupIndex::~BackupIndex()
+{
+}
+
+void BackupIndex::Clear()
+{
+	m_dbs.clear();
+}
+
+void BackupIndex::Add(const std::string &dbname,
+			uint32_t uniqueId,
+			uint8_t recType,
+			const reuse::TarOffset &pos)
+{
+	if( m_dbs.empty() || m_dbs.back().Name != dbname ) {
+		m_dbs.push_back(Database());
+		m_dbs.back().Name = dbname;
+	}
+
+	Entry entry;
+	entry.UniqueId = uniqueId;
+	entry.RecType = recType;
+	entry.Position = pos;
+	m_dbs.back().Entries.push_back(entry);
+}
+
+const BackupIndex::Database* BackupIndex::FindDB(const std::string &dbname) const
+{
+	for( DatabaseArrayType::const_iterator i = m_dbs.begin();
+		i != m_dbs.end();
+		++i )
+	{
+		if( i->Name == dbname )
+			return &(*i);
+	}
+	return 0;
+}
+
+const BackupIndex::Entry* BackupIndex::Find(const std::string &dbname,
+						uint32_t uniqueId) const
+{
+	const Database *db = FindDB(dbname);
+	if( !db )
+		return 0;
+
+	for( EntryArrayType::const_iterator i = db->Entries.begin();
+		i != db->Entries.end();
+		++i )
+	{
+		if( i->UniqueId == uniqueId )
+			return &(*i);
+	}
+	return 0;
+}
+
+bool BackupIndex::Read(std::istream &is)
+{
+	Clear();
+
+	std::string line;
+	if( !getline(is, line) || line != INDEX_HEADER )
+		return false;
+
+	Database *db = 0;
+	while( getline(is, line) ) {
+		if( line.size() == 0 )
+			continue;
+
+		if( line.compare(0, sizeof(INDEX_DB) - 1, INDEX_DB) == 0 ) {
+			m_dbs.push_back(Database());
+			db = &m_dbs.back();
+			db->Name = line.substr(sizeof(INDEX_DB) - 1);
+			continue;
+		}
+
+		if( !db )
+			return false;
+
+		std::istringstream iss(line);
+		Entry entry;
+		unsigned int rectype;
+		long long member;
+		unsigned long long skip;
+		if( !(iss >> std::hex >> entry.UniqueId >> rectype
+			  >> std::dec >> member >> skip) )
+			return false;
+		entry.RecType = (uint8_t) rectype;
+		entry.Position.member = member;
+		entry.Position.skip = skip;
+		db->Entries.push_back(entry);
+	}
+	return true;
+}
+
+void BackupIndex::Write(std::ostream &os) const
+{
+	os << INDEX_HEADER << "\n";
+
+	for( DatabaseArrayType::const_iterator i = m_dbs.begin();
+		i != m_dbs.end();
+		++i )
+	{
+		os << INDEX_DB << i->Name << "\n";
+
+		for( EntryArrayType::const_iterator e = i->Entries.begin();
+			e != i->Entries.end();
+			++e )
+		{
+			os << std::hex << e->UniqueId << " "
+				<< (unsigned int)e->RecType << " "
+				<< std::dec << (long long)e->Position.member << " "
+				<< (unsigned long long)e->Position.skip << "\n";
+		}
+	}
+}
+
+bool BackupIndex::ReadFromTar(const std::string &tarpath, reuse::TarFile &tar)
+{
+	Clear();
+
+	reuse::TarOffset pos;
+	if( !reuse::TarFile::FindIndex(tarpath, pos) )
+		return false;
+
+	std::string filename, text;
+	if( !tar.Seek(pos) ||
+	    !tar.ReadNextFile(filename, text) ||
+	    filename != TarName )
+	{
+		throw reuse::TarFile::TarError(_("Unable to read index of ") + tarpath);
+	}
+
+	std::istringstream iss(text);
+	if( !Read(iss) ) {
+		Clear();
+		throw reuse::TarFile::TarError(_("Invalid index in ") + tarpath);
+	}
+	return true;
+}
+
+} // namespace Barry
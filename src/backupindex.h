@@ -0,0 +1,108 @@
+///
+/// \file	backupindex.h
+///		Record index for seekable Barry Backup files
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRYBACKUP_BACKUPINDEX_H__
+#define __BARRYBACKUP_BACKUPINDEX_H__
+
+#include "dll.h"
+#include "tarfile.h"
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <stdint.h>
+
+namespace Barry {
+
+//
+// BackupIndex
+//
+/// Maps each record in a backup tarball to the position of its
+/// tar header, so Restore can go straight to a database or record
+/// without decompressing everything in front of it.
+///
+/// Backup writes the index as the last file in the tarball, in a
+/// restart point of its own, and marks its position at the end of
+/// the file (see reuse::TarFile::FindIndex()).
+///
+/// The on-disk format is plain text, one entry per line:
+///
+///	Barry Backup Index 1
+///	DB: <database name>
+///	<hex unique ID> <hex record type> <member offset> <skip>
+///
+class BXLOCAL BackupIndex
+{
+public:
+	/// Name of the index file inside the tarball.  It contains
+	/// no slash, so older Restore code skips it as a non-record.
+	static const char *TarName;
+
+	struct Entry
+	{
+		uint32_t UniqueId;
+		uint8_t RecType;
+		reuse::TarOffset Position;
+	};
+
+	typedef std::vector<Entry>			EntryArrayType;
+
+	struct Database
+	{
+		std::string Name;
+		EntryArrayType Entries;
+	};
+
+	typedef std::vector<Database>			DatabaseArrayType;
+
+private:
+	DatabaseArrayType m_dbs;
+
+public:
+	BackupIndex();
+	~BackupIndex();
+
+	void Clear();
+	bool IsEmpty() const { return m_dbs.empty(); }
+
+	/// Records are expected to arrive grouped by database,
+	/// as they are written by Backup
+	void Add(const std::string &dbname, uint32_t uniqueId,
+		uint8_t recType, const reuse::TarOffset &pos);
+
+	const DatabaseArrayType& GetDatabases() const { return m_dbs; }
+	const Database* FindDB(const std::string &dbname) const;
+	const Entry* Find(const std::string &dbname, uint32_t uniqueId) const;
+
+	/// Returns false if the stream is not a valid index
+	bool Read(std::istream &is);
+	void Write(std::ostream &os) const;
+
+	/// Loads the index of tarpath, using tar, which must be that
+	/// file opened for reading with TarFile::GetReadOps().  Leaves
+	/// tar positioned after the index.  Returns false, leaving tar
+	/// untouched, if the file has no index.  Throws TarError if
+	/// the index cannot be read.
+	bool ReadFromTar(const std::string &tarpath, reuse::TarFile &tar);
+};
+
+} // namespace Barry
+
+#endif
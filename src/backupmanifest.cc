@@ -0,0 +1,276 @@
+///
+/// \file	backupmanifest.cc
+///		Record manifest for incremental Barry Backup files
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "backupmanifest.h"
+#include "tarfile.h"
+#include "error.h"
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+#include <limits.h>
+
+#define MANIFEST_HEADER		"Barry Backup Manifest 1"
+#define MANIFEST_BASE		"Base: "
+#define MANIFEST_DB		"DB: "
+
+namespace Barry {
+
+namespace {
+
+	// returns the directory part of path, including the trailing
+	// slash, or an empty string if path has no directory part
+	std::string DirName(const std::string &path)
+	{
+		std::string::size_type pos = path.rfind('/');
+		if( pos == std::string::npos )
+			return std::string();
+		return path.substr(0, pos + 1);
+	}
+
+	std::string BaseName(const std::string &path)
+	{
+		std::string::size_type pos = path.rfind('/');
+		if( pos == std::string::npos )
+			return path;
+		return path.substr(pos + 1);
+	}
+
+	std::string AbsolutePath(const std::string &path)
+	{
+		if( path.size() && path[0] == '/' )
+			return path;
+
+		char buf[PATH_MAX];
+		if( !getcwd(buf, sizeof(buf)) )
+			return path;
+		return std::string(buf) + "/" + path;
+	}
+
+}
+
+const char *BackupManifest::TarName = "barry-manifest";
+
+//////////////////////////////////////////////////////////////////////////////
+// BackupManifest::Record and Database
+
+std::string BackupManifest::Record::GetTarName(const std::string &dbname) const
+{
+	// must match the filenames written by Backup::ParseRecord()
+	std::ostringstream oss;
+	oss << dbname << "/" << std::hex << UniqueId
+		<< " " << (unsigned int)RecType;
+	return oss.str();
+}
+
+unsigned int BackupManifest::Database::GetLiveCount() const
+{
+	unsigned int count = 0;
+	for( RecordArrayType::const_iterator i = Records.begin();
+		i != Records.end();
+		++i )
+	{
+		if( i->Status != Deleted )
+			count++;
+	}
+	return count;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// BackupManifest
+
+BackupManifest::BackupManifest()
+{
+}
+
+BackupManifest::~BackupManifest()
+{
+}
+
+void BackupManifest::Clear()
+{
+	m_base.clear();
+	m_dbs.clear();
+}
+
+const BackupManifest::Database* BackupManifest::FindDB(const std::string &dbname) const
+{
+	for( DatabaseArrayType::const_iterator i = m_dbs.begin();
+		i != m_dbs.end();
+		++i )
+	{
+		if( i->Name == dbname )
+			return &(*i);
+	}
+	return 0;
+}
+
+BackupManifest::Database& BackupManifest::AddDB(const std::string &dbname)
+{
+	m_dbs.push_back(Database());
+	m_dbs.back().Name = dbname;
+	return m_dbs.back();
+}
+
+bool BackupManifest::Read(std::istream &is)
+{
+	Clear();
+
+	std::string line;
+	if( !getline(is, line) || line != MANIFEST_HEADER )
+		return false;
+
+	Database *db = 0;
+	while( getline(is, line) ) {
+		if( line.size() == 0 )
+			continue;
+
+		if( line.compare(0, sizeof(MANIFEST_BASE) - 1, MANIFEST_BASE) == 0 ) {
+			m_base = line.substr(sizeof(MANIFEST_BASE) - 1);
+		}
+		else if( line.compare(0, sizeof(MANIFEST_DB) - 1, MANIFEST_DB) == 0 ) {
+			db = &AddDB(line.substr(sizeof(MANIFEST_DB) - 1));
+		}
+		else {
+			char status = line[0];
+			if( !db || (status != Stored && status != Inherited &&
+					status != Deleted) )
+				return false;
+
+			std::istringstream iss(line.substr(1));
+			Record rec;
+			unsigned int rectype;
+			if( !(iss >> std::hex >> rec.UniqueId >> rectype) )
+				return false;
+			rec.RecType = (uint8_t) rectype;
+			rec.Status = (RecordStatus) status;
+			db->Records.push_back(rec);
+		}
+	}
+	return true;
+}
+
+void BackupManifest::Write(std::ostream &os) const
+{
+	os << MANIFEST_HEADER << "\n";
+	if( m_base.size() )
+		os << MANIFEST_BASE << m_base << "\n";
+
+	for( DatabaseArrayType::const_iterator i = m_dbs.begin();
+		i != m_dbs.end();
+		++i )
+	{
+		os << MANIFEST_DB << i->Name << "\n";
+
+		for( RecordArrayType::const_iterator r = i->Records.begin();
+			r != i->Records.end();
+			++r )
+		{
+			os << (char)r->Status << " "
+				<< std::hex << r->UniqueId << " "
+				<< (unsigned int)r->RecType << "\n";
+		}
+	}
+}
+
+bool BackupManifest::ReadFromTar(const std::string &tarpath)
+{
+	Clear();
+
+	try {
+		reuse::TarFile tar(tarpath.c_str(), false,
+			reuse::TarFile::GetReadOps(tarpath), true);
+
+		// the manifest is always written first, so there
+		// is no need to look any further than one file
+		std::string filename, text;
+		if( !tar.ReadNextFile(filename, text) || filename != TarName )
+			return false;
+
+		std::istringstream iss(text);
+		if( !Read(iss) ) {
+			Clear();
+			throw Barry::BackupError(_("BackupManifest: invalid manifest in ") + tarpath);
+		}
+		return true;
+	}
+	catch( reuse::TarFile::TarError &te ) {
+		throw Barry::BackupError(te.what());
+	}
+}
+
+void BackupManifest::Load(const std::string &tarpath)
+{
+	if( ReadFromTar(tarpath) )
+		return;
+
+	try {
+		reuse::TarFile tar(tarpath.c_str(), false,
+			reuse::TarFile::GetReadOps(tarpath), true);
+
+		std::string name;
+		Database *db = 0;
+		while( tar.ReadNextFilenameOnly(name) ) {
+			std::string::size_type pos = name.rfind('/');
+			if( pos == std::string::npos )
+				continue;	// not a record
+
+			std::string dbname = name.substr(0, pos);
+			if( !db || db->Name != dbname )
+				db = &AddDB(dbname);
+
+			std::istringstream iss(name.substr(pos + 1));
+			Record rec;
+			unsigned int rectype;
+			if( !(iss >> std::hex >> rec.UniqueId >> rectype) )
+				continue;	// not a record
+			rec.RecType = (uint8_t) rectype;
+			rec.Status = Stored;
+			db->Records.push_back(rec);
+		}
+	}
+	catch( reuse::TarFile::TarError &te ) {
+		throw Barry::BackupError(te.what());
+	}
+}
+
+std::string BackupManifest::MakeBaseLink(const std::string &tarpath,
+					const std::string &basepath)
+{
+	std::string tardir = DirName(AbsolutePath(tarpath));
+	std::string basedir = DirName(AbsolutePath(basepath));
+	if( tardir == basedir )
+		return BaseName(basepath);
+	return AbsolutePath(basepath);
+}
+
+std::string BackupManifest::ResolveBase(const std::string &tarpath,
+					const std::string &link)
+{
+	if( link.size() == 0 || link[0] == '/' )
+		return link;
+	return DirName(tarpath) + link;
+}
+
+} // namespace Barry
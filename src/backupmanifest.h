@@ -0,0 +1,144 @@
+///
+/// \file	backupmanifest.h
+///		Record manifest for incremental Barry Backup files
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRYBACKUP_BACKUPMANIFEST_H__
+#define __BARRYBACKUP_BACKUPMANIFEST_H__
+
+#include "dll.h"
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <stdint.h>
+
+namespace Barry {
+
+//
+// BackupManifest
+//
+/// Lists every record a backup file represents, database by
+/// database, in the order they will be restored.
+///
+/// An incremental backup stores its manifest as the first file in
+/// the tarball, under the name given by TarName.  The manifest names
+/// the backup it was made against (the base), and marks each record
+/// as either stored in this tarball, inherited unchanged from the
+/// base chain, or deleted since the base.  A plain full backup has
+/// no manifest file, but Load() can build an equivalent one from the
+/// record filenames.
+///
+/// The on-disk format is plain text, one entry per line:
+///
+///	Barry Backup Manifest 1
+///	Base: <path to base backup, relative to this backup's directory>
+///	DB: <database name>
+///	+ <hex unique ID> <record type>		(stored)
+///	= <hex unique ID> <record type>		(inherited)
+///	- <hex unique ID> <record type>		(deleted)
+///
+class BXEXPORT BackupManifest
+{
+public:
+	/// Name of the manifest file inside the tarball.  It contains
+	/// no slash, so older Restore code skips it as a non-record.
+	static const char *TarName;
+
+	enum RecordStatus
+	{
+		Stored = '+',
+		Inherited = '=',
+		Deleted = '-'
+	};
+
+	struct BXEXPORT Record
+	{
+		uint32_t UniqueId;
+		uint8_t RecType;
+		RecordStatus Status;
+
+		/// Returns the "DBName/hexid rectype" tarball filename
+		/// that Backup uses for this record
+		std::string GetTarName(const std::string &dbname) const;
+	};
+
+	typedef std::vector<Record>			RecordArrayType;
+
+	struct BXEXPORT Database
+	{
+		std::string Name;
+		RecordArrayType Records;
+
+		/// Count of records that will be restored (not Deleted)
+		unsigned int GetLiveCount() const;
+	};
+
+	typedef std::vector<Database>			DatabaseArrayType;
+
+private:
+	std::string m_base;
+	DatabaseArrayType m_dbs;
+
+public:
+	BackupManifest();
+	~BackupManifest();
+
+	void Clear();
+
+	/// Base backup link, as stored in the manifest.  Empty for
+	/// full backups.  Use ResolveBase() to turn it into a path.
+	const std::string& GetBase() const { return m_base; }
+	void SetBase(const std::string &base) { m_base = base; }
+	bool IsIncremental() const { return m_base.size() > 0; }
+
+	const DatabaseArrayType& GetDatabases() const { return m_dbs; }
+	const Database* FindDB(const std::string &dbname) const;
+	Database& AddDB(const std::string &dbname);
+
+	/// Returns false if the stream is not a valid manifest
+	bool Read(std::istream &is);
+	void Write(std::ostream &os) const;
+
+	/// Fills the manifest from the first file in the given tarball.
+	/// Returns false, leaving the manifest empty, if the tarball
+	/// does not start with a manifest (i.e. is a full backup).
+	/// Throws BackupError if the file cannot be read.
+	bool ReadFromTar(const std::string &tarpath);
+
+	/// Like ReadFromTar(), but if no manifest is found, builds one
+	/// from the record filenames, marking every record as Stored.
+	/// Throws BackupError if the file cannot be read.
+	void Load(const std::string &tarpath);
+
+	/// Returns the link to store in a manifest written to tarpath,
+	/// for the given base backup path.  A base in the same directory
+	/// is stored as a bare filename, so a set of backups can be
+	/// moved together, otherwise an absolute path is used.
+	static std::string MakeBaseLink(const std::string &tarpath,
+		const std::string &basepath);
+
+	/// Returns the path of the base backup, given the path of the
+	/// backup containing the manifest and the stored base link.
+	static std::string ResolveBase(const std::string &tarpath,
+		const std::string &link);
+};
+
+} // namespace Barry
+
+#endif
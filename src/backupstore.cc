@@ -0,0 +1,510 @@
+///
+/// \file	backupstore.cc
+///		Content-addressed, deduplicating backup store
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "backupstore.h"
+#include "data.h"
+#include "sha1.h"
+#include "error.h"
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SNAPSHOT_HEADER		"Barry Backup Snapshot 1"
+#define SNAPSHOT_DB		"DB: "
+
+#define STORE_OBJECTS		"objects"
+#define STORE_SNAPSHOTS		"snapshots"
+
+namespace Barry {
+
+namespace {
+
+	std::string ErrnoText(const std::string &msg, const std::string &path)
+	{
+		return msg + path + ": " + strerror(errno);
+	}
+
+	bool IsDir(const std::string &path)
+	{
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	}
+
+	void MakeDir(const std::string &path)
+	{
+		if( mkdir(path.c_str(), 0755) != 0 && errno != EEXIST )
+			throw Barry::BackupError(ErrnoText(_("BackupStore: unable to create directory "), path));
+	}
+
+	// name for writing path's contents before renaming into place
+	std::string TempName(const std::string &path)
+	{
+		std::ostringstream oss;
+		oss << path << ".tmp." << getpid();
+		return oss.str();
+	}
+
+	bool ValidHash(const std::string &hash)
+	{
+		return hash.size() == SHA_DIGEST_LENGTH * 2 &&
+			hash.find_first_not_of("0123456789abcdef") == std::string::npos;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// BackupSnapshot
+
+std::string BackupSnapshot::Entry::GetTarName(const std::string &dbname) const
+{
+	// must match the filenames written by Backup::WriteRecord()
+	std::ostringstream oss;
+	oss << dbname << "/" << std::hex << UniqueId
+		<< " " << (unsigned int)RecType;
+	return oss.str();
+}
+
+const BackupSnapshot::Entry* BackupSnapshot::Database::Find(uint32_t uniqueId) const
+{
+	for( EntryArrayType::const_iterator i = Entries.begin();
+		i != Entries.end();
+		++i )
+	{
+		if( i->UniqueId == uniqueId )
+			return &(*i);
+	}
+	return 0;
+}
+
+BackupSnapshot::BackupSnapshot()
+{
+}
+
+BackupSnapshot::~BackupSnapshot()
+{
+}
+
+void BackupSnapshot::Clear()
+{
+	m_dbs.clear();
+}
+
+const BackupSnapshot::Database* BackupSnapshot::FindDB(const std::string &dbname) const
+{
+	for( DatabaseArrayType::const_iterator i = m_dbs.begin();
+		i != m_dbs.end();
+		++i )
+	{
+		if( i->Name == dbname )
+			return &(*i);
+	}
+	return 0;
+}
+
+BackupSnapshot::Database& BackupSnapshot::AddDB(const std::string &dbname)
+{
+	m_dbs.push_back(Database());
+	m_dbs.back().Name = dbname;
+	return m_dbs.back();
+}
+
+void BackupSnapshot::Add(const std::string &dbname,
+			uint32_t uniqueId,
+			uint8_t recType,
+			const std::string &hash)
+{
+	if( m_dbs.empty() || m_dbs.back().Name != dbname )
+		AddDB(dbname);
+
+	Entry entry;
+	entry.UniqueId = uniqueId;
+	entry.RecType = recType;
+	entry.Hash = hash;
+	m_dbs.back().Entries.push_back(entry);
+}
+
+const BackupSnapshot::Entry* BackupSnapshot::Find(const std::string &dbname,
+						uint32_t uniqueId) const
+{
+	const Database *db = FindDB(dbname);
+	return db ? db->Find(uniqueId) : 0;
+}
+
+bool BackupSnapshot::Read(std::istream &is)
+{
+	Clear();
+
+	std::string line;
+	if( !getline(is, line) || line != SNAPSHOT_HEADER )
+		return false;
+
+	Database *db = 0;
+	while( getline(is, line) ) {
+		if( line.size() == 0 )
+			continue;
+
+		if( line.compare(0, sizeof(SNAPSHOT_DB) - 1, SNAPSHOT_DB) == 0 ) {
+			db = &AddDB(line.substr(sizeof(SNAPSHOT_DB) - 1));
+			continue;
+		}
+
+		if( !db )
+			return false;
+
+		std::istringstream iss(line);
+		Entry entry;
+		unsigned int rectype;
+		if( !(iss >> std::hex >> entry.UniqueId >> rectype >> entry.Hash) ||
+		    !ValidHash(entry.Hash) )
+			return false;
+		entry.RecType = (uint8_t) rectype;
+		db->Entries.push_back(entry);
+	}
+	return true;
+}
+
+void BackupSnapshot::Write(std::ostream &os) const
+{
+	os << SNAPSHOT_HEADER << "\n";
+
+	for( DatabaseArrayType::const_iterator i = m_dbs.begin();
+		i != m_dbs.end();
+		++i )
+	{
+		os << SNAPSHOT_DB << i->Name << "\n";
+
+		for( EntryArrayType::const_iterator e = i->Entries.begin();
+			e != i->Entries.end();
+			++e )
+		{
+			os << std::hex << e->UniqueId << " "
+				<< (unsigned int)e->RecType << " "
+				<< e->Hash << "\n";
+		}
+	}
+}
+
+void BackupSnapshot::Load(const std::string &path)
+{
+	std::ifstream ifs(path.c_str());
+	if( !ifs )
+		throw Barry::BackupError(ErrnoText(_("BackupSnapshot: unable to open "), path));
+
+	if( !Read(ifs) ) {
+		Clear();
+		throw Barry::BackupError(_("BackupSnapshot: invalid snapshot in ") + path);
+	}
+}
+
+void BackupSnapshot::Save(const std::string &path) const
+{
+	std::string temp = TempName(path);
+	{
+		std::ofstream ofs(temp.c_str());
+		Write(ofs);
+		ofs.close();
+		if( !ofs ) {
+			unlink(temp.c_str());
+			throw Barry::BackupError(_("BackupSnapshot: unable to write ") + temp);
+		}
+	}
+
+	if( rename(temp.c_str(), path.c_str()) != 0 ) {
+		std::string msg = ErrnoText(_("BackupSnapshot: unable to rename to "), path);
+		unlink(temp.c_str());
+		throw Barry::BackupError(msg);
+	}
+}
+
+bool BackupSnapshot::IsSnapshot(const std::string &path)
+{
+	std::ifstream ifs(path.c_str());
+	std::string line;
+	return ifs && getline(ifs, line) && line == SNAPSHOT_HEADER;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// BackupStore
+
+BackupStore::BackupStore(const std::string &path, bool create)
+	: m_path(path)
+{
+	// strip trailing slashes, so paths built on it look sane
+	while( m_path.size() > 1 && m_path[m_path.size() - 1] == '/' )
+		m_path.erase(m_path.size() - 1);
+
+	if( create ) {
+		MakeDir(m_path);
+		MakeDir(m_path + "/" STORE_OBJECTS);
+		MakeDir(m_path + "/" STORE_SNAPSHOTS);
+	}
+
+	if( !IsDir(m_path + "/" STORE_OBJECTS) ||
+	    !IsDir(m_path + "/" STORE_SNAPSHOTS) )
+		throw Barry::BackupError(_("BackupStore: not a backup store: ") + path);
+}
+
+BackupStore::~BackupStore()
+{
+}
+
+std::string BackupStore::GetStorePath(const std::string &snapshotPath)
+{
+	// <store>/snapshots/<name>
+	std::string::size_type pos = snapshotPath.rfind('/');
+	if( pos == std::string::npos || pos == 0 )
+		return "..";
+	pos = snapshotPath.rfind('/', pos - 1);
+	if( pos == std::string::npos )
+		return ".";
+	return snapshotPath.substr(0, pos);
+}
+
+std::string BackupStore::GetSnapshotPath(const std::string &name) const
+{
+	return m_path + "/" STORE_SNAPSHOTS "/" + name;
+}
+
+std::vector<std::string> BackupStore::GetSnapshotList() const
+{
+	std::vector<std::string> list;
+
+	std::string dirname = m_path + "/" STORE_SNAPSHOTS;
+	DIR *dir = opendir(dirname.c_str());
+	if( !dir )
+		throw Barry::BackupError(ErrnoText(_("BackupStore: unable to read "), dirname));
+
+	struct dirent *entry;
+	while( (entry = readdir(dir)) ) {
+		std::string name = entry->d_name;
+		if( name[0] == '.' || name.find(".tmp.") != std::string::npos )
+			continue;
+		list.push_back(name);
+	}
+	closedir(dir);
+
+	std::sort(list.begin(), list.end());
+	return list;
+}
+
+std::string BackupStore::MakeSnapshotName() const
+{
+	time_t now = time(NULL);
+	struct tm local;
+	char buf[32];
+	localtime_r(&now, &local);
+	strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &local);
+
+	std::string name = buf;
+	for( int n = 2; access(GetSnapshotPath(name).c_str(), F_OK) == 0; n++ ) {
+		std::ostringstream oss;
+		oss << buf << "-" << n;
+		name = oss.str();
+	}
+	return name;
+}
+
+std::string BackupStore::Hash(const void *data, size_t size)
+{
+	unsigned char sha1[SHA_DIGEST_LENGTH];
+	SHA1(data, size, sha1);
+
+	std::ostringstream oss;
+	for( int i = 0; i < SHA_DIGEST_LENGTH; i++ ) {
+		oss << std::hex << std::setfill('0') << std::setw(2)
+			<< (unsigned int) sha1[i];
+	}
+	return oss.str();
+}
+
+std::string BackupStore::GetObjectPath(const std::string &hash) const
+{
+	return m_path + "/" STORE_OBJECTS "/" + hash.substr(0, 2) + "/"
+		+ hash.substr(2);
+}
+
+bool BackupStore::HasObject(const std::string &hash) const
+{
+	return access(GetObjectPath(hash).c_str(), F_OK) == 0;
+}
+
+bool BackupStore::StoreObject(const std::string &hash,
+				const void *data,
+				size_t size)
+{
+	if( !ValidHash(hash) )
+		throw Barry::BackupError(_("BackupStore: invalid hash: ") + hash);
+
+	if( HasObject(hash) )
+		return false;
+
+	MakeDir(m_path + "/" STORE_OBJECTS "/" + hash.substr(0, 2));
+
+	std::string path = GetObjectPath(hash);
+	std::string temp = TempName(path);
+	int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if( fd == -1 )
+		throw Barry::BackupError(ErrnoText(_("BackupStore: unable to create "), temp));
+
+	const char *buf = (const char*) data;
+	size_t left = size;
+	while( left ) {
+		ssize_t n = write(fd, buf, left);
+		if( n < 0 ) {
+			if( errno == EINTR )
+				continue;
+			std::string msg = ErrnoText(_("BackupStore: unable to write "), temp);
+			close(fd);
+			unlink(temp.c_str());
+			throw Barry::BackupError(msg);
+		}
+		buf += n;
+		left -= n;
+	}
+
+	if( close(fd) != 0 || rename(temp.c_str(), path.c_str()) != 0 ) {
+		std::string msg = ErrnoText(_("BackupStore: unable to write "), path);
+		unlink(temp.c_str());
+		throw Barry::BackupError(msg);
+	}
+	return true;
+}
+
+void BackupStore::LoadObject(const std::string &hash, Data &data) const
+{
+	if( !ValidHash(hash) )
+		throw Barry::BackupError(_("BackupStore: invalid hash: ") + hash);
+
+	std::string path = GetObjectPath(hash);
+	int fd = open(path.c_str(), O_RDONLY);
+	if( fd == -1 )
+		throw Barry::BackupError(ErrnoText(_("BackupStore: missing object "), path));
+
+	struct stat st;
+	if( fstat(fd, &st) != 0 ) {
+		std::string msg = ErrnoText(_("BackupStore: unable to read "), path);
+		close(fd);
+		throw Barry::BackupError(msg);
+	}
+
+	size_t size = st.st_size;
+	unsigned char *buf = data.GetBuffer(size);
+	size_t done = 0;
+	while( done < size ) {
+		ssize_t n = read(fd, buf + done, size - done);
+		if( n < 0 && errno == EINTR )
+			continue;
+		if( n <= 0 )
+			break;
+		done += n;
+	}
+	close(fd);
+	data.ReleaseBuffer(done);
+
+	if( done != size || Hash(data.GetData(), data.GetSize()) != hash )
+		throw Barry::BackupError(_("BackupStore: corrupt object ") + path);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// StoreBackup
+
+StoreBackup::StoreBackup(const std::string &storePath, const std::string &name)
+	: m_store(storePath, true)
+	, m_closed(false)
+	, m_new_objects(0)
+	, m_new_bytes(0)
+{
+	m_snapshot_path = m_store.GetSnapshotPath(
+		name.size() ? name : m_store.MakeSnapshotName());
+}
+
+StoreBackup::~StoreBackup()
+{
+	try {
+		Close();
+	}
+	catch( Barry::BackupError & ) {
+		// throw it away
+	}
+}
+
+void StoreBackup::Close()
+{
+	if( m_closed )
+		return;
+
+	// only try once
+	m_closed = true;
+	m_snapshot.Save(m_snapshot_path);
+}
+
+void StoreBackup::ClearStats()
+{
+	m_stats.clear();
+	m_new_objects = 0;
+	m_new_bytes = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Barry::Parser overrides
+
+void StoreBackup::ParseRecord(const Barry::DBData &data,
+				const Barry::IConverter *ic)
+{
+	if( m_closed )
+		throw Barry::BackupError(_("StoreBackup: snapshot already closed"));
+
+	const std::string &dbname = data.GetDBName();
+	if( dbname.size() == 0 )
+		throw Barry::BackupError(_("Backup: No database name available"));
+
+	// same bytes that Backup would put in the tarball
+	const unsigned char *payload = data.GetData().GetData() + data.GetOffset();
+	size_t size = data.GetData().GetSize() - data.GetOffset();
+
+	std::string hash = BackupStore::Hash(payload, size);
+	if( m_store.StoreObject(hash, payload, size) ) {
+		m_new_objects++;
+		m_new_bytes += size;
+	}
+
+	m_snapshot.Add(dbname, data.GetUniqueId(), data.GetRecType(), hash);
+
+	// add stats
+	m_stats[dbname]++;
+}
+
+} // namespace Barry
+
@@ -0,0 +1,225 @@
+///
+/// \file	backupstore.h
+///		Content-addressed, deduplicating backup store
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRYBACKUP_BACKUPSTORE_H__
+#define __BARRYBACKUP_BACKUPSTORE_H__
+
+#include "dll.h"
+#include "parser.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <iosfwd>
+#include <stdint.h>
+
+namespace Barry {
+
+class Data;
+
+//
+// BackupSnapshot
+//
+/// Lists every record in one backup snapshot of a BackupStore,
+/// database by database, along with the SHA1 hash that names the
+/// record's data in the store.
+///
+/// The on-disk format is plain text, one entry per line:
+///
+///	Barry Backup Snapshot 1
+///	DB: <database name>
+///	<hex unique ID> <hex record type> <40 digit SHA1 hash>
+///
+class BXEXPORT BackupSnapshot
+{
+public:
+	struct BXEXPORT Entry
+	{
+		uint32_t UniqueId;
+		uint8_t RecType;
+		std::string Hash;
+
+		/// Returns the "DBName/hexid rectype" filename that
+		/// Backup would use for this record in a tarball
+		std::string GetTarName(const std::string &dbname) const;
+	};
+
+	typedef std::vector<Entry>			EntryArrayType;
+
+	struct BXEXPORT Database
+	{
+		std::string Name;
+		EntryArrayType Entries;
+
+		const Entry* Find(uint32_t uniqueId) const;
+	};
+
+	typedef std::vector<Database>			DatabaseArrayType;
+
+private:
+	DatabaseArrayType m_dbs;
+
+public:
+	BackupSnapshot();
+	~BackupSnapshot();
+
+	void Clear();
+
+	const DatabaseArrayType& GetDatabases() const { return m_dbs; }
+	const Database* FindDB(const std::string &dbname) const;
+	Database& AddDB(const std::string &dbname);
+
+	/// Adds an entry to the named database, creating a new
+	/// database entry if it is not the last one added
+	void Add(const std::string &dbname, uint32_t uniqueId,
+		uint8_t recType, const std::string &hash);
+
+	/// Returns the entry for the given record, or 0 if none
+	const Entry* Find(const std::string &dbname, uint32_t uniqueId) const;
+
+	/// Returns false if the stream is not a valid snapshot
+	bool Read(std::istream &is);
+	void Write(std::ostream &os) const;
+
+	/// Throws BackupError if the file cannot be read or is invalid
+	void Load(const std::string &path);
+
+	/// Writes to a temporary file first, and renames it into place,
+	/// so a snapshot is never seen half written.
+	/// Throws BackupError on failure.
+	void Save(const std::string &path) const;
+
+	/// Returns true if path names a snapshot file.  Never throws.
+	static bool IsSnapshot(const std::string &path);
+};
+
+//
+// BackupStore
+//
+/// A directory holding any number of backup snapshots, with each
+/// distinct record stored only once, no matter how many snapshots
+/// it appears in.
+///
+/// Record data lives in objects/xx/yyyy..., named by the SHA1 hash
+/// of the raw record data, split after the first two hex digits.
+/// Snapshots live in snapshots/<name>, as BackupSnapshot files.
+/// Since objects are written before the snapshot that refers to them,
+/// and both are renamed into place when complete, an interrupted
+/// backup leaves at worst a few unreferenced objects behind.
+///
+/// Restore accepts a snapshot path in place of a tarball, so all
+/// the usual restore tools work with a store.
+///
+class BXEXPORT BackupStore
+{
+	std::string m_path;
+
+public:
+	/// Opens the store at path, creating it if create is true
+	/// and it does not exist yet.  Throws BackupError on failure.
+	explicit BackupStore(const std::string &path, bool create = false);
+	~BackupStore();
+
+	const std::string& GetPath() const { return m_path; }
+
+	/// Returns the path of the store that the given snapshot
+	/// file belongs to
+	static std::string GetStorePath(const std::string &snapshotPath);
+
+	std::string GetSnapshotPath(const std::string &name) const;
+
+	/// Returns the names of all snapshots, sorted.  Snapshots
+	/// named by MakeSnapshotName() sort oldest first.
+	std::vector<std::string> GetSnapshotList() const;
+
+	/// Returns a name for a new snapshot, based on the current
+	/// date and time, that is not yet used in this store
+	std::string MakeSnapshotName() const;
+
+	/// Returns the hex SHA1 hash of the given data
+	static std::string Hash(const void *data, size_t size);
+
+	std::string GetObjectPath(const std::string &hash) const;
+	bool HasObject(const std::string &hash) const;
+
+	/// Stores data under the given hash, unless it is already there.
+	/// Returns true if a new object was written.
+	/// Throws BackupError on failure.
+	bool StoreObject(const std::string &hash, const void *data,
+		size_t size);
+
+	/// Loads the object with the given hash into data.
+	/// Throws BackupError if it is missing or corrupt.
+	void LoadObject(const std::string &hash, Data &data) const;
+};
+
+//
+// StoreBackup
+//
+/// Parser class that writes records into a new snapshot in a
+/// BackupStore, much like Backup does for tarballs.  Records
+/// that are already in the store cost nothing but their line in
+/// the snapshot.
+///
+class BXEXPORT StoreBackup : public Barry::Parser
+{
+public:
+	typedef std::map<std::string, int>		StatsType;
+
+private:
+	BackupStore m_store;
+	std::string m_snapshot_path;
+	BackupSnapshot m_snapshot;
+	bool m_closed;
+
+	StatsType m_stats;
+	unsigned int m_new_objects;
+	uint64_t m_new_bytes;
+
+public:
+	/// Creates the store at storePath if needed, and starts a
+	/// snapshot with the given name, or one from
+	/// BackupStore::MakeSnapshotName() if name is empty
+	explicit StoreBackup(const std::string &storePath,
+		const std::string &name = std::string());
+	~StoreBackup();
+
+	/// Writes the snapshot.  Nothing is visible in the store's
+	/// snapshot list until this is called.
+	void Close();
+
+	const std::string& GetSnapshotPath() const { return m_snapshot_path; }
+
+	void ClearStats();
+	const StatsType& GetStats() const { return m_stats; }
+
+	/// Count and size of record data actually written to the store
+	unsigned int GetNewObjects() const { return m_new_objects; }
+	uint64_t GetNewBytes() const { return m_new_bytes; }
+
+	// Barry::Parser overrides
+	virtual void ParseRecord(const Barry::DBData &data,
+			const Barry::IConverter *ic);
+};
+
+} // namespace Barry
+
+#endif
+
@@ -48,7 +48,9 @@
 // Only these headers get installed.
 
 #include "data.h"
+#include "dataslice.h"
 #include "usbwrap.h"			// to be moved to libusb someday
+#include "usbcapture.h"
 #include "common.h"			// Init()
 #include "error.h"			// exceptions
 #include "configfile.h"
@@ -56,6 +58,8 @@
 #include "dataqueue.h"
 #include "socket.h"
 #include "router.h"
+#include "metrics.h"
+#include "multirouter.h"
 #include "protocol.h"			// application-safe header
 #include "parser.h"
 #include "builder.h"
@@ -78,6 +82,7 @@
 #include "threadwrap.h"
 #include "vsmartptr.h"
 #include "pipe.h"
+#include "threadedparser.h"
 #include "connector.h"
 #include "fifoargs.h"
 
@@ -91,6 +96,7 @@
 // Include the template helpers after the record classes
 #include "m_desktoptmpl.h"
 #include "recordtmpl.h"
+#include "lazyrecord.h"
 
 #ifdef __BARRY_BOOST_MODE__
 // Boost serialization seems to be picky about header order, do them all here
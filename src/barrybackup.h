@@ -25,6 +25,8 @@
 // Include only the public backup / restore headers
 // (not tarfile)
 #include "backup.h"
+#include "backupmanifest.h"
+#include "backupstore.h"
 #include "restore.h"
 
 #endif
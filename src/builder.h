@@ -131,6 +131,9 @@ public:
 //
 /// Contains the proper way to convert a record object into a DBData object.
 ///
+/// The buffer is sized for the whole record first, using the record's
+/// GetFieldsSize(), so that building the fields never has to grow it.
+///
 template <class RecordT>
 void SetDBData(const RecordT &rec, DBData &data, size_t &offset,
 		const IConverter *ic)
@@ -144,6 +147,12 @@ void SetDBData(const RecordT &rec, DBData &data, size_t &offset,
 	data.SetOffset(offset);
 	data.SetDBName(RecordT::GetDBName());
 	data.SetIds(rec.GetRecType(), rec.GetUniqueId());
+
+	// 0 means the record can't tell, and the buffer grows as usual
+	size_t size = rec.GetFieldsSize(ic);
+	if( size )
+		data.UseData().GetBuffer(offset + size);
+
 	rec.BuildHeader(data.UseData(), offset);
 	rec.BuildFields(data.UseData(), offset, ic);
 }
@@ -31,6 +31,7 @@
 
 #ifdef USE_BARRY_SOCKETS
 #include "usbwrap.h"
+#include "usbcapture.h"
 #endif
 
 namespace Barry {
@@ -51,6 +52,9 @@ pthread_mutex_t LogStreamMutex;
 /// data_dump_mode and the log stream will be updated each time
 /// it is called, but the USB library will not be re-initialized.
 ///
+/// If the BARRY_ASYNC_LOG environment variable is set, logging goes
+/// through the background writer from the start.  See LogAsync().
+///
 /// \param[in]	data_dump_mode	If set to true, the protocol conversation
 ///				will be sent to the logStream specified
 ///				in the second argument.
@@ -81,11 +85,20 @@ void Init(bool data_dump_mode, std::ostream *logStream)
 			throw Error(_("Failed to initialise USB"));
 			return;
 		}
+
+		// binary capture of all USB traffic, if requested
+		const char *capture = getenv(USB_CAPTURE_ENV);
+		if( capture && *capture )
+			Usb::Capture::Start(capture);
 #endif
 
 		// only need to initialize this once
 		pthread_mutex_init(&LogStreamMutex, NULL);
 
+		// background log writer, if requested
+		if( getenv(LOG_ASYNC_ENV) )
+			LogAsync(true);
+
 		// done
 		initialized = true;
 	}
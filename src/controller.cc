@@ -28,7 +28,10 @@
 #include "data.h"
 #include "endian.h"
 #include "platform.h"
+#include "packet.h"
+#include "metrics.h"
 #include <string.h>
+#include <deque>
 
 #define __DEBUG_MODE__
 #include "debug.h"
@@ -262,5 +265,82 @@ const ProbeResult& Controller::GetProbeResult() const
 	return m_priv->m_result;
 }
 
+//
+// GetProtocolMetrics
+//
+/// Returns the counters for everything sent and received over this
+/// device's sockets.  See metrics.h.
+///
+ProtocolMetrics Controller::GetProtocolMetrics() const
+{
+	return m_priv->m_zero.GetMetrics();
+}
+
+//
+// GetRouterMetrics
+//
+/// Copies out the routing queue's counters.  Returns false if this
+/// Controller is not using a routing queue.
+///
+bool Controller::GetRouterMetrics(RouterMetrics &metrics) const
+{
+	if( !m_priv->m_queue )
+		return false;
+	m_priv->m_queue->GetMetrics(metrics);
+	return true;
+}
+
+void Controller::ClearMetrics()
+{
+	m_priv->m_zero.ClearMetrics();
+	if( m_priv->m_queue )
+		m_priv->m_queue->ClearMetrics();
+}
+
+//
+// Echo
+//
+/// Sends count echo requests on socket zero, keeping up to burst of
+/// them outstanding at once, and adds each round trip time, in
+/// microseconds, to rtt.  The device answers in order, so replies are
+/// matched to requests by position.  Anything else arriving on socket
+/// zero is skipped, so use this before selecting a mode.
+///
+/// \exception	Barry::Error, Usb::Error
+///		Thrown on timeouts and bus errors.
+///
+void Controller::Echo(int count, int burst, Histogram &rtt, int timeout)
+{
+	if( burst < 1 )
+		burst = 1;
+
+	SocketZero &zero = m_priv->m_zero;
+	Data send, receive;
+	ZeroPacket packet(send, receive);
+
+	// the echo payload is host time in microseconds,
+	// measured from the start of the run
+	Stopwatch clock;
+	std::deque<Stopwatch> outstanding;
+
+	while( count > 0 || outstanding.size() ) {
+		while( count > 0 && (int)outstanding.size() < burst ) {
+			packet.Echo(clock.GetElapsed());
+			outstanding.push_back(Stopwatch());
+			zero.Send(send, timeout);
+			count--;
+		}
+
+		zero.Receive(receive, timeout);
+		if( packet.Command() != SB_COMMAND_ECHO_REPLY ) {
+			dout("Controller::Echo: skipping socket zero packet:\n" << receive);
+			continue;
+		}
+
+		rtt.Add(outstanding.front().GetElapsed());
+		outstanding.pop_front();
+	}
+}
+
 } // namespace Barry
 
@@ -119,6 +119,15 @@ public:
 					// this exposed, but oh well
 
 	const ProbeResult& GetProbeResult() const;
+
+	// Counters and latencies for performance diagnostics,
+	// see metrics.h
+	ProtocolMetrics GetProtocolMetrics() const;
+	bool GetRouterMetrics(RouterMetrics &metrics) const;
+	void ClearMetrics();
+
+	// Socket zero echo round trips, for measuring latency
+	void Echo(int count, int burst, Histogram &rtt, int timeout = -1);
 };
 
 } // namespace Barry
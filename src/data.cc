@@ -25,11 +25,15 @@
 #include <sstream>
 #include <iomanip>
 #include <string>
+#include <algorithm>
 #include <stdexcept>
 #include <string.h>
 #include <stdlib.h>
 #include <locale>
+#include <new>
+#include <pthread.h>
 #include "ios_state.h"
+#include "scoped_lock.h"
 
 //#define __DEBUG_MODE__
 #include "debug.h"
@@ -61,32 +65,264 @@ inline bool IsHexData(const std::string &s)
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+// DataPool class
+
+namespace {
+
+	//
+	// PoolClass
+	//
+	// Plain data only, with a static mutex initializer, so the pool
+	// is usable by Data objects constructed before main()
+	//
+	struct PoolClass
+	{
+		size_t size;
+		size_t limit;		// most blocks kept at once
+		pthread_mutex_t mutex;	// protects everything below
+		unsigned char **blocks;	// free blocks, allocated on first use
+		size_t count;
+		unsigned long hits, misses, returns, discards;
+	};
+
+	// Sizes fit the common Data uses: short protocol packets, a full
+	// default sized Data with its prepend space, and large records
+	PoolClass pool_classes[] = {
+		{ 0x200, 256, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0 },
+		{ 0x1000, 64, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0 },
+		{ BARRY_DATA_DEFAULT_SIZE + BARRY_DATA_DEFAULT_PREPEND_SIZE,
+			64, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0 },
+		{ 0x10000, 8, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0 },
+		{ 0x40000, 2, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0 },
+	};
+
+	const size_t pool_class_count =
+		sizeof(pool_classes) / sizeof(pool_classes[0]);
+
+	// oversize requests, updated atomically
+	unsigned long oversize_allocs = 0;
+	unsigned long oversize_frees = 0;
+
+	// set once the free lists are released at exit, after which
+	// freed blocks go straight back to the heap
+	int pool_closed = 0;
+
+	PoolClass* FindClass(size_t size)
+	{
+		for( size_t i = 0; i < pool_class_count; i++ ) {
+			if( size <= pool_classes[i].size )
+				return &pool_classes[i];
+		}
+		return 0;
+	}
+
+	//
+	// PoolCleanup
+	//
+	// Releases the free lists at exit, so that only blocks still
+	// owned by Data objects are left for leak checkers to report
+	//
+	struct PoolCleanup
+	{
+		~PoolCleanup()
+		{
+			__sync_lock_test_and_set(&pool_closed, 1);
+			DataPool::Trim();
+
+			for( size_t i = 0; i < pool_class_count; i++ ) {
+				PoolClass &pc = pool_classes[i];
+				scoped_lock lock(pc.mutex);
+				delete [] pc.blocks;
+				pc.blocks = 0;
+			}
+		}
+	} pool_cleanup;
+
+	unsigned char* NewBlock(size_t size)
+	{
+		unsigned char *block = new unsigned char[size];
+		memset(block, 0, size);
+		return block;
+	}
+}
+
+DataPool::Stats::Stats()
+	: BlockSize(0)
+	, Hits(0)
+	, Misses(0)
+	, Returns(0)
+	, Discards(0)
+	, Pooled(0)
+{
+}
+
+unsigned char* DataPool::Allocate(size_t &size)
+{
+	PoolClass *pc = FindClass(size);
+	if( !pc ) {
+		__sync_fetch_and_add(&oversize_allocs, 1);
+		return NewBlock(size);
+	}
+
+	size = pc->size;
+	{
+		scoped_lock lock(pc->mutex);
+		if( pc->count ) {
+			pc->hits++;
+			return pc->blocks[--pc->count];
+		}
+		pc->misses++;
+	}
+
+	return NewBlock(size);
+}
+
+void DataPool::Release(unsigned char *block, size_t size)
+{
+	if( !block )
+		return;
+
+	PoolClass *pc = FindClass(size);
+	if( !pc ) {
+		__sync_fetch_and_add(&oversize_frees, 1);
+		delete [] block;
+		return;
+	}
+
+	// once the pool is closed at exit, just free the block
+	if( pc->size == size && !__sync_fetch_and_add(&pool_closed, 0) ) {
+		scoped_lock lock(pc->mutex);
+
+		if( !pc->blocks ) {
+			// never throw from here, since Data's destructor
+			// calls us... just fall back to freeing the block
+			pc->blocks = new (std::nothrow) unsigned char*[pc->limit];
+		}
+
+		if( pc->blocks && pc->count < pc->limit ) {
+			pc->blocks[pc->count++] = block;
+			pc->returns++;
+			return;
+		}
+		pc->discards++;
+	}
+
+	delete [] block;
+}
+
+size_t DataPool::ClassSize(size_t size)
+{
+	PoolClass *pc = FindClass(size);
+	return pc ? pc->size : 0;
+}
+
+void DataPool::GetStats(StatsArrayType &stats)
+{
+	stats.clear();
+	for( size_t i = 0; i < pool_class_count; i++ ) {
+		PoolClass &pc = pool_classes[i];
+		scoped_lock lock(pc.mutex);
+		Stats s;
+		s.BlockSize = pc.size;
+		s.Hits = pc.hits;
+		s.Misses = pc.misses;
+		s.Returns = pc.returns;
+		s.Discards = pc.discards;
+		s.Pooled = pc.count;
+		stats.push_back(s);
+	}
+}
+
+DataPool::Stats DataPool::GetTotals()
+{
+	Stats totals;
+	for( size_t i = 0; i < pool_class_count; i++ ) {
+		PoolClass &pc = pool_classes[i];
+		scoped_lock lock(pc.mutex);
+		totals.Hits += pc.hits;
+		totals.Misses += pc.misses;
+		totals.Returns += pc.returns;
+		totals.Discards += pc.discards;
+		totals.Pooled += pc.count;
+	}
+
+	totals.Misses += __sync_fetch_and_add(&oversize_allocs, 0);
+	totals.Discards += __sync_fetch_and_add(&oversize_frees, 0);
+	return totals;
+}
+
+void DataPool::ClearStats()
+{
+	for( size_t i = 0; i < pool_class_count; i++ ) {
+		PoolClass &pc = pool_classes[i];
+		scoped_lock lock(pc.mutex);
+		pc.hits = pc.misses = pc.returns = pc.discards = 0;
+	}
+
+	__sync_fetch_and_and(&oversize_allocs, 0);
+	__sync_fetch_and_and(&oversize_frees, 0);
+}
+
+void DataPool::Trim()
+{
+	for( size_t i = 0; i < pool_class_count; i++ ) {
+		PoolClass &pc = pool_classes[i];
+		scoped_lock lock(pc.mutex);
+		while( pc.count )
+			delete [] pc.blocks[--pc.count];
+	}
+}
+
+ostream& operator<< (ostream &os, const DataPool::Stats &stats)
+{
+	ios_format_state state(os);
+
+	os << dec;
+	if( stats.BlockSize )
+		os << _("Block size: ") << stats.BlockSize << ", ";
+	else
+		os << _("All blocks: ");
+
+	os << _("hits: ") << stats.Hits
+	   << _(", misses: ") << stats.Misses
+	   << _(", returned: ") << stats.Returns
+	   << _(", discarded: ") << stats.Discards
+	   << _(", pooled: ") << stats.Pooled;
+	return os;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Data class
 
 bool Data::bPrintAscii = true;
 
 Data::Data()
-	: m_memBlock(new unsigned char[BARRY_DATA_DEFAULT_SIZE + BARRY_DATA_DEFAULT_PREPEND_SIZE])
-	, m_blockSize(BARRY_DATA_DEFAULT_SIZE + BARRY_DATA_DEFAULT_PREPEND_SIZE)
-	, m_dataStart(m_memBlock + BARRY_DATA_DEFAULT_PREPEND_SIZE)
+	: m_memBlock(0)
+	, m_blockSize(BARRY_DATA_INITIAL_SIZE + BARRY_DATA_DEFAULT_PREPEND_SIZE)
+	, m_dataStart(0)
 	, m_dataSize(0)
 	, m_externalData(0)
 	, m_external(false)
 	, m_endpoint(-1)
 {
+	m_memBlock = DataPool::Allocate(m_blockSize);
+	m_dataStart = m_memBlock + BARRY_DATA_DEFAULT_PREPEND_SIZE;
 	memset(m_memBlock, 0, m_blockSize);
 }
 
 Data::Data(int endpoint, size_t startsize, size_t prependsize)
-	: m_memBlock(new unsigned char[startsize + prependsize])
+	: m_memBlock(0)
 	, m_blockSize(startsize + prependsize)
-	, m_dataStart(m_memBlock + prependsize)
+	, m_dataStart(0)
 	, m_dataSize(0)
 	, m_externalData(0)
 	, m_external(false)
 	, m_endpoint(endpoint)
 {
+	m_memBlock = DataPool::Allocate(m_blockSize);
+	m_dataStart = m_memBlock + prependsize;
 	memset(m_memBlock, 0, m_blockSize);
 }
 
@@ -102,14 +338,18 @@ Data::Data(const void *ValidData, size_t size)
 }
 
 Data::Data(const Data &other)
-	: m_memBlock(other.m_blockSize ? new unsigned char[other.m_blockSize] : 0)
+	: m_memBlock(0)
 	, m_blockSize(other.m_blockSize)
-	, m_dataStart(m_memBlock + other.AvailablePrependSpace())
+	, m_dataStart(0)
 	, m_dataSize(other.m_dataSize)
 	, m_externalData(other.m_externalData)
 	, m_external(other.m_external)
 	, m_endpoint(other.m_endpoint)
 {
+	if( m_blockSize )
+		m_memBlock = DataPool::Allocate(m_blockSize);
+	m_dataStart = m_memBlock + other.AvailablePrependSpace();
+
 	// copy over the raw data
 	if( !m_external )
 		memcpy(m_memBlock, other.m_memBlock, other.m_blockSize);
@@ -117,7 +357,7 @@ Data::Data(const Data &other)
 
 Data::~Data()
 {
-	delete [] m_memBlock;
+	DataPool::Release(m_memBlock, m_blockSize);
 }
 
 //
@@ -143,8 +383,11 @@ void Data::MakeSpace(size_t desiredsize, size_t desiredprepend)
 	if( GetBufSize() < (desiredsize + prepend) ||
 	    (desiredprepend && AvailablePrependSpace() < desiredprepend) )
 	{
-		// get a proper chunk to avoid future resizes
-		desiredsize += 1024 + prepend;
+		// get a proper chunk to avoid future resizes... the
+		// pool's size classes already round up the small ones
+		desiredsize += prepend;
+		if( !DataPool::ClassSize(desiredsize) )
+			desiredsize += 1024;
 
 		// desired size must be at least the size of our current
 		// data (in case of external data), as well as the size
@@ -159,7 +402,9 @@ void Data::MakeSpace(size_t desiredsize, size_t desiredprepend)
 			newbuf = m_memBlock;
 		}
 		else {
-			newbuf = new unsigned char[desiredsize];
+			// blocks from the pool hold stale data, and code
+			// growing a Data expects zero padding past its end
+			newbuf = DataPool::Allocate(desiredsize);
 			memset(newbuf, 0, desiredsize);
 		}
 
@@ -176,7 +421,7 @@ void Data::MakeSpace(size_t desiredsize, size_t desiredprepend)
 
 		// install new buffer if we've allocated a new one
 		if( m_memBlock != newbuf ) {
-			delete [] m_memBlock;
+			DataPool::Release(m_memBlock, m_blockSize);
 			m_memBlock = newbuf;
 			m_blockSize = desiredsize;
 		}
@@ -354,6 +599,38 @@ Data & Data::operator=(const Data &other)
 	return *this;
 }
 
+void Data::Swap(Data &other)
+{
+	std::swap(m_memBlock, other.m_memBlock);
+	std::swap(m_blockSize, other.m_blockSize);
+	std::swap(m_dataStart, other.m_dataStart);
+	std::swap(m_dataSize, other.m_dataSize);
+	std::swap(m_externalData, other.m_externalData);
+	std::swap(m_external, other.m_external);
+	std::swap(m_endpoint, other.m_endpoint);
+}
+
+void Data::ShrinkToFit()
+{
+	if( m_external || !m_memBlock )
+		return;
+
+	size_t prepend = AvailablePrependSpace();
+	size_t size = prepend + m_dataSize;
+	size_t classSize = DataPool::ClassSize(size);
+	if( !classSize || classSize >= m_blockSize )
+		return;	// nothing smaller to move to
+
+	unsigned char *newbuf = DataPool::Allocate(size);
+	memset(newbuf, 0, size);
+	memcpy(newbuf + prepend, m_dataStart, m_dataSize);
+
+	DataPool::Release(m_memBlock, m_blockSize);
+	m_memBlock = newbuf;
+	m_blockSize = size;
+	m_dataStart = m_memBlock + prepend;
+}
+
 void Data::MemCpy(size_t &offset, const void *src, size_t size)
 {
 	unsigned char *pd = GetBuffer(offset + size) + offset;
@@ -29,10 +29,65 @@
 #include <stdint.h>
 
 #define BARRY_DATA_DEFAULT_SIZE 0x4000
+#define BARRY_DATA_INITIAL_SIZE 0x100
 #define BARRY_DATA_DEFAULT_PREPEND_SIZE 0x100
 
 namespace Barry {
 
+//
+// DataPool
+//
+/// Process wide pool of the memory blocks behind Data objects.
+/// Blocks come in a few fixed size classes, and freed blocks are
+/// kept for the next Data that needs one of the same class, up to
+/// a limit per class.  Requests larger than the largest class go
+/// straight to the heap.
+///
+/// All functions are thread safe.
+///
+class BXEXPORT DataPool
+{
+public:
+	struct BXEXPORT Stats
+	{
+		size_t BlockSize;		//< size class, or 0 for totals
+		unsigned long Hits;		//< allocations reusing a block
+		unsigned long Misses;		//< allocations from the heap
+		unsigned long Returns;		//< blocks kept for reuse
+		unsigned long Discards;		//< blocks freed to the heap
+		size_t Pooled;			//< blocks waiting for reuse
+
+		Stats();
+	};
+
+	typedef std::vector<Stats>			StatsArrayType;
+
+	/// Returns a block of at least size bytes, and sets size to
+	/// its real size.  Blocks fresh from the heap are zeroed, but
+	/// reused blocks hold whatever their last user left there.
+	static unsigned char* Allocate(size_t &size);
+
+	/// Takes back a block from Allocate().  size must be the
+	/// real size that Allocate() returned.
+	static void Release(unsigned char *block, size_t size);
+
+	/// Returns the block size Allocate() would use for size bytes,
+	/// or 0 if that is too big to pool
+	static size_t ClassSize(size_t size);
+
+	/// One entry per size class
+	static void GetStats(StatsArrayType &stats);
+	/// Sums of all classes, plus oversize requests
+	static Stats GetTotals();
+	static void ClearStats();
+
+	/// Frees all blocks waiting in the pool
+	static void Trim();
+};
+
+BXEXPORT std::ostream& operator<< (std::ostream &os, const DataPool::Stats &stats);
+
+
 class BXEXPORT Data
 {
 	unsigned char *m_memBlock;	//< pointer to full memory block
@@ -62,6 +117,9 @@ protected:
 	size_t AvailablePrependSpace() const;
 
 public:
+	/// Starts in the pool's smallest block, and grows on demand,
+	/// so code reading straight into GetBuffer() must ask for the
+	/// size it needs
 	Data();
 	explicit Data(int endpoint, size_t startsize = BARRY_DATA_DEFAULT_SIZE, size_t prependsize = BARRY_DATA_DEFAULT_PREPEND_SIZE);
 	Data(const void *ValidData, size_t size);
@@ -90,6 +148,15 @@ public:
 
 	Data& operator=(const Data &other);
 
+	/// Exchanges buffers, contents and endpoint with other, without
+	/// copying any data.  Used to hand pooled receive buffers around.
+	void Swap(Data &other);
+
+	/// Moves the data into the smallest pooled block that holds it
+	/// and its prepend space, if that is smaller than the current
+	/// one.  Lets short packets give back a full sized read buffer.
+	void ShrinkToFit();
+
 
 	//
 	// Utility functions
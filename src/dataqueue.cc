@@ -19,11 +19,20 @@
     root directory of this project for more details.
 */
 
+#include "config.h"
+#include "i18n.h"
 #include "dataqueue.h"
 #include "scoped_lock.h"
+#include "error.h"
 #include "data.h"
 #include "time.h"
 #include <iostream>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 using namespace std;
 
@@ -222,6 +231,430 @@ void DataQueue::DumpAll(std::ostream &os) const
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// QueueEventFd class
+
+//
+// QueueEventFd
+//
+/// A file descriptor that polls readable while its queue has data.
+/// Uses an eventfd where available, and a pipe otherwise.  The mutex
+/// makes sure a push is never lost between a pop seeing an empty
+/// queue and clearing the descriptor.
+///
+class QueueEventFd
+{
+	int m_read, m_write;
+	pthread_mutex_t m_mutex;
+	bool m_set;
+
+	void Signal();
+	void Drain();
+
+public:
+	QueueEventFd();
+	~QueueEventFd();
+
+	int GetFd() const { return m_read; }
+
+	// call after every push
+	void Set();
+
+	// call after every pop
+	void Update(const DataRing &queue);
+};
+
+QueueEventFd::QueueEventFd()
+	: m_read(-1)
+	, m_write(-1)
+	, m_set(false)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	m_read = m_write = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if( m_read == -1 )
+		throw ErrnoError(_("DataRing: eventfd() failed"), errno);
+#else
+	int fds[2];
+	if( pipe(fds) == -1 )
+		throw ErrnoError(_("DataRing: pipe() failed"), errno);
+	m_read = fds[0];
+	m_write = fds[1];
+	for( int i = 0; i < 2; i++ ) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+QueueEventFd::~QueueEventFd()
+{
+	pthread_mutex_destroy(&m_mutex);
+	if( m_write != m_read )
+		close(m_write);
+	close(m_read);
+}
+
+void QueueEventFd::Signal()
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	uint64_t one = 1;
+	while( write(m_write, &one, sizeof(one)) == -1 && errno == EINTR )
+		;
+#else
+	char one = 1;
+	while( write(m_write, &one, sizeof(one)) == -1 && errno == EINTR )
+		;
+#endif
+}
+
+void QueueEventFd::Drain()
+{
+	// there is never more than one signal outstanding, but the
+	// descriptor is non-blocking, so read until empty to be sure
+	char buf[8];
+	while( read(m_read, buf, sizeof(buf)) > 0 )
+		;
+}
+
+void QueueEventFd::Set()
+{
+	scoped_lock lock(m_mutex);
+	if( !m_set ) {
+		Signal();
+		m_set = true;
+	}
+}
+
+void QueueEventFd::Update(const DataRing &queue)
+{
+	scoped_lock lock(m_mutex);
+	bool ready = !queue.empty();
+	if( ready && !m_set ) {
+		Signal();
+		m_set = true;
+	}
+	else if( !ready && m_set ) {
+		Drain();
+		m_set = false;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// DataRing class
+//
+// Each slot's sequence number says whose turn it is: it equals the
+// push position when the slot is free for that push, and the push
+// position + 1 once it holds data for the matching pop.  A pop then
+// sets it a full lap ahead, freeing it for the next push to land there.
+// The __sync builtins are full memory barriers.
+
+DataRing::DataRing(size_t capacity)
+	: m_slots(0)
+	, m_mask(0)
+	, m_pushPos(0)
+	, m_popPos(0)
+	, m_spilled(0)
+	, m_waiters(0)
+	, m_event(0)
+{
+	size_t size = 2;
+	while( size < capacity )
+		size <<= 1;
+
+	m_slots = new Slot[size];
+	m_mask = size - 1;
+	for( size_t i = 0; i < size; i++ ) {
+		m_slots[i].m_seq = i;
+		m_slots[i].m_data = 0;
+	}
+
+	pthread_mutex_init(&m_overflowMutex, NULL);
+	pthread_mutex_init(&m_waitMutex, NULL);
+	pthread_cond_init(&m_waitCond, NULL);
+}
+
+DataRing::~DataRing()
+{
+	while( Data *data = pop() ) {
+		delete data;
+	}
+
+	delete m_event;
+
+	pthread_cond_destroy(&m_waitCond);
+	pthread_mutex_destroy(&m_waitMutex);
+	pthread_mutex_destroy(&m_overflowMutex);
+	delete [] m_slots;
+}
+
+// a push into the ring only - returns false if full
+bool DataRing::raw_push(Data *data)
+{
+	Slot *slot;
+	size_t pos = m_pushPos;
+	for(;;) {
+		slot = &m_slots[pos & m_mask];
+		size_t seq = slot->m_seq;
+		__sync_synchronize();
+
+		long diff = (long) (seq - pos);
+		if( diff == 0 ) {
+			// our turn, if no other producer beats us to it
+			if( __sync_bool_compare_and_swap(&m_pushPos, pos, pos + 1) )
+				break;
+			pos = m_pushPos;
+		}
+		else if( diff < 0 ) {
+			// slot still holds data from the last lap
+			return false;
+		}
+		else {
+			// another producer got here first
+			pos = m_pushPos;
+		}
+	}
+
+	slot->m_data = data;
+	__sync_synchronize();
+	slot->m_seq = pos + 1;
+	return true;
+}
+
+// a pop from the ring only - returns 0 if empty
+Data* DataRing::raw_pop()
+{
+	Slot *slot;
+	size_t pos = m_popPos;
+	for(;;) {
+		slot = &m_slots[pos & m_mask];
+		size_t seq = slot->m_seq;
+		__sync_synchronize();
+
+		long diff = (long) (seq - (pos + 1));
+		if( diff == 0 ) {
+			if( __sync_bool_compare_and_swap(&m_popPos, pos, pos + 1) )
+				break;
+			pos = m_popPos;
+		}
+		else if( diff < 0 ) {
+			// nothing pushed here yet
+			return 0;
+		}
+		else {
+			pos = m_popPos;
+		}
+	}
+
+	Data *data = slot->m_data;
+	slot->m_data = 0;
+	__sync_synchronize();
+	slot->m_seq = pos + m_mask + 1;
+	return data;
+}
+
+// wakes wait_pop(), but only takes the lock if someone is waiting,
+// and sets the event descriptor, if there is one
+void DataRing::signal()
+{
+	__sync_synchronize();
+	if( m_waiters ) {
+		scoped_lock wait(m_waitMutex);
+		pthread_cond_broadcast(&m_waitCond);
+	}
+
+	if( QueueEventFd *event = m_event )
+		event->Set();
+}
+
+//
+// push
+//
+/// Pushes data into the end of the queue.
+///
+/// The queue owns this pointer as soon as the function is
+/// called.  In the case of an exception, it will be freed.
+/// Never blocks on a full ring; the data goes to the overflow
+/// list instead, which keeps being used until it is empty again,
+/// so nothing is reordered.
+///
+void DataRing::push(Data *data)
+{
+	if( m_spilled || !raw_push(data) ) {
+		scoped_lock lock(m_overflowMutex);
+		try {
+			m_overflow.push_back(data);
+		}
+		catch(...) {
+			delete data;
+			throw;
+		}
+		m_spilled = m_overflow.size();
+	}
+
+	signal();
+}
+
+//
+// try_push
+//
+/// Pushes data only if the ring has room for it.
+///
+/// Returns true if the queue took ownership of data, and false if
+/// the ring was full, in which case the caller still owns it.
+///
+bool DataRing::try_push(Data *data)
+{
+	if( m_spilled || !raw_push(data) )
+		return false;
+
+	signal();
+	return true;
+}
+
+//
+// pop
+//
+/// Pops the next element off the front of the queue.
+///
+/// Returns 0 if empty.
+/// The queue no longer owns this pointer upon return.
+///
+Data* DataRing::pop()
+{
+	Data *data = raw_pop();
+
+	// the ring is empty, so anything older is in the overflow
+	if( !data ) {
+		__sync_synchronize();
+		if( m_spilled ) {
+			scoped_lock lock(m_overflowMutex);
+			if( m_overflow.size() ) {
+				data = m_overflow.front();
+				m_overflow.pop_front();
+				m_spilled = m_overflow.size();
+			}
+		}
+	}
+
+	if( QueueEventFd *event = m_event )
+		event->Update(*this);
+
+	return data;
+}
+
+//
+// wait_pop
+//
+/// Pops the next element off the front of the queue, and
+/// waits until one exists if empty.  If still no data
+/// on timeout, returns null.
+///
+/// Timeout specified in milliseconds.  Default is wait forever.
+///
+Data* DataRing::wait_pop(int timeout)
+{
+	// check if something's there already
+	if( Data *data = pop() )
+		return data;
+
+	struct timespec to;
+	if( timeout != -1 )
+		ThreadTimeout(timeout, &to);
+
+	// Announce ourselves before checking again, so that any push
+	// after the check sees m_waiters and signals... and since
+	// we hold m_waitMutex until the wait starts, the signal
+	// cannot get there first.
+	scoped_lock wait(m_waitMutex);
+	for(;;) {
+		__sync_fetch_and_add(&m_waiters, 1);
+		Data *data = pop();
+		if( data ) {
+			__sync_fetch_and_sub(&m_waiters, 1);
+			return data;
+		}
+
+		int ret;
+		if( timeout == -1 )
+			ret = pthread_cond_wait(&m_waitCond, &m_waitMutex);
+		else
+			ret = pthread_cond_timedwait(&m_waitCond, &m_waitMutex, &to);
+		__sync_fetch_and_sub(&m_waiters, 1);
+
+		if( ret == ETIMEDOUT )
+			return pop();
+	}
+}
+
+//
+// append_from
+//
+/// Pops all data from other and appends it to this.
+///
+/// Data pushed to other by another thread meanwhile may or may
+/// not be moved as well.
+///
+void DataRing::append_from(DataRing &other)
+{
+	while( Data *data = other.pop() ) {
+		push(data);
+	}
+}
+
+//
+// empty
+//
+/// Returns true if the queue is empty.
+///
+bool DataRing::empty() const
+{
+	return size() == 0;
+}
+
+//
+// size
+//
+/// Returns number of items in the queue.
+///
+size_t DataRing::size() const
+{
+	// read the pop position first, so a racing pop can only
+	// make the result too big, never wrap it below zero
+	size_t popped = m_popPos;
+	__sync_synchronize();
+	size_t pushed = m_pushPos;
+	return (pushed - popped) + m_spilled;
+}
+
+//
+// GetEventFd
+//
+/// Returns a non-blocking file descriptor that polls readable
+/// whenever the queue has data.  Pop until pop() returns 0, or
+/// until empty(), once it is readable... the descriptor is cleared
+/// by the pop that empties the queue, so never read from it.
+///
+/// The descriptor is created on the first call, and closed
+/// by the queue's destructor.
+///
+int DataRing::GetEventFd()
+{
+	if( !m_event ) {
+		QueueEventFd *event = new QueueEventFd;
+		if( !__sync_bool_compare_and_swap(&m_event, (QueueEventFd*) 0, event) )
+			delete event;	// another thread beat us
+
+		// catch up with anything pushed already
+		m_event->Update(*this);
+	}
+
+	return m_event->GetFd();
+}
+
+
 } // namespace Barry
 
 
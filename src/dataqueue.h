@@ -30,6 +30,7 @@
 namespace Barry {
 
 class Data;
+class QueueEventFd;
 
 //
 // DataQueue class
@@ -95,6 +96,104 @@ inline std::ostream& operator<< (std::ostream &os, const DataQueue &dq)
 	return os;
 }
 
+//
+// DataRing class
+//
+/// A bounded, lock-free variant of DataQueue, for the packet queues
+/// between the USB read thread and its consumers.  Pushing and popping
+/// use a fixed ring of slots, so there are no list nodes to allocate,
+/// and no mutex to hand back and forth.  Each slot carries a sequence
+/// number, so any number of threads may push and pop at once, though
+/// the common case is one of each.
+///
+/// If the ring is full, push() spills into a locked overflow list
+/// instead of blocking the caller, and the ring is used again once
+/// the overflow drains, so packet order is kept.  Use try_push() to
+/// refuse data instead, such as for a pool of free buffers.
+///
+/// Waiting consumers sleep on a condition variable, which is only
+/// signalled when someone is actually waiting.  Consumers with a
+/// poll() or select() loop can ask for a file descriptor instead,
+/// with GetEventFd().
+///
+class BXEXPORT DataRing
+{
+	struct Slot
+	{
+		volatile size_t m_seq;
+		Data *m_data;
+	};
+
+	Slot *m_slots;
+	size_t m_mask;
+
+	// kept apart, since they are written by different threads
+	volatile size_t m_pushPos;
+	char m_pad[64];
+	volatile size_t m_popPos;
+
+	// used only when the ring is full
+	pthread_mutex_t m_overflowMutex;
+	std::list<Data*> m_overflow;
+	volatile size_t m_spilled;	// m_overflow.size(), readable unlocked
+
+	pthread_mutex_t m_waitMutex;
+	pthread_cond_t m_waitCond;
+	volatile int m_waiters;
+
+	QueueEventFd * volatile m_event;	// created by GetEventFd()
+
+	DataRing(const DataRing &other);
+	DataRing& operator=(const DataRing &other);
+
+protected:
+	bool raw_push(Data *data);
+	Data* raw_pop();
+	void signal();
+
+public:
+	/// capacity is rounded up to a power of 2
+	explicit DataRing(size_t capacity = 128);
+	~DataRing();		// frees all data in the queue
+
+	size_t capacity() const { return m_mask + 1; }
+
+	// Pushes data into the end of the queue.
+	// The queue owns this pointer as soon as the function is
+	// called.  In the case of an exception, it will be freed.
+	// Wakes any thread waiting in wait_pop().
+	void push(Data *data);
+
+	// Pushes data only if there is room in the ring.  Returns
+	// false if full, in which case the caller still owns data.
+	bool try_push(Data *data);
+
+	// Pops the next element off the front of the queue.
+	// Returns 0 if empty.
+	// The queue no longer owns this pointer upon return.
+	Data* pop();
+
+	// Pops the next element off the front of the queue, and
+	// waits until one exists if empty.  If still no data
+	// on timeout, returns null.
+	// Timeout specified in milliseconds.  Default is wait forever.
+	Data* wait_pop(int timeout = -1);
+
+	// Pops all data from other and appends it to this.
+	void append_from(DataRing &other);
+
+	// These are only a snapshot, when other threads are active
+	bool empty() const;
+	size_t size() const;
+
+	// Returns a non-blocking file descriptor that polls readable
+	// whenever the queue has data, and is cleared again by the
+	// pop that empties it.  It is created on first call, and
+	// is owned by the queue, so do not read or close it.
+	// Throws Barry::ErrnoError if it cannot be created.
+	int GetEventFd();
+};
+
 } // namespace Barry
 
 #endif
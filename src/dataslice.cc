@@ -0,0 +1,121 @@
+///
+/// \file	dataslice.cc
+///		Shared, read only views of Data contents
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "dataslice.h"
+#include <string.h>
+
+namespace Barry {
+
+//////////////////////////////////////////////////////////////////////////////
+// DataSlice class
+
+const size_t DataSlice::npos;
+
+DataSlice::DataSlice()
+	: m_offset(0)
+	, m_size(0)
+{
+}
+
+DataSlice::DataSlice(const DataPtr &data, size_t offset, size_t size)
+	: m_data(data)
+	, m_offset(0)
+	, m_size(0)
+{
+	size_t total = m_data ? m_data->GetSize() : 0;
+	m_offset = offset < total ? offset : total;
+	m_size = total - m_offset;
+	if( size < m_size )
+		m_size = size;
+}
+
+const unsigned char* DataSlice::GetData() const
+{
+	return m_data ? m_data->GetData() + m_offset : 0;
+}
+
+DataSlice DataSlice::Slice(size_t offset, size_t size) const
+{
+	if( offset > m_size )
+		offset = m_size;
+	if( size > m_size - offset )
+		size = m_size - offset;
+	return DataSlice(m_data, m_offset + offset, size);
+}
+
+void DataSlice::Prechop(size_t size)
+{
+	if( size > m_size )
+		size = m_size;
+	m_offset += size;
+	m_size -= size;
+}
+
+Data DataSlice::GetView() const
+{
+	return Data(GetData(), GetSize());
+}
+
+void DataSlice::AppendTo(Data &data) const
+{
+	if( m_size )
+		data.Append(GetData(), m_size);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// DataGather class
+
+DataGather::DataGather()
+	: m_size(0)
+{
+}
+
+void DataGather::Clear()
+{
+	m_slices.clear();
+	m_size = 0;
+}
+
+void DataGather::Append(const DataSlice &slice)
+{
+	if( slice.empty() )
+		return;
+
+	m_slices.push_back(slice);
+	m_size += slice.GetSize();
+}
+
+void DataGather::AppendTo(Data &data) const
+{
+	size_t size = data.GetSize();
+	unsigned char *buf = data.GetBuffer(size + m_size) + size;
+
+	for( const_iterator i = begin(); i != end(); ++i ) {
+		memcpy(buf, i->GetData(), i->GetSize());
+		buf += i->GetSize();
+	}
+
+	data.ReleaseBuffer(size + m_size);
+}
+
+} // namespace Barry
+
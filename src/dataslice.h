@@ -0,0 +1,123 @@
+///
+/// \file	dataslice.h
+///		Shared, read only views of Data contents
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRY_DATASLICE_H__
+#define __BARRY_DATASLICE_H__
+
+#include "dll.h"
+#include "data.h"
+#include <vector>
+#include <tr1/memory>
+
+namespace Barry {
+
+//
+// DataSlice
+//
+/// A read only window onto part of a Data object's contents.  The
+/// slice shares ownership of the Data, so slices can be copied,
+/// narrowed and kept around without copying any data.
+///
+/// The Data must not be changed while slices of it exist, since
+/// that could move its buffer.
+///
+class BXEXPORT DataSlice
+{
+public:
+	typedef std::tr1::shared_ptr<const Data>	DataPtr;
+
+	static const size_t npos = (size_t) -1;
+
+private:
+	DataPtr m_data;
+	size_t m_offset;
+	size_t m_size;
+
+public:
+	DataSlice();
+
+	/// Slices size bytes starting at offset, limited to the
+	/// contents of data
+	explicit DataSlice(const DataPtr &data, size_t offset = 0,
+		size_t size = npos);
+
+	const DataPtr& GetDataPtr() const { return m_data; }
+	const unsigned char* GetData() const;
+	size_t GetSize() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	/// Returns a narrower slice of the same data, with offset
+	/// relative to this slice
+	DataSlice Slice(size_t offset, size_t size = npos) const;
+
+	/// Drops size bytes from the front of the slice
+	void Prechop(size_t size);
+
+	/// Returns an external Data object that points at the slice's
+	/// contents.  It is only valid while the slice exists.
+	Data GetView() const;
+
+	/// Copies the slice's contents to the end of data
+	void AppendTo(Data &data) const;
+};
+
+//
+// DataGather
+//
+/// A list of slices that make up one logical block of data, such as
+/// the fragments of a large packet, so the pieces can be collected
+/// as they arrive and copied into place all at once.
+///
+class BXEXPORT DataGather
+{
+public:
+	typedef std::vector<DataSlice>			SliceArrayType;
+	typedef SliceArrayType::const_iterator		const_iterator;
+
+private:
+	SliceArrayType m_slices;
+	size_t m_size;
+
+public:
+	DataGather();
+
+	void Clear();
+
+	/// Empty slices are skipped
+	void Append(const DataSlice &slice);
+
+	/// Total size of all slices
+	size_t GetSize() const { return m_size; }
+	size_t GetCount() const { return m_slices.size(); }
+	bool empty() const { return m_size == 0; }
+
+	const_iterator begin() const { return m_slices.begin(); }
+	const_iterator end() const { return m_slices.end(); }
+
+	/// Copies all slices to the end of data, growing its buffer
+	/// only once
+	void AppendTo(Data &data) const;
+};
+
+} // namespace Barry
+
+#endif
+
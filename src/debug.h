@@ -31,7 +31,7 @@ extern std::ostream *LogStream;
 #endif // __BARRY_DEBUG_H__
 
 // data dump output - controlled by command line -v switch
-#define ddout(x)	if(::Barry::__data_dump_mode__) { ::Barry::LogLock lock; (*::Barry::LogStream) << x << std::endl; }
+#define ddout(x)	if(::Barry::__data_dump_mode__) { ::Barry::LogLine line; line.GetStream() << x; }
 
 #ifdef __DEBUG_MODE__
 	// debugging on
@@ -40,14 +40,14 @@ extern std::ostream *LogStream;
 	#undef DEBUG_ONLY
 
 	// low level debug output
-	#define dout(x)		if(::Barry::__data_dump_mode__) { ::Barry::LogLock lock; (*::Barry::LogStream) << x << std::endl; }
+	#define dout(x)		if(::Barry::__data_dump_mode__) { ::Barry::LogLine line; line.GetStream() << x; }
 //	#define dout(x)
 
 	// exception output
-	#define eout(x)		{ ::Barry::LogLock lock; (*::Barry::LogStream) << x << std::endl; }
+	#define eout(x)		{ ::Barry::LogLine line; line.GetStream() << x; }
 
 	// easy exception output
-	#define eeout(c, r)	{ ::Barry::LogLock lock; (*::Barry::LogStream) << "Sent packet:\n" << c << "\n" << "Response packet:\n" << r << "\n"; }
+	#define eeout(c, r)	{ ::Barry::LogLine line; line.GetStream() << "Sent packet:\n" << c << "\n" << "Response packet:\n" << r; }
 
 	// For debug only variables and parameters
 	#define DEBUG_ONLY(x) x
@@ -62,8 +62,8 @@ extern std::ostream *LogStream;
 	#undef DEBUG_ONLY
 
 	#define dout(x)
-	#define eout(x)		{ ::Barry::LogLock lock; (*::Barry::LogStream) << x << std::endl; }
-	#define eeout(c, r)	{ ::Barry::LogLock lock; (*::Barry::LogStream) << "Sent packet:\n" << c << "\n" << "Response packet:\n" << r << "\n"; }
+	#define eout(x)		{ ::Barry::LogLine line; line.GetStream() << x; }
+	#define eeout(c, r)	{ ::Barry::LogLine line; line.GetStream() << "Sent packet:\n" << c << "\n" << "Response packet:\n" << r; }
 
 	// For debug only variables and parameters
 	#define DEBUG_ONLY(x)
@@ -90,18 +90,25 @@ IConvHandle::~IConvHandle()
 
 std::string IConvHandle::Convert(Data &tmp, const std::string &str) const
 {
-	size_t target = str.size() * 2;
+	std::string ret;
+	Convert(tmp, str.data(), str.size(), ret);
+	return ret;
+}
+
+void IConvHandle::Convert(Data &tmp, const char *str, size_t size,
+			std::string &dest) const
+{
+	size_t target = size * 2;
 	char *out = 0, *outstart = 0;
 	size_t outbytesleft = 0;
-	std::string ret;
 	iconv_t cd = m_priv->m_handle;
 
 	// this loop is for the very odd case that the output string
 	// needs more than twice the input size
 	for( int tries = 0; ; tries++ ) {
 
-		const char *in = str.data();
-		size_t inbytesleft = str.size();
+		const char *in = str;
+		size_t inbytesleft = size;
 		out = outstart = (char*) tmp.GetBuffer(target);
 		outbytesleft = tmp.GetBufSize();
 
@@ -120,14 +127,15 @@ std::string IConvHandle::Convert(Data &tmp, const std::string &str) const
 			// whether the user wants to be notified by
 			// exception... if not, just fall through and
 			// store as much converted data as possible
-			ErrnoError e(string("iconv failed with string '") + str + "'", errno);
+			ErrnoError e(string("iconv failed with string '") + string(str, size) + "'", errno);
 			if( m_throw_on_conv_err ) {
 				throw e;
 			}
 			else {
 				cerr << e.what();
 				// return the unconverted string
-				return str;
+				dest.assign(str, size);
+				return;
 			}
 		}
 		else {
@@ -137,8 +145,16 @@ std::string IConvHandle::Convert(Data &tmp, const std::string &str) const
 	}
 
 	// store any available converted data
-	ret.assign(outstart, out - outstart);
-	return ret;
+	dest.assign(outstart, out - outstart);
+}
+
+static bool IsAscii(const char *str, size_t size)
+{
+	for( size_t i = 0; i < size; i++ ) {
+		if( str[i] & 0x80 )
+			return false;
+	}
+	return true;
 }
 
 
@@ -149,7 +165,22 @@ IConverter::IConverter(const char *tocode, bool throw_on_conv_err)
 	: m_from(BLACKBERRY_CHARSET, tocode, throw_on_conv_err)
 	, m_to(tocode, BLACKBERRY_CHARSET, throw_on_conv_err)
 	, m_tocode(tocode)
+	, m_ascii_passthrough(false)
 {
+	// check with a handle that throws, so a failed conversion
+	// can't pass for an unchanged one
+	std::string ascii;
+	for( int c = 1; c < 0x80; c++ )
+		ascii += (char) c;
+
+	try {
+		IConvHandle from(BLACKBERRY_CHARSET, tocode, true);
+		IConvHandle to(tocode, BLACKBERRY_CHARSET, true);
+		m_ascii_passthrough = from.Convert(m_buffer, ascii) == ascii &&
+			to.Convert(m_buffer, ascii) == ascii;
+	}
+	catch( ErrnoError & ) {
+	}
 }
 
 IConverter::~IConverter()
@@ -158,14 +189,31 @@ IConverter::~IConverter()
 
 std::string IConverter::FromBB(const std::string &str) const
 {
+	if( m_ascii_passthrough && IsAscii(str.data(), str.size()) )
+		return str;
 	return m_from.Convert(m_buffer, str);
 }
 
+void IConverter::FromBB(const char *str, size_t size, std::string &dest) const
+{
+	if( m_ascii_passthrough && IsAscii(str, size) )
+		dest.assign(str, size);
+	else
+		m_from.Convert(m_buffer, str, size, dest);
+}
+
 std::string IConverter::ToBB(const std::string &str) const
 {
+	if( m_ascii_passthrough && IsAscii(str.data(), str.size()) )
+		return str;
 	return m_to.Convert(m_buffer, str);
 }
 
+bool IConverter::IsPassthrough(const std::string &str) const
+{
+	return m_ascii_passthrough && IsAscii(str.data(), str.size());
+}
+
 std::string IConverter::Convert(const IConvHandle &custom, const std::string &str) const
 {
 	return custom.Convert(m_buffer, str);
@@ -56,6 +56,8 @@ private:
 
 	// the heart of the conversion
 	std::string Convert(Data &tmp, const std::string &str) const;
+	void Convert(Data &tmp, const char *str, size_t size,
+		std::string &dest) const;
 
 public:
 	// custom conversions from any to IConverter's 'tocode'
@@ -103,6 +105,10 @@ class BXEXPORT IConverter
 	IConvHandle m_to;
 	std::string m_tocode;
 
+	// true if converting plain ASCII to or from the Blackberry's
+	// charset changes nothing, so iconv can be skipped for it
+	bool m_ascii_passthrough;
+
 	// internal buffer for fast conversions
 	mutable Data m_buffer;
 
@@ -117,6 +123,14 @@ public:
 	std::string FromBB(const std::string &str) const;
 	std::string ToBB(const std::string &str) const;
 
+	/// Converts size bytes at str straight into dest, for parsing
+	/// raw record data without a temporary string
+	void FromBB(const char *str, size_t size, std::string &dest) const;
+
+	/// Returns true if ToBB(str) would return str unchanged, which
+	/// is known without converting it only for plain ASCII
+	bool IsPassthrough(const std::string &str) const;
+
 	// Custom override functions, meant for converting between
 	// non-BLACKBERRY_CHARSET charsets and the tocode set by the
 	// IConverter constructor
@@ -85,7 +85,8 @@ bool JDWP::Read(int socket, Barry::Data &data, int timeout)
 	do {
 		data.QuickZap();
 
-		ret = read(socket, (char*) data.GetBuffer(), data.GetBufSize());
+		ret = read(socket, (char*) data.GetBuffer(BARRY_DATA_DEFAULT_SIZE),
+			data.GetBufSize());
 
 		if( ret < 0 ) {
 			ret = -errno;
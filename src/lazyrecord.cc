@@ -0,0 +1,205 @@
+///
+/// \file	lazyrecord.cc
+///		Record wrapper that parses fields only when they are used
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "lazyrecord.h"
+#include "protostructs.h"
+#include "endian.h"
+#include <string.h>
+
+namespace Barry {
+
+///////////////////////////////////////////////////////////////////////////////
+// RecordArena
+
+const size_t RecordArena::DefaultBlockSize;
+
+// keep each copy aligned, in case a record class ever reads
+// anything wider than a byte straight from its data
+#define ARENA_ALIGN(size)	(((size) + 7) & ~((size_t)7))
+
+RecordArena::RecordArena(size_t block_size)
+	: m_block_size(ARENA_ALIGN(block_size ? block_size : DefaultBlockSize))
+	, m_current(0)
+	, m_left(0)
+	, m_size(0)
+{
+}
+
+RecordArena::~RecordArena()
+{
+	Clear();
+}
+
+unsigned char* RecordArena::Allocate(size_t size)
+{
+	size_t needed = ARENA_ALIGN(size);
+	unsigned char *dest;
+
+	if( needed > m_block_size ) {
+		// too big to share a block, and not worth wasting
+		// what's left of the current one
+		dest = new unsigned char[needed];
+		m_blocks.push_back(dest);
+	}
+	else {
+		if( needed > m_left ) {
+			m_current = new unsigned char[m_block_size];
+			m_blocks.push_back(m_current);
+			m_left = m_block_size;
+		}
+		dest = m_current + (m_block_size - m_left);
+		m_left -= needed;
+	}
+
+	m_size += size;
+	return dest;
+}
+
+const unsigned char* RecordArena::Copy(const void *data, size_t size)
+{
+	unsigned char *dest = Allocate(size);
+	memcpy(dest, data, size);
+	return dest;
+}
+
+void RecordArena::Clear()
+{
+	for( BlockList::iterator i = m_blocks.begin(); i != m_blocks.end(); ++i )
+		delete [] *i;
+	m_blocks.clear();
+	m_current = 0;
+	m_left = 0;
+	m_size = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RecordFieldIndex
+
+RecordFieldIndex::RecordFieldIndex()
+	: m_entries(0)
+	, m_count(0)
+{
+}
+
+RecordFieldIndex::RecordFieldIndex(const RecordFieldIndex &other)
+	: m_entries(0)
+	, m_count(0)
+{
+	operator=(other);
+}
+
+RecordFieldIndex& RecordFieldIndex::operator=(const RecordFieldIndex &other)
+{
+	if( this == &other )
+		return *this;
+
+	if( other.m_owned.size() ) {
+		m_owned = other.m_owned;
+		m_entries = &m_owned[0];
+	}
+	else {
+		// arena entries are shared
+		m_owned.clear();
+		m_entries = other.m_entries;
+	}
+	m_count = other.m_count;
+	return *this;
+}
+
+//
+// Scan
+//
+/// Walks the field headers, filling entries if not null.  Returns the
+/// number of fields found, so a first pass can size the entry array.
+///
+size_t RecordFieldIndex::Scan(const Data &data, size_t offset, Entry *entries)
+{
+	using namespace Barry::Protocol;
+
+	size_t count = 0;
+
+	const unsigned char *start = data.GetData();
+	const unsigned char *b = start + offset;
+	const unsigned char *e = start + data.GetSize();
+
+	// same walk as ParseCommonFields() and ParseField()
+	while( (b + COMMON_FIELD_HEADER_SIZE) < e ) {
+		const CommonField *field = (const CommonField *) b;
+		uint16_t size = btohs(field->size);
+
+		const unsigned char *next = b + COMMON_FIELD_HEADER_SIZE + size;
+		if( next > e )
+			break;
+
+		if( size ) {
+			if( entries ) {
+				entries[count].Type = field->type;
+				entries[count].Offset = b - start;
+			}
+			count++;
+		}
+		b = next;
+	}
+	return count;
+}
+
+void RecordFieldIndex::Build(const Data &data, size_t offset, RecordArena *arena)
+{
+	Clear();
+
+	// count first, so the entries take exactly one allocation
+	size_t count = Scan(data, offset, 0);
+	if( !count )
+		return;
+
+	Entry *entries;
+	if( arena ) {
+		entries = (Entry*) arena->Allocate(count * sizeof(Entry));
+	}
+	else {
+		m_owned.resize(count);
+		entries = &m_owned[0];
+	}
+
+	Scan(data, offset, entries);
+	m_entries = entries;
+	m_count = count;
+}
+
+void RecordFieldIndex::Clear()
+{
+	m_owned.clear();
+	m_entries = 0;
+	m_count = 0;
+}
+
+bool RecordFieldIndex::HasField(uint8_t type) const
+{
+	for( const_iterator i = begin(); i != end(); ++i ) {
+		if( i->Type == type )
+			return true;
+	}
+	return false;
+}
+
+} // namespace Barry
+
@@ -0,0 +1,428 @@
+///
+/// \file	lazyrecord.h
+///		Record wrapper that parses fields only when they are used
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRY_LAZYRECORD_H__
+#define __BARRY_LAZYRECORD_H__
+
+#include "dll.h"
+#include "data.h"
+#include "parser.h"
+#include "record.h"
+#include "recordtmpl.h"
+#include <stdint.h>
+#include <vector>
+#include <bitset>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+namespace Barry {
+
+class IConverter;
+
+//
+// RecordArena
+//
+/// Holds the raw data of many records in a few large blocks, so that
+/// a whole database load costs a handful of allocations, and freeing
+/// it costs one per block, no matter how many records it holds.
+/// Used with LazyRecord, which then refers to its data here instead
+/// of keeping its own copy of the packet it arrived in.
+///
+/// Not thread safe.  Everything copied in stays valid until Clear()
+/// or destruction, so the arena must outlive the records using it.
+///
+class BXEXPORT RecordArena
+{
+public:
+	static const size_t DefaultBlockSize = 0x100000;
+
+private:
+	typedef std::vector<unsigned char*> BlockList;
+
+	BlockList m_blocks;
+	size_t m_block_size;
+	unsigned char *m_current;	// block being filled
+	size_t m_left;			// bytes left in m_current
+	size_t m_size;			// total bytes copied in
+
+	RecordArena(const RecordArena &other);	// not copyable
+	RecordArena& operator=(const RecordArena &other);
+
+public:
+	explicit RecordArena(size_t block_size = DefaultBlockSize);
+	~RecordArena();
+
+	/// Returns size bytes of uninitialized space in the arena,
+	/// aligned for any basic type.  Requests larger than the
+	/// block size get a block of their own.
+	unsigned char* Allocate(size_t size);
+
+	/// Returns a copy of the given data, stored in the arena
+	const unsigned char* Copy(const void *data, size_t size);
+
+	/// Frees every block at once
+	void Clear();
+
+	size_t GetBlockCount() const { return m_blocks.size(); }
+	size_t GetSize() const { return m_size; }
+};
+
+//
+// RecordFieldIndex
+//
+/// The type and offset of every field in a raw record, found in one
+/// pass over the field headers without parsing any field data.
+/// Fields are listed in record order, and skipped the same way
+/// ParseFields() skips them: empty fields are left out, and the scan
+/// stops at the first field that runs past the end of the data.
+///
+/// Built with a RecordArena, the entries are kept in the arena, and
+/// copies of the index share them.  Otherwise the index keeps its own.
+///
+class BXEXPORT RecordFieldIndex
+{
+public:
+	struct Entry
+	{
+		uint8_t Type;
+		size_t Offset;		//< of the field header, from the
+					//< start of the Data block
+	};
+	typedef const Entry* const_iterator;
+
+private:
+	std::vector<Entry> m_owned;	// entries, when there is no arena
+	const Entry *m_entries;		// points into m_owned or an arena
+	size_t m_count;
+
+protected:
+	static size_t Scan(const Data &data, size_t offset, Entry *entries);
+
+public:
+	RecordFieldIndex();
+	RecordFieldIndex(const RecordFieldIndex &other);
+	RecordFieldIndex& operator=(const RecordFieldIndex &other);
+
+	/// Indexes the fields in data, starting at offset, which
+	/// should be just past the record header.  If arena is not
+	/// null, it must outlive this index and all copies of it.
+	void Build(const Data &data, size_t offset, RecordArena *arena = 0);
+	void Clear();
+
+	const_iterator begin() const { return m_entries; }
+	const_iterator end() const { return m_entries + m_count; }
+	size_t GetCount() const { return m_count; }
+	bool HasField(uint8_t type) const;
+};
+
+//
+// LazyRecord
+//
+/// Holds a copy of one raw record, and parses it into a RecordT only
+/// as far as the caller needs.  The record ID and type are available
+/// straight from the DBData, and Decode() parses just the fields of
+/// one device type, so code that only filters, sorts, or lists
+/// records by a few fields skips the string conversion, iconv, and
+/// UnknownField copies for all the rest.  GetRecord() parses the
+/// whole record, exactly as RecordParser<> would.
+///
+/// Fields are decoded with RecordT::ParseField(), so RecordT must be
+/// one of the record classes whose fields are all CommonFields, which
+/// is every database record class in record.h.
+///
+/// On its own, a LazyRecord copies the Data block its record arrived
+/// in.  For bulk loads, pass a RecordArena instead, and only the
+/// record's own bytes, and its field index, are copied into it.
+/// Copies of a LazyRecord then share that data, so they are cheap to
+/// store in a std::vector.
+///
+/// The RecordT itself is only created once a member function needs
+/// it, so a LazyRecord nobody looks into costs no more than its raw
+/// data.  It is cached inside, so the const member functions may
+/// modify it, and a LazyRecord must not be shared between threads
+/// without locking.  The IConverter, if given, must outlive it.
+///
+template <class RecordT>
+class LazyRecord
+{
+	DBData m_data;
+	const IConverter *m_ic;
+	RecordFieldIndex m_index;
+
+	mutable RecordT *m_rec;			// created on first use
+	mutable std::bitset<256> m_decoded;	// field types parsed so far
+	mutable bool m_complete;
+
+protected:
+	RecordT& Materialize() const
+	{
+		if( !m_rec ) {
+			std::auto_ptr<RecordT> rec(new RecordT);
+			rec->SetIds(m_data.GetRecType(), m_data.GetUniqueId());
+			size_t offset = m_data.GetOffset();
+			rec->ParseHeader(m_data.GetData(), offset);
+			m_rec = rec.release();
+		}
+		return *m_rec;
+	}
+
+public:
+	/// Copies the raw record, so data need not outlive this object
+	explicit LazyRecord(const DBData &data, const IConverter *ic = 0)
+		: m_data(data)
+		, m_ic(ic)
+		, m_rec(0)
+		, m_complete(false)
+	{
+		m_index.Build(m_data.GetData(), m_data.GetOffset());
+	}
+
+	/// Copies the raw record into arena, which must outlive this
+	/// object and all copies of it
+	LazyRecord(const DBData &data, RecordArena &arena,
+			const IConverter *ic = 0)
+		: m_data(data.GetVersion(), data.GetDBName(),
+			data.GetRecType(), data.GetUniqueId(), 0,
+			arena.Copy(data.GetData().GetData() + data.GetOffset(),
+				data.GetData().GetSize() - data.GetOffset()),
+			data.GetData().GetSize() - data.GetOffset())
+		, m_ic(ic)
+		, m_rec(0)
+		, m_complete(false)
+	{
+		m_index.Build(m_data.GetData(), m_data.GetOffset(), &arena);
+	}
+
+	LazyRecord(const LazyRecord &other)
+		: m_data(other.m_data)
+		, m_ic(other.m_ic)
+		, m_index(other.m_index)
+		, m_rec(other.m_rec ? new RecordT(*other.m_rec) : 0)
+		, m_decoded(other.m_decoded)
+		, m_complete(other.m_complete)
+	{
+	}
+
+	~LazyRecord()
+	{
+		delete m_rec;
+	}
+
+	LazyRecord& operator=(const LazyRecord &other)
+	{
+		if( this != &other ) {
+			RecordT *rec = other.m_rec ?
+				new RecordT(*other.m_rec) : 0;
+			m_data = other.m_data;
+			m_ic = other.m_ic;
+			m_index = other.m_index;
+			delete m_rec;
+			m_rec = rec;
+			m_decoded = other.m_decoded;
+			m_complete = other.m_complete;
+		}
+		return *this;
+	}
+
+	uint8_t GetRecType() const { return m_data.GetRecType(); }
+	uint32_t GetUniqueId() const { return m_data.GetUniqueId(); }
+	const DBData& GetDBData() const { return m_data; }
+	const RecordFieldIndex& GetIndex() const { return m_index; }
+
+	bool HasField(uint8_t type) const { return m_index.HasField(type); }
+	bool IsComplete() const { return m_complete; }
+
+	/// Parses every field of the given device type, if not done
+	/// already, and returns the partly decoded record.  Only the
+	/// members filled by those fields are valid.
+	const RecordT& Decode(uint8_t type) const
+	{
+		RecordT &rec = Materialize();
+		if( m_complete || m_decoded[type] )
+			return rec;
+
+		const unsigned char *base = m_data.GetData().GetData();
+		const unsigned char *end = base + m_data.GetData().GetSize();
+
+		RecordFieldIndex::const_iterator
+			i = m_index.begin(),
+			e = m_index.end();
+		for( ; i != e; ++i ) {
+			if( i->Type == type )
+				rec.ParseField(base + i->Offset, end, m_ic);
+		}
+
+		m_decoded[type] = true;
+		return rec;
+	}
+
+	/// Same as above, for the device field behind a FieldHandle.
+	/// Members with no single device field, such as a postal
+	/// address as a whole, or fields shared between members, like
+	/// Contact's first and last names, parse the whole record.
+	const RecordT& Decode(const FieldHandle<RecordT> &handle) const
+	{
+		int code = handle.GetIdentity().FieldTypeCode;
+		if( code < 0 || code > 0xff )
+			return GetRecord();
+		return Decode((uint8_t) code);
+	}
+
+	/// Returns the record decoded as far as Decode() has gone
+	const RecordT& GetDecoded() const { return Materialize(); }
+
+	/// Parses the whole record, if not done already
+	const RecordT& GetRecord() const
+	{
+		RecordT &rec = Materialize();
+		if( !m_complete ) {
+			ParseDBData(m_data, rec, m_ic);
+			m_complete = true;
+		}
+		return rec;
+	}
+};
+
+//
+// LazyRecordParser
+//
+/// Like RecordParser<>, but passes each record to the storage functor
+/// as a LazyRecord<RecordT>, without parsing any fields.  If given an
+/// arena, the records' raw data is kept there.
+///
+template <class RecordT, class StorageT>
+class LazyRecordParser : public Parser
+{
+	StorageT &m_store;
+	RecordArena *m_arena;
+
+public:
+	explicit LazyRecordParser(StorageT &storage, RecordArena *arena = 0)
+		: m_store(storage)
+		, m_arena(arena)
+	{
+	}
+
+	virtual void ParseRecord(const DBData &data, const IConverter *ic)
+	{
+		if( m_arena )
+			m_store(LazyRecord<RecordT>(data, *m_arena, ic));
+		else
+			m_store(LazyRecord<RecordT>(data, ic));
+	}
+};
+
+//
+// LazyRecordStore
+//
+/// Storage for LazyRecordParser<> that keeps every record of a load,
+/// with their raw data in its own arena.  Reserve room for the record
+/// count the DBDB gives, so the list is not reallocated as it grows:
+///
+/// <pre>
+/// LazyRecordStore<Sms> store;
+/// store.Reserve(count);	// RecordCount from the DBDB
+/// LazyRecordParser<Sms, LazyRecordStore<Sms> > parser(store, &store.Arena);
+/// desktop.LoadDatabase(desktop.GetDBID(Sms::GetDBName()), parser);
+/// </pre>
+///
+template <class RecordT>
+class LazyRecordStore
+{
+public:
+	typedef std::vector<LazyRecord<RecordT> > RecordList;
+
+	RecordArena Arena;
+	RecordList Records;
+
+	void operator() (const LazyRecord<RecordT> &rec)
+	{
+		Records.push_back(rec);
+	}
+
+	/// Makes room for count records, such as the RecordCount of
+	/// the database's DatabaseItem in the DBDB
+	void Reserve(size_t count)
+	{
+		Records.reserve(count);
+	}
+
+	/// Drops all records, and frees their data at once
+	void Clear()
+	{
+		Records.clear();
+		Arena.Clear();
+	}
+};
+
+//
+// LazyNamedFieldCmp
+//
+/// NamedFieldCmp<> for LazyRecords, for use with std::sort().  Decodes
+/// only the fields named in the sort key before comparing.
+///
+template <class RecordT>
+class LazyNamedFieldCmp
+{
+	typedef typename FieldHandle<RecordT>::ListT HandlesT;
+
+	const std::string &m_name;
+	std::vector<const FieldHandle<RecordT>*> m_handles;
+
+public:
+	/// Throws std::logic_error if field_names, a comma separated
+	/// list like NamedFieldCmp<> takes, names an unknown field
+	explicit LazyNamedFieldCmp(const std::string &field_names)
+		: m_name(field_names)
+	{
+		std::string token;
+		std::istringstream iss(m_name);
+		while( std::getline(iss, token, ',') ) {
+			typename HandlesT::const_iterator
+				fhi = RecordT::GetFieldHandles().begin(),
+				fhe = RecordT::GetFieldHandles().end();
+			for( ; fhi != fhe; ++fhi ) {
+				if( token == fhi->GetIdentity().Name )
+					break;
+			}
+			if( fhi == fhe )
+				throw std::logic_error("LazyNamedFieldCmp: No field named '" + token + "' in '" + RecordT::GetDBName() + "'");
+			m_handles.push_back(&*fhi);
+		}
+	}
+
+	bool operator() (const LazyRecord<RecordT> &a,
+			const LazyRecord<RecordT> &b) const
+	{
+		for( size_t i = 0; i < m_handles.size(); i++ ) {
+			a.Decode(*m_handles[i]);
+			b.Decode(*m_handles[i]);
+		}
+		return NamedFieldCmp<RecordT>(m_name)(a.GetDecoded(), b.GetDecoded());
+	}
+};
+
+} // namespace Barry
+
+#endif
+
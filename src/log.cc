@@ -19,14 +19,24 @@
     root directory of this project for more details.
 */
 
+#include "i18n.h"
 #include "log.h"
 #include "clog.h"
 #include "platform.h"
+#include "scoped_lock.h"
+#include "error.h"
+#include "time.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 namespace Barry {
 
@@ -56,6 +66,383 @@ std::ostream* GetLogStream()
 	return LogStream;
 }
 
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-thread log buffers
+
+namespace {
+
+	// Lines each thread may have waiting for the writer
+	const unsigned int LogQueueSize = 256;
+
+	// Queue slots holding on to more than this, after a big data
+	// dump, give the memory back once written
+	const size_t MaxKeptCapacity = 0x4000;
+
+	// Writer thread wakeup interval, in milliseconds
+	const int WriterInterval = 100;
+
+	//
+	// LogBuf
+	//
+	/// Stream buffer appending to a string that is reused from line
+	/// to line, so formatting stops allocating once it is warmed up.
+	///
+	class LogBuf : public std::streambuf
+	{
+		std::string m_text;
+
+	protected:
+		virtual int_type overflow(int_type c)
+		{
+			if( !traits_type::eq_int_type(c, traits_type::eof()) )
+				m_text += traits_type::to_char_type(c);
+			return traits_type::not_eof(c);
+		}
+
+		virtual std::streamsize xsputn(const char *s, std::streamsize n)
+		{
+			m_text.append(s, n);
+			return n;
+		}
+
+	public:
+		std::string& GetText() { return m_text; }
+	};
+
+	struct LogSlot
+	{
+		unsigned long m_seq;
+		std::string m_text;
+	};
+
+} // anonymous namespace
+
+//
+// LogThread
+//
+/// A thread's line buffer, and its queue of lines for the writer
+/// thread.  The queue is a ring with a single producer, the owning
+/// thread, and a single consumer, whoever holds g_queue_mutex, so
+/// neither side needs a lock to use it.
+///
+struct LogThread
+{
+	LogBuf m_buf;
+	std::ostream m_stream;
+	std::ios::fmtflags m_flags;
+	bool m_busy;			// a LogLine is using m_stream
+
+	LogSlot m_slots[LogQueueSize];
+	volatile unsigned int m_head;	// next slot to fill
+	volatile unsigned int m_tail;	// next slot to write out
+	bool m_exited;			// thread is gone, delete once empty
+
+	LogThread()
+		: m_stream(&m_buf)
+		, m_flags(m_stream.flags())
+		, m_busy(false)
+		, m_head(0)
+		, m_tail(0)
+		, m_exited(false)
+	{
+	}
+
+	bool IsEmpty() const { return m_head == m_tail; }
+};
+
+namespace {
+
+	pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+	pthread_key_t g_key;
+
+	// protects everything below, and is held while writing out
+	// queued lines, always before LogStreamMutex
+	pthread_mutex_t g_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t g_queue_cond = PTHREAD_COND_INITIALIZER;
+
+	typedef std::vector<LogThread*> ThreadList;
+	typedef std::vector<std::pair<unsigned long, LogSlot*> > SlotList;
+	ThreadList g_threads;
+	SlotList g_slots;		// scratch space for WriteQueued()
+	std::vector<unsigned int> g_heads;
+
+	// held by LogAsync(), so starting and stopping don't overlap
+	pthread_mutex_t g_control_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+	pthread_t g_writer;
+	bool g_writer_running = false;
+	bool g_writer_stop = false;
+	bool g_atexit = false;
+	unsigned long g_reported = 0;	// drops already logged
+
+	// read without the lock
+	volatile bool g_async = false;
+	volatile unsigned long g_queued = 0;	// also the next sequence number
+	volatile unsigned long g_written = 0;
+	volatile unsigned long g_dropped = 0;
+
+	void ThreadExit(void *arg)
+	{
+		LogThread *thread = (LogThread*) arg;
+
+		scoped_lock lock(g_queue_mutex);
+		if( thread->IsEmpty() ) {
+			g_threads.erase(std::remove(g_threads.begin(),
+				g_threads.end(), thread), g_threads.end());
+			delete thread;
+		}
+		else {
+			thread->m_exited = true;
+		}
+	}
+
+	void CreateKey()
+	{
+		pthread_key_create(&g_key, &ThreadExit);
+	}
+
+	LogThread* GetLogThread()
+	{
+		pthread_once(&g_key_once, &CreateKey);
+
+		LogThread *thread = (LogThread*) pthread_getspecific(g_key);
+		if( !thread ) {
+			thread = new LogThread;
+			{
+				scoped_lock lock(g_queue_mutex);
+				g_threads.push_back(thread);
+			}
+			pthread_setspecific(g_key, thread);
+		}
+		return thread;
+	}
+
+	//
+	// Enqueue
+	//
+	/// Hands the thread's current line to the writer, or drops it if
+	/// the thread's queue is full.  Called only by the owning thread.
+	///
+	void Enqueue(LogThread &thread)
+	{
+		unsigned int head = thread.m_head;
+		unsigned int used = head - thread.m_tail;
+		if( used >= LogQueueSize ) {
+			__sync_fetch_and_add(&g_dropped, 1);
+			return;
+		}
+
+		// swap rather than copy; the slot is free, and its old
+		// buffer becomes the line buffer
+		LogSlot &slot = thread.m_slots[head % LogQueueSize];
+		slot.m_text.swap(thread.m_buf.GetText());
+		slot.m_seq = __sync_fetch_and_add(&g_queued, 1);
+
+		__sync_synchronize();
+		thread.m_head = head + 1;
+
+		// don't wait for the timeout if this thread is busy
+		if( used + 1 == LogQueueSize / 2 )
+			pthread_cond_signal(&g_queue_cond);
+	}
+
+	//
+	// WriteQueued
+	//
+	/// Writes every queued line, from all threads, in sequence order.
+	/// Must be called with g_queue_mutex held.
+	///
+	void WriteQueued()
+	{
+		g_slots.clear();
+		g_heads.resize(g_threads.size());
+
+		for( size_t i = 0; i < g_threads.size(); i++ ) {
+			LogThread *thread = g_threads[i];
+			unsigned int head = thread->m_head;
+			__sync_synchronize();
+			for( unsigned int j = thread->m_tail; j != head; j++ ) {
+				LogSlot &slot = thread->m_slots[j % LogQueueSize];
+				g_slots.push_back(std::make_pair(slot.m_seq, &slot));
+			}
+			g_heads[i] = head;
+		}
+
+		if( g_slots.size() ) {
+			std::sort(g_slots.begin(), g_slots.end());
+
+			LogLock lock;
+			for( SlotList::iterator i = g_slots.begin(); i != g_slots.end(); ++i )
+				(*LogStream) << i->second->m_text << '\n';
+			LogStream->flush();
+		}
+
+		for( size_t i = 0; i < g_threads.size(); i++ ) {
+			LogThread *thread = g_threads[i];
+			for( unsigned int j = thread->m_tail; j != g_heads[i]; j++ ) {
+				LogSlot &slot = thread->m_slots[j % LogQueueSize];
+				if( slot.m_text.capacity() > MaxKeptCapacity )
+					std::string().swap(slot.m_text);
+			}
+			__sync_synchronize();
+			thread->m_tail = g_heads[i];
+		}
+		__sync_fetch_and_add(&g_written, g_slots.size());
+
+		// clean up after threads that have exited
+		for( ThreadList::iterator i = g_threads.begin(); i != g_threads.end(); ) {
+			if( (*i)->m_exited && (*i)->IsEmpty() ) {
+				delete *i;
+				i = g_threads.erase(i);
+			}
+			else {
+				++i;
+			}
+		}
+
+		unsigned long dropped = g_dropped;
+		if( dropped != g_reported ) {
+			LogLock lock;
+			(*LogStream) << _("Barry log: ") << (dropped - g_reported)
+				<< _(" lines dropped") << std::endl;
+			g_reported = dropped;
+		}
+	}
+
+	void* LogWriterThread(void *arg)
+	{
+		scoped_lock lock(g_queue_mutex);
+
+		while( !g_writer_stop ) {
+			struct timespec timeout;
+			pthread_cond_timedwait(&g_queue_cond, &g_queue_mutex,
+				ThreadTimeout(WriterInterval, &timeout));
+			WriteQueued();
+		}
+		return 0;
+	}
+
+	void LogAtExit()
+	{
+		LogAsync(false);
+	}
+
+} // anonymous namespace
+
+
+///////////////////////////////////////////////////////////////////////////////
+// LogLine
+
+LogLine::LogLine()
+	: m_thread(GetLogThread())
+	, m_fallback(0)
+	, m_stream(0)
+{
+	if( m_thread->m_busy ) {
+		// something being logged logged something itself
+		m_thread = 0;
+		m_fallback = new std::ostringstream;
+		m_stream = m_fallback;
+		return;
+	}
+
+	m_thread->m_busy = true;
+	m_thread->m_buf.GetText().clear();
+	m_thread->m_stream.clear();
+	m_thread->m_stream.flags(m_thread->m_flags);
+	m_thread->m_stream.fill(' ');
+	m_stream = &m_thread->m_stream;
+}
+
+LogLine::~LogLine()
+{
+	if( m_fallback ) {
+		LogLock lock;
+		(*LogStream) << m_fallback->str() << std::endl;
+		delete m_fallback;
+		return;
+	}
+
+	if( g_async ) {
+		Enqueue(*m_thread);
+	}
+	else {
+		// keep anything left over from async mode in order
+		if( g_queued != g_written )
+			LogFlush();
+
+		LogLock lock;
+		(*LogStream) << m_thread->m_buf.GetText() << std::endl;
+	}
+
+	m_thread->m_busy = false;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Background writer
+
+//
+// LogAsync
+//
+/// Starts or stops the background log writer.  See log.h for details.
+///
+void LogAsync(bool enable)
+{
+	scoped_lock control(g_control_mutex);
+	scoped_lock lock(g_queue_mutex);
+
+	if( enable == g_writer_running )
+		return;
+
+	if( enable ) {
+		g_writer_stop = false;
+		int ret = pthread_create(&g_writer, NULL, &LogWriterThread, 0);
+		if( ret )
+			throw Barry::ErrnoError(_("Barry::LogAsync: Error creating log writer thread."), ret);
+		g_writer_running = true;
+		g_async = true;
+
+		// write out whatever is left, and don't leave the
+		// writer running while globals are destroyed
+		if( !g_atexit ) {
+			atexit(&LogAtExit);
+			g_atexit = true;
+		}
+	}
+	else {
+		g_async = false;
+		g_writer_stop = true;
+		g_writer_running = false;
+		pthread_cond_signal(&g_queue_cond);
+
+		// the writer needs the lock to finish
+		pthread_t writer = g_writer;
+		lock.unlock();
+		pthread_join(writer, NULL);
+
+		// lines queued just before g_async was cleared
+		LogFlush();
+	}
+}
+
+bool IsLogAsync()
+{
+	return g_async;
+}
+
+void LogFlush()
+{
+	scoped_lock lock(g_queue_mutex);
+	WriteQueued();
+}
+
+unsigned long LogDropped()
+{
+	return g_dropped;
+}
+
 } // namespace Barry
 
 // Callable from C:
@@ -24,6 +24,11 @@
 
 #include "dll.h"
 #include <iomanip>
+#include <iosfwd>
+
+// Environment variable which, if set, makes Barry::Init() switch
+// logging to the asynchronous writer.  See LogAsync().
+#define LOG_ASYNC_ENV		"BARRY_ASYNC_LOG"
 
 namespace Barry {
 
@@ -42,15 +47,63 @@ public:
 	~LogLock();
 };
 
+struct LogThread;
+
+//
+// LogLine
+//
+/// One line of log output, as written by the macros below.  The line
+/// is formatted into a buffer belonging to the calling thread, without
+/// taking any locks, and handed over when the LogLine is destroyed.
+/// A newline is added at the end.
+///
+/// Normally the line is then written out under LogLock.  With
+/// LogAsync(true), it is instead queued, and a background thread does
+/// the writing, so that logging from the USB read thread does not
+/// wait on the log stream.
+///
+class BXEXPORT LogLine
+{
+	LogThread *m_thread;
+	std::ostringstream *m_fallback;	// used if m_thread is busy
+	std::ostream *m_stream;
+
+	LogLine(const LogLine &other);
+	LogLine& operator=(const LogLine &other);
+
+public:
+	LogLine();
+	~LogLine();
+
+	std::ostream& GetStream() { return *m_stream; }
+};
+
 BXEXPORT bool LogVerbose();
 BXEXPORT std::ostream* GetLogStream();
 
+/// Turns the background log writer on or off.  While on, each thread
+/// queues up to 256 lines; if the writer falls that far behind, further
+/// lines from that thread are dropped and counted, instead of making
+/// the thread wait.  Lines are written in the order they were logged,
+/// within about a tenth of a second, and whatever is queued is written
+/// out at exit.  Turning it off writes out everything queued and stops
+/// the writer thread.  Throws Barry::ErrnoError if the writer thread
+/// cannot be started.
+BXEXPORT void LogAsync(bool enable);
+BXEXPORT bool IsLogAsync();
+
+/// Writes out all queued lines right away
+BXEXPORT void LogFlush();
+
+/// Number of lines dropped by the background writer so far
+BXEXPORT unsigned long LogDropped();
+
 } // namespace Barry
 
-#define barrylog(x)	{ ::Barry::LogLock lock; (*::Barry::GetLogStream()) << x << std::endl; }
+#define barrylog(x)	{ ::Barry::LogLine line; line.GetStream() << x; }
 
 // controlled by command line -v switch
-#define barryverbose(x)	if(::Barry::LogVerbose()) { ::Barry::LogLock lock; (*::Barry::GetLogStream()) << x << std::endl; }
+#define barryverbose(x)	if(::Barry::LogVerbose()) { ::Barry::LogLine line; line.GetStream() << x; }
 
 #endif // __BARRY_LOG_H__
 
@@ -44,12 +44,14 @@ namespace Barry { namespace Mode {
 Desktop::Desktop(Controller &con)
 	: Mode(con, Controller::Desktop)
 	, m_ic(0)
+	, m_fetchWindow(1)
 {
 }
 
 Desktop::Desktop(Controller &con, const IConverter &ic)
 	: Mode(con, Controller::Desktop)
 	, m_ic(&ic)
+	, m_fetchWindow(1)
 {
 }
 
@@ -57,6 +59,60 @@ Desktop::~Desktop()
 {
 }
 
+//
+// CheckRecordResponse
+//
+/// Performs the copious packet checks on a response to
+/// GET_RECORD_BY_INDEX, throwing Error if it isn't record data.
+///
+static void CheckRecordResponse(const Data &command, const Data &response,
+				DBPacket &packet)
+{
+	if( response.GetSize() < SB_PACKET_RESPONSE_HEADER_SIZE ) {
+		eeout(command, response);
+
+		std::ostringstream oss;
+		oss << _("Desktop: invalid response packet size of: ")
+		    << std::dec << response.GetSize();
+		eout(oss.str());
+		throw Error(oss.str());
+	}
+	if( packet.Command() != SB_COMMAND_DB_DATA ) {
+		eeout(command, response);
+
+		std::ostringstream oss;
+		oss << _("Desktop: unexpected command of ")
+		    << "0x" << std::setbase(16) << packet.Command()
+		    << _(" instead of expected ")
+		    << "0x"
+		    << std::setbase(16) << (unsigned int)SB_COMMAND_DB_DATA;
+		eout(oss.str());
+		throw Error(oss.str());
+	}
+}
+
+//
+// DrainReplies
+//
+/// Reads and throws away count replies to pipelined requests, so
+/// that none of them is later taken as the response to another
+/// command.  Stops early if the device stops answering.  Returns
+/// the number of replies left unread.
+///
+static unsigned int DrainReplies(SocketBase &socket, unsigned int count)
+{
+	Data discard;
+	try {
+		while( count ) {
+			socket.PacketReceive(discard);
+			count--;
+		}
+	}
+	catch( Usb::Timeout & ) {
+	}
+	return count;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // protected members
 
@@ -176,6 +232,11 @@ void Desktop::SetIConverter(const IConverter &ic)
 	m_ic = &ic;
 }
 
+void Desktop::SetFetchWindow(unsigned int window)
+{
+	m_fetchWindow = window ? window : 1;
+}
+
 //
 // GetRecordStateTable
 //
@@ -259,27 +320,7 @@ void Desktop::GetRecord(unsigned int dbId,
 	m_socket->Packet(packet);
 
 	// perform copious packet checks
-	if( m_response.GetSize() < SB_PACKET_RESPONSE_HEADER_SIZE ) {
-		eeout(m_command, m_response);
-
-		std::ostringstream oss;
-		oss << _("Desktop: invalid response packet size of: ")
-		    << std::dec << m_response.GetSize();
-		eout(oss.str());
-		throw Error(oss.str());
-	}
-	if( packet.Command() != SB_COMMAND_DB_DATA ) {
-		eeout(m_command, m_response);
-
-		std::ostringstream oss;
-		oss << _("Desktop: unexpected command of ")
-		    << "0x" << std::setbase(16) << packet.Command()
-		    << _(" instead of expected ")
-		    << "0x"
-		    << std::setbase(16) << (unsigned int)SB_COMMAND_DB_DATA;
-		eout(oss.str());
-		throw Error(oss.str());
-	}
+	CheckRecordResponse(m_command, m_response, packet);
 
 	// grab that data
 	packet.Parse(parser, dbName, m_ic);
@@ -289,6 +330,83 @@ void Desktop::GetRecord(unsigned int dbId,
 		m_socket->NextRecord(m_response);
 }
 
+//
+// GetRecordsByIndex
+//
+/// Retrieves several records from the specified database, feeding
+/// them to parser in the order given.  Up to GetFetchWindow() requests
+/// are kept outstanding on the socket, so the device always has the
+/// next request in hand when it finishes the current one.
+/// Like GetRecord(), this does not clear the dirty flags.
+///
+void Desktop::GetRecordsByIndex(unsigned int dbId,
+				const std::vector<unsigned int> &stateTableIndices,
+				Parser &parser)
+{
+	if( m_fetchWindow <= 1 ) {
+		for( size_t i = 0; i < stateTableIndices.size(); i++ )
+			GetRecord(dbId, stateTableIndices[i], parser);
+		return;
+	}
+
+	dout(_("Database ID: ") << dbId);
+
+	std::string dbName;
+	m_dbdb.GetDBName(dbId, dbName);
+
+	DBPacket packet(*this, m_command, m_response);
+
+	// copies of the requests in flight, so an error dump shows
+	// the one being answered, not the newest
+	std::vector<Data> sentCommands(m_fetchWindow);
+
+	size_t sent = 0, received = 0;
+	unsigned int replies = 0;	// replies owed by the device
+	try {
+		while( received < stateTableIndices.size() ) {
+			// keep the window full... each record takes the
+			// request itself, plus the DB_DONE that flushes it
+			while( sent < stateTableIndices.size() &&
+			       sent - received < m_fetchWindow )
+			{
+				packet.GetRecordByIndex(dbId, stateTableIndices[sent]);
+				sentCommands[sent % m_fetchWindow] = m_command;
+				m_socket->PacketSend(m_command);
+				replies++;
+				m_socket->NextRecordSend();
+				replies++;
+				sent++;
+			}
+
+			// responses arrive in request order
+			const Data &command = sentCommands[received % m_fetchWindow];
+			m_socket->PacketReceive(m_response);
+			replies--;
+			CheckRecordResponse(command, m_response, packet);
+			packet.Parse(parser, dbName, m_ic);
+
+			m_socket->PacketReceive(m_response);
+			replies--;
+			if( packet.Command() != SB_COMMAND_DB_DONE ) {
+				eeout(command, m_response);
+				throw Error(_("Desktop: missing DB_DONE after pipelined record"));
+			}
+			received++;
+		}
+	}
+	catch( ... ) {
+		// the replies still owed would otherwise be taken
+		// as responses to the next command
+		try {
+			DrainReplies(*m_socket, replies);
+		}
+		catch( ... ) {
+			// report the original error
+		}
+		throw;
+	}
+}
+
 //
 // SetRecord
 //
@@ -477,6 +595,10 @@ DBLoader::DBLoader(Desktop &desktop)
 	: m_desktop(desktop)
 	, m_loading(false)
 	, m_loader(new DBLoaderData(desktop, m_send, m_send))
+	, m_window(1)
+	, m_outstanding(0)
+	, m_ahead(0)
+	, m_streamDone(false)
 {
 }
 
@@ -495,6 +617,37 @@ bool DBLoader::StartDBLoad(unsigned int dbId, DBData &data)
 	DBPacket &packet = m_loader->m_packet;
 	packet.SetNewReceive(data.UseData());
 	packet.GetRecords(dbId);
+
+	m_window = m_desktop.m_fetchWindow;
+	if( m_window > 1 ) {
+		// Each DB_DONE sent after GET_RECORDS fetches one more
+		// record, plus one final DB_DONE reply at the end, so
+		// the DBDB record count tells how many are worth
+		// sending ahead of the responses.
+		m_ahead = 0;
+		DatabaseDatabase::DatabaseArrayType::const_iterator
+			b = m_desktop.m_dbdb.Databases.begin(),
+			e = m_desktop.m_dbdb.Databases.end();
+		for( ; b != e; ++b ) {
+			if( b->Number == dbId ) {
+				m_ahead = b->RecordCount;
+				break;
+			}
+		}
+
+		m_streamDone = false;
+		m_desktop.m_socket->PacketSend(m_send);
+		m_outstanding = 1;
+
+		if( ReceiveNext(data) ) {
+			data.SetDBName(m_dbName);
+			return true;
+		}
+
+		m_loading = false;
+		return false;
+	}
+
 	m_desktop.m_socket->Packet(packet);
 
 	while( packet.Command() != SB_COMMAND_DB_DONE ) {
@@ -517,6 +670,14 @@ bool DBLoader::GetNextRecord(DBData &data)
 	if( !m_loading )
 		return false;
 
+	if( m_window > 1 ) {
+		if( ReceiveNext(data) )
+			return true;
+
+		m_loading = false;
+		return false;
+	}
+
 	DBPacket &packet = m_loader->m_packet;
 	packet.SetNewReceive(data.UseData());
 
@@ -534,6 +695,69 @@ bool DBLoader::GetNextRecord(DBData &data)
 	return false;
 }
 
+//
+// ReceiveNext
+//
+/// Pipelined version of the GetNextRecord() loop.  Keeps up to m_window
+/// requests outstanding, and returns the next record in data.
+/// Returns false at the end of the database.
+///
+bool DBLoader::ReceiveNext(DBData &data)
+{
+	DBPacket &packet = m_loader->m_packet;
+	packet.SetNewReceive(data.UseData());
+
+	while( !m_streamDone ) {
+		// top up the window, but only with the requests the
+		// DBDB record count says are answered... if the device
+		// has more records than that, go on one request at a
+		// time, so nothing is ever sent past the end unless
+		// records were deleted since the DBDB was loaded
+		while( m_outstanding < m_window &&
+		       (m_ahead > 0 || m_outstanding == 0) )
+		{
+			m_desktop.m_socket->NextRecordSend();
+			m_outstanding++;
+			if( m_ahead )
+				m_ahead--;
+		}
+
+		m_desktop.m_socket->PacketReceive(data.UseData());
+		m_outstanding--;
+
+		if( packet.Command() == SB_COMMAND_DB_DATA ) {
+			packet.ParseMeta(data);
+			return true;
+		}
+		else if( packet.Command() == SB_COMMAND_DB_DONE ) {
+			m_streamDone = true;
+		}
+	}
+
+	DrainOutstanding();
+	return false;
+}
+
+//
+// DrainOutstanding
+//
+/// Reads and throws away the replies to any requests sent past the
+/// end of the database, which happens if records were deleted since
+/// the DBDB was loaded.  Every request gets a reply, so all of them
+/// must be read, or a late one would be taken as the response to the
+/// next command.  The load itself is complete by now, so if the
+/// device stops answering, this only logs a warning.
+///
+void DBLoader::DrainOutstanding()
+{
+	m_outstanding = DrainReplies(*m_desktop.m_socket, m_outstanding);
+	if( m_outstanding ) {
+		eout(_("DBLoader: timed out waiting for replies to ")
+			<< m_outstanding << _(" pipelined record requests"));
+		m_outstanding = 0;
+	}
+}
+
 } // namespace Barry::Mode
 
 
@@ -586,7 +810,7 @@ bool DeviceBuilder::BuildRecord(DBData &data,
 				size_t &offset,
 				const IConverter *ic)
 {
-	DBData temp;
+	DBData &temp = m_temp;
 	if( !FetchRecord(temp, ic) )
 		return false;
 
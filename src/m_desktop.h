@@ -72,6 +72,9 @@ private:
 	// external objects (optional, can be null)
 	const IConverter *m_ic;
 
+	// number of record requests kept outstanding during bulk fetches
+	unsigned int m_fetchWindow;
+
 protected:
 	void LoadCommandTable();
 	void LoadDBDB();
@@ -97,6 +100,13 @@ public:
 
 	void SetIConverter(const IConverter &ic);
 
+	// Sets how many record requests are kept outstanding on the
+	// socket by GetRecordsByIndex() and DBLoader, instead of waiting
+	// for each response before sending the next request.  A window
+	// of 1, the default, keeps the old one-at-a-time behaviour.
+	void SetFetchWindow(unsigned int window);
+	unsigned int GetFetchWindow() const { return m_fetchWindow; }
+
 	//////////////////////////////////
 	// Desktop mode - database specific
 
@@ -106,6 +116,9 @@ public:
 		// retrieved from build, and duplicate IDs are allowed,
 		// but *not* recommended!
 	void GetRecord(unsigned int dbId, unsigned int stateTableIndex, Parser &parser);
+	void GetRecordsByIndex(unsigned int dbId,
+		const std::vector<unsigned int> &stateTableIndices,
+		Parser &parser);
 	void SetRecord(unsigned int dbId, unsigned int stateTableIndex, Builder &build);
 	void ClearDirty(unsigned int dbId, unsigned int stateTableIndex);
 	void DeleteRecord(unsigned int dbId, unsigned int stateTableIndex);
@@ -147,6 +160,16 @@ class BXEXPORT DBLoader
 	std::string m_dbName;
 	DBLoaderData *m_loader;
 
+	// pipelined loads only
+	unsigned int m_window;		//< requests to keep outstanding
+	unsigned int m_outstanding;	//< requests sent, not yet answered
+	unsigned int m_ahead;		//< records left, per the DBDB count
+	bool m_streamDone;		//< device has sent DB_DONE
+
+protected:
+	bool ReceiveNext(DBData &data);
+	void DrainOutstanding();
+
 public:
 	explicit DBLoader(Desktop &desktop);
 	~DBLoader();
@@ -207,6 +230,10 @@ class BXEXPORT DeviceBuilder : public Builder
 	// giving per-record control
 	Mode::DBLoader m_loader;
 
+	// records are fetched here before BuildRecord() copies them to
+	// the requested offset, reused so each record needs no new buffer
+	DBData m_temp;
+
 public:
 	explicit DeviceBuilder(Mode::Desktop &desktop);
 
@@ -452,8 +452,7 @@ void JavaLoader::StartStream()
 //   00000064   B8 BC C0 A1  C0 14 00 81  00 00 01 01  04 0E 3F 6D  00 02 00 6D  ..............?m...m
 void JavaLoader::SendStream(std::istream &input, size_t module_size)
 {
-	char buffer[MAX_PACKET_DATA_SIZE - SB_JLPACKET_HEADER_SIZE];
-	size_t max_data_size = sizeof(buffer);
+	size_t max_data_size = MAX_PACKET_DATA_SIZE - SB_JLPACKET_HEADER_SIZE;
 
 	size_t remaining = module_size;
 
@@ -470,12 +469,11 @@ void JavaLoader::SendStream(std::istream &input, size_t module_size)
 	while( remaining > 0 ) {
 		size_t size = min(remaining, max_data_size);
 
-		input.read(buffer, size);
-		if( input.fail() || (size_t)input.gcount() != size ) {
+		// read straight into the packet, rather than copying
+		if( !packet.PutData(input, size) ) {
 			throw Error(_("JavaLoader::SendStream: input stream read failed"));
 		}
 
-		packet.PutData(buffer, size);
 		m_socket->Packet(packet);
 
 		if( packet.Command() == SB_COMMAND_JL_NOT_ENOUGH_MEMORY ) {
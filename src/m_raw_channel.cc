@@ -281,7 +281,7 @@ void RawChannel::Receive(Data &data,int timeout)
 	MAKE_CHANNELPACKETPTR_BUF(packet, m_receive_data.GetData());
 
 	size_t len = packet->size - SB_CHANNELPACKET_HEADER_SIZE;
-	memcpy(data.GetBuffer(), packet->u.data, len);
+	memcpy(data.GetBuffer(len), packet->u.data, len);
 	data.ReleaseBuffer(len);
 
 }
@@ -52,7 +52,10 @@ public:
 	virtual void DataReceived(Data &data) = 0;
 	// Called when the channel has an error
 	virtual void ChannelError(std::string msg) = 0;
-	// Called when the channel has been asked to close by the other side
+	// Called when the channel has been asked to close by the other side.
+	// Socket zero packets like this one are handled ahead of any
+	// channel data still waiting for DataReceived(), but never
+	// ahead of data the other side sent before closing.
 	virtual void ChannelClose() = 0;
 };
 
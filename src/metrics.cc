@@ -0,0 +1,258 @@
+///
+/// \file	metrics.cc
+///		Protocol and router counters, for performance diagnostics
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "metrics.h"
+#include "ios_state.h"
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+
+namespace Barry {
+
+///////////////////////////////////////////////////////////////////////////////
+// Histogram
+
+const int Histogram::BucketCount;
+
+Histogram::Histogram()
+{
+	Clear();
+}
+
+void Histogram::Add(unsigned long usec)
+{
+	int index = 0;
+	for( unsigned long v = usec; v && index < BucketCount - 1; v >>= 1 )
+		index++;
+
+	__sync_fetch_and_add(&m_buckets[index], 1);
+	__sync_fetch_and_add(&m_count, 1);
+	__sync_fetch_and_add(&m_total, (unsigned long long) usec);
+
+	unsigned long min = m_min;
+	while( usec < min ) {
+		unsigned long prev = __sync_val_compare_and_swap(&m_min, min, usec);
+		if( prev == min )
+			break;
+		min = prev;
+	}
+
+	unsigned long max = m_max;
+	while( usec > max ) {
+		unsigned long prev = __sync_val_compare_and_swap(&m_max, max, usec);
+		if( prev == max )
+			break;
+		max = prev;
+	}
+}
+
+void Histogram::Clear()
+{
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_total = 0;
+	m_min = ~0UL;
+	m_max = 0;
+}
+
+unsigned long Histogram::GetAverage() const
+{
+	return m_count ? (unsigned long) (m_total / m_count) : 0;
+}
+
+unsigned long Histogram::GetPercentile(int percent) const
+{
+	if( !m_count )
+		return 0;
+
+	// rank of the sample we want, rounded up
+	unsigned long long rank =
+		((unsigned long long) m_count * percent + 99) / 100;
+	unsigned long long seen = 0;
+	for( int i = 0; i < BucketCount; i++ ) {
+		seen += m_buckets[i];
+		if( seen >= rank ) {
+			unsigned long bound = i ? (1UL << i) - 1 : 0;
+			return bound < m_max ? bound : m_max;
+		}
+	}
+	return m_max;
+}
+
+std::ostream& operator<<(std::ostream &os, const Histogram &h)
+{
+	ios_format_state state(os);
+
+	os << std::dec << h.GetCount();
+	if( h.GetCount() ) {
+		os << _(" calls, min ") << h.GetMin()
+		   << _("us, avg ") << h.GetAverage()
+		   << _("us, p50 <= ") << h.GetPercentile(50)
+		   << _("us, p90 <= ") << h.GetPercentile(90)
+		   << _("us, p99 <= ") << h.GetPercentile(99)
+		   << _("us, max ") << h.GetMax() << "us";
+	}
+	else {
+		os << _(" calls");
+	}
+	return os;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Stopwatch
+
+void Stopwatch::Restart()
+{
+	gettimeofday(&m_start, NULL);
+}
+
+unsigned long Stopwatch::GetElapsed() const
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	long usec = (now.tv_sec - m_start.tv_sec) * 1000000L +
+		(now.tv_usec - m_start.tv_usec);
+	// the clock may have been set back
+	return usec > 0 ? usec : 0;
+}
+
+void MetricAdd(unsigned long &counter, unsigned long n)
+{
+	__sync_fetch_and_add(&counter, n);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// ProtocolMetrics
+
+ProtocolMetrics::ProtocolMetrics()
+	: WriteEp(0)
+	, ReadEp(0)
+{
+	Clear();
+}
+
+void ProtocolMetrics::Clear()
+{
+	PacketsSent = 0;
+	BytesSent = 0;
+	SizePackets = 0;
+	PacketsReceived = 0;
+	BytesReceived = 0;
+	FragmentsSent = 0;
+	FragmentsReceived = 0;
+	Timeouts = 0;
+	Retries = 0;
+	PacketRoundTrip.Clear();
+	ReceiveWait.Clear();
+}
+
+std::ostream& operator<<(std::ostream &os, const ProtocolMetrics &m)
+{
+	ios_format_state state(os);
+
+	os << _("Protocol:") << "\n" << std::hex
+	   << _("   Sent (ep 0x") << m.WriteEp << "): " << std::dec
+		<< m.PacketsSent << _(" packets, ")
+		<< m.BytesSent << _(" bytes, ")
+		<< m.FragmentsSent << _(" fragments, ")
+		<< m.SizePackets << _(" size packets") << "\n" << std::hex
+	   << _("   Received (ep 0x") << m.ReadEp << "): " << std::dec
+		<< m.PacketsReceived << _(" packets, ")
+		<< m.BytesReceived << _(" bytes, ")
+		<< m.FragmentsReceived << _(" fragments") << "\n"
+	   << _("   Timeouts: ") << m.Timeouts
+		<< _(", retries: ") << m.Retries << "\n"
+	   << _("   Packet round trip: ") << m.PacketRoundTrip << "\n"
+	   << _("   Response wait: ") << m.ReceiveWait << "\n";
+	return os;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// RouterMetrics
+
+RouterMetrics::SocketStats::SocketStats()
+	: Socket(0)
+	, Handler(false)
+	, Packets(0)
+	, Bytes(0)
+	, Depth(0)
+	, MaxDepth(0)
+{
+}
+
+RouterMetrics::RouterMetrics()
+	: ReadEp(0)
+{
+	Clear();
+}
+
+void RouterMetrics::Clear()
+{
+	PacketsRead = 0;
+	BytesRead = 0;
+	ReadTimeouts = 0;
+	UsbErrors = 0;
+	DeferredMaxDepth = 0;
+	Default = SocketStats();
+	Sockets.clear();
+}
+
+static void DumpSocket(std::ostream &os, const RouterMetrics::SocketStats &s)
+{
+	os << s.Packets << _(" packets, ") << s.Bytes << _(" bytes");
+	if( s.Handler )
+		os << _(", to handler");
+	else
+		os << _(", queued ") << s.Depth << _(", max ") << s.MaxDepth;
+	os << "\n";
+}
+
+std::ostream& operator<<(std::ostream &os, const RouterMetrics &m)
+{
+	ios_format_state state(os);
+
+	os << _("Router:") << "\n" << std::hex
+	   << _("   Read (ep 0x") << m.ReadEp << "): " << std::dec
+		<< m.PacketsRead << _(" packets, ")
+		<< m.BytesRead << _(" bytes, ")
+		<< m.ReadTimeouts << _(" empty reads, ")
+		<< m.UsbErrors << _(" USB errors") << "\n"
+	   << _("   Most data held behind socket 0: ")
+		<< m.DeferredMaxDepth << "\n"
+	   << _("   Default queue: ");
+	DumpSocket(os, m.Default);
+
+	RouterMetrics::SocketStatsList::const_iterator i = m.Sockets.begin();
+	for( ; i != m.Sockets.end(); ++i ) {
+		os << _("   Socket 0x") << std::hex << i->Socket << ": "
+		   << std::dec;
+		DumpSocket(os, *i);
+	}
+	return os;
+}
+
+} // namespace Barry
+
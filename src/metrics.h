@@ -0,0 +1,167 @@
+///
+/// \file	metrics.h
+///		Protocol and router counters, for performance diagnostics
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRY_METRICS_H__
+#define __BARRY_METRICS_H__
+
+#include "dll.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <iosfwd>
+#include <sys/time.h>
+
+namespace Barry {
+
+//
+// Histogram
+//
+/// Distribution of durations in microseconds, in power of two buckets.
+/// Bucket 0 counts zeros, and bucket i counts values from 2^(i-1) up
+/// to 2^i - 1.  Add() is safe to call from any thread without locking.
+///
+class BXEXPORT Histogram
+{
+public:
+	static const int BucketCount = 32;
+
+private:
+	unsigned long m_buckets[BucketCount];
+	unsigned long m_count;
+	unsigned long long m_total;
+	unsigned long m_min;
+	unsigned long m_max;
+
+public:
+	Histogram();
+
+	void Add(unsigned long usec);
+	void Clear();
+
+	unsigned long GetCount() const { return m_count; }
+	unsigned long long GetTotal() const { return m_total; }
+	unsigned long GetMin() const { return m_count ? m_min : 0; }
+	unsigned long GetMax() const { return m_max; }
+	unsigned long GetBucket(int index) const { return m_buckets[index]; }
+	unsigned long GetAverage() const;
+
+	/// Returns the upper bound of the bucket holding the given
+	/// percentile, so the real value is no more than that
+	unsigned long GetPercentile(int percent) const;
+};
+
+BXEXPORT std::ostream& operator<<(std::ostream &os, const Histogram &h);
+
+//
+// Stopwatch
+//
+/// Measures elapsed time for a Histogram.
+///
+class BXEXPORT Stopwatch
+{
+	struct timeval m_start;
+
+public:
+	Stopwatch() { Restart(); }
+
+	void Restart();
+	unsigned long GetElapsed() const;	// in microseconds
+};
+
+/// Atomically adds n to a counter in one of the structs below
+BXEXPORT void MetricAdd(unsigned long &counter, unsigned long n = 1);
+
+//
+// ProtocolMetrics
+//
+/// Counters kept by SocketZero for everything sent and received over
+/// its sockets.  Get a copy from Controller::GetProtocolMetrics().
+///
+struct BXEXPORT ProtocolMetrics
+{
+	int WriteEp;
+	int ReadEp;
+
+	unsigned long PacketsSent;
+	unsigned long BytesSent;
+	unsigned long SizePackets;	//< size prefixes sent ahead of
+					//< packets sized in multiples of 0x40
+	unsigned long PacketsReceived;
+	unsigned long BytesReceived;
+	unsigned long FragmentsSent;
+	unsigned long FragmentsReceived;
+	unsigned long Timeouts;		//< sends and receives that timed out
+	unsigned long Retries;		//< extra reads after blank packets,
+					//< or for late sequence packets
+
+	Histogram PacketRoundTrip;	//< SocketBase::Packet() calls
+	Histogram ReceiveWait;		//< waiting for a whole response,
+					//< including pipelined ones
+
+	ProtocolMetrics();
+	void Clear();
+};
+
+BXEXPORT std::ostream& operator<<(std::ostream &os, const ProtocolMetrics &m);
+
+//
+// RouterMetrics
+//
+/// Counters kept by SocketRoutingQueue for the packets it reads and
+/// routes.  Get a copy from SocketRoutingQueue::GetMetrics(), or
+/// Controller::GetRouterMetrics().
+///
+struct BXEXPORT RouterMetrics
+{
+	struct SocketStats
+	{
+		uint16_t Socket;
+		bool Handler;		//< packets go to a handler, not queued
+		unsigned long Packets;	//< data and sequence packets routed
+		unsigned long Bytes;
+		size_t Depth;		//< packets waiting to be read now
+		size_t MaxDepth;	//< most packets ever waiting at once
+
+		SocketStats();
+	};
+	typedef std::vector<SocketStats> SocketStatsList;
+
+	int ReadEp;
+	unsigned long PacketsRead;
+	unsigned long BytesRead;
+	unsigned long ReadTimeouts;	//< reads that found no data
+	unsigned long UsbErrors;
+	size_t DeferredMaxDepth;	//< most data packets held back
+					//< behind socket zero at once
+
+	SocketStats Default;		//< packets for no registered socket
+	SocketStatsList Sockets;	//< registered sockets
+
+	RouterMetrics();
+	void Clear();
+};
+
+BXEXPORT std::ostream& operator<<(std::ostream &os, const RouterMetrics &m);
+
+} // namespace Barry
+
+#endif
+
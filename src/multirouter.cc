@@ -0,0 +1,297 @@
+///
+/// \file	multirouter.cc
+///		Shared read threads for many SocketRoutingQueues
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "multirouter.h"
+#include "router.h"
+#include "usbwrap.h"
+#include "scoped_lock.h"
+#include "error.h"
+#include "debug.h"
+#include <stdexcept>
+#include <typeinfo>
+#include <unistd.h>
+
+namespace Barry {
+
+const int MultiRouter::DefaultPipelineDepth;
+const int MultiRouter::MaxBatch;
+
+MultiRouter::MultiRouter(int workers)
+	: m_stop(false)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_workCond, NULL);
+	pthread_cond_init(&m_idleCond, NULL);
+
+	int ret = pthread_create(&m_event_thread, NULL, &MultiRouter::EventThread, this);
+	if( ret ) {
+		pthread_cond_destroy(&m_idleCond);
+		pthread_cond_destroy(&m_workCond);
+		pthread_mutex_destroy(&m_mutex);
+		throw Barry::ErrnoError(_("MultiRouter: Error creating USB event thread."), ret);
+	}
+
+	if( workers < 1 )
+		workers = 1;
+	for( int i = 0; i < workers; i++ ) {
+		pthread_t thread;
+		ret = pthread_create(&thread, NULL, &MultiRouter::WorkerThread, this);
+		if( ret ) {
+			Shutdown();
+			pthread_cond_destroy(&m_idleCond);
+			pthread_cond_destroy(&m_workCond);
+			pthread_mutex_destroy(&m_mutex);
+			throw Barry::ErrnoError(_("MultiRouter: Error creating worker thread."), ret);
+		}
+		m_workers.push_back(thread);
+	}
+}
+
+MultiRouter::~MultiRouter()
+{
+	Shutdown();
+
+	// any routers left behind must not call back into us
+	for( EntryMap::iterator i = m_entries.begin(); i != m_entries.end(); ++i ) {
+		SocketRoutingQueue *q = i->first;
+		scoped_lock lock(q->m_mutex);
+		q->m_pool = 0;
+	}
+
+	pthread_cond_destroy(&m_idleCond);
+	pthread_cond_destroy(&m_workCond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+//
+// Shutdown
+//
+/// Stops and joins all threads.
+///
+void MultiRouter::Shutdown()
+{
+	{
+		scoped_lock lock(m_mutex);
+		m_stop = true;
+		pthread_cond_broadcast(&m_workCond);
+	}
+
+	for( ThreadList::iterator i = m_workers.begin(); i != m_workers.end(); ++i )
+		pthread_join(*i, NULL);
+	m_workers.clear();
+
+	// the event thread notices m_stop on its next timeout
+	pthread_join(m_event_thread, NULL);
+}
+
+void* MultiRouter::EventThread(void *arg)
+{
+	MultiRouter *mr = (MultiRouter*) arg;
+	mr->HandleEvents();
+	return 0;
+}
+
+void* MultiRouter::WorkerThread(void *arg)
+{
+	MultiRouter *mr = (MultiRouter*) arg;
+	mr->Work();
+	return 0;
+}
+
+//
+// HandleEvents
+//
+/// Runs libusb event handling for every device, which is where the
+/// read pipeline callbacks end up calling Notify().
+///
+void MultiRouter::HandleEvents()
+{
+	while( !m_stop ) {
+		try {
+			// timeout in milliseconds
+			if( !Usb::LibraryInterface::HandleEvents(250) ) {
+				// no asynchronous reads, so every router
+				// is using its own read thread instead
+				dout("MultiRouter: USB library has no event handling, stopping event thread");
+				return;
+			}
+		}
+		catch( Usb::Error &e ) {
+			eout(_("MultiRouter: error handling USB events: ") << e.what());
+			// don't spin on a persistent error
+			usleep(125000);
+		}
+	}
+}
+
+//
+// Work
+//
+/// Worker thread loop.  Takes the next router with completed reads
+/// off the work queue, and routes up to MaxBatch packets for it.
+/// If it has more, or more arrived meanwhile, it goes to the back
+/// of the queue, behind any other routers waiting.
+///
+void MultiRouter::Work()
+{
+	scoped_lock lock(m_mutex);
+
+	while( !m_stop ) {
+		if( m_work.empty() ) {
+			pthread_cond_wait(&m_workCond, &m_mutex);
+			continue;
+		}
+
+		SocketRoutingQueue *q = m_work.front();
+		m_work.pop_front();
+
+		// safe to hold on to, since Remove() waits until
+		// m_scheduled is cleared
+		Entry &entry = m_entries[q];
+		entry.m_pending = false;
+
+		pthread_mutex_unlock(&m_mutex);
+
+		bool more = false;
+		try {
+			int count = 0;
+			while( (more = q->DoPolledRead()) && ++count < MaxBatch )
+				;
+		}
+		catch( std::exception &e ) {
+			// a socket handler threw... that packet is gone,
+			// but there may be others behind it
+			eout(_("MultiRouter received uncaught exception: ") << typeid(e).name() << _(" what: ") << e.what());
+			more = true;
+		}
+		catch( ... ) {
+			eout(_("MultiRouter received uncaught exception of unknown type"));
+			more = true;
+		}
+
+		while( pthread_mutex_lock(&m_mutex) != 0 )
+			;
+
+		if( more || entry.m_pending ) {
+			m_work.push_back(q);
+		}
+		else {
+			entry.m_scheduled = false;
+			pthread_cond_broadcast(&m_idleCond);
+		}
+	}
+}
+
+//
+// Notify
+//
+/// Queues a router for a worker, unless it is already queued or being
+/// serviced, in which case the worker is told to take another look.
+/// Runs inside libusb event handling, so it must never block for long.
+///
+void MultiRouter::Notify(SocketRoutingQueue &queue)
+{
+	scoped_lock lock(m_mutex);
+
+	EntryMap::iterator i = m_entries.find(&queue);
+	if( i == m_entries.end() )
+		return;
+
+	i->second.m_pending = true;
+	if( !i->second.m_scheduled ) {
+		i->second.m_scheduled = true;
+		m_work.push_back(&queue);
+		pthread_cond_signal(&m_workCond);
+	}
+}
+
+//
+// Quiesce
+//
+/// Waits until no worker is servicing queue, and none is about to.
+///
+void MultiRouter::Quiesce(SocketRoutingQueue &queue)
+{
+	scoped_lock lock(m_mutex);
+
+	EntryMap::iterator i = m_entries.find(&queue);
+	if( i == m_entries.end() )
+		return;
+
+	while( i->second.m_scheduled && !m_stop )
+		pthread_cond_wait(&m_idleCond, &m_mutex);
+}
+
+//
+// Add
+//
+/// Attaches a router to this pool.  See multirouter.h for details.
+///
+void MultiRouter::Add(SocketRoutingQueue &queue)
+{
+	// the pool only works with pipelined reads
+	if( queue.GetReadPipelineDepth() == 0 )
+		queue.SetReadPipelineDepth(DefaultPipelineDepth);
+
+	scoped_lock qlock(queue.m_mutex);
+	if( queue.m_pool )
+		throw std::logic_error(_("MultiRouter: router is already attached to a pool."));
+	if( queue.m_dev )
+		throw std::logic_error(_("MultiRouter: router must be added before its USB device is set."));
+
+	scoped_lock lock(m_mutex);
+	m_entries[&queue] = Entry();
+	queue.m_pool = this;
+}
+
+//
+// Remove
+//
+/// Detaches a router from this pool.  Does nothing if it is not
+/// attached.  SocketRoutingQueue's destructor calls this itself.
+///
+void MultiRouter::Remove(SocketRoutingQueue &queue)
+{
+	{
+		scoped_lock lock(m_mutex);
+
+		EntryMap::iterator i = m_entries.find(&queue);
+		if( i == m_entries.end() )
+			return;
+
+		while( i->second.m_scheduled && !m_stop )
+			pthread_cond_wait(&m_idleCond, &m_mutex);
+		m_entries.erase(i);
+	}
+
+	scoped_lock qlock(queue.m_mutex);
+	queue.m_pool = 0;
+}
+
+size_t MultiRouter::GetCount() const
+{
+	scoped_lock lock(m_mutex);
+	return m_entries.size();
+}
+
+} // namespace Barry
+
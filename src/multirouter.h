@@ -0,0 +1,137 @@
+///
+/// \file	multirouter.h
+///		Shared read threads for many SocketRoutingQueues
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRY_MULTIROUTER_H__
+#define __BARRY_MULTIROUTER_H__
+
+#include "dll.h"
+#include <map>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+namespace Barry {
+
+class SocketRoutingQueue;
+
+//
+// MultiRouter
+//
+/// Does the USB reading for any number of SocketRoutingQueues, one
+/// per device, with a fixed number of threads, instead of a
+/// SpinoffSimpleReadThread() per device.  Each router keeps its own
+/// socket map, queues and handlers, and works exactly as before.
+///
+/// Reads use each device's asynchronous read pipeline.  One thread
+/// handles USB events for every device, and as reads complete, the
+/// routers are handed to a small pool of worker threads, which route
+/// the packets and call any socket handlers.  A router is only ever
+/// serviced by one worker at a time, so its packets stay in order,
+/// and busy devices take turns, so one cannot starve the others.
+///
+/// Attach each router before its Controller is created:
+///
+///	MultiRouter pool;
+///	SocketRoutingQueue queue;
+///	pool.Add(queue);
+///	Controller con(probeResult, queue);
+///
+/// Routers are detached automatically when destroyed.  If the USB
+/// library cannot do asynchronous reads, each router quietly starts
+/// its own simple read thread instead.
+///
+/// The MultiRouter must outlive any Controller using its routers.
+///
+class BXEXPORT MultiRouter
+{
+	friend class SocketRoutingQueue;
+
+public:
+	/// Read pipeline depth given to routers that have none set
+	static const int DefaultPipelineDepth = 4;
+
+	/// Most packets routed for one router before the worker moves
+	/// on to the next one waiting
+	static const int MaxBatch = 16;
+
+private:
+	struct Entry
+	{
+		bool m_scheduled;	// queued for, or held by, a worker
+		bool m_pending;		// reads completed since last serviced
+
+		Entry() : m_scheduled(false), m_pending(false) {}
+	};
+
+	typedef std::map<SocketRoutingQueue*, Entry>	EntryMap;
+	typedef std::deque<SocketRoutingQueue*>		WorkQueue;
+	typedef std::vector<pthread_t>			ThreadList;
+
+	mutable pthread_mutex_t m_mutex;	// protects everything below
+	pthread_cond_t m_workCond;	// signalled when m_work grows
+	pthread_cond_t m_idleCond;	// signalled when a router is done
+
+	EntryMap m_entries;
+	WorkQueue m_work;
+	volatile bool m_stop;
+
+	pthread_t m_event_thread;
+	ThreadList m_workers;
+
+protected:
+	static void* EventThread(void *arg);
+	static void* WorkerThread(void *arg);
+	void HandleEvents();
+	void Work();
+	void Shutdown();
+
+	// Called from the read pipeline callback, from within
+	// libusb event handling, when queue has data to route
+	void Notify(SocketRoutingQueue &queue);
+
+	// Waits until no worker is servicing queue
+	void Quiesce(SocketRoutingQueue &queue);
+
+public:
+	/// Starts the event thread and the given number of worker
+	/// threads.  Throws Barry::ErrnoError if a thread cannot
+	/// be created.
+	explicit MultiRouter(int workers = 2);
+
+	/// Stops all threads, and detaches any routers still attached
+	~MultiRouter();
+
+	/// Attaches a router, whose device will be read by this pool
+	/// from its next SetUsbDevice() call.  Throws std::logic_error
+	/// if the router already has a device, or another pool.
+	void Add(SocketRoutingQueue &queue);
+
+	/// Detaches a router.  Its device must already be cleared.
+	void Remove(SocketRoutingQueue &queue);
+
+	/// Number of routers attached
+	size_t GetCount() const;
+};
+
+} // namespace Barry
+
+#endif
+
@@ -32,6 +32,7 @@
 #include "builder.h"
 #include "error.h"
 #include <string.h>
+#include <istream>
 
 #define __DEBUG_MODE__
 #include "debug.h"
@@ -686,6 +687,25 @@ int JLPacket::PutData(const void *data, uint16_t size)
 	return SimpleData(data, size);
 }
 
+int JLPacket::PutData(std::istream &input, uint16_t size)
+{
+	SimpleCmd(SB_COMMAND_JL_SEND_DATA, 0, size);
+
+	uint16_t total = size + 4;
+
+	MAKE_JLPACKETPTR_BUF(dpack, m_data.GetBuffer(total));
+
+	// socket class sets socket for us
+	dpack->size = htobs(total);
+	input.read((char*) dpack->u.raw, size);
+	if( input.fail() || (size_t) input.gcount() != size )
+		return 0;
+
+	m_data.ReleaseBuffer(total);
+
+	return m_last_set_size = 2;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 // JVMPacket class
@@ -25,6 +25,7 @@
 #define __BARRY_PACKET_H__
 
 #include <string>
+#include <iosfwd>
 #include <stdint.h>
 #include <unistd.h>
 #include "protocol.h"
@@ -243,6 +244,8 @@ public:
 	int ClearEventlog()	{ return SimpleCmd(SB_COMMAND_JL_CLEAR_LOG); }
 	int SaveModule(uint16_t id);
 	int PutData(const void *data, uint16_t size);
+	// reads straight into the packet, returns 0 on a short read
+	int PutData(std::istream &input, uint16_t size);
 	int WipeApps()		{ return SimpleCmd(SB_COMMAND_JL_WIPE_APPS); }
 	int WipeFs()		{ return SimpleCmd(SB_COMMAND_JL_WIPE_FS); }
 	int LogStackTraces()	{ return SimpleCmd(SB_COMMAND_JL_LOG_STRACES); }
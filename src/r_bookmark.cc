@@ -116,10 +116,10 @@ const unsigned char* Bookmark::ParseStruct1Field(const unsigned char *begin,
 				switch( type )
 				{
 				case BMK1SC_NAME:
-					Name = ParseFieldString(f->data, size);
+					ParseFieldString(Name, f->data, size);
 					break;
 				case BMK1SC_ICON:
-					Icon = ParseFieldString(f->data, size);
+					ParseFieldString(Icon, f->data, size);
 					break;
 				default:
 					throw std::logic_error("Bookmark: Check case statement. Should never happen.");
@@ -234,7 +234,7 @@ const unsigned char* Bookmark::ParseStruct2(const unsigned char *begin,
 	if( begin > end )	// if begin==end, we are ok
 		return begin;
 
-	Url = ParseFieldString(field->data, size);
+	ParseFieldString(Url, field->data, size);
 
 	// FIXME - more fields after this, but unknown meaning
 
@@ -317,6 +317,12 @@ void Bookmark::BuildFields(Data &data, size_t &offset, const IConverter *ic) con
 	// not yet implemented
 }
 
+size_t Bookmark::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void Bookmark::Dump(std::ostream &os) const
 {
 	ios_format_state state(os);
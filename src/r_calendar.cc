@@ -114,6 +114,7 @@ static FieldLink<Calendar> CalendarFieldLinks[] = {
    { CALFC_INVITED,    N_("Invited"),    0, 0,    0, &Calendar::Invited, 0, 0, 0, true },
    { CALFC_END,        N_("End of List"),0, 0,    0, 0, 0, 0, 0, false }
 };
+static FieldLinkTable<Calendar> CalendarFieldIndex(CalendarFieldLinks, CALFC_END);
 
 Calendar::Calendar()
 {
@@ -138,59 +139,53 @@ const unsigned char* Calendar::ParseField(const unsigned char *begin,
 	if( !btohs(field->size) )	// if field has no size, something's up
 		return begin;
 
-	// cycle through the type table
-	for(	FieldLink<Calendar> *b = CalendarFieldLinks;
-		b->type != CALFC_END;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;	// done!
-			}
-			else if( b->timeMember && btohs(field->size) == 4 ) {
-				TimeT &t = this->*(b->timeMember);
-				dout("min1900: " << field->u.min1900);
-				t.Time = min2time(field->u.min1900);
-				return begin;
-			}
-			else if( b->addrMember ) {
-				//
-				// parse email address
-				// get dual addr+name string first
-				// Note: this is a different format than
-				// used in r_message*.cc
-				//
-				std::string dual((const char*)field->u.raw, btohs(field->size));
-
-				EmailAddress a;
-
-				// assign first string, using null terminator
-				// letting std::string add it for us if it
-				// doesn't exist
-				a.Email = dual.c_str();
-
-				// assign second string, using first size
-				// as starting point
-				a.Name = dual.c_str() + a.Email.size() + 1;
-
-				// if the address is non-empty, add to list
-				if( a.size() ) {
-					// i18n convert if needed
-					if( b->iconvNeeded && ic ) {
-						a.Name = ic->FromBB(a.Name);
-						a.Email = ic->FromBB(a.Email);
-					}
-
-					EmailAddressList &al = this->*(b->addrMember);
-					al.push_back(a);
+	// look up the type table
+	const FieldLink<Calendar> *b = CalendarFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;	// done!
+		}
+		else if( b->timeMember && btohs(field->size) == 4 ) {
+			TimeT &t = this->*(b->timeMember);
+			dout("min1900: " << field->u.min1900);
+			t.Time = min2time(field->u.min1900);
+			return begin;
+		}
+		else if( b->addrMember ) {
+			//
+			// parse email address
+			// get dual addr+name string first
+			// Note: this is a different format than
+			// used in r_message*.cc
+			//
+			std::string dual((const char*)field->u.raw, btohs(field->size));
+
+			EmailAddress a;
+
+			// assign first string, using null terminator
+			// letting std::string add it for us if it
+			// doesn't exist
+			a.Email = dual.c_str();
+
+			// assign second string, using first size
+			// as starting point
+			a.Name = dual.c_str() + a.Email.size() + 1;
+
+			// if the address is non-empty, add to list
+			if( a.size() ) {
+				// i18n convert if needed
+				if( b->iconvNeeded && ic ) {
+					a.Name = ic->FromBB(a.Name);
+					a.Email = ic->FromBB(a.Email);
 				}
 
-				return begin;
+				EmailAddressList &al = this->*(b->addrMember);
+				al.push_back(a);
 			}
+
+			return begin;
 		}
 	}
 
@@ -381,6 +376,65 @@ void Calendar::BuildFields(Data &data, size_t &offset, const IConverter *ic) con
 	data.ReleaseBuffer(offset);
 }
 
+//
+// GetFieldsSize
+//
+/// Returns the size of the data BuildFields() builds, without building it,
+/// or 0 if a string would need converting to tell.
+///
+size_t Calendar::GetFieldsSize(const IConverter *ic) const
+{
+	FieldSizer sizer(ic);
+
+	// type field
+	sizer.Add(1);
+
+	if( AllDayEvent )
+		sizer.Add(1);
+
+	for(	const FieldLink<Calendar> *b = CalendarFieldLinks;
+		b->type != CALFC_END;
+		b++ )
+	{
+		if( b->strMember ) {
+			const std::string &s = this->*(b->strMember);
+			if( s.size() )
+				sizer.AddString(s, b->iconvNeeded);
+		}
+		else if( b->timeMember ) {
+			TimeT t = this->*(b->timeMember);
+			if( t.Time > 0 )
+				sizer.Add(COMMON_FIELD_MIN1900_SIZE);
+		}
+		else if( b->addrMember ) {
+			const EmailAddressList &al = this->*(b->addrMember);
+			EmailAddressList::const_iterator lb = al.begin(), le = al.end();
+			for( ; lb != le; ++lb ) {
+				// null terminated address, then name
+				if( lb->size() )
+					sizer.Add(lb->Email.size() + 1 +
+						lb->Name.size() + 1);
+			}
+		}
+	}
+
+	if( Recurring )
+		sizer.Add(CALENDAR_RECURRENCE_DATA_FIELD_SIZE);
+
+	if( TimeZoneValid )
+		sizer.Add(sizeof(TimeZoneCode));
+
+	// free/busy and class flags
+	sizer.Add(sizeof(uint8_t));
+	sizer.Add(sizeof(uint8_t));
+
+	if( CalendarID != (uint64_t) -1 )
+		sizer.Add(sizeof(CalendarID));
+
+	sizer.AddUnknowns(Unknowns);
+	return sizer.GetSize();
+}
+
 void Calendar::Clear()
 {
 	// clear the base class too
@@ -642,7 +696,7 @@ void CalendarAll::ParseHeader(const Data &data, size_t &offset)
 			continue;
 
 		case CALALLFC_MAIL_ACCOUNT:
-			MailAccount = ParseFieldString(field);
+			ParseFieldString(MailAccount, field);
 			continue;
 
 		case CALALLFC_UNIQUEID:
@@ -85,6 +85,7 @@ static FieldLink<CallLog> CallLogFieldLinks[] = {
     { CLLFC_CONTACT_NAME,  N_("Contact name"),  0, 0, &CallLog::ContactName, 0, 0, 0, 0, true },
     { CLLFC_END,           N_("End of List"),   0, 0, 0, 0, 0, 0, 0, false }
 };
+static FieldLinkTable<CallLog> CallLogFieldIndex(CallLogFieldLinks, CLLFC_END);
 
 CallLog::CallLog()
 {
@@ -121,24 +122,18 @@ const unsigned char* CallLog::ParseField(const unsigned char *begin,
 	if( field->type == CLLFC_UNIQUEID)
 		return begin;
 
-	// cycle through the type table
-	for(    FieldLink<CallLog> *b = CallLogFieldLinks;
-		b->type != CLLFC_END;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;   // done!
-			}
-			else if( b->timeMember && btohs(field->size) == 4 ) {
-				TimeT &t = this->*(b->timeMember);
-				t.Time = min2time(field->u.min1900);
-				return begin;
-			}
+	// look up the type table
+	const FieldLink<CallLog> *b = CallLogFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;   // done!
+		}
+		else if( b->timeMember && btohs(field->size) == 4 ) {
+			TimeT &t = this->*(b->timeMember);
+			t.Time = min2time(field->u.min1900);
+			return begin;
 		}
 	}
 
@@ -247,6 +242,12 @@ void CallLog::BuildFields(Data &data, size_t &offset, const IConverter *ic) cons
 	// not yet implemented
 }
 
+size_t CallLog::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void CallLog::Dump(std::ostream &os) const
 {
 	ios_format_state state(os);
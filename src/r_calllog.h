@@ -117,6 +117,7 @@ public:
 	void ParseFields(const Data &data, size_t &offset, const IConverter *ic = 0);
 	void BuildHeader(Data &data, size_t &offset) const;
 	void BuildFields(Data &data, size_t &offset, const IConverter *ic = 0) const;
+	size_t GetFieldsSize(const IConverter *ic = 0) const;
 
 	// operations (common among record classes)
 	void Clear();
@@ -148,6 +148,7 @@ static FieldLink<Contact> ContactFieldLinks[] = {
    { CFC_IMAGE,        N_("Image"),      0,0,                 &Contact::Image, 0, 0, 0, 0, false },
    { CFC_INVALID_FIELD,N_("EndOfList"),  0, 0, 0, 0, 0, 0, 0, false }
 };
+static FieldLinkTable<Contact> ContactFieldIndex(ContactFieldLinks, CFC_INVALID_FIELD);
 
 Contact::Contact()
 	: RecType(Contact::GetDefaultRecType()),
@@ -174,40 +175,32 @@ const unsigned char* Contact::ParseField(const unsigned char *begin,
 	if( !btohs(field->size) )	// if field has no size, something's up
 		return begin;
 
-	// cycle through the type table
-	for(	FieldLink<Contact> *b = ContactFieldLinks;
-		b->type != CFC_INVALID_FIELD;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;	// done!
-			}
-			else if( b->postMember && b->postField ) {
-				std::string &s = (this->*(b->postMember)).*(b->postField);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;
-			}
-			else {
-				break;	// fall through to special handling
-			}
+	// look up the type table
+	const FieldLink<Contact> *b = ContactFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;	// done!
 		}
+		else if( b->postMember && b->postField ) {
+			std::string &s = (this->*(b->postMember)).*(b->postField);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;
+		}
+		// otherwise fall through to special handling
 	}
 
 	// if not found in the type table, check for special handling
 	switch( field->type )
 	{
 	case CFC_EMAIL: {
-		std::string s = ParseFieldString(field);
-		if( ic )
-			s = ic->FromBB(s);
-		EmailAddresses.push_back( s );
+		// only add the address once it has parsed, then swap
+		// it in, so it is still only copied once
+		std::string s;
+		ParseFieldString(s, field, ic);
+		EmailAddresses.push_back(std::string());
+		EmailAddresses.back().swap(s);
 		}
 		return begin;
 
@@ -224,9 +217,7 @@ const unsigned char* Contact::ParseField(const unsigned char *begin,
 			m_FirstNameSeen = true;
 		}
 
-		*name = ParseFieldString(field);
-		if( ic )
-			*name = ic->FromBB(*name);
+		ParseFieldString(*name, field, ic);
 		}
 		return begin;
 
@@ -243,9 +234,8 @@ const unsigned char* Contact::ParseField(const unsigned char *begin,
 		return begin;
 
 	case CFC_CATEGORY: {
-		std::string catstring = ParseFieldString(field);
-		if( ic )
-			catstring = ic->FromBB(catstring);
+		std::string catstring;
+		ParseFieldString(catstring, field, ic);
 		Categories.CategoryStr2List(catstring);
 		}
 		return begin;
@@ -413,6 +403,66 @@ void Contact::BuildFields(Data &data, size_t &offset, const IConverter *ic) cons
 	data.ReleaseBuffer(offset);
 }
 
+//
+// GetFieldsSize
+//
+/// Returns the size of the data BuildFields() builds, without building it,
+/// or 0 if a string would need converting to tell.
+///
+size_t Contact::GetFieldsSize(const IConverter *ic) const
+{
+	FieldSizer sizer(ic);
+
+	if( GroupLinks.size() )
+		sizer.Add(1);
+
+	if( FirstName.size() )
+		sizer.AddString(FirstName, true);
+	if( LastName.size() ) {
+		if( !FirstName.size() )
+			sizer.AddString(std::string());
+		sizer.AddString(LastName, true);
+	}
+
+	sizer.Add(sizeof(RecordId));
+
+	EmailList::const_iterator eai = EmailAddresses.begin();
+	for( ; eai != EmailAddresses.end(); ++eai ) {
+		if( eai->size() )
+			sizer.AddString(*eai, true);
+	}
+
+	for(	FieldLink<Contact> *b = ContactFieldLinks;
+		b->type != CFC_INVALID_FIELD;
+		b++ )
+	{
+		if( b->strMember ) {
+			const std::string &field = this->*(b->strMember);
+			if( field.size() )
+				sizer.AddString(field, b->iconvNeeded);
+		}
+		else if( b->postMember && b->postField ) {
+			const std::string &field = (this->*(b->postMember)).*(b->postField);
+			if( field.size() )
+				sizer.AddString(field, b->iconvNeeded);
+		}
+	}
+
+	for( size_t i = 0; i < GroupLinks.size(); i++ )
+		sizer.Add(sizeof(Barry::Protocol::GroupLink));
+
+	if( Categories.size() )
+		sizer.AddCategories(Categories);
+
+	if( Birthday.HasData() )
+		sizer.AddString(Birthday.ToBBString());
+	if( Anniversary.HasData() )
+		sizer.AddString(Anniversary.ToBBString());
+
+	sizer.AddUnknowns(Unknowns);
+	return sizer.GetSize();
+}
+
 void Contact::Clear()
 {
 	RecType = GetDefaultRecType();
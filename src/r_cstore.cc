@@ -78,7 +78,7 @@ const unsigned char* ContentStore::ParseField(const unsigned char *begin,
 	switch( field->type )
 	{
 	case CSFC_FILENAME:
-		Filename = ParseFieldString(field);
+		ParseFieldString(Filename, field);
 		return begin;
 
 	case CSFC_FOLDER_FLAG:
@@ -196,6 +196,40 @@ void ContentStore::BuildFields(Data &data, size_t &offset, const IConverter *ic)
 	data.ReleaseBuffer(offset);
 }
 
+//
+// GetFieldsSize
+//
+/// Returns the size of the data BuildFields() builds, without building it,
+/// or 0 if a string would need converting to tell.
+///
+size_t ContentStore::GetFieldsSize(const IConverter *ic) const
+{
+	FieldSizer sizer(ic);
+
+	sizer.AddString(Filename);
+
+	if( FolderFlag ) {
+		sizer.AddString(string("folder"));
+	}
+	else {
+		// descriptor, and the 64 bit content size
+		sizer.Add(FileDescriptor.size());
+		sizer.Add(sizeof(uint64_t));
+
+		// content, in blocks of MAX_CONTENT_BLOCK_SIZE bytes
+		for( size_t foff = 0; foff < FileContent.size(); ) {
+			size_t blocksize = FileContent.size() - foff;
+			if( blocksize > MAX_CONTENT_BLOCK_SIZE )
+				blocksize = MAX_CONTENT_BLOCK_SIZE;
+			sizer.Add(blocksize);
+			foff += blocksize;
+		}
+	}
+
+	sizer.AddUnknowns(Unknowns);
+	return sizer.GetSize();
+}
+
 void ContentStore::Clear()
 {
 	RecType = GetDefaultRecType();
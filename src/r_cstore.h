@@ -98,6 +98,7 @@ public:
 	void ParseFields(const Data &data, size_t &offset, const IConverter *ic = 0);
 	void BuildHeader(Data &data, size_t &offset) const;
 	void BuildFields(Data &data, size_t &offset, const IConverter *ic = 0) const;
+	size_t GetFieldsSize(const IConverter *ic = 0) const;
 	static const char * GetDBName() { return "Content Store"; }
 	static uint8_t GetDefaultRecType() { return 0; }
 
@@ -84,6 +84,7 @@ static FieldLink<Folder> FolderFieldLinks[] = {
     { FFC_NAME, N_("FolderName"),  0, 0, &Folder::Name, 0, 0, 0, 0, true },
     { FFC_END,  N_("End of List"), 0, 0, 0, 0, 0, 0, 0, false },
 };
+static FieldLinkTable<Folder> FolderFieldIndex(FolderFieldLinks, FFC_END);
 
 Folder::Folder()
 {
@@ -109,24 +110,18 @@ const unsigned char* Folder::ParseField(const unsigned char *begin,
 	if( !btohs(field->size) )   // if field has no size, something's up
 		return begin;
 
-	// cycle through the type table
-	for(    FieldLink<Folder> *b = FolderFieldLinks;
-		b->type != FFC_END;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;   // done!
-			}
-			else if( b->timeMember && btohs(field->size) == 4 ) {
-				TimeT &t = this->*(b->timeMember);
-				t.Time= min2time(field->u.min1900);
-				return begin;
-			}
+	// look up the type table
+	const FieldLink<Folder> *b = FolderFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;   // done!
+		}
+		else if( b->timeMember && btohs(field->size) == 4 ) {
+			TimeT &t = this->*(b->timeMember);
+			t.Time= min2time(field->u.min1900);
+			return begin;
 		}
 	}
 	// handle special cases
@@ -179,6 +174,12 @@ void Folder::BuildFields(Data &data, size_t &offset, const IConverter *ic) const
 	// not yet implemented
 }
 
+size_t Folder::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void Folder::Clear()
 {
 	RecType = GetDefaultRecType();
@@ -156,9 +156,7 @@ const unsigned char* HandheldAgent::ParseField(const unsigned char *begin,
 		if( b->type == field->type ) {
 			if( b->strMember ) {
 				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
+				ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
 				return begin;	// done!
 			}
 			else if( b->timeMember && btohs(field->size) == 4 ) {
@@ -249,6 +247,12 @@ void HandheldAgent::BuildFields(Data &data, size_t &offset, const IConverter *ic
 {
 }
 
+size_t HandheldAgent::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void HandheldAgent::Clear()
 {
 	// clear our fields
@@ -51,6 +51,7 @@ static FieldLink<Memo> MemoFieldLinks[] = {
     { MEMFC_BODY,   N_("Body"),        0, 0, &Memo::Body, 0, 0, 0, 0, true },
     { MEMFC_END,    N_("End of List"), 0, 0, 0, 0, 0, 0, 0, false }
 };
+static FieldLinkTable<Memo> MemoFieldIndex(MemoFieldLinks, MEMFC_END);
 
 Memo::Memo()
 {
@@ -83,24 +84,18 @@ const unsigned char* Memo::ParseField(const unsigned char *begin,
 	}
 
 
-	// cycle through the type table
-	for(    FieldLink<Memo> *b = MemoFieldLinks;
-		b->type != MEMFC_END;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;   // done!
-			}
-			else if( b->timeMember && btohs(field->size) == 4 ) {
-				TimeT &t = this->*(b->timeMember);
-				t.Time = min2time(field->u.min1900);
-				return begin;
-			}
+	// look up the type table
+	const FieldLink<Memo> *b = MemoFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;   // done!
+		}
+		else if( b->timeMember && btohs(field->size) == 4 ) {
+			TimeT &t = this->*(b->timeMember);
+			t.Time = min2time(field->u.min1900);
+			return begin;
 		}
 	}
 	// handle special cases
@@ -108,9 +103,8 @@ const unsigned char* Memo::ParseField(const unsigned char *begin,
 	{
 	case MEMFC_CATEGORY:
 		{
-			std::string catstring = ParseFieldString(field);
-			if( ic )
-				catstring = ic->FromBB(catstring);
+			std::string catstring;
+			ParseFieldString(catstring, field, ic);
 			Categories.CategoryStr2List(catstring);
 		}
 		return begin;
@@ -200,6 +194,42 @@ void Memo::BuildFields(Data &data, size_t &offset, const IConverter *ic) const
 	data.ReleaseBuffer(offset);
 }
 
+//
+// GetFieldsSize
+//
+/// Returns the size of the data BuildFields() builds, without building it,
+/// or 0 if a string would need converting to tell.
+///
+size_t Memo::GetFieldsSize(const IConverter *ic) const
+{
+	FieldSizer sizer(ic);
+
+	// 'm' memo type field
+	sizer.Add(1);
+
+	if( Categories.size() )
+		sizer.AddCategories(Categories);
+
+	for(	FieldLink<Memo> *b = MemoFieldLinks;
+		b->type != MEMFC_END;
+		b++ )
+	{
+		if( b->strMember ) {
+			const std::string &field = this->*(b->strMember);
+			if( field.size() )
+				sizer.AddString(field, b->iconvNeeded);
+		}
+		else if( b->postMember && b->postField ) {
+			const std::string &field = (this->*(b->postMember)).*(b->postField);
+			if( field.size() )
+				sizer.AddString(field, b->iconvNeeded);
+		}
+	}
+
+	sizer.AddUnknowns(Unknowns);
+	return sizer.GetSize();
+}
+
 
 
 void Memo::Dump(std::ostream &os) const
@@ -88,6 +88,7 @@ static FieldLink<MessageBase> MessageBaseFieldLinks[] = {
    { MBFC_ATTACHMENT,N_("Attachment"),   0, 0, &MessageBase::Attachment, 0, 0, 0, 0, false },
    { MBFC_END,       N_("End of List"),  0, 0, 0, 0, 0, 0, 0, false }
 };
+static FieldLinkTable<MessageBase> MessageBaseFieldIndex(MessageBaseFieldLinks, MBFC_END);
 
 MessageBase::MessageBase()
 {
@@ -112,50 +113,44 @@ const unsigned char* MessageBase::ParseField(const unsigned char *begin,
 	if( !btohs(field->size) )	// if field has no size, something's up
 		return begin;
 
-	// cycle through the type table
-	for(	FieldLink<MessageBase> *b = MessageBaseFieldLinks;
-		b->type != MBFC_END;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				// parse regular string
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;	// done!
-			}
-			else if( b->addrMember ) {
-				// parse email address
-				// get dual name+addr string first
-				const char *fa = (const char*)field->u.addr.addr;
-				std::string dual(fa, btohs(field->size) - sizeof(field->u.addr.unknown));
-
-				// assign first string, using null terminator
-				// letting std::string add it for us if it
-				// doesn't exist
-				EmailAddress a;
-				a.Name = dual.c_str();
-
-				// assign second string, using first size
-				// as starting point
-				a.Email = dual.c_str() + a.Name.size() + 1;
-
-				// if the address is non-empty, add to list
-				if( a.size() ) {
-					// i18n convert if needed
-					if( b->iconvNeeded && ic ) {
-						a.Name = ic->FromBB(a.Name);
-						a.Email = ic->FromBB(a.Email);
-					}
-
-					EmailAddressList &al = this->*(b->addrMember);
-					al.push_back(a);
+	// look up the type table
+	const FieldLink<MessageBase> *b = MessageBaseFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			// parse regular string
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;	// done!
+		}
+		else if( b->addrMember ) {
+			// parse email address
+			// get dual name+addr string first
+			const char *fa = (const char*)field->u.addr.addr;
+			std::string dual(fa, btohs(field->size) - sizeof(field->u.addr.unknown));
+
+			// assign first string, using null terminator
+			// letting std::string add it for us if it
+			// doesn't exist
+			EmailAddress a;
+			a.Name = dual.c_str();
+
+			// assign second string, using first size
+			// as starting point
+			a.Email = dual.c_str() + a.Name.size() + 1;
+
+			// if the address is non-empty, add to list
+			if( a.size() ) {
+				// i18n convert if needed
+				if( b->iconvNeeded && ic ) {
+					a.Name = ic->FromBB(a.Name);
+					a.Email = ic->FromBB(a.Email);
 				}
 
-				return begin;
+				EmailAddressList &al = this->*(b->addrMember);
+				al.push_back(a);
 			}
+
+			return begin;
 		}
 	}
 
@@ -283,6 +278,12 @@ void MessageBase::BuildFields(Data &data, size_t &offset, const IConverter *ic)
 	throw std::logic_error(_("MessageBase::BuildFields not yet implemented"));
 }
 
+size_t MessageBase::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void MessageBase::Clear()
 {
 	// these must be overwritten by any derived classes
@@ -118,7 +118,7 @@ const unsigned char* ServiceBookConfig::ParseField(const unsigned char *begin,
 		if( b->type == type ) {
 			if( b->strMember ) {
 				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(raw, size-1);
+				ParseFieldString(s, raw, size-1);
 				return begin;	// done!
 			}
 		}
@@ -182,6 +182,12 @@ void ServiceBookConfig::BuildFields(Data &data, size_t &offset, const IConverter
 	throw std::logic_error(_("ServiceBookConfig::Build not yet implemented"));
 }
 
+size_t ServiceBookConfig::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void ServiceBookConfig::Clear()
 {
 	Format = 0;
@@ -293,9 +299,7 @@ FieldLink<RecordT>* ParseFieldByTable(RecordT *rec,
 				if( s.size() ) {
 					dout(RecordT::GetDBName() << ": field '" << b->name << "' already has data (" << s << "). Overwriting.");
 				}
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
+				ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
 				return links;
 			}
 			else if( b->timeMember && btohs(field->size) == 4 ) {
@@ -423,6 +427,12 @@ void ServiceBook::BuildFields(Data &data, size_t &offset, const IConverter *ic)
 	throw std::logic_error(_("ServiceBook::BuildFields not yet implemented"));
 }
 
+size_t ServiceBook::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void ServiceBook::Clear()
 {
 	m_data->m_typeSet = ServiceBookOldFieldLinks;
@@ -241,6 +241,12 @@ void Sms::BuildFields(Data &data, size_t &offset, const IConverter *ic) const
 	// not yet implemented
 }
 
+size_t Sms::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void Sms::Clear()
 {
 	RecType = GetDefaultRecType();
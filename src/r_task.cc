@@ -111,6 +111,7 @@ static FieldLink<Task> TaskFieldLinks[] = {
    { TSKFC_ALARM_TIME, N_("Alarm Time"),  0, 0, 0, 0, &Task::AlarmTime, 0, 0, false },
    { TSKFC_END,        N_("End of List"), 0, 0, 0, 0, 0, 0, 0, false },
 };
+static FieldLinkTable<Task> TaskFieldIndex(TaskFieldLinks, TSKFC_END);
 
 Task::Task()
 {
@@ -142,24 +143,18 @@ const unsigned char* Task::ParseField(const unsigned char *begin,
 		return begin;
 	}
 
-	// cycle through the type table
-	for(    FieldLink<Task> *b = TaskFieldLinks;
-		b->type != TSKFC_END;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;   // done!
-			}
-			else if( b->timeMember && btohs(field->size) == 4 ) {
-				TimeT &t = this->*(b->timeMember);
-				t.Time = min2time(field->u.min1900);
-				return begin;
-			}
+	// look up the type table
+	const FieldLink<Task> *b = TaskFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;   // done!
+		}
+		else if( b->timeMember && btohs(field->size) == 4 ) {
+			TimeT &t = this->*(b->timeMember);
+			t.Time = min2time(field->u.min1900);
+			return begin;
 		}
 	}
 
@@ -219,9 +214,8 @@ const unsigned char* Task::ParseField(const unsigned char *begin,
 
 	case TSKFC_CATEGORIES:
 		{
-			std::string catstring = ParseFieldString(field);
-			if( ic )
-				catstring = ic->FromBB(catstring);
+			std::string catstring;
+			ParseFieldString(catstring, field, ic);
 			Categories.CategoryStr2List(catstring);
 		}
 		return begin;
@@ -349,6 +343,56 @@ void Task::BuildFields(Data &data, size_t &offset, const IConverter *ic) const
 	data.ReleaseBuffer(offset);
 }
 
+//
+// GetFieldsSize
+//
+/// Returns the size of the data BuildFields() builds, without building it,
+/// or 0 if a string would need converting to tell.
+///
+size_t Task::GetFieldsSize(const IConverter *ic) const
+{
+	FieldSizer sizer(ic);
+
+	// 't' task type field
+	sizer.Add(1);
+
+	if( Summary.size() )
+		sizer.AddString(Summary, true);
+
+	// status and priority
+	sizer.Add(sizeof(uint32_t));
+	sizer.Add(sizeof(uint32_t));
+
+	if( TimeZoneValid )
+		sizer.Add(sizeof(uint32_t));
+
+	if( DueTime.IsValid() ) {
+		// start time, due flag, due time
+		sizer.Add(COMMON_FIELD_MIN1900_SIZE);
+		sizer.Add(sizeof(uint32_t));
+		sizer.Add(COMMON_FIELD_MIN1900_SIZE);
+	}
+
+	if( AlarmTime.IsValid() ) {
+		// alarm flag, alarm type, alarm time
+		sizer.Add(sizeof(uint32_t));
+		sizer.Add(sizeof(uint8_t));
+		sizer.Add(COMMON_FIELD_MIN1900_SIZE);
+	}
+
+	if( Categories.size() )
+		sizer.AddCategories(Categories);
+
+	if( Notes.size() )
+		sizer.AddString(Notes, true);
+
+	if( Recurring )
+		sizer.Add(CALENDAR_RECURRENCE_DATA_FIELD_SIZE);
+
+	sizer.AddUnknowns(Unknowns);
+	return sizer.GetSize();
+}
+
 
 
 void Task::Clear()
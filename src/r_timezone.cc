@@ -59,6 +59,7 @@ static FieldLink<TimeZone> TimeZoneFieldLinks[] = {
    { TZFC_NAME,  N_("Name"),        0, 0, &TimeZone::Name, 0, 0, 0, 0, true },
    { TZFC_END,   N_("End of List"), 0, 0, 0, 0, 0, 0, 0, false },
 };
+static FieldLinkTable<TimeZone> TimeZoneFieldIndex(TimeZoneFieldLinks, TZFC_END);
 
 TimeZone::TimeZone()
 {
@@ -113,19 +114,13 @@ const unsigned char* TimeZone::ParseField(const unsigned char *begin,
 		return begin;
 	}
 
-	// cycle through the type table
-	for(    FieldLink<TimeZone> *b = TimeZoneFieldLinks;
-		b->type != TZFC_END;
-		b++ )
-	{
-		if( b->type == field->type ) {
-			if( b->strMember ) {
-				std::string &s = this->*(b->strMember);
-				s = ParseFieldString(field);
-				if( b->iconvNeeded && ic )
-					s = ic->FromBB(s);
-				return begin;   // done!
-			}
+	// look up the type table
+	const FieldLink<TimeZone> *b = TimeZoneFieldIndex[field->type];
+	if( b ) {
+		if( b->strMember ) {
+			std::string &s = this->*(b->strMember);
+			ParseFieldString(s, field, b->iconvNeeded ? ic : 0);
+			return begin;   // done!
 		}
 	}
 
@@ -191,6 +186,12 @@ void TimeZone::BuildFields(Data &data, size_t &offset, const IConverter *ic) con
 	// not yet implemented
 }
 
+size_t TimeZone::GetFieldsSize(const IConverter *ic) const
+{
+	// not yet implemented
+	return 0;
+}
+
 void TimeZone::Clear()
 {
 	RecType = GetDefaultRecType();
@@ -87,6 +87,39 @@ struct FieldLink
 	bool iconvNeeded;
 };
 
+//
+// FieldLinkTable
+//
+/// Index of a FieldLink array by field type, so that ParseField() can
+/// find the link for each field without scanning the whole array.
+/// Define one as a static next to the array it indexes.  As with a
+/// scan, the first link with a given type wins.
+///
+template <class RecordT>
+class FieldLinkTable
+{
+	const FieldLink<RecordT> *m_links[256];
+
+public:
+	FieldLinkTable(const FieldLink<RecordT> *links, int end_type)
+	{
+		for( int i = 0; i < 256; i++ )
+			m_links[i] = 0;
+
+		for( ; links->type != end_type; links++ ) {
+			if( links->type >= 0 && links->type < 256 &&
+			    !m_links[links->type] )
+				m_links[links->type] = links;
+		}
+	}
+
+	/// Returns 0 if no link has this type
+	const FieldLink<RecordT>* operator[](uint8_t type) const
+	{
+		return m_links[type];
+	}
+};
+
 void BuildField1900(Data &data, size_t &size, uint8_t type, time_t t);
 inline void BuildField1900(Data &data, size_t &size, uint8_t type, const Barry::TimeT &t)
 {
@@ -101,8 +134,54 @@ void BuildField(Data &data, size_t &size, uint8_t type, const std::string &str);
 void BuildField(Data &data, size_t &size, uint8_t type, const void *buf, size_t bufsize);
 void BuildField(Data &data, size_t &size, const Barry::UnknownField &field);
 void BuildField(Data &data, size_t &size, uint8_t type, const Barry::Protocol::GroupLink &link);
+
+//
+// FieldSizer
+//
+/// Adds up the sizes of the fields built by the BuildField() functions
+/// above, for use in each record's GetFieldsSize().  A string that
+/// would need a real iconv conversion can't be measured without
+/// converting it twice, once here and once when building, so then
+/// the total is unknown, and GetSize() returns 0.
+///
+class FieldSizer
+{
+	const IConverter *m_ic;
+	size_t m_size;
+	bool m_known;
+
+public:
+	explicit FieldSizer(const IConverter *ic)
+		: m_ic(ic)
+		, m_size(0)
+		, m_known(true)
+	{
+	}
+
+	/// Adds a field holding datasize bytes
+	void Add(size_t datasize)
+	{
+		m_size += COMMON_FIELD_HEADER_SIZE + datasize;
+	}
+
+	/// Adds a null terminated string field, converted with the
+	/// IConverter if convert is true
+	void AddString(const std::string &str, bool convert = false);
+
+	/// Adds the string field built by CategoryList2Str()
+	void AddCategories(const Barry::CategoryList &cats);
+
+	void AddUnknowns(const Barry::UnknownsType &unknowns);
+
+	size_t GetSize() const { return m_known ? m_size : 0; }
+};
+
 std::string ParseFieldString(const Barry::Protocol::CommonField *field);
 std::string ParseFieldString(const void *data, uint16_t maxlen);
+void ParseFieldString(std::string &dest,
+	const Barry::Protocol::CommonField *field, const IConverter *ic = 0);
+void ParseFieldString(std::string &dest, const void *data, uint16_t maxlen,
+	const IConverter *ic = 0);
 
 
 // Functions to help build JDWP command packets
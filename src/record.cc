@@ -32,6 +32,7 @@
 #include "trim.h"
 #include "ios_state.h"
 #include "parser.h"
+#include "iconv.h"
 #include <sstream>
 #include <iomanip>
 #include <time.h>
@@ -239,6 +240,73 @@ std::string ParseFieldString(const void *data, uint16_t maxlen)
 	return std::string(str, maxlen);
 }
 
+//
+// ParseFieldString
+//
+/// Same as above, but stores the string straight into dest, converting
+/// it with ic if given, instead of returning a copy.  The field data is
+/// only copied once, into dest itself.
+///
+void ParseFieldString(std::string &dest,
+			const Barry::Protocol::CommonField *field,
+			const IConverter *ic)
+{
+	ParseFieldString(dest, field->u.raw, btohs(field->size), ic);
+}
+
+void ParseFieldString(std::string &dest, const void *data, uint16_t maxlen,
+			const IConverter *ic)
+{
+	const char *str = (const char *)data;
+
+	while( maxlen && str[maxlen-1] == 0 )
+		maxlen--;
+
+	if( ic )
+		ic->FromBB(str, maxlen, dest);
+	else
+		dest.assign(str, maxlen);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// FieldSizer class
+
+void FieldSizer::AddString(const std::string &str, bool convert)
+{
+	if( convert && m_ic && !m_ic->IsPassthrough(str) )
+		m_known = false;
+
+	// include null terminator
+	Add(str.size() + 1);
+}
+
+void FieldSizer::AddCategories(const Barry::CategoryList &cats)
+{
+	// same joining as CategoryList2Str(), without building the string
+	size_t size = 0;
+	Barry::CategoryList::const_iterator i = cats.begin();
+	for( ; i != cats.end(); ++i ) {
+		if( m_ic && !m_ic->IsPassthrough(*i) )
+			m_known = false;
+		if( size )
+			size += 2;
+		size += i->size();
+	}
+
+	// include null terminator
+	Add(size + 1);
+}
+
+void FieldSizer::AddUnknowns(const Barry::UnknownsType &unknowns)
+{
+	UnknownsType::const_iterator
+		ub = unknowns.begin(), ue = unknowns.end();
+	for( ; ub != ue; ub++ ) {
+		Add(ub->data.raw_data.size());
+	}
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // UnknownField
@@ -21,6 +21,9 @@
 
 #include "i18n.h"
 #include "restore.h"
+#include "backupmanifest.h"
+#include "backupindex.h"
+#include "backupstore.h"
 #include "tarfile.h"
 #include "error.h"
 #include <sstream>
@@ -28,6 +31,8 @@
 #include <iostream>
 #include <string.h>
 #include <algorithm>
+#include <set>
+#include <map>
 
 using namespace std;
 
@@ -64,8 +69,339 @@ namespace {
 		return count;
 	}
 
+	// same as CountFiles(), but using an incremental backup's
+	// manifest instead of scanning the tarball
+	int CountManifest(const Barry::BackupManifest &manifest,
+			const Barry::Restore::DBListType &restoreList,
+			Barry::Restore::DBListType *available,
+			bool default_all_db)
+	{
+		int count = 0;
+
+		const Barry::BackupManifest::DatabaseArrayType &dbs =
+			manifest.GetDatabases();
+		for( Barry::BackupManifest::DatabaseArrayType::const_iterator
+				i = dbs.begin();
+			i != dbs.end();
+			++i )
+		{
+			unsigned int live = i->GetLiveCount();
+			if( live == 0 )
+				continue;	// nothing in tarball for this db
+
+			bool good = (default_all_db && restoreList.size() == 0) ||
+				restoreList.IsSelected(i->Name);
+			if( good ) {
+				if( available )
+					available->push_back(i->Name);
+				count += live;
+			}
+		}
+		return count;
+	}
+
+	// same as CountFiles(), but using a store snapshot
+	int CountSnapshot(const Barry::BackupSnapshot &snapshot,
+			const Barry::Restore::DBListType &restoreList,
+			Barry::Restore::DBListType *available,
+			bool default_all_db)
+	{
+		int count = 0;
+
+		const Barry::BackupSnapshot::DatabaseArrayType &dbs =
+			snapshot.GetDatabases();
+		for( Barry::BackupSnapshot::DatabaseArrayType::const_iterator
+				i = dbs.begin();
+			i != dbs.end();
+			++i )
+		{
+			bool good = (default_all_db && restoreList.size() == 0) ||
+				restoreList.IsSelected(i->Name);
+			if( good ) {
+				if( available )
+					available->push_back(i->Name);
+				count += i->Entries.size();
+			}
+		}
+		return count;
+	}
+
+	// same as CountFiles(), but using the tarball's index
+	int CountIndex(const Barry::BackupIndex &index,
+			const Barry::Restore::DBListType &restoreList,
+			Barry::Restore::DBListType *available,
+			bool default_all_db)
+	{
+		int count = 0;
+
+		const Barry::BackupIndex::DatabaseArrayType &dbs =
+			index.GetDatabases();
+		for( Barry::BackupIndex::DatabaseArrayType::const_iterator
+				i = dbs.begin();
+			i != dbs.end();
+			++i )
+		{
+			bool good = (default_all_db && restoreList.size() == 0) ||
+				restoreList.IsSelected(i->Name);
+			if( good ) {
+				if( available )
+					available->push_back(i->Name);
+				count += i->Entries.size();
+			}
+		}
+		return count;
+	}
+
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// RestoreChain class
+
+//
+// RestoreChain
+//
+/// The backups of an incremental chain, newest first, and which of
+/// them holds the newest copy of each record the restore needs.
+/// Nothing but file names and positions is read up front... each
+/// record is read from its backup by Read(), when asked for.
+///
+/// Records in a backup with an index are found with Seek().  In
+/// other backups, they are found by skipping over the files before
+/// them, so reading in restore order only rewinds a backup if the
+/// chain lists its records in a different order than it stores them.
+///
+class BXLOCAL RestoreChain
+{
+public:
+	typedef std::vector<std::string>		NameList;
+
+private:
+	static const size_t NoOrdinal = (size_t) -1;
+
+	struct Archive
+	{
+		std::string Path;
+		bool Indexed;
+		reuse::TarFile *Tar;	// opened on first Read()
+		size_t Next;		// ordinal of the next file in Tar
+	};
+
+	struct Source
+	{
+		size_t Archive;		// in m_archives
+		size_t Ordinal;		// order of the file in its backup
+		reuse::TarOffset Position;	// only if indexed
+	};
+
+	typedef std::vector<Archive>			ArchiveList;
+	typedef std::map<std::string, Source>		SourceMap;
+
+	ArchiveList m_archives;
+	SourceMap m_sources;
+	NameList m_names;		// in restore order
+
+	RestoreChain(const RestoreChain &other);	// not copyable
+	RestoreChain& operator=(const RestoreChain &other);
+
+protected:
+	void AddArchive(const std::string &path,
+		std::set<std::string> &wanted);
+	void Claim(const std::string &name, size_t ordinal,
+		const reuse::TarOffset &pos, std::set<std::string> &wanted);
+
+public:
+	/// Follows the chain back from tarpath, whose manifest is
+	/// given, until every record it lists is found.  Throws
+	/// RestoreError if the chain loops, and BackupError or
+	/// TarError if a backup cannot be read.
+	RestoreChain(const std::string &tarpath,
+		const BackupManifest &manifest);
+	~RestoreChain();
+
+	/// Names of the records to restore, in restore order
+	const NameList& GetNames() const { return m_names; }
+
+	/// Reads the newest copy of the named record into data.
+	/// Throws RestoreError if no backup in the chain has it,
+	/// and TarError on file errors.
+	void Read(const std::string &name, Data &data);
+};
+
+RestoreChain::RestoreChain(const std::string &tarpath,
+				const BackupManifest &manifest)
+{
+	std::set<std::string> wanted;
+
+	const BackupManifest::DatabaseArrayType &dbs = manifest.GetDatabases();
+	for( BackupManifest::DatabaseArrayType::const_iterator db = dbs.begin();
+		db != dbs.end();
+		++db )
+	{
+		for( BackupManifest::RecordArrayType::const_iterator
+				r = db->Records.begin();
+			r != db->Records.end();
+			++r )
+		{
+			if( r->Status == BackupManifest::Deleted )
+				continue;
+
+			std::string name = r->GetTarName(db->Name);
+			if( wanted.insert(name).second )
+				m_names.push_back(name);
+		}
+	}
+
+	try {
+		std::set<std::string> visited;
+		std::string path = tarpath;
+		while( wanted.size() && path.size() ) {
+			if( !visited.insert(path).second )
+				throw Barry::RestoreError(_("Restore: backup chain refers back to itself: ") + path);
+
+			AddArchive(path, wanted);
+
+			// find the next link in the chain
+			BackupManifest base;
+			if( path == tarpath )
+				path = BackupManifest::ResolveBase(path, manifest.GetBase());
+			else if( base.ReadFromTar(path) )
+				path = BackupManifest::ResolveBase(path, base.GetBase());
+			else
+				path.clear();
+		}
+	}
+	catch( ... ) {
+		for( size_t i = 0; i < m_archives.size(); i++ )
+			delete m_archives[i].Tar;
+		throw;
+	}
+
+	// anything still wanted is reported by Read(), and only if
+	// the restore actually gets to it
+}
+
+RestoreChain::~RestoreChain()
+{
+	for( size_t i = 0; i < m_archives.size(); i++ )
+		delete m_archives[i].Tar;
+}
+
+//
+// AddArchive
+//
+/// Lists the records in the backup at path, from its index if it has
+/// one, and claims the ones still wanted for it.
+///
+void RestoreChain::AddArchive(const std::string &path,
+				std::set<std::string> &wanted)
+{
+	Archive archive;
+	archive.Path = path;
+	archive.Indexed = false;
+	archive.Tar = 0;
+	archive.Next = NoOrdinal;
+	m_archives.push_back(archive);
+
+	reuse::TarFile tar(path.c_str(), false,
+		reuse::TarFile::GetReadOps(path), true);
+
+	BackupIndex index;
+	if( index.ReadFromTar(path, tar) ) {
+		m_archives.back().Indexed = true;
+
+		// records are stored in index order
+		size_t ordinal = 0;
+		const BackupIndex::DatabaseArrayType &dbs = index.GetDatabases();
+		for( BackupIndex::DatabaseArrayType::const_iterator
+				db = dbs.begin();
+			db != dbs.end();
+			++db )
+		{
+			for( BackupIndex::EntryArrayType::const_iterator
+					e = db->Entries.begin();
+				e != db->Entries.end();
+				++e, ++ordinal )
+			{
+				BackupManifest::Record rec;
+				rec.UniqueId = e->UniqueId;
+				rec.RecType = e->RecType;
+				Claim(rec.GetTarName(db->Name), ordinal,
+					e->Position, wanted);
+			}
+		}
+	}
+	else {
+		std::string name;
+		for( size_t ordinal = 0; tar.ReadNextFilenameOnly(name); ordinal++ )
+			Claim(name, ordinal, reuse::TarOffset(), wanted);
+	}
+}
+
+void RestoreChain::Claim(const std::string &name, size_t ordinal,
+			const reuse::TarOffset &pos,
+			std::set<std::string> &wanted)
+{
+	// the newest backup holding a record is searched first,
+	// so the first claim wins
+	if( !wanted.erase(name) )
+		return;
+
+	Source &source = m_sources[name];
+	source.Archive = m_archives.size() - 1;
+	source.Ordinal = ordinal;
+	source.Position = pos;
+}
+
+void RestoreChain::Read(const std::string &name, Data &data)
+{
+	SourceMap::const_iterator i = m_sources.find(name);
+	if( i == m_sources.end() )
+		throw Barry::RestoreError(_("Restore: record missing from backup chain: ") + name);
+
+	const Source &source = i->second;
+	Archive &archive = m_archives[source.Archive];
+
+	if( archive.Indexed ) {
+		if( !archive.Tar ) {
+			archive.Tar = new reuse::TarFile(archive.Path.c_str(),
+				false, reuse::TarFile::GetReadOps(archive.Path),
+				true);
+		}
+
+		// no need to seek if it follows the last one read
+		if( source.Ordinal != archive.Next )
+			archive.Tar->Seek(source.Position);
+	}
+	else {
+		// without an index, going back means starting over
+		if( archive.Tar && source.Ordinal < archive.Next ) {
+			delete archive.Tar;
+			archive.Tar = 0;
+		}
+		if( !archive.Tar ) {
+			archive.Tar = new reuse::TarFile(archive.Path.c_str(),
+				false, reuse::TarFile::GetReadOps(archive.Path),
+				true);
+			archive.Next = 0;
+		}
+
+		std::string skipped;
+		for( ; archive.Next < source.Ordinal; archive.Next++ ) {
+			if( !archive.Tar->ReadNextFilenameOnly(skipped) )
+				break;
+		}
+	}
+
+	// whatever happens, the position is unknown until read
+	archive.Next = NoOrdinal;
+
+	std::string filename;
+	if( !archive.Tar->ReadNextFile(filename, data) || filename != name )
+		throw Barry::RestoreError(_("Restore: backup changed while restoring: ") + archive.Path);
+	archive.Next = source.Ordinal + 1;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 // Static Restore members
 
@@ -104,14 +440,42 @@ Restore::Restore(const std::string &tarpath, bool default_all_db)
 	, m_tar_record_state(RS_EMPTY)
 	, m_rec_type(0)
 	, m_unique_id(0)
+	, m_chain_pos(0)
+	, m_index_db(0)
+	, m_index_rec(0)
+	, m_index_seek(true)
+	, m_snap_db(0)
+	, m_snap_rec(0)
 {
 	try {
+		if( BackupSnapshot::IsSnapshot(tarpath) ) {
+			m_store.reset( new BackupStore(
+				BackupStore::GetStorePath(tarpath)) );
+			m_snapshot.reset( new BackupSnapshot );
+			m_snapshot->Load(tarpath);
+			return;
+		}
+
+		std::auto_ptr<BackupManifest> manifest(new BackupManifest);
+		if( manifest->ReadFromTar(tarpath) && manifest->IsIncremental() ) {
+			m_chain.reset( new RestoreChain(tarpath, *manifest) );
+			m_manifest = manifest;
+			return;
+		}
+
 		m_tar.reset( new reuse::TarFile(tarpath.c_str(), false,
-					&reuse::gztar_ops_nonthread, true) );
+					reuse::TarFile::GetReadOps(tarpath), true) );
+
+		std::auto_ptr<BackupIndex> index(new BackupIndex);
+		if( index->ReadFromTar(tarpath, *m_tar) )
+			m_index = index;
 	}
 	catch( reuse::TarFile::TarError &te ) {
 		throw Barry::RestoreError(te.what());
 	}
+	catch( Barry::BackupError &be ) {
+		throw Barry::RestoreError(be.what());
+	}
 }
 
 Restore::~Restore()
@@ -135,6 +499,86 @@ bool Restore::IsSelected(const std::string &dbName) const
 		return m_dbList.IsSelected(dbName);
 }
 
+/// Reads the next record file, either from the tarball or from the
+/// incremental chain.  Returns false at the end.
+bool Restore::ReadNextFile(std::string &filename, Data &record_data)
+{
+	if( m_snapshot.get() ) {
+		// only load what is selected
+		const BackupSnapshot::DatabaseArrayType &dbs =
+			m_snapshot->GetDatabases();
+		while( m_snap_db < dbs.size() ) {
+			const BackupSnapshot::Database &db = dbs[m_snap_db];
+			if( m_snap_rec >= db.Entries.size() || !IsSelected(db.Name) ) {
+				m_snap_db++;
+				m_snap_rec = 0;
+				continue;
+			}
+
+			const BackupSnapshot::Entry &entry = db.Entries[m_snap_rec++];
+			filename = entry.GetTarName(db.Name);
+			try {
+				m_store->LoadObject(entry.Hash, record_data);
+			}
+			catch( Barry::BackupError &be ) {
+				throw Barry::RestoreError(be.what());
+			}
+			return true;
+		}
+		return false;
+	}
+
+	if( m_index.get() ) {
+		// only read what is selected, seeking past the rest
+		const BackupIndex::DatabaseArrayType &dbs = m_index->GetDatabases();
+		while( m_index_db < dbs.size() ) {
+			const BackupIndex::Database &db = dbs[m_index_db];
+			if( m_index_rec >= db.Entries.size() ) {
+				m_index_db++;
+				m_index_rec = 0;
+				continue;
+			}
+			if( !IsSelected(db.Name) ) {
+				m_index_db++;
+				m_index_rec = 0;
+				m_index_seek = true;
+				continue;
+			}
+
+			const BackupIndex::Entry &entry = db.Entries[m_index_rec++];
+			if( m_index_seek ) {
+				m_tar->Seek(entry.Position);
+				m_index_seek = false;
+			}
+			return m_tar->ReadNextFile(filename, record_data);
+		}
+		return false;
+	}
+
+	if( !m_chain.get() ) {
+		while( m_tar->ReadNextFile(filename, record_data) ) {
+			if( filename != BackupManifest::TarName &&
+			    filename != BackupIndex::TarName )
+				return true;
+		}
+		return false;
+	}
+
+	// only read what is selected
+	const RestoreChain::NameList &names = m_chain->GetNames();
+	while( m_chain_pos < names.size() ) {
+		filename = names[m_chain_pos++];
+
+		std::string::size_type pos = filename.rfind('/');
+		if( pos == std::string::npos || !IsSelected(filename.substr(0, pos)) )
+			continue;
+
+		m_chain->Read(filename, record_data);
+		return true;
+	}
+	return false;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 // Restore - Public API
@@ -200,6 +644,14 @@ void Restore::SkipCurrentDB()
 
 unsigned int Restore::GetRecordTotal() const
 {
+	// answer from what the constructor loaded, if possible
+	if( m_snapshot.get() )
+		return CountSnapshot(*m_snapshot, m_dbList, 0, m_default_all_db);
+	if( m_manifest.get() )
+		return CountManifest(*m_manifest, m_dbList, 0, m_default_all_db);
+	if( m_index.get() )
+		return CountIndex(*m_index, m_dbList, 0, m_default_all_db);
+
 	return GetRecordTotal(m_tarpath, m_dbList, m_default_all_db);
 }
 
@@ -212,20 +664,48 @@ unsigned int Restore::GetRecordTotal(const std::string &tarpath,
 	std::auto_ptr<reuse::TarFile> tar;
 
 	try {
+		if( BackupSnapshot::IsSnapshot(tarpath) ) {
+			BackupSnapshot snapshot;
+			snapshot.Load(tarpath);
+			return CountSnapshot(snapshot, dbList, 0, default_all_db);
+		}
+
 		// do a scan through the tar file
+		BackupManifest manifest;
+		if( manifest.ReadFromTar(tarpath) && manifest.IsIncremental() )
+			return CountManifest(manifest, dbList, 0, default_all_db);
+
 		tar.reset( new reuse::TarFile(tarpath.c_str(), false,
-				&reuse::gztar_ops_nonthread, true) );
+				reuse::TarFile::GetReadOps(tarpath), true) );
+
+		BackupIndex index;
+		if( index.ReadFromTar(tarpath, *tar) )
+			return CountIndex(index, dbList, 0, default_all_db);
+
 		count = CountFiles(*tar, dbList, 0, default_all_db);
 	}
 	catch( reuse::TarFile::TarError &te ) {
 		throw Barry::RestoreError(te.what());
 	}
+	catch( Barry::BackupError &be ) {
+		throw Barry::RestoreError(be.what());
+	}
 	return count;
 }
 
 Barry::Restore::DBListType Restore::GetDBList() const
 {
-	return GetDBList(m_tarpath);
+	// answer from what the constructor loaded, if possible
+	DBListType available, empty;
+	if( m_snapshot.get() )
+		CountSnapshot(*m_snapshot, empty, &available, true);
+	else if( m_manifest.get() )
+		CountManifest(*m_manifest, empty, &available, true);
+	else if( m_index.get() )
+		CountIndex(*m_index, empty, &available, true);
+	else
+		return GetDBList(m_tarpath);
+	return available;
 }
 
 Barry::Restore::DBListType Restore::GetDBList(const std::string &tarpath)
@@ -234,15 +714,131 @@ Barry::Restore::DBListType Restore::GetDBList(const std::string &tarpath)
 	DBListType available, empty;
 
 	try {
+		if( BackupSnapshot::IsSnapshot(tarpath) ) {
+			BackupSnapshot snapshot;
+			snapshot.Load(tarpath);
+			CountSnapshot(snapshot, empty, &available, true);
+			return available;
+		}
+
+		BackupManifest manifest;
+		if( manifest.ReadFromTar(tarpath) && manifest.IsIncremental() ) {
+			CountManifest(manifest, empty, &available, true);
+			return available;
+		}
+
 		// do a scan through the tar file
 		tar.reset( new reuse::TarFile(tarpath.c_str(), false,
-				&reuse::gztar_ops_nonthread, true) );
-		CountFiles(*tar, empty, &available, true);
+				reuse::TarFile::GetReadOps(tarpath), true) );
+
+		BackupIndex index;
+		if( index.ReadFromTar(tarpath, *tar) )
+			CountIndex(index, empty, &available, true);
+		else
+			CountFiles(*tar, empty, &available, true);
 		return available;
 	}
 	catch( reuse::TarFile::TarError &te ) {
 		throw Barry::RestoreError(te.what());
 	}
+	catch( Barry::BackupError &be ) {
+		throw Barry::RestoreError(be.what());
+	}
+}
+
+bool Restore::FindRecord(const std::string &dbName,
+			uint32_t uniqueId,
+			DBData &data) const
+{
+	try {
+		if( m_snapshot.get() ) {
+			const BackupSnapshot::Entry *entry =
+				m_snapshot->Find(dbName, uniqueId);
+			if( !entry )
+				return false;
+
+			m_store->LoadObject(entry->Hash, data.UseData());
+			data.SetVersion(Barry::DBData::REC_VERSION_1);
+			data.SetDBName(dbName);
+			data.SetIds(entry->RecType, uniqueId);
+			data.SetOffset(0);
+			return true;
+		}
+
+		// follow incremental backups back to the one that
+		// actually stores the record
+		std::set<std::string> visited;
+		std::string path = m_tarpath;
+		BackupManifest manifest;
+		while( manifest.ReadFromTar(path) && manifest.IsIncremental() ) {
+			if( !visited.insert(path).second )
+				throw Barry::RestoreError(_("Restore: backup chain refers back to itself: ") + path);
+
+			const BackupManifest::Database *db = manifest.FindDB(dbName);
+			if( !db )
+				return false;
+
+			BackupManifest::RecordArrayType::const_iterator r = db->Records.begin();
+			for( ; r != db->Records.end(); ++r ) {
+				if( r->UniqueId == uniqueId )
+					break;
+			}
+			if( r == db->Records.end() || r->Status == BackupManifest::Deleted )
+				return false;
+			if( r->Status == BackupManifest::Stored )
+				break;
+
+			path = BackupManifest::ResolveBase(path, manifest.GetBase());
+		}
+
+		return FindRecordIn(path, dbName, uniqueId, data);
+	}
+	catch( reuse::TarFile::TarError &te ) {
+		throw Barry::RestoreError(te.what());
+	}
+	catch( Barry::BackupError &be ) {
+		throw Barry::RestoreError(be.what());
+	}
+}
+
+/// Loads a record from the given tarball alone, using its index
+/// if it has one.  Throws TarError on file errors.
+bool Restore::FindRecordIn(const std::string &tarpath,
+				const std::string &dbName,
+				uint32_t uniqueId,
+				DBData &data)
+{
+	reuse::TarFile tar(tarpath.c_str(), false,
+		reuse::TarFile::GetReadOps(tarpath), true);
+
+	BackupIndex index;
+	bool indexed = index.ReadFromTar(tarpath, tar);
+	if( indexed ) {
+		const BackupIndex::Entry *entry = index.Find(dbName, uniqueId);
+		if( !entry )
+			return false;
+		tar.Seek(entry->Position);
+	}
+
+	std::string filename, dbname, id_text;
+	uint8_t rectype;
+	uint32_t id;
+	while( tar.ReadNextFile(filename, data.UseData()) ) {
+		if( SplitTarPath(filename, dbname, id_text, rectype, id) &&
+		    dbname == dbName && id == uniqueId )
+		{
+			data.SetVersion(Barry::DBData::REC_VERSION_1);
+			data.SetDBName(dbname);
+			data.SetIds(rectype, id);
+			data.SetOffset(0);
+			return true;
+		}
+
+		// the index pointed right at it, so no point going on
+		if( indexed )
+			break;
+	}
+	return false;
 }
 
 bool Restore::GetNextMeta(DBData &data)
@@ -285,7 +881,7 @@ Restore::RetrievalState Restore::Retrieve(Data &record_data)
 	for(;;) {
 		// load record data from tar file
 		std::string filename;
-		if( !m_tar->ReadNextFile(filename, record_data) ) {
+		if( !ReadNextFile(filename, record_data) ) {
 			// assume end of file
 			return m_tar_record_state = RS_EOF;
 		}
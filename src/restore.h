@@ -36,13 +36,20 @@ namespace reuse {
 
 namespace Barry {
 
+class BackupManifest;
+class BackupIndex;
+class RestoreChain;
+class BackupStore;
+class BackupSnapshot;
+
 //
 // Restore
 //
 /// Barry Backup Restore builder class.  This class is suitable
 /// to be used as a builder object anywhere a builder object is
-/// accepted.  It reads from a Barry Backup tar.gz backup file,
-/// and builds records in a staged manner.
+/// accepted.  It reads from a Barry Backup tarball, compressed with
+/// gzip, zstd, or lz4 (detected automatically), and builds records
+/// in a staged manner.
 ///
 /// If a backup file contains more than one database (for example
 /// both Address Book and Calendar), then it will build one database
@@ -61,6 +68,21 @@ namespace Barry {
 ///	- then call Retrieve(), which will grab the first record,
 ///	  and make GetDBName() valid.
 ///
+/// If the backup file is an incremental backup (see BackupManifest),
+/// the constructor follows its chain of base backups, and notes which
+/// one holds the newest copy of each record listed in the manifest.
+/// Each record is read from there when the restore reaches it, so
+/// the restore produces the complete databases as they were when the
+/// last incremental backup was made.
+///
+/// The path may also name a snapshot in a BackupStore, in which
+/// case records are loaded from the store as they are needed.
+///
+/// If the backup file has an index (see Backup), Restore uses it
+/// to skip over databases that are not selected, and to answer
+/// GetRecordTotal(), GetDBList(), and FindRecord() without reading
+/// the whole file.
+///
 class BXEXPORT Restore : public Barry::Builder
 {
 public:
@@ -92,14 +114,34 @@ private:
 	Barry::Data m_record_data;
 	std::string m_tar_id_text;
 
+	// incremental backup chain, if that is what we are reading
+	std::auto_ptr<BackupManifest> m_manifest;
+	std::auto_ptr<RestoreChain> m_chain;
+	size_t m_chain_pos;		//< next record name to restore
+
+	// record index, if the tarball has one
+	std::auto_ptr<BackupIndex> m_index;
+	size_t m_index_db, m_index_rec;	//< next entry to read
+	bool m_index_seek;		//< true if entries were skipped
+
+	// snapshot in a deduplicated backup store, if that is
+	// what we are reading from
+	std::auto_ptr<BackupStore> m_store;
+	std::auto_ptr<BackupSnapshot> m_snapshot;
+	size_t m_snap_db, m_snap_rec;	//< next entry to read
+
 protected:
 	static bool SplitTarPath(const std::string &tarpath,
 		std::string &dbname, std::string &dbid_text,
 		uint8_t &dbrectype, uint32_t &dbid);
 
 	bool IsSelected(const std::string &dbName) const;
+	bool ReadNextFile(std::string &filename, Data &record_data);
 	RetrievalState Retrieve(Data &record_data);
 
+	static bool FindRecordIn(const std::string &tarpath,
+		const std::string &dbName, uint32_t uniqueId, DBData &data);
+
 
 public:
 	/// If default_all_db is true, and none of the Add*() functions
@@ -131,9 +173,10 @@ public:
 	// Skip the current DB, in case of error, or preference
 	void SkipCurrentDB();
 
-	/// Loads the given file, and counts all records according
-	/// to the current read filter.  Does not use the main
-	/// Restore file, but opens the file separately.
+	/// Counts all records according to the current read filter.
+	/// Uses the manifest, index, or snapshot the constructor
+	/// loaded, if any, and otherwise opens the file separately,
+	/// without disturbing the main Restore file.
 	/// It is safe to call this function as often as needed.
 	unsigned int GetRecordTotal() const;
 
@@ -141,15 +184,23 @@ public:
 	static unsigned int GetRecordTotal(const std::string &tarpath,
 		const DBListType &dbList, bool default_all_db);
 
-	/// Loads the given file, and creates a DBListType list of
-	/// all database names available in the tarball, using no filters.
-	/// Does not use the main Restore file, but opens the file separately.
+	/// Creates a DBListType list of all database names available
+	/// in the tarball, using no filters.  Like GetRecordTotal(),
+	/// only opens the file separately if the constructor loaded
+	/// nothing that can answer.
 	/// It is safe to call this function as often as needed.
 	DBListType GetDBList() const;
 
 	/// Static version of GetDBList()
 	static DBListType GetDBList(const std::string &tarpath);
 
+	/// Loads a single record, given its database name and unique ID,
+	/// into data.  Does not use the main Restore file, but opens
+	/// the file separately, so it does not disturb the current
+	/// restore.  Returns false if the record is not in the backup.
+	bool FindRecord(const std::string &dbName, uint32_t uniqueId,
+		DBData &data) const;
+
 	/// If this function returns true, it fills data with the
 	/// meta data that the next call to BuildRecord() will retrieve.
 	/// This is useful for applications that need to setup a manual
@@ -28,6 +28,7 @@
 #include "usbwrap.h"
 #include "endian.h"
 #include "debug.h"
+#include "multirouter.h"
 #include <unistd.h>
 #include <iostream>
 #include <iomanip>
@@ -54,6 +55,8 @@ SocketRoutingQueue::SocketDataHandler::~SocketDataHandler()
 ///////////////////////////////////////////////////////////////////////////////
 // SocketRoutingQueue constructors
 
+const int SocketRoutingQueue::MaxReadAhead;
+
 SocketRoutingQueue::SocketRoutingQueue(int prealloc_buffer_count,
 					int default_read_timeout)
 	: m_dev(0)
@@ -62,6 +65,10 @@ SocketRoutingQueue::SocketRoutingQueue(int prealloc_buffer_count,
 	, m_interest(false)
 	, m_seen_usb_error(false)
 	, m_timeout(default_read_timeout)
+	, m_pipeline_depth(0)
+	, m_pipeline_running(false)
+	, m_pool(0)
+	, m_polled(false)
 	, m_continue_reading(false)
 {
 	pthread_mutex_init(&m_mutex, NULL);
@@ -74,6 +81,13 @@ SocketRoutingQueue::SocketRoutingQueue(int prealloc_buffer_count,
 
 SocketRoutingQueue::~SocketRoutingQueue()
 {
+	// stop any pool from servicing us... Remove() clears m_pool
+	scoped_lock lock(m_mutex);
+	MultiRouter *pool = m_pool;
+	lock.unlock();
+	if( pool )
+		pool->Remove(*this);
+
 	// thread running?
 	if( m_continue_reading ) {
 		m_continue_reading = false;
@@ -83,11 +97,15 @@ SocketRoutingQueue::~SocketRoutingQueue()
 	// dump all unused packets to debug output
 	SocketQueueMap::const_iterator b = m_socketQueues.begin();
 	for( ; b != m_socketQueues.end(); ++b ) {
-		DumpSocketQueue(b->first, b->second->m_queue);
+		SalvageSocketQueue(b->first, b->second->m_queue);
 	}
 	if( m_default.size() ) {
 		ddout("(Default queue is socket 0)");
-		DumpSocketQueue(0, m_default);
+		SalvageSocketQueue(0, m_default);
+	}
+	if( m_deferred.size() ) {
+		ddout("(Undelivered data packets)");
+		SalvageSocketQueue(0, m_deferred);
 	}
 }
 
@@ -102,8 +120,10 @@ SocketRoutingQueue::~SocketRoutingQueue()
 /// from its destructor.
 void SocketRoutingQueue::ReturnBuffer(Data *buf)
 {
-	// don't need to lock here, since m_free handles its own locking
-	m_free.push(buf);
+	// don't need to lock here, since m_free is safe from any thread...
+	// and if it is full, we have plenty of buffers already
+	if( !m_free.try_push(buf) )
+		delete buf;
 }
 
 //
@@ -132,16 +152,21 @@ bool SocketRoutingQueue::QueuePacket(SocketId socket, DataHandle &buf)
 				if( (qi->second->m_type & DataPackets) == 0 )
 					return false;
 			}
-			qi->second->m_queue.push(buf.release());
-			return true;
+			CountPacket(*qi->second, *buf.get());
+			return QueuePacket(qi->second->m_queue, buf);
 		}
 	}
 
 	return false;
 }
 
-bool SocketRoutingQueue::QueuePacket(DataQueue &queue, DataHandle &buf)
+bool SocketRoutingQueue::QueuePacket(DataRing &queue, DataHandle &buf)
 {
+	// short packets, like sequence packets, should not tie up
+	// a full sized read buffer while they wait in a queue...
+	// the big block goes back to the pool for the next read
+	buf->ShrinkToFit();
+
 	// don't need to lock here, since queue handles its own locking
 	queue.push(buf.release());
 	return true;
@@ -166,6 +191,7 @@ bool SocketRoutingQueue::RouteOrQueuePacket(SocketId socket, DataHandle &buf)
 		SocketQueueMap::iterator qi = m_socketQueues.find(socket);
 		if( qi != m_socketQueues.end() ) {
 			SocketDataHandlerPtr &sdh = qi->second->m_handler;
+			CountPacket(*qi->second, *buf.get());
 
 			// is there a handler?
 			if( sdh ) {
@@ -180,8 +206,7 @@ bool SocketRoutingQueue::RouteOrQueuePacket(SocketId socket, DataHandle &buf)
 				return true;
 			}
 			else {
-				qi->second->m_queue.push(buf.release());
-				return true;
+				return QueuePacket(qi->second->m_queue, buf);
 			}
 		}
 	}
@@ -189,6 +214,278 @@ bool SocketRoutingQueue::RouteOrQueuePacket(SocketId socket, DataHandle &buf)
 	return false;
 }
 
+//
+// QueueDefault
+//
+/// Puts a packet nobody registered for on the default queue.
+///
+void SocketRoutingQueue::QueueDefault(DataHandle &buf)
+{
+	m_metrics.Default.Packets++;
+	m_metrics.Default.Bytes += buf->GetSize();
+
+	QueuePacket(m_default, buf);
+
+	size_t depth = m_default.size();
+	if( depth > m_metrics.Default.MaxDepth )
+		m_metrics.Default.MaxDepth = depth;
+}
+
+//
+// CountPacket
+//
+/// Updates a socket's counters for a packet about to be queued or
+/// handled.  Must be called with m_mutex held.
+///
+void SocketRoutingQueue::CountPacket(QueueEntry &entry, const Data &data)
+{
+	entry.m_packets++;
+	entry.m_bytes += data.GetSize();
+
+	// counting the packet about to be pushed
+	size_t depth = entry.m_handler ? 0 : entry.m_queue.size() + 1;
+	if( depth > entry.m_max_depth )
+		entry.m_max_depth = depth;
+}
+
+//
+// GetFreeBuffer
+//
+/// Returns a buffer from the free queue, or a new one if it is empty,
+/// ready for a full sized USB read.
+///
+DataHandle SocketRoutingQueue::GetFreeBuffer()
+{
+	Data *raw = m_free.pop();
+	DataHandle buf(*this, raw ? raw : new Data);
+
+	// buffers recycled through the swapping DefaultRead() and
+	// SocketRead() calls come from the application, and may
+	// be small or external, so make sure there is room for
+	// a full packet before reading straight into it
+	Data &data = *buf.get();
+	data.QuickZap();
+	data.GetBuffer(BARRY_DATA_DEFAULT_SIZE);
+	return buf;
+}
+
+//
+// RoutePacket
+//
+/// Sorts a freshly read packet by priority.  Socket zero carries the
+/// control traffic, such as sequence acks, open and close responses
+/// and password challenges, which other threads are usually waiting
+/// on with a timeout, so it is delivered right away.  Data packets
+/// are held in m_deferred, in order, until DeliverDeferred() gets to
+/// them, so that a slow socket handler cannot hold up control
+/// packets read after its data.
+///
+/// A close must not overtake data read before it, so it delivers
+/// all held data first.  Neither may a sequence packet, which is
+/// queued on the socket it names, so that socket's held data goes
+/// ahead of it.
+///
+void SocketRoutingQueue::RoutePacket(DataHandle &buf)
+{
+	Data &data = *buf.get();
+
+	m_metrics.PacketsRead++;
+	m_metrics.BytesRead += data.GetSize();
+
+	// make sure the size is right
+	if( data.GetSize() < SB_PACKET_SOCKET_SIZE )
+		return;	// bad size, just skip
+
+	MAKE_PACKET(pack, data);
+	if( pack->socket != 0 ) {
+		m_deferred.push(buf.release());
+		if( m_deferred.size() > m_metrics.DeferredMaxDepth )
+			m_metrics.DeferredMaxDepth = m_deferred.size();
+		return;
+	}
+
+	if( data.GetSize() >= SB_PACKET_HEADER_SIZE &&
+	    (pack->command == SB_COMMAND_CLOSE_SOCKET ||
+	     pack->command == SB_COMMAND_REMOTE_CLOSE_SOCKET) )
+	{
+		int none = 0;
+		DeliverDeferred(0, 0, none);
+	}
+	else if( Protocol::IsSequencePacket(data) &&
+		 pack->u.sequence.socket != 0 )
+	{
+		DeliverDeferredFor(pack->u.sequence.socket);
+	}
+
+	DeliverPacket(buf);
+}
+
+//
+// DeliverDeferred
+//
+/// Delivers the data packets held by RoutePacket(), oldest first.
+/// If dev is not null, reads that have already completed on readEp
+/// are routed between deliveries, at most budget of them, so control
+/// packets wait for no more than one socket handler call.
+///
+void SocketRoutingQueue::DeliverDeferred(Usb::Device *dev, int readEp,
+					int &budget)
+{
+	while( Data *raw = m_deferred.pop() ) {
+		DataHandle buf(*this, raw);
+		DeliverPacket(buf);
+
+		while( dev && budget > 0 ) {
+			DataHandle next = GetFreeBuffer();
+			if( !dev->PollRead(readEp, *next.get()) )
+				break;
+			budget--;
+			RoutePacket(next);
+		}
+	}
+}
+
+//
+// DeliverDeferredFor
+//
+/// Delivers the held data packets for one socket, oldest first.
+/// Packets for other sockets stay held, in their original order.
+///
+void SocketRoutingQueue::DeliverDeferredFor(SocketId socket)
+{
+	// cycle through the ring once, pulling out this socket's
+	// packets, before delivering anything... a throwing handler
+	// must not leave the rest of the ring out of order
+	std::vector<Data*> mine;
+	for( size_t count = m_deferred.size(); count; count-- ) {
+		Data *raw = m_deferred.pop();
+		if( !raw )
+			break;
+
+		MAKE_PACKET(pack, *raw);
+		if( btohs(pack->socket) == socket )
+			mine.push_back(raw);
+		else
+			m_deferred.push(raw);
+	}
+
+	size_t i = 0;
+	try {
+		for( ; i < mine.size(); i++ ) {
+			DataHandle buf(*this, mine[i]);
+			DeliverPacket(buf);
+		}
+	}
+	catch( ... ) {
+		// the failed one was freed by its DataHandle
+		for( i++; i < mine.size(); i++ ) {
+			DataHandle buf(*this, mine[i]);
+		}
+		throw;
+	}
+}
+
+//
+// DeliverPacket
+//
+/// Sends a packet to its socket's handler or queue, or to the
+/// default queue if nobody is interested in it.
+///
+void SocketRoutingQueue::DeliverPacket(DataHandle &buf)
+{
+	Data &data = *buf.get();
+	MAKE_PACKET(pack, data);
+
+	// extract the socket from the packet
+	uint16_t socket = btohs(pack->socket);
+
+	// if this is a sequence packet, handle it specially
+	if( Protocol::IsSequencePacket(data) ) {
+		// sequence.socket is a single byte
+		socket = pack->u.sequence.socket;
+
+		//////////////////////////////////////////////
+		// ALWAYS queue sequence packets, so that
+		// the socket code can handle SyncSend()
+		if( !QueuePacket(socket, buf) ) {
+			// if no queue available for this
+			// socket, send it to the default
+			// queue
+			QueueDefault(buf);
+		}
+
+		// done with sequence packet
+		return;
+	}
+
+	// we have data, now route or queue it
+	if( RouteOrQueuePacket(socket, buf) )
+		return; // done
+
+	// if we get here, send to default queue
+	QueueDefault(buf);
+}
+
+//
+// ReportUsbError
+//
+/// Stops reading, and passes a USB read error on to every handler.
+///
+void SocketRoutingQueue::ReportUsbError(Usb::Error &ue)
+{
+	// set the flag first, in case any of the handlers
+	// are able to recover from this error
+	m_seen_usb_error = true;
+	m_metrics.UsbErrors++;
+
+	// this is unexpected, but we're in a thread here...
+	// Need to iterate through all the registered handlers
+	// calling their error callback.
+	// Can't be locked when calling the callback, so need
+	// to make a list of them first.
+	scoped_lock lock(m_mutex);
+	std::vector<SocketDataHandlerPtr> handlers;
+	SocketQueueMap::iterator qi = m_socketQueues.begin();
+	while( qi != m_socketQueues.end() ) {
+		SocketDataHandlerPtr &sdh = qi->second->m_handler;
+		// is there a handler?
+		if( sdh ) {
+			handlers.push_back(sdh);
+		}
+		++qi;
+	}
+
+	SocketDataHandlerPtr usb_error_handler = m_usb_error_dev_callback;
+
+	lock.unlock();
+	std::vector<SocketDataHandlerPtr>::iterator hi = handlers.begin();
+	while( hi != handlers.end() ) {
+		(*hi)->Error(ue);
+		++hi;
+	}
+
+	// and finally, call the specific error callback if available
+	if( usb_error_handler.get() ) {
+		usb_error_handler->Error(ue);
+	}
+}
+
+//
+// ReadReady
+//
+/// Read pipeline callback, runs inside libusb event handling
+/// when a read completes.  Hands the router to its MultiRouter.
+///
+void SocketRoutingQueue::ReadReady(void *userptr)
+{
+	SocketRoutingQueue *q = (SocketRoutingQueue *)userptr;
+
+	// m_pool is cleared under the lock when detaching
+	scoped_lock lock(q->m_mutex);
+	if( q->m_pool )
+		q->m_pool->Notify(*q);
+}
+
 //
 // SimpleReadThread()
 //
@@ -214,16 +511,21 @@ void *SocketRoutingQueue::SimpleReadThread(void *userptr)
 	return 0;
 }
 
-void SocketRoutingQueue::DumpSocketQueue(SocketId socket, const DataQueue &dq)
+void SocketRoutingQueue::SalvageSocketQueue(SocketId socket, DataRing &dq)
 {
 	// dump a record of any unused packets in the queue, for debugging
 	if( dq.size() ) {
 		ddout(_("SocketRoutingQueue Leftovers: ")
 			<< dec << dq.size()
 			<< _(" packet(s) for socket: ") << "0x"
-			<< hex << (unsigned int) socket
-			<< "\n"
-			<< dq);
+			<< hex << (unsigned int) socket);
+	}
+
+	// the ring can't be walked while a reader may be popping,
+	// so dump each packet as it comes off
+	while( Data *buf = dq.pop() ) {
+		ddout(*buf);
+		ReturnBuffer(buf);
 	}
 }
 
@@ -238,23 +540,92 @@ void SocketRoutingQueue::SetUsbDevice(Usb::Device *dev, int writeEp, int readEp,
 					SocketDataHandlerPtr callback)
 {
 	scoped_lock lock(m_mutex);
+
+	// start the read pipeline before DoRead() can see the device...
+	// a MultiRouter needs to hear about each completed read
+	m_polled = false;
+	m_pipeline_running = false;
+	if( dev && m_pipeline_depth ) {
+		if( dev->StartReadPipeline(readEp, m_pipeline_depth, 0,
+				m_pool ? &ReadReady : 0, this) ) {
+			m_pipeline_running = true;
+			m_polled = m_pool != 0;
+		}
+		else
+			dout("SocketRoutingQueue: read pipeline not available, using synchronous reads");
+	}
+	bool fallback = dev && m_pool && !m_polled;
+
 	m_dev = dev;
 	m_usb_error_dev_callback = callback;
 	m_writeEp = writeEp;
 	m_readEp = readEp;
+	lock.unlock();
+
+	// a MultiRouter can only service pipelined devices, so
+	// without one, go back to a read thread of our own
+	if( fallback )
+		SpinoffSimpleReadThread();
 }
 
 void SocketRoutingQueue::ClearUsbDevice()
 {
 	scoped_lock lock(m_mutex);
+	Usb::Device *dev = m_dev;
+	bool polled = m_polled;
+	bool pipelined = m_pipeline_running;
 	m_dev = 0;
+	m_polled = false;
+	m_pipeline_running = false;
 	m_usb_error_dev_callback.reset();
 	lock.unlock();
 
 	// wait for the DoRead cycle to finish, so the external
 	// Usb::Device object doesn't close before we're done with it
-	scoped_lock wait(m_readwaitMutex);
-	pthread_cond_wait(&m_readwaitCond, &m_readwaitMutex);
+	if( polled ) {
+		// there is no read cycle, only a pool worker
+		// that may be in the middle of DoPolledRead()
+		m_pool->Quiesce(*this);
+	}
+	else {
+		scoped_lock wait(m_readwaitMutex);
+		pthread_cond_wait(&m_readwaitCond, &m_readwaitMutex);
+		wait.unlock();
+	}
+
+	// DoRead() no longer touches the device, so it is safe to
+	// take down the pipeline from this thread
+	if( dev && pipelined )
+		dev->StopReadPipeline();
+}
+
+//
+// ClearUsbError
+//
+/// Resumes reading after a USB error has been handled.
+///
+void SocketRoutingQueue::ClearUsbError()
+{
+	scoped_lock lock(m_mutex);
+	m_seen_usb_error = false;
+
+	// reads that completed while stopped will not be
+	// announced again, so have the pool look for them
+	if( m_polled )
+		m_pool->Notify(*this);
+}
+
+//
+// SetReadPipelineDepth
+//
+/// Sets the number of bulk reads to keep in flight on the read
+/// endpoint.  Takes effect on the next call to SetUsbDevice().
+/// A count of 0 turns pipelining off.
+///
+void SocketRoutingQueue::SetReadPipelineDepth(int count)
+{
+	scoped_lock lock(m_mutex);
+	m_pipeline_depth = count < 0 ? 0 : count;
 }
 
 bool SocketRoutingQueue::UsbDeviceReady()
@@ -277,8 +648,12 @@ void SocketRoutingQueue::AllocateBuffers(int count)
 	int todo = count - m_free.size();
 
 	for( int i = 0; i < todo; i++ ) {
-		// m_free handles its own locking
-		m_free.push( new Data );
+		// m_free is safe from any thread, but bounded
+		Data *buf = new Data;
+		if( !m_free.try_push(buf) ) {
+			delete buf;
+			break;
+		}
 	}
 }
 
@@ -291,7 +666,9 @@ void SocketRoutingQueue::AllocateBuffers(int count)
 /// With the return version of the function, there is no
 /// copying performed.
 ///
-/// This version performs a copy.
+/// This version swaps buffers with receive, so no data is copied
+/// here either.  The old buffer in receive is recycled into the
+/// free queue.
 ///
 bool SocketRoutingQueue::DefaultRead(Data &receive, int timeout)
 {
@@ -299,8 +676,9 @@ bool SocketRoutingQueue::DefaultRead(Data &receive, int timeout)
 	if( !buf.get() )
 		return false;
 
-	// copy to desired buffer
-	receive = *buf.get();
+	// hand over the pooled buffer, and let buf return
+	// receive's old one to m_free
+	receive.Swap(*buf.get());
 	return true;
 }
 
@@ -335,7 +713,7 @@ DataHandle SocketRoutingQueue::DefaultRead(int timeout)
 ///
 /// If not null, handler is called when new data is read.  It will
 /// be called in the same thread instance that DoRead() is called from.
-/// Handler is passed the DataQueue Data pointer, and so no
+/// Handler is passed the queue's Data pointer, and so no
 /// copying is done.  Once the handler returns, the data is
 /// considered processed and not added to the interested queue,
 /// but instead returned to m_free.
@@ -385,11 +763,9 @@ void SocketRoutingQueue::UnregisterInterest(SocketId socket)
 	if( qi == m_socketQueues.end() )
 		return;	// nothing registered, done
 
-	// dump a record of any unused packets in the queue, for debugging
-	DumpSocketQueue(qi->first, qi->second->m_queue);
-
-	// salvage all our data buffers
-	m_free.append_from( qi->second->m_queue );
+	// dump a record of any unused packets in the queue, for debugging,
+	// and salvage all our data buffers
+	SalvageSocketQueue(qi->first, qi->second->m_queue);
 
 	// remove the QueueEntryPtr from the map
 	m_socketQueues.erase( qi );
@@ -432,7 +808,8 @@ void SocketRoutingQueue::ChangeInterest(SocketId socket, InterestType type)
 /// Throws std::logic_error if a socket was requested that was
 /// not previously registered.
 ///
-/// Copying is performed with this function.
+/// This function swaps buffers with receive instead of copying,
+/// and recycles receive's old buffer into the free queue.
 ///
 bool SocketRoutingQueue::SocketRead(SocketId socket, Data &receive, int timeout)
 {
@@ -440,8 +817,9 @@ bool SocketRoutingQueue::SocketRead(SocketId socket, Data &receive, int timeout)
 	if( !buf.get() )
 		return false;
 
-	// copy to desired buffer
-	receive = *buf.get();
+	// hand over the pooled buffer, and let buf return
+	// receive's old one to m_free
+	receive.Swap(*buf.get());
 	return true;
 }
 
@@ -454,7 +832,7 @@ bool SocketRoutingQueue::SocketRead(SocketId socket, Data &receive, int timeout)
 DataHandle SocketRoutingQueue::SocketRead(SocketId socket, int timeout)
 {
 	QueueEntryPtr qep;
-	DataQueue *dq = 0;
+	DataRing *dq = 0;
 
 	// accessing our own std::map, need a lock
 	{
@@ -464,7 +842,7 @@ DataHandle SocketRoutingQueue::SocketRead(SocketId socket, int timeout)
 			throw std::logic_error(_("SocketRead requested data from unregistered socket."));
 
 		// got our queue, save the whole QueueEntryPtr (shared_ptr),
-		// and unlock, since we will be waiting on the DataQueue,
+		// and unlock, since we will be waiting on the DataRing,
 		// not the socketQueues map
 		//
 		// This is safe, since even if UnregisterInterest is called,
@@ -478,7 +856,7 @@ DataHandle SocketRoutingQueue::SocketRead(SocketId socket, int timeout)
 		dq = &qep->m_queue;
 	}
 
-	// get data from DataQueue
+	// get data from DataRing
 	// Be careful with the queue timeout, since its -1 means "forever"
 	Data *buf = dq->wait_pop(timeout == -1 ? m_timeout : timeout);
 
@@ -502,12 +880,86 @@ bool SocketRoutingQueue::IsAvailable(SocketId socket) const
 	return qi->second->m_queue.size() > 0;
 }
 
+//
+// GetMetrics
+//
+/// Copies out the router's counters.  The totals are updated by the
+/// reading thread without locking, so they may be a packet behind.
+///
+void SocketRoutingQueue::GetMetrics(RouterMetrics &metrics) const
+{
+	scoped_lock lock(m_mutex);
+
+	metrics = m_metrics;
+	metrics.ReadEp = m_readEp;
+	metrics.Default.Depth = m_default.size();
+	metrics.Sockets.clear();
+
+	SocketQueueMap::const_iterator qi = m_socketQueues.begin();
+	for( ; qi != m_socketQueues.end(); ++qi ) {
+		const QueueEntry &entry = *qi->second;
+
+		RouterMetrics::SocketStats stats;
+		stats.Socket = qi->first;
+		stats.Handler = entry.m_handler.get() != 0;
+		stats.Packets = entry.m_packets;
+		stats.Bytes = entry.m_bytes;
+		stats.Depth = entry.m_queue.size();
+		stats.MaxDepth = entry.m_max_depth;
+		metrics.Sockets.push_back(stats);
+	}
+}
+
+void SocketRoutingQueue::ClearMetrics()
+{
+	scoped_lock lock(m_mutex);
+
+	m_metrics.Clear();
+
+	SocketQueueMap::iterator qi = m_socketQueues.begin();
+	for( ; qi != m_socketQueues.end(); ++qi ) {
+		qi->second->m_packets = 0;
+		qi->second->m_bytes = 0;
+		qi->second->m_max_depth = 0;
+	}
+}
+
+//
+// GetSocketEventFd
+//
+/// Returns a descriptor that polls readable while the given socket's
+/// queue has data.  See router.h for details.
+///
+int SocketRoutingQueue::GetSocketEventFd(SocketId socket)
+{
+	scoped_lock lock(m_mutex);
+	SocketQueueMap::iterator qi = m_socketQueues.find(socket);
+	if( qi == m_socketQueues.end() )
+		throw std::logic_error(_("GetSocketEventFd requested descriptor for unregistered socket."));
+	return qi->second->m_queue.GetEventFd();
+}
+
+//
+// GetDefaultEventFd
+//
+/// Returns a descriptor that polls readable while the default queue,
+/// read by DefaultRead(), has data.
+///
+int SocketRoutingQueue::GetDefaultEventFd()
+{
+	// m_default creates its descriptor safely from any thread
+	return m_default.GetEventFd();
+}
+
 //
 // DoRead
 //
 /// Called by the application's "read thread" to read the next usb
 /// packet and route it to the correct queue.  Returns after every
 /// read, even if a handler is associated with a queue.
+/// With a read pipeline, up to MaxReadAhead reads that have already
+/// completed are routed as well, so socket zero packets behind data
+/// are not held up by slow handlers.  See RoutePacket().
 /// Note: this function is safe to call before SetUsbDevice() is
 /// called... it just doesn't do anything if there is no usb
 /// device to work with.
@@ -550,98 +1002,68 @@ void SocketRoutingQueue::DoRead(int timeout)
 
 		dev = m_dev;
 		readEp = m_readEp;
-
-		// fetch a free buffer
-		Data *raw = m_free.pop();
-		if( !raw )
-			buf = DataHandle(*this, new Data);
-		else
-			buf = DataHandle(*this, raw);
+		buf = GetFreeBuffer();
 	}
 
 	// take a chance and do the read unlocked, as this has the potential
 	// for blocking for a while
 	try {
-
-		Data &data = *buf.get();
-
-		if( !dev->BulkRead(readEp, data, timeout) )
+		if( !dev->BulkRead(readEp, *buf.get(), timeout) )
 			return;	// no data, done!
 
-		MAKE_PACKET(pack, data);
-
-		// make sure the size is right
-		if( data.GetSize() < SB_PACKET_SOCKET_SIZE )
-			return;	// bad size, just skip
-
-		// extract the socket from the packet
-		uint16_t socket = btohs(pack->socket);
-
-		// if this is a sequence packet, handle it specially
-		if( Protocol::IsSequencePacket(data) ) {
-			// sequence.socket is a single byte
-			socket = pack->u.sequence.socket;
-
-			//////////////////////////////////////////////
-			// ALWAYS queue sequence packets, so that
-			// the socket code can handle SyncSend()
-			if( !QueuePacket(socket, buf) ) {
-				// if no queue available for this
-				// socket, send it to the default
-				// queue
-				QueuePacket(m_default, buf);
-			}
+		RoutePacket(buf);
 
-			// done with sequence packet
-			return;
-		}
-
-		// we have data, now route or queue it
-		if( RouteOrQueuePacket(socket, buf) )
-			return; // done
-
-		// if we get here, send to default queue
-		QueuePacket(m_default, buf);
+		int budget = MaxReadAhead;
+		DeliverDeferred(dev, readEp, budget);
 	}
 	catch( Usb::Timeout & ) {
-		// this is expected... just ignore
+		// this is expected... just count it
+		m_metrics.ReadTimeouts++;
 	}
 	catch( Usb::Error &ue ) {
-		// set the flag first, in case any of the handlers
-		// are able to recover from this error
-		m_seen_usb_error = true;
-
-		// this is unexpected, but we're in a thread here...
-		// Need to iterate through all the registered handlers
-		// calling their error callback.
-		// Can't be locked when calling the callback, so need
-		// to make a list of them first.
+		ReportUsbError(ue);
+	}
+}
+
+//
+// DoPolledRead
+//
+/// Same as DoRead(), but only collects a read that the device's read
+/// pipeline has already completed, and never blocks.  Returns true
+/// if a packet was routed, so call it until it returns false.
+/// Used by MultiRouter, which calls this from its worker threads
+/// whenever the pipeline reports a completed read.
+///
+bool SocketRoutingQueue::DoPolledRead()
+{
+	Usb::Device *dev = 0;
+	int readEp;
+	DataHandle buf(*this, 0);
+
+	{
 		scoped_lock lock(m_mutex);
-		std::vector<SocketDataHandlerPtr> handlers;
-		SocketQueueMap::iterator qi = m_socketQueues.begin();
-		while( qi != m_socketQueues.end() ) {
-			SocketDataHandlerPtr &sdh = qi->second->m_handler;
-			// is there a handler?
-			if( sdh ) {
-				handlers.push_back(sdh);
-			}
-			++qi;
-		}
+		if( !m_dev || !m_polled || m_seen_usb_error )
+			return false;
 
-		SocketDataHandlerPtr usb_error_handler = m_usb_error_dev_callback;
+		dev = m_dev;
+		readEp = m_readEp;
+		buf = GetFreeBuffer();
+	}
 
-		lock.unlock();
-		std::vector<SocketDataHandlerPtr>::iterator hi = handlers.begin();
-		while( hi != handlers.end() ) {
-			(*hi)->Error(ue);
-			++hi;
-		}
+	try {
+		if( !dev->PollRead(readEp, *buf.get()) )
+			return false;
 
-		// and finally, call the specific error callback if available
-		if( usb_error_handler.get() ) {
-			usb_error_handler->Error(ue);
-		}
+		RoutePacket(buf);
+
+		int budget = MaxReadAhead;
+		DeliverDeferred(dev, readEp, budget);
+	}
+	catch( Usb::Error &ue ) {
+		ReportUsbError(ue);
+		return false;
 	}
+	return true;
 }
 
 void SocketRoutingQueue::SpinoffSimpleReadThread()
@@ -31,14 +31,17 @@
 #include "dataqueue.h"
 #include "error.h"
 #include "usbwrap.h"
+#include "metrics.h"
 
 namespace Barry {
 
 class DataHandle;
+class MultiRouter;
 
 class BXEXPORT SocketRoutingQueue
 {
 	friend class DataHandle;
+	friend class MultiRouter;
 
 public:
 	// When registering interest in socket packets
@@ -94,12 +97,20 @@ public:
 	struct QueueEntry
 	{
 		SocketDataHandlerPtr m_handler;
-		DataQueue m_queue;
+		DataRing m_queue;
 		InterestType m_type;
 
+		// counters, protected by the router's m_mutex
+		unsigned long m_packets;
+		unsigned long m_bytes;
+		size_t m_max_depth;
+
 		QueueEntry(SocketDataHandlerPtr h, InterestType t)
 			: m_handler(h)
 			, m_type(t)
+			, m_packets(0)
+			, m_bytes(0)
+			, m_max_depth(0)
 			{}
 	};
 	typedef std::tr1::shared_ptr<QueueEntry>	QueueEntryPtr;
@@ -114,19 +125,31 @@ private:
 				// used to optimize the reading
 
 	mutable pthread_mutex_t m_mutex;// controls access to local data, but not
-				// DataQueues, as they have their own
-				// locking per queue
+				// the queues, as they are safe to use
+				// from any thread
 
 	pthread_mutex_t m_readwaitMutex;
 	pthread_cond_t m_readwaitCond;
 	bool m_seen_usb_error;
 	SocketDataHandlerPtr m_usb_error_dev_callback;
 
-	DataQueue m_free;
-	DataQueue m_default;
+	DataRing m_free;	// bounded: extra buffers are deleted
+	DataRing m_default;
+	DataRing m_deferred;	// data packets waiting behind socket zero,
+				// only used by the reading thread
 	SocketQueueMap m_socketQueues;
 
 	int m_timeout;
+	int m_pipeline_depth;	// number of USB reads kept in flight,
+				// or 0 for plain synchronous reads
+	bool m_pipeline_running;// true if SetUsbDevice() started a
+				// pipeline that ClearUsbDevice() must stop
+
+	MultiRouter *m_pool;	// set while attached to a MultiRouter
+	bool m_polled;		// true if m_pool is doing our reads
+
+	RouterMetrics m_metrics;	// updated by the reading thread;
+				// per socket counters are in QueueEntry
 
 	// thread state
 	pthread_t m_usb_read_thread;
@@ -145,16 +168,40 @@ protected:
 	// Returns false if no queue is available for that socket
 	// Also empties the DataHandle on success.
 	bool QueuePacket(SocketId socket, DataHandle &buf);
-	bool QueuePacket(DataQueue &queue, DataHandle &buf);
+	bool QueuePacket(DataRing &queue, DataHandle &buf);
 	bool RouteOrQueuePacket(SocketId socket, DataHandle &buf);
+	void QueueDefault(DataHandle &buf);
+	static void CountPacket(QueueEntry &entry, const Data &data);
+
+	// Helpers for DoRead() and DoPolledRead()
+	DataHandle GetFreeBuffer();
+	void RoutePacket(DataHandle &buf);
+	void DeliverDeferred(Usb::Device *dev, int readEp, int &budget);
+	void DeliverDeferredFor(SocketId socket);
+	void DeliverPacket(DataHandle &buf);
+	void ReportUsbError(Usb::Error &ue);
+
+	// Read pipeline callback used while attached to a MultiRouter
+	static void ReadReady(void *userptr);
+
+	// Non-blocking version of DoRead(), called by MultiRouter
+	// once the read pipeline reports completed reads.  Returns
+	// true if a packet was routed.
+	bool DoPolledRead();
 
 	// Thread function for the simple read behaviour... thread is
 	// created in the SpinoffSimpleReadThread() member below.
 	static void *SimpleReadThread(void *userptr);
 
-	void DumpSocketQueue(SocketId socket, const DataQueue &dq);
+	// Empties dq, dumping its packets to debug output, and returns
+	// the buffers to m_free
+	void SalvageSocketQueue(SocketId socket, DataRing &dq);
 
 public:
+	// Most completed reads that one DoRead() call will route ahead
+	// of the data it is still delivering
+	static const int MaxReadAhead = 16;
+
 	SocketRoutingQueue(int prealloc_buffer_count = 4,
 		int default_read_timeout = USBWRAP_DEFAULT_TIMEOUT);
 	~SocketRoutingQueue();
@@ -175,6 +222,11 @@ public:
 	// the callback, fix the USB device, and then call
 	// ClearUsbError() to clear the flag.
 	//
+	// If the router is attached to a MultiRouter, SetUsbDevice()
+	// starts the read pipeline and hands reading over to the
+	// pool.  If the device cannot be pipelined, it starts the
+	// simple read thread instead.
+	//
 	void SetUsbDevice(Usb::Device *dev, int writeEp, int readEp,
 		SocketDataHandlerPtr callback = SocketDataHandlerPtr());
 	void ClearUsbDevice();
@@ -182,6 +234,15 @@ public:
 	Usb::Device* GetUsbDevice() { return m_dev; }
 	void ClearUsbError();
 
+	// Sets the number of bulk reads to keep queued on the read
+	// endpoint at all times, so the device never waits for
+	// DoRead() to come around again.  Takes effect on the next
+	// call to SetUsbDevice().  If the USB library cannot do
+	// asynchronous reads, the router quietly falls back to
+	// synchronous ones.  Default is 0, which disables pipelining.
+	void SetReadPipelineDepth(int count);
+	int GetReadPipelineDepth() const { return m_pipeline_depth; }
+
 
 	// This class starts out with no buffers, and will grow one buffer
 	// at a time if needed.  Call this to allocate count buffers
@@ -191,8 +252,9 @@ public:
 	// Returns the data for the next unregistered socket.
 	// Blocks until timeout or data is available.
 	// Returns false (or null pointer) on timeout and no data.
-	// With the return version of the function, there is no
-	// copying performed.
+	// Neither version copies packet data: the return version hands
+	// out the pooled buffer itself, and the Data& version swaps
+	// buffers with receive.
 	//
 	// Timeout is in milliseconds.  Default timeout set by constructor
 	// is used if set to -1.
@@ -212,7 +274,7 @@ public:
 	// and must be read by DefaultRead()
 	// If not null, handler is called when new data is read.  It will
 	// be called in the same thread instance that DoRead() is called from.
-	// Handler is passed the DataQueue Data object, and so no
+	// Handler is passed the queue's Data object, and so no
 	// copying is done.  Once the handler returns, the data is
 	// considered processed and not added to the interested queue,
 	// but instead returned to m_free.
@@ -237,8 +299,9 @@ public:
 	// from sockets that have been previously registered.
 	// Blocks until timeout or data is available.
 	// Returns false (or null pointer) on timeout and no data.
-	// With the return version of the function, there is no
-	// copying performed.
+	// Neither version copies packet data: the return version hands
+	// out the pooled buffer itself, and the Data& version swaps
+	// buffers with receive.
 	//
 	// Timeout is in milliseconds.  Default timeout set by constructor
 	// is used if set to -1.
@@ -248,9 +311,36 @@ public:
 	// Returns true if data is available for that socket.
 	bool IsAvailable(SocketId socket) const;
 
+	// Copies out the packet counters and queue depths, per socket.
+	// See metrics.h.  Counters for a socket are lost when interest
+	// in it is unregistered.
+	void GetMetrics(RouterMetrics &metrics) const;
+	void ClearMetrics();
+
+	// Return file descriptors for use in the application's own
+	// poll(), select() or epoll loop, instead of blocking a thread
+	// in SocketRead() or DefaultRead().  Each polls readable while
+	// its queue has data: call SocketRead() or DefaultRead() with
+	// a timeout of 0 until they return no data, and never read the
+	// descriptor itself.  Sockets registered with a handler never
+	// queue data, so their descriptor never becomes readable.
+	//
+	// The descriptor belongs to the router, and is closed when
+	// interest in the socket is unregistered, so remove it from
+	// any poll sets first.  GetSocketEventFd() throws
+	// std::logic_error if the socket is not registered, and both
+	// throw Barry::ErrnoError if the descriptor cannot be created.
+	int GetSocketEventFd(SocketId socket);
+	int GetDefaultEventFd();
+
 	// Called by the application's "read thread" to read the next usb
 	// packet and route it to the correct queue.  Returns after every
 	// read, even if a handler is associated with a queue.
+	//
+	// Socket zero packets are routed ahead of data: if the read
+	// pipeline has more reads completed, DoRead() routes their
+	// socket zero packets before calling any more data handlers.
+	// A close from socket zero still waits for the data before it.
 	// Note: this function is safe to call before SetUsbDevice() is
 	// called... it just doesn't do anything if there is no usb
 	// device to work with.
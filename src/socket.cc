@@ -23,6 +23,7 @@
 #include "socket.h"
 #include "usbwrap.h"
 #include "data.h"
+#include "dataslice.h"
 #include "protocol.h"
 #include "protostructs.h"
 #include "endian.h"
@@ -56,6 +57,7 @@ SocketZero::SocketZero(	SocketRoutingQueue &queue,
 	, m_modeSequencePacketSeen(false)
 	, m_pushback(false)
 {
+	m_metrics.WriteEp = writeEndpoint;
 }
 
 SocketZero::SocketZero(	Device &dev,
@@ -73,6 +75,7 @@ SocketZero::SocketZero(	Device &dev,
 	, m_modeSequencePacketSeen(false)
 	, m_pushback(false)
 {
+	m_metrics.WriteEp = writeEndpoint;
 }
 
 SocketZero::~SocketZero()
@@ -84,76 +87,21 @@ SocketZero::~SocketZero()
 ///////////////////////////////////////
 // Socket Zero static calls
 
-// appends fragment to whole... if whole is empty, simply copies, and
-// sets command to DATA instead of FRAGMENTED.  Always updates the
-// packet size of whole, to reflect the total size
-void SocketZero::AppendFragment(Data &whole, const Data &fragment)
+// appends the fragment payloads to whole, which holds the first
+// fragment, in one copy, and sets command to DATA instead of FRAGMENTED.
+// Always updates the packet size of whole, to reflect the total size
+void SocketZero::AppendFragments(Data &whole, const DataGather &fragments)
 {
-	if( whole.GetSize() == 0 ) {
-		// empty, so just copy
-		whole = fragment;
-	}
-	else {
-		// has some data already, so just append
-		int size = whole.GetSize();
-		unsigned char *buf = whole.GetBuffer(size + fragment.GetSize());
-		MAKE_PACKET(fpack, fragment);
-		int fragsize = fragment.GetSize() - SB_FRAG_HEADER_SIZE;
-
-		memcpy(buf+size, &fpack->u.db.u.fragment, fragsize);
-		whole.ReleaseBuffer(size + fragsize);
-	}
+	fragments.AppendTo(whole);
 
 	// update whole's size and command type for future sanity
 	Barry::Protocol::Packet *wpack = (Barry::Protocol::Packet *) whole.GetBuffer();
 	wpack->size = htobs((uint16_t) whole.GetSize());
 	wpack->command = SB_COMMAND_DB_DATA;
 	// don't need to call ReleaseBuffer here, since we're not changing
-	// the real data size, and ReleaseBuffer was called above during copy
-}
-
-// If offset is 0, starts fresh, taking the first fragment packet size chunk
-// out of whole and creating a sendable packet in fragment.  Returns the
-// next offset if there is still more data, or 0 if finished.
-unsigned int SocketZero::MakeNextFragment(const Data &whole, Data &fragment, unsigned int offset)
-{
-	// sanity check
-	if( whole.GetSize() < SB_FRAG_HEADER_SIZE ) {
-		eout("Whole packet too short to fragment: " << whole.GetSize());
-		throw Error(_("Socket: Whole packet too short to fragment"));
-	}
-
-	// calculate size
-	unsigned int todo = whole.GetSize() - SB_FRAG_HEADER_SIZE - offset;
-	unsigned int nextOffset = 0;
-	if( todo > (MAX_PACKET_SIZE - SB_FRAG_HEADER_SIZE) ) {
-		todo = MAX_PACKET_SIZE - SB_FRAG_HEADER_SIZE;
-		nextOffset = offset + todo;
-	}
-
-	// create fragment header
-	unsigned char *buf = fragment.GetBuffer(SB_FRAG_HEADER_SIZE + todo);
-	memcpy(buf, whole.GetData(), SB_FRAG_HEADER_SIZE);
-
-	// copy over a fragment size of data
-	memcpy(buf + SB_FRAG_HEADER_SIZE, whole.GetData() + SB_FRAG_HEADER_SIZE + offset, todo);
-
-	// update fragment's size and command type
-	Barry::Protocol::Packet *wpack = (Barry::Protocol::Packet *) buf;
-	wpack->size = htobs((uint16_t) (todo + SB_FRAG_HEADER_SIZE));
-	if( nextOffset )
-		wpack->command = SB_COMMAND_DB_FRAGMENTED;
-	else
-		wpack->command = SB_COMMAND_DB_DATA;
-
-	// adjust the new fragment size
-	fragment.ReleaseBuffer(SB_FRAG_HEADER_SIZE + todo);
-
-	// return next round
-	return nextOffset;
+	// the real data size, and AppendTo() set it above
 }
 
-
 ///////////////////////////////////////
 // SocketZero private API
 
@@ -299,34 +247,55 @@ void SocketZero::RawSend(Data &send, int timeout)
 	// is sent in a special 3 byte packet before the real packet.
 	// Check for this case here.
 	//
-	if( (send.GetSize() % 0x40) == 0 ) {
-		Protocol::SizePacket packet;
-		packet.size = htobs(send.GetSize());
-		packet.buffer[2] = 0;		// zero the top byte
-		Data sizeCommand(&packet, 3);
+	try {
+		if( (send.GetSize() % 0x40) == 0 ) {
+			Protocol::SizePacket packet;
+			packet.size = htobs(send.GetSize());
+			packet.buffer[2] = 0;		// zero the top byte
+			Data sizeCommand(&packet, 3);
+
+			dev->BulkWrite(m_writeEp, sizeCommand, timeout);
+			MetricAdd(m_metrics.SizePackets);
+		}
 
-		dev->BulkWrite(m_writeEp, sizeCommand, timeout);
+		dev->BulkWrite(m_writeEp, send, timeout);
+	}
+	catch( Usb::Timeout & ) {
+		MetricAdd(m_metrics.Timeouts);
+		throw;
 	}
 
-	dev->BulkWrite(m_writeEp, send, timeout);
+	MetricAdd(m_metrics.PacketsSent);
+	MetricAdd(m_metrics.BytesSent, send.GetSize());
 }
 
 void SocketZero::RawReceive(Data &receive, int timeout)
 {
 	if( m_pushback ) {
-		receive = m_pushback_buffer;
+		receive.Swap(m_pushback_buffer);
 		m_pushback = false;
 		return;
 	}
 
 	if( m_queue ) {
-		if( !m_queue->DefaultRead(receive, timeout) )
+		if( !m_queue->DefaultRead(receive, timeout) ) {
+			MetricAdd(m_metrics.Timeouts);
 			throw Timeout(_("SocketZero::RawReceive: queue DefaultRead returned false (likely a timeout)"));
+		}
 	}
 	else {
-		m_dev->BulkRead(m_readEp, receive, timeout);
+		try {
+			m_dev->BulkRead(m_readEp, receive, timeout);
+		}
+		catch( Usb::Timeout & ) {
+			MetricAdd(m_metrics.Timeouts);
+			throw;
+		}
 	}
 
+	MetricAdd(m_metrics.PacketsReceived);
+	MetricAdd(m_metrics.BytesReceived, receive.GetSize());
+
 	ddout("SocketZero::RawReceive: Endpoint "
 		<< (m_queue ? m_queue->GetReadEp() : m_readEp)
 		<< "\nReceived:\n" << receive);
@@ -356,6 +325,18 @@ void SocketZero::UnlinkRoutingQueue()
 	m_queue = 0;
 }
 
+ProtocolMetrics SocketZero::GetMetrics() const
+{
+	ProtocolMetrics metrics = m_metrics;
+	metrics.ReadEp = m_queue ? m_queue->GetReadEp() : m_readEp;
+	return metrics;
+}
+
+void SocketZero::ClearMetrics()
+{
+	m_metrics.Clear();
+}
+
 void SocketZero::Send(Data &send, int timeout)
 {
 	// force the socket number to 0
@@ -570,6 +551,7 @@ SocketHandle SocketZero::Open(
 			// ditch effort, do one more read with a short
 			// timeout, and check that as well
 			Data late_sequence;
+			MetricAdd(m_metrics.Retries);
 			RawReceive(late_sequence, 500);
 			if( !Protocol::IsSequencePacket(late_sequence) ) {
 				throw Error(_("Could not find mode's starting sequence packet"));
@@ -681,6 +663,138 @@ void SocketZero::Close(Socket &socket)
 
 
 
+//////////////////////////////////////////////////////////////////////////////
+// Fragmenter class
+
+namespace {
+
+//
+// Fragmenter
+//
+/// Splits a packet that is too big to send in one piece into
+/// fragments, without copying its payload.
+///
+/// Each fragment is the packet's header followed by the next chunk
+/// of payload, so the first fragment is whole itself, cut short, and
+/// each later fragment's header is written into whole's buffer just
+/// ahead of its chunk, over the tail of the chunk already sent.  The
+/// fragment is then an external Data pointing into that buffer.
+///
+/// The overwritten bytes are put back as soon as the next fragment
+/// is asked for, and whole is fully restored once done, or on
+/// exception.
+///
+class Fragmenter
+{
+	Data &m_whole;
+	size_t m_size;			// original size of m_whole
+	unsigned char *m_buf;
+	unsigned char m_header[SB_FRAG_HEADER_SIZE];	// original
+	unsigned char m_saved[SB_FRAG_HEADER_SIZE];
+	unsigned int m_offset;		// where the next header goes
+	unsigned int m_saved_at;	// where m_saved belongs, or 0
+	bool m_done;
+	Data m_view;			// external, for fragments 2..n
+
+	void RestoreSaved();
+	void Restore();
+
+public:
+	explicit Fragmenter(Data &whole);
+	~Fragmenter();
+
+	Data* Next();
+};
+
+} // anonymous namespace
+
+Fragmenter::Fragmenter(Data &whole)
+	: m_whole(whole)
+	, m_size(whole.GetSize())
+	, m_buf(0)
+	, m_offset(0)
+	, m_saved_at(0)
+	, m_done(false)
+	, m_view((const void*) 0, 0)
+{
+	// sanity check
+	if( m_size < SB_FRAG_HEADER_SIZE ) {
+		eout("Whole packet too short to fragment: " << m_size);
+		throw Error(_("Socket: Whole packet too short to fragment"));
+	}
+
+	// make sure the buffer is internal and big enough now, so
+	// sending the shortened first fragment never moves it
+	m_buf = m_whole.GetBuffer(m_size);
+	memcpy(m_header, m_buf, SB_FRAG_HEADER_SIZE);
+}
+
+Fragmenter::~Fragmenter()
+{
+	Restore();
+}
+
+void Fragmenter::RestoreSaved()
+{
+	if( m_saved_at ) {
+		memcpy(m_buf + m_saved_at, m_saved, SB_FRAG_HEADER_SIZE);
+		m_saved_at = 0;
+	}
+}
+
+void Fragmenter::Restore()
+{
+	RestoreSaved();
+	memcpy(m_buf, m_header, SB_FRAG_HEADER_SIZE);
+	m_whole.ReleaseBuffer(m_size);
+}
+
+// Returns the next fragment to send, or 0 when finished.
+// The fragment is only valid until the next call.
+Data* Fragmenter::Next()
+{
+	RestoreSaved();
+	if( m_done )
+		return 0;
+
+	// calculate size
+	unsigned int todo = m_size - SB_FRAG_HEADER_SIZE - m_offset;
+	if( todo > (MAX_PACKET_SIZE - SB_FRAG_HEADER_SIZE) )
+		todo = MAX_PACKET_SIZE - SB_FRAG_HEADER_SIZE;
+	else
+		m_done = true;
+
+	unsigned char *start = m_buf + m_offset;
+	Data *fragment;
+	if( m_offset == 0 ) {
+		// first fragment... the send functions may fill in
+		// the socket number here, and later fragments copy it
+		m_whole.ReleaseBuffer(SB_FRAG_HEADER_SIZE + todo);
+		fragment = &m_whole;
+	}
+	else {
+		// create fragment header in front of the chunk
+		memcpy(m_saved, start, SB_FRAG_HEADER_SIZE);
+		m_saved_at = m_offset;
+		memcpy(start, m_buf, SB_FRAG_HEADER_SIZE);
+
+		m_view = Data(start, SB_FRAG_HEADER_SIZE + todo);
+		fragment = &m_view;
+	}
+
+	// update fragment's size and command type
+	Barry::Protocol::Packet *wpack = (Barry::Protocol::Packet *) start;
+	wpack->size = htobs((uint16_t) (todo + SB_FRAG_HEADER_SIZE));
+	if( m_done )
+		wpack->command = SB_COMMAND_DB_DATA;
+	else
+		wpack->command = SB_COMMAND_DB_FRAGMENTED;
+
+	m_offset += todo;
+	return fragment;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 // SocketBase class
 
@@ -719,13 +833,12 @@ void SocketBase::DBFragSend(Data &send, int timeout)
 	}
 	else {
 		// send fragmented
-		unsigned int offset = 0;
-		Data outFrag;
-
-		do {
-			offset = SocketZero::MakeNextFragment(send, outFrag, offset);
-			SyncSend(outFrag, timeout);
-		} while( offset > 0 );
+		Fragmenter fragmenter(send);
+		while( Data *outFrag = fragmenter.Next() ) {
+			SyncSend(*outFrag, timeout);
+			if( m_metrics )
+				MetricAdd(m_metrics->FragmentsSent);
+		}
 	}
 
 }
@@ -760,16 +873,74 @@ void SocketBase::Send(Barry::Packet &packet, int timeout)
 //
 void SocketBase::Packet(Data &send, Data &receive, int timeout)
 {
+	Stopwatch watch;
+
+	receive.Zap();
+	DBFragSend(send, timeout);
+	PacketReceive(receive, timeout);
+
+	if( m_metrics )
+		m_metrics->PacketRoundTrip.Add(watch.GetElapsed());
+}
+
+void SocketBase::Packet(Barry::Packet &packet, int timeout)
+{
+	Packet(packet.m_send, *packet.m_receive, timeout);
+}
+
+//
+// PacketSend
+//
+/// Sends a Desktop / Database command packet, fragmenting if necessary,
+/// like DBFragSend(), but without waiting for the sequence handshake.
+/// PacketReceive() skips over the handshakes as they arrive.
+///
+void SocketBase::PacketSend(Data &send, int timeout)
+{
+	MAKE_PACKET(spack, send);
+	if( send.GetSize() < MIN_PACKET_SIZE ||
+	    (spack->command != SB_COMMAND_DB_DATA &&
+	     spack->command != SB_COMMAND_DB_DONE) )
+	{
+		// we don't do that around here
+		eout("unknown send data in PacketSend(): " << send);
+		throw std::logic_error(_("Socket: unknown send data in PacketSend()"));
+	}
+
+	if( send.GetSize() <= MAX_PACKET_SIZE ) {
+		RawSend(send, timeout);
+	}
+	else {
+		Fragmenter fragmenter(send);
+		while( Data *outFrag = fragmenter.Next() ) {
+			RawSend(*outFrag, timeout);
+			if( m_metrics )
+				MetricAdd(m_metrics->FragmentsSent);
+		}
+	}
+}
+
+//
+// PacketReceive
+//
+/// Receives the response to the oldest command sent with Packet() or
+/// PacketSend(), defragmenting if needed.  Sequence handshake packets
+/// are checked and skipped.
+///
+void SocketBase::PacketReceive(Data &receive, int timeout)
+{
+	Stopwatch watch;
+
 	// assume the common case of no fragmentation,
 	// and use the receive buffer for input... allocate a frag buffer
 	// later if necessary
 	Data *inputBuf = &receive;
-	receive.Zap();
-
-	DBFragSend(send, timeout);
 	Receive(*inputBuf, timeout);
 
-	std::auto_ptr<Data> inFrag;
+	// later fragments are kept as they arrive, and copied into
+	// receive all at once when the last one is in
+	std::tr1::shared_ptr<Data> inFrag;
+	DataGather fragments;
 	bool done = false, frag = false;
 	int blankCount = 0;
 	while( !done ) {
@@ -789,7 +960,8 @@ void SocketBase::Packet(Data &send, Data &receive, int timeout)
 
 			case SB_COMMAND_DB_DATA:
 				if( frag ) {
-					SocketZero::AppendFragment(receive, *inputBuf);
+					fragments.Append(DataSlice(inFrag, SB_FRAG_HEADER_SIZE));
+					SocketZero::AppendFragments(receive, fragments);
 				}
 				else {
 					// no copy needed, already in receive,
@@ -799,12 +971,14 @@ void SocketBase::Packet(Data &send, Data &receive, int timeout)
 				break;
 
 			case SB_COMMAND_DB_FRAGMENTED:
-				// only copy if frag is true, since the
+				// only gather if frag is true, since the
 				// first time through, receive == inputBuf
 				if( frag ) {
-					SocketZero::AppendFragment(receive, *inputBuf);
+					fragments.Append(DataSlice(inFrag, SB_FRAG_HEADER_SIZE));
 				}
 				frag = true;
+				if( m_metrics )
+					MetricAdd(m_metrics->FragmentsReceived);
 				break;
 
 			case SB_COMMAND_DB_DONE:
@@ -829,23 +1003,25 @@ void SocketBase::Packet(Data &send, Data &receive, int timeout)
 				// for so long
 				throw Error(_("Socket: 10 blank packets received"));
 			}
+			if( m_metrics )
+				MetricAdd(m_metrics->Retries);
 		}
 
 		if( !done ) {
 			// not done yet, ask for another read, and
-			// create new buffer for fragmented reads
-			if( frag && !inFrag.get() ) {
+			// create new buffer for fragmented reads, unless
+			// the last one can be reused, since it was not
+			// gathered
+			if( frag && (!inFrag.get() || !inFrag.unique()) ) {
 				inFrag.reset( new Data );
 				inputBuf = inFrag.get();
 			}
 			Receive(*inputBuf);
 		}
 	}
-}
 
-void SocketBase::Packet(Barry::Packet &packet, int timeout)
-{
-	Packet(packet.m_send, *packet.m_receive, timeout);
+	if( m_metrics )
+		m_metrics->ReceiveWait.Add(watch.GetElapsed());
 }
 
 void SocketBase::Packet(Barry::JLPacket &packet, int timeout)
@@ -922,6 +1098,8 @@ void SocketBase::PacketJVM(Data &send, Data &receive, int timeout)
 				// for so long
 				throw Error(_("Socket: 10 blank packets received"));
 			}
+			if( m_metrics )
+				MetricAdd(m_metrics->Retries);
 		}
 
 		if( !done ) {
@@ -1005,6 +1183,8 @@ void SocketBase::PacketData(Data &send,
 				// for so long
 				throw Error(_("Socket: 10 blank packets received"));
 			}
+			if( m_metrics )
+				MetricAdd(m_metrics->Retries);
 		}
 
 		if( !done ) {
@@ -1014,18 +1194,37 @@ void SocketBase::PacketData(Data &send,
 	}
 }
 
-void SocketBase::NextRecord(Data &receive)
+// Builds the 7 byte DB_DONE packet that asks for the next record.
+// The socket number is filled in, so RawSend() has no reason to
+// copy the external Data that wraps it.
+static void MakeNextRecordCommand(Barry::Protocol::Packet &packet,
+					uint16_t socket)
 {
-	Barry::Protocol::Packet packet;
+	packet.socket = htobs(socket);
 	packet.size = htobs(7);
 	packet.command = SB_COMMAND_DB_DONE;
 	packet.u.db.tableCmd = 0;
 	packet.u.db.u.command.operation = 0;
+}
+
+void SocketBase::NextRecord(Data &receive)
+{
+	Barry::Protocol::Packet packet;
+	MakeNextRecordCommand(packet, GetSocket());
 
 	Data command(&packet, 7);
 	Packet(command, receive);
 }
 
+void SocketBase::NextRecordSend(int timeout)
+{
+	Barry::Protocol::Packet packet;
+	MakeNextRecordCommand(packet, GetSocket());
+
+	Data command(&packet, 7);
+	PacketSend(command, timeout);
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1040,6 +1239,7 @@ Socket::Socket( SocketZero &zero,
 	, m_registered(false)
 	, m_sequence(new Data)
 {
+	m_metrics = &zero.m_metrics;
 }
 
 Socket::~Socket()
@@ -1092,10 +1292,15 @@ void Socket::LocalUnregisterInterest()
 ///
 void Socket::RawSend(Data &send, int timeout)
 {
-	// force the socket number to this socket
+	// force the socket number to this socket... but only write
+	// if needed, so that external data, such as a fragment pointing
+	// into a larger packet, is not copied
 	if( send.GetSize() >= SB_PACKET_HEADER_SIZE ) {
-		MAKE_PACKETPTR_BUF(spack, send.GetBuffer());
-		spack->socket = htobs(m_socket);
+		MAKE_PACKET(cpack, send);
+		if( cpack->socket != htobs(m_socket) ) {
+			MAKE_PACKETPTR_BUF(spack, send.GetBuffer());
+			spack->socket = htobs(m_socket);
+		}
 	}
 	m_zero->RawSend(send, timeout);
 }
@@ -1113,8 +1318,12 @@ void Socket::Receive(Data &receive, int timeout)
 {
 	if( m_registered ) {
 		if( m_zero->m_queue ) {
-			if( !m_zero->m_queue->SocketRead(m_socket, receive, timeout) )
+			if( !m_zero->m_queue->SocketRead(m_socket, receive, timeout) ) {
+				MetricAdd(m_metrics->Timeouts);
 				throw Timeout(_("Socket::Receive: queue SocketRead returned false (likely a timeout)"));
+			}
+			MetricAdd(m_metrics->PacketsReceived);
+			MetricAdd(m_metrics->BytesReceived, receive.GetSize());
 		}
 		else {
 			throw std::logic_error(_("NULL queue pointer in a registered socket read."));
@@ -28,6 +28,7 @@
 #include <memory>
 #include "router.h"
 #include "data.h"
+#include "metrics.h"
 
 // forward declarations
 namespace Usb { class Device; }
@@ -36,6 +37,7 @@ namespace Barry {
 	class JLPacket;
 	class JVMPacket;
 	class SocketRoutingQueue;
+	class DataGather;
 }
 
 namespace Barry {
@@ -66,10 +68,10 @@ class BXEXPORT SocketZero
 	Data m_pushback_buffer;
 	bool m_pushback;
 
+	ProtocolMetrics m_metrics;
+
 private:
-	static void AppendFragment(Data &whole, const Data &fragment);
-	static unsigned int MakeNextFragment(const Data &whole, Data &fragment,
-		unsigned int offset = 0);
+	static void AppendFragments(Data &whole, const DataGather &fragments);
 	void CheckSequence(uint16_t socket, const Data &seq);
 
 	void SendOpen(uint16_t socket, Data &receive);
@@ -94,6 +96,11 @@ public:
 
 	uint8_t GetZeroSocketSequence() const { return m_zeroSocketSequence; }
 
+	// Counters for everything sent and received through this
+	// SocketZero and its sockets
+	ProtocolMetrics GetMetrics() const;
+	void ClearMetrics();
+
 	void SetRoutingQueue(SocketRoutingQueue &queue);
 	void UnlinkRoutingQueue();
 
@@ -124,11 +131,14 @@ class BXEXPORT SocketBase
 	bool m_resetOnClose;
 
 protected:
+	ProtocolMetrics *m_metrics;	// counters to update, may be null
+
 	void CheckSequence(const Data &seq);
 
 public:
 	SocketBase()
 		: m_resetOnClose(false)
+		, m_metrics(0)
 	{
 	}
 
@@ -138,6 +148,7 @@ public:
 	// Virtual Socket API
 	//
 	virtual void Close() = 0;
+	virtual uint16_t GetSocket() const = 0;
 
 	// FIXME - do I need RawSend?  Or just a good fragmenter?
 	virtual void RawSend(Data &send, int timeout = -1) = 0;
@@ -187,6 +198,16 @@ public:
 
 	// some handy wrappers for the Packet() interface
 	void NextRecord(Data &receive);
+
+	// Pipelined versions of Packet() and NextRecord().  These split
+	// the send from the receive, so that several commands can be
+	// sent before their responses are read.  The device answers
+	// commands in the order they were sent, and each call to
+	// PacketReceive() returns the next complete response, so the
+	// caller only needs to count how many are still outstanding.
+	void PacketSend(Data &send, int timeout = -1);
+	void PacketReceive(Data &receive, int timeout = -1);
+	void NextRecordSend(int timeout = -1);
 };
 
 //
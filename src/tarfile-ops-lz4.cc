@@ -0,0 +1,229 @@
+///
+/// \file	tarfile-ops-lz4.cc
+///		Non-thread safe operation functions for a libtar-compatible
+///		lz4 frame compression interface.
+
+/*
+    Copyright (C) 2007-2013, Chris Frey <cdfrey@foursquare.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include <config.h>
+#include "tarfile.h"
+
+#ifdef HAVE_LIBLZ4
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <lz4frame.h>
+
+#include <vector>
+#include <assert.h>
+
+// amount of input handed to LZ4F_compressUpdate() at a time,
+// which sets the size of the output buffer
+#define LZ4TAR_CHUNK_SIZE	(64 * 1024)
+
+namespace reuse {
+
+namespace lz4tar_nonthread {
+
+	struct Lz4File
+	{
+		int fd;
+		LZ4F_cctx *cctx;	//< set when writing
+		LZ4F_dctx *dctx;	//< set when reading
+		std::vector<char> buffer;
+		size_t in_pos, in_size;	//< read side: unconsumed file data
+		bool eof;
+	};
+
+	namespace {
+		std::vector<Lz4File*> handles;
+
+		Lz4File* Lookup(int fd)
+		{
+			unsigned int ufd = fd;
+			assert( ufd < handles.size() && handles[ufd] );
+			return handles[ufd];
+		}
+
+		bool WriteAll(int fd, const char *buf, size_t size)
+		{
+			while( size ) {
+				ssize_t n = write(fd, buf, size);
+				if( n < 0 ) {
+					if( errno == EINTR )
+						continue;
+					return false;
+				}
+				buf += n;
+				size -= n;
+			}
+			return true;
+		}
+
+		void Free(Lz4File *f)
+		{
+			if( f->cctx )
+				LZ4F_freeCompressionContext(f->cctx);
+			if( f->dctx )
+				LZ4F_freeDecompressionContext(f->dctx);
+			delete f;
+		}
+	}
+
+	int open_compressed(const char *file, int flags, mode_t mode)
+	{
+		int fd = open(file, flags, mode);
+		if( fd == -1 )
+			return -1;
+
+		Lz4File *f = new Lz4File;
+		f->fd = fd;
+		f->cctx = 0;
+		f->dctx = 0;
+		f->in_pos = f->in_size = 0;
+		f->eof = false;
+
+		bool ok;
+		if( flags & O_WRONLY ) {
+			f->buffer.resize(LZ4F_compressBound(LZ4TAR_CHUNK_SIZE, NULL));
+			ok = !LZ4F_isError(LZ4F_createCompressionContext(&f->cctx, LZ4F_VERSION));
+			if( ok ) {
+				// frame header goes out right away
+				size_t n = LZ4F_compressBegin(f->cctx,
+					&f->buffer[0], f->buffer.size(), NULL);
+				ok = !LZ4F_isError(n) &&
+					WriteAll(fd, &f->buffer[0], n);
+			}
+		}
+		else {
+			f->buffer.resize(LZ4TAR_CHUNK_SIZE);
+			ok = !LZ4F_isError(LZ4F_createDecompressionContext(&f->dctx, LZ4F_VERSION));
+		}
+
+		if( !ok ) {
+			Free(f);
+			close(fd);
+			return -1;
+		}
+
+		unsigned int index = 0;
+		for( ; index < handles.size(); index++ ) {
+			if( handles[index] == 0 )
+				break;
+		}
+		if( index == handles.size() )
+			handles.push_back(f);
+		else
+			handles[index] = f;
+		return index;
+	}
+
+	int close_compressed(int fd)
+	{
+		Lz4File *f = Lookup(fd);
+		handles[fd] = 0;
+
+		bool ok = true;
+		if( f->cctx ) {
+			size_t n = LZ4F_compressEnd(f->cctx,
+				&f->buffer[0], f->buffer.size(), NULL);
+			ok = !LZ4F_isError(n) && WriteAll(f->fd, &f->buffer[0], n);
+		}
+
+		if( close(f->fd) != 0 )
+			ok = false;
+		Free(f);
+		return ok ? 0 : -1;
+	}
+
+	ssize_t read_compressed(int fd, void *buf, size_t size)
+	{
+		Lz4File *f = Lookup(fd);
+		if( !f->dctx )
+			return -1;
+
+		char *dst = (char*) buf;
+		size_t done = 0;
+		while( done < size ) {
+			size_t dst_size = size - done;
+			size_t src_size = f->in_size - f->in_pos;
+			size_t ret = LZ4F_decompress(f->dctx, dst + done, &dst_size,
+				&f->buffer[0] + f->in_pos, &src_size, NULL);
+			if( LZ4F_isError(ret) )
+				return -1;
+			done += dst_size;
+			f->in_pos += src_size;
+
+			// an output buffer that is not full means the
+			// decoder has nothing more without new input
+			if( done == size || f->in_pos < f->in_size )
+				continue;
+			if( f->eof )
+				break;
+
+			ssize_t n = read(f->fd, &f->buffer[0], f->buffer.size());
+			if( n < 0 ) {
+				if( errno == EINTR )
+					continue;
+				return -1;
+			}
+			if( n == 0 )
+				f->eof = true;
+			f->in_pos = 0;
+			f->in_size = n;
+		}
+		return done;
+	}
+
+	ssize_t write_compressed(int fd, const void *buf, size_t size)
+	{
+		Lz4File *f = Lookup(fd);
+		if( !f->cctx )
+			return -1;
+
+		const char *src = (const char*) buf;
+		size_t left = size;
+		while( left ) {
+			size_t chunk = left < LZ4TAR_CHUNK_SIZE ? left : LZ4TAR_CHUNK_SIZE;
+			size_t n = LZ4F_compressUpdate(f->cctx,
+				&f->buffer[0], f->buffer.size(), src, chunk, NULL);
+			if( LZ4F_isError(n) || !WriteAll(f->fd, &f->buffer[0], n) )
+				return -1;
+			src += chunk;
+			left -= chunk;
+		}
+		return size;
+	}
+
+} // namespace lz4tar_nonthread
+
+
+tartype_t lz4tar_ops_nonthread = {
+	(openfunc_t) lz4tar_nonthread::open_compressed,
+	lz4tar_nonthread::close_compressed,
+	lz4tar_nonthread::read_compressed,
+	lz4tar_nonthread::write_compressed
+};
+
+
+} // namespace reuse
+
+#endif // HAVE_LIBLZ4
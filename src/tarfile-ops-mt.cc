@@ -0,0 +1,556 @@
+///
+/// \file	tarfile-ops-mt.cc
+///		Parallel, thread safe operation functions for a
+///		libtar-compatible zlib compression interface.
+
+/*
+    Copyright (C) 2007-2013, Chris Frey <cdfrey@foursquare.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "tarfile.h"
+#include "scoped_lock.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+
+namespace reuse {
+
+namespace gztar_parallel {
+
+	// Writing works the way pigz does: the tar stream is cut into
+	// fixed size blocks, and each block is deflated by a worker
+	// thread as a raw deflate stream, ending on a byte boundary with
+	// Z_SYNC_FLUSH (or Z_FINISH for the last block).  The last 32k of
+	// the previous block is used as a preset dictionary, so the
+	// ratio is close to a single stream.  The blocks are written
+	// in order between a normal gzip header and trailer, so the
+	// result is one standard gzip member that any gunzip can read.
+	//
+	// Reading a deflate stream cannot be split up this way, so
+	// files opened for reading use plain zlib gzFile calls.
+
+	#define GZP_BLOCK_SIZE		(128 * 1024)
+	#define GZP_DICT_SIZE		(32 * 1024)
+	#define GZP_LEVEL		9
+	#define GZP_MAX_THREADS		8
+
+	struct Job
+	{
+		std::string m_input;
+		std::string m_dict;
+		std::string m_output;
+		uLong m_crc;
+		bool m_last;
+		bool m_done;
+		bool m_failed;
+	};
+
+	class Compressor
+	{
+		int m_fd;
+		bool m_failed;
+
+		pthread_mutex_t m_mutex;
+		pthread_cond_t m_cond;
+		std::vector<pthread_t> m_threads;
+		bool m_quit;
+
+		std::string m_block;		//< input not yet handed out
+		std::string m_dict;		//< tail of the previous block
+		std::deque<Job*> m_jobs;	//< in stream order
+		std::deque<Job*>::size_type m_next_job;	//< next unclaimed
+
+		uLong m_crc;
+		uLong m_total;
+
+		// restart point tracking
+		off_t m_file_bytes;		//< written to m_fd so far
+		off_t m_member_offset;		//< where current member starts
+		uint64_t m_member_bytes;	//< input since member start
+		off_t m_index_offset;		//< -1 if no index marker
+
+	protected:
+		static void* WorkerThread(void *arg);
+		void Worker();
+		static bool Deflate(Job &job);
+
+		void Submit(bool last);
+		bool WriteAll(const void *buf, size_t size);
+		bool WriteDone(bool wait);
+		bool WriteHeader();
+		bool FinishMember();
+
+	public:
+		explicit Compressor(int fd);
+		~Compressor();
+
+		bool Start();
+		ssize_t Write(const void *buf, size_t size);
+		bool Restart();
+		void Tell(TarOffset &pos) const;
+		void SetIndex(off_t member) { m_index_offset = member; }
+		int Close();
+	};
+
+	Compressor::Compressor(int fd)
+		: m_fd(fd)
+		, m_failed(false)
+		, m_quit(false)
+		, m_next_job(0)
+		, m_crc(crc32(0L, Z_NULL, 0))
+		, m_total(0)
+		, m_file_bytes(0)
+		, m_member_offset(0)
+		, m_member_bytes(0)
+		, m_index_offset(-1)
+	{
+		pthread_mutex_init(&m_mutex, NULL);
+		pthread_cond_init(&m_cond, NULL);
+	}
+
+	Compressor::~Compressor()
+	{
+		// stop workers, in case Close() was never reached
+		{
+			Barry::scoped_lock lock(m_mutex);
+			m_quit = true;
+			pthread_cond_broadcast(&m_cond);
+		}
+		for( size_t i = 0; i < m_threads.size(); i++ )
+			pthread_join(m_threads[i], NULL);
+
+		for( size_t i = 0; i < m_jobs.size(); i++ )
+			delete m_jobs[i];
+
+		pthread_cond_destroy(&m_cond);
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	void* Compressor::WorkerThread(void *arg)
+	{
+		((Compressor*) arg)->Worker();
+		return 0;
+	}
+
+	void Compressor::Worker()
+	{
+		for(;;) {
+			Job *job;
+			{
+				Barry::scoped_lock lock(m_mutex);
+				while( !m_quit && m_next_job >= m_jobs.size() )
+					pthread_cond_wait(&m_cond, &m_mutex);
+				if( m_quit )
+					return;
+				job = m_jobs[m_next_job++];
+			}
+
+			bool ok = Deflate(*job);
+
+			Barry::scoped_lock lock(m_mutex);
+			job->m_failed = !ok;
+			job->m_done = true;
+			pthread_cond_broadcast(&m_cond);
+		}
+	}
+
+	bool Compressor::Deflate(Job &job)
+	{
+		job.m_crc = crc32(crc32(0L, Z_NULL, 0),
+			(const Bytef*) job.m_input.data(), job.m_input.size());
+
+		z_stream strm;
+		strm.zalloc = Z_NULL;
+		strm.zfree = Z_NULL;
+		strm.opaque = Z_NULL;
+		if( deflateInit2(&strm, GZP_LEVEL, Z_DEFLATED, -15, 8,
+				Z_DEFAULT_STRATEGY) != Z_OK )
+			return false;
+
+		if( job.m_dict.size() ) {
+			deflateSetDictionary(&strm,
+				(const Bytef*) job.m_dict.data(),
+				job.m_dict.size());
+		}
+
+		// room for the worst case, plus the sync flush marker
+		job.m_output.resize(deflateBound(&strm, job.m_input.size()) + 16);
+
+		strm.next_in = (Bytef*) job.m_input.data();
+		strm.avail_in = job.m_input.size();
+
+		int flush = job.m_last ? Z_FINISH : Z_SYNC_FLUSH;
+		size_t used = 0;
+		int ret;
+		for(;;) {
+			strm.next_out = (Bytef*) &job.m_output[used];
+			strm.avail_out = job.m_output.size() - used;
+			ret = deflate(&strm, flush);
+			used = job.m_output.size() - strm.avail_out;
+
+			// a full output buffer may mean there is more to come
+			if( ret == Z_STREAM_END || ret == Z_STREAM_ERROR ||
+			    strm.avail_out > 0 )
+				break;
+			job.m_output.resize(job.m_output.size() * 2);
+		}
+		job.m_output.resize(used);
+		deflateEnd(&strm);
+
+		// dictionary is no longer needed
+		std::string().swap(job.m_dict);
+
+		if( job.m_last )
+			return ret == Z_STREAM_END;
+		// a repeated flush with nothing left to write gives Z_BUF_ERROR
+		return (ret == Z_OK || ret == Z_BUF_ERROR) && strm.avail_in == 0;
+	}
+
+	bool Compressor::WriteHeader()
+	{
+		// standard gzip header: no name, no mtime, unix
+		static const unsigned char header[10] = {
+			0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 2, 3 };
+		return WriteAll(header, sizeof(header));
+	}
+
+	/// Compresses and writes everything buffered, and ends the
+	/// current gzip member with its trailer
+	bool Compressor::FinishMember()
+	{
+		Submit(true);
+		while( !m_failed && m_jobs.size() ) {
+			if( !WriteDone(true) )
+				break;
+		}
+
+		// gzip trailer: CRC32 and length, little endian
+		unsigned char trailer[8];
+		for( int i = 0; i < 4; i++ ) {
+			trailer[i] = (m_crc >> (i * 8)) & 0xff;
+			trailer[i + 4] = (m_total >> (i * 8)) & 0xff;
+		}
+
+		return !m_failed && WriteAll(trailer, sizeof(trailer));
+	}
+
+	bool Compressor::Start()
+	{
+		if( !WriteHeader() )
+			return false;
+
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if( cpus < 1 )
+			cpus = 1;
+		if( cpus > GZP_MAX_THREADS )
+			cpus = GZP_MAX_THREADS;
+
+		for( long i = 0; i < cpus; i++ ) {
+			pthread_t thread;
+			if( pthread_create(&thread, NULL, &Compressor::WorkerThread, this) != 0 )
+				break;
+			m_threads.push_back(thread);
+		}
+		return m_threads.size() > 0;
+	}
+
+	bool Compressor::WriteAll(const void *buf, size_t size)
+	{
+		const char *p = (const char*) buf;
+		while( size ) {
+			ssize_t n = write(m_fd, p, size);
+			if( n < 0 ) {
+				if( errno == EINTR )
+					continue;
+				m_failed = true;
+				return false;
+			}
+			p += n;
+			size -= n;
+			m_file_bytes += n;
+		}
+		return true;
+	}
+
+	/// Writes finished jobs from the front of the queue, in order.
+	/// If wait is true, waits until the oldest job is finished first.
+	bool Compressor::WriteDone(bool wait)
+	{
+		for(;;) {
+			Job *job;
+			{
+				Barry::scoped_lock lock(m_mutex);
+				if( m_jobs.empty() )
+					return true;
+				job = m_jobs.front();
+				while( wait && !job->m_done )
+					pthread_cond_wait(&m_cond, &m_mutex);
+				if( !job->m_done )
+					return true;
+				m_jobs.pop_front();
+				m_next_job--;
+			}
+			wait = false;
+
+			bool ok = !job->m_failed &&
+				WriteAll(job->m_output.data(), job->m_output.size());
+			m_crc = crc32_combine(m_crc, job->m_crc, job->m_input.size());
+			m_total += job->m_input.size();
+			delete job;
+
+			if( !ok ) {
+				m_failed = true;
+				return false;
+			}
+		}
+	}
+
+	void Compressor::Submit(bool last)
+	{
+		Job *job = new Job;
+		job->m_last = last;
+		job->m_done = false;
+		job->m_failed = false;
+		job->m_crc = 0;
+		job->m_input.swap(m_block);
+		m_block.reserve(GZP_BLOCK_SIZE);
+
+		// prime with the tail of the previous block
+		job->m_dict = m_dict;
+		if( job->m_input.size() >= GZP_DICT_SIZE )
+			m_dict.assign(job->m_input, job->m_input.size() - GZP_DICT_SIZE, GZP_DICT_SIZE);
+		else
+			m_dict = job->m_input;
+
+		Barry::scoped_lock lock(m_mutex);
+		m_jobs.push_back(job);
+		pthread_cond_signal(&m_cond);
+	}
+
+	ssize_t Compressor::Write(const void *buf, size_t size)
+	{
+		if( m_failed )
+			return -1;
+
+		const char *p = (const char*) buf;
+		size_t left = size;
+		while( left ) {
+			size_t n = GZP_BLOCK_SIZE - m_block.size();
+			if( n > left )
+				n = left;
+			m_block.append(p, n);
+			p += n;
+			left -= n;
+			m_member_bytes += n;
+
+			if( m_block.size() == GZP_BLOCK_SIZE ) {
+				Submit(false);
+
+				// keep memory bounded: two blocks per worker
+				bool full = m_jobs.size() >= m_threads.size() * 2;
+				if( !WriteDone(full) )
+					return -1;
+			}
+		}
+		return size;
+	}
+
+	/// Ends the current gzip member and starts a new one, so that
+	/// a reader can start decompressing here without anything
+	/// that came before.
+	bool Compressor::Restart()
+	{
+		if( m_failed )
+			return false;
+		if( m_member_bytes == 0 )
+			return true;	// already at the start of one
+
+		if( !FinishMember() )
+			return false;
+
+		m_crc = crc32(0L, Z_NULL, 0);
+		m_total = 0;
+		m_dict.clear();
+		m_member_offset = m_file_bytes;
+		m_member_bytes = 0;
+		return WriteHeader();
+	}
+
+	void Compressor::Tell(TarOffset &pos) const
+	{
+		pos.member = m_member_offset;
+		pos.skip = m_member_bytes;
+	}
+
+	int Compressor::Close()
+	{
+		bool ok = FinishMember();
+
+		if( ok && m_index_offset != -1 ) {
+			// empty gzip member holding the index position
+			// in an FEXTRA subfield... see tarfile.h
+			unsigned char m[TAR_INDEX_MARKER_SIZE] = {
+				0x1f, 0x8b, Z_DEFLATED, 4, 0, 0, 0, 0, 0, 3,
+				12, 0, 'B', 'I', 8, 0 };
+			for( int i = 0; i < 8; i++ )
+				m[16 + i] = ((uint64_t)m_index_offset >> (i * 8)) & 0xff;
+			m[24] = 3;	// empty final static block
+			m[25] = 0;
+			// CRC32 and length of nothing are both zero
+			ok = WriteAll(m, sizeof(m));
+		}
+
+		if( close(m_fd) != 0 )
+			ok = false;
+		return ok ? 0 : -1;
+	}
+
+	//
+	// Handle table
+	//
+
+	struct Handle
+	{
+		gzFile m_gz;		//< for reading
+		Compressor *m_comp;	//< for writing
+	};
+
+	namespace {
+		pthread_mutex_t handleMutex = PTHREAD_MUTEX_INITIALIZER;
+		std::vector<Handle> handles;
+
+		Handle Lookup(int fd)
+		{
+			Barry::scoped_lock lock(handleMutex);
+			return handles.at(fd);
+		}
+	}
+
+	int open_compressed(const char *file, int flags, mode_t mode)
+	{
+		int fd = open(file, flags, mode);
+		if( fd == -1 )
+			return -1;
+
+		Handle h = { 0, 0 };
+		if( flags & O_WRONLY ) {
+			h.m_comp = new Compressor(fd);
+			if( !h.m_comp->Start() ) {
+				delete h.m_comp;
+				close(fd);
+				return -1;
+			}
+		}
+		else {
+			h.m_gz = gzdopen(fd, "rb");
+			if( h.m_gz == NULL ) {
+				close(fd);
+				return -1;
+			}
+		}
+
+		Barry::scoped_lock lock(handleMutex);
+		unsigned int index = 0;
+		for( ; index < handles.size(); index++ ) {
+			if( handles[index].m_gz == 0 && handles[index].m_comp == 0 )
+				break;
+		}
+		if( index == handles.size() )
+			handles.push_back(h);
+		else
+			handles[index] = h;
+		return index;
+	}
+
+	int close_compressed(int fd)
+	{
+		Handle h = Lookup(fd);
+		{
+			Barry::scoped_lock lock(handleMutex);
+			handles[fd].m_gz = 0;
+			handles[fd].m_comp = 0;
+		}
+
+		if( h.m_comp ) {
+			int ret = h.m_comp->Close();
+			delete h.m_comp;
+			return ret;
+		}
+		return gzclose(h.m_gz);
+	}
+
+	ssize_t read_compressed(int fd, void *buf, size_t size)
+	{
+		Handle h = Lookup(fd);
+		if( !h.m_gz )
+			return -1;
+		return gzread(h.m_gz, buf, size);
+	}
+
+	ssize_t write_compressed(int fd, const void *buf, size_t size)
+	{
+		Handle h = Lookup(fd);
+		if( !h.m_comp )
+			return -1;
+		return h.m_comp->Write(buf, size);
+	}
+
+	bool restart_compressed(int fd)
+	{
+		Handle h = Lookup(fd);
+		return h.m_comp && h.m_comp->Restart();
+	}
+
+	bool tell_compressed(int fd, TarOffset &pos)
+	{
+		Handle h = Lookup(fd);
+		if( !h.m_comp )
+			return false;
+		h.m_comp->Tell(pos);
+		return true;
+	}
+
+	bool set_index_compressed(int fd, off_t member)
+	{
+		Handle h = Lookup(fd);
+		if( !h.m_comp )
+			return false;
+		h.m_comp->SetIndex(member);
+		return true;
+	}
+
+} // namespace gztar_parallel
+
+
+tartype_t gztar_ops_parallel = {
+	(openfunc_t) gztar_parallel::open_compressed,
+	gztar_parallel::close_compressed,
+	gztar_parallel::read_compressed,
+	gztar_parallel::write_compressed
+};
+
+
+} // namespace reuse
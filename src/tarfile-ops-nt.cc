@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <stdlib.h>
 
 #include <zlib.h>
@@ -35,9 +36,16 @@ namespace reuse {
 namespace gztar_nonthread {
 
 	namespace {
+		struct Handle
+		{
+			gzFile gz;
+			int fd;		// raw file, kept for seeking
+					// when reading, -1 otherwise
+		};
+
 		// array of compressed file handles... needed for architectures
 		// where sizeof(int) != sizeof(gzFile)
-		gzFile *gzHandles = 0;
+		Handle *gzHandles = 0;
 		unsigned int gzArraySize = 0;
 	}
 
@@ -45,14 +53,16 @@ namespace gztar_nonthread {
 	{
 		unsigned int index = 0;
 		for( ; index < gzArraySize; index++ ) {
-			if( gzHandles[index] == 0 )
+			if( gzHandles[index].gz == 0 )
 				break;
 		}
 		if( index >= gzArraySize ) {
-			gzFile *h = (gzFile*) realloc(gzHandles,
-				(gzArraySize + 100) * sizeof(gzFile));
+			Handle *h = (Handle*) realloc(gzHandles,
+				(gzArraySize + 100) * sizeof(Handle));
 			if( h ) {
 				gzHandles = h;
+				for( unsigned int i = gzArraySize; i < gzArraySize + 100; i++ )
+					gzHandles[i].gz = 0;
 				gzArraySize += 100;
 			}
 			else {
@@ -64,13 +74,28 @@ namespace gztar_nonthread {
 		if( fd == -1 )
 			return -1;
 
+		// when reading, zlib gets its own descriptor, so that
+		// seek_compressed() can start over on a new gzFile
+		int rawfd = -1;
+		if( !(flags & O_WRONLY) ) {
+			rawfd = fd;
+			fd = dup(rawfd);
+			if( fd == -1 ) {
+				close(rawfd);
+				return -1;
+			}
+		}
+
 		gzFile gfd = gzdopen(fd, (flags & O_WRONLY) ? "wb9" : "rb");
 		if( gfd == NULL ) {
 			close(fd);
+			if( rawfd != -1 )
+				close(rawfd);
 			return -1;
 		}
 
-		gzHandles[index] = gfd;
+		gzHandles[index].gz = gfd;
+		gzHandles[index].fd = rawfd;
 		return index;
 	}
 
@@ -78,8 +103,10 @@ namespace gztar_nonthread {
 	{
 		unsigned int ufd = fd;
 		assert( ufd < gzArraySize );
-		int ret = gzclose(gzHandles[ufd]);
-		gzHandles[ufd] = 0;
+		int ret = gzclose(gzHandles[ufd].gz);
+		if( gzHandles[ufd].fd != -1 )
+			close(gzHandles[ufd].fd);
+		gzHandles[ufd].gz = 0;
 		return ret;
 	}
 
@@ -87,14 +114,51 @@ namespace gztar_nonthread {
 	{
 		unsigned int ufd = fd;
 		assert( ufd < gzArraySize );
-		return gzread(gzHandles[ufd], buf, size);
+		return gzread(gzHandles[ufd].gz, buf, size);
 	}
 
 	ssize_t write_compressed(int fd, const void *buf, size_t size)
 	{
 		unsigned int ufd = fd;
 		assert( ufd < gzArraySize );
-		return gzwrite(gzHandles[ufd], buf, size);
+		return gzwrite(gzHandles[ufd].gz, buf, size);
+	}
+
+	bool seek_compressed(int fd, const TarOffset &pos)
+	{
+		unsigned int ufd = fd;
+		assert( ufd < gzArraySize );
+		Handle &h = gzHandles[ufd];
+		if( h.fd == -1 )
+			return false;	// write mode
+
+		// start decompressing afresh at the gzip member... the new
+		// gzFile only replaces the old one once it is open, so a
+		// failure never leaves this slot looking free to
+		// open_compressed() while h.fd is still in use
+		int gzfd = -1;
+		gzFile gz = NULL;
+		if( lseek(h.fd, pos.member, SEEK_SET) != (off_t)-1 &&
+		    (gzfd = dup(h.fd)) != -1 )
+			gz = gzdopen(gzfd, "rb");
+		if( gz == NULL ) {
+			if( gzfd != -1 )
+				close(gzfd);
+			return false;
+		}
+		gzclose(h.gz);
+		h.gz = gz;
+
+		// and skip to the position inside it
+		char buf[4096];
+		uint64_t left = pos.skip;
+		while( left ) {
+			unsigned int n = left < sizeof(buf) ? left : sizeof(buf);
+			if( gzread(h.gz, buf, n) != (int) n )
+				return false;
+			left -= n;
+		}
+		return true;
 	}
 
 } // namespace gztar_nonthread
@@ -0,0 +1,229 @@
+///
+/// \file	tarfile-ops-zstd.cc
+///		Non-thread safe operation functions for a libtar-compatible
+///		zstd compression interface.
+
+/*
+    Copyright (C) 2007-2013, Chris Frey <cdfrey@foursquare.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include <config.h>
+#include "tarfile.h"
+
+#ifdef HAVE_LIBZSTD
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <zstd.h>
+
+#include <vector>
+#include <assert.h>
+
+namespace reuse {
+
+namespace zstdtar_nonthread {
+
+	struct ZstdFile
+	{
+		int fd;
+		ZSTD_CCtx *cctx;	//< set when writing
+		ZSTD_DCtx *dctx;	//< set when reading
+		std::vector<char> buffer;
+		ZSTD_inBuffer in;	//< read side: unconsumed file data
+		bool eof;
+	};
+
+	namespace {
+		std::vector<ZstdFile*> handles;
+
+		ZstdFile* Lookup(int fd)
+		{
+			unsigned int ufd = fd;
+			assert( ufd < handles.size() && handles[ufd] );
+			return handles[ufd];
+		}
+
+		bool WriteAll(int fd, const char *buf, size_t size)
+		{
+			while( size ) {
+				ssize_t n = write(fd, buf, size);
+				if( n < 0 ) {
+					if( errno == EINTR )
+						continue;
+					return false;
+				}
+				buf += n;
+				size -= n;
+			}
+			return true;
+		}
+
+		// feeds in to the compressor, writing whatever comes out;
+		// returns false on error
+		bool Compress(ZstdFile *f, ZSTD_inBuffer &in, ZSTD_EndDirective mode)
+		{
+			for(;;) {
+				ZSTD_outBuffer out = { &f->buffer[0], f->buffer.size(), 0 };
+				size_t remaining = ZSTD_compressStream2(f->cctx,
+					&out, &in, mode);
+				if( ZSTD_isError(remaining) )
+					return false;
+				if( !WriteAll(f->fd, &f->buffer[0], out.pos) )
+					return false;
+
+				if( mode == ZSTD_e_end ? remaining == 0 :
+						in.pos == in.size )
+					return true;
+			}
+		}
+
+		void Free(ZstdFile *f)
+		{
+			if( f->cctx )
+				ZSTD_freeCCtx(f->cctx);
+			if( f->dctx )
+				ZSTD_freeDCtx(f->dctx);
+			delete f;
+		}
+	}
+
+	int open_compressed(const char *file, int flags, mode_t mode)
+	{
+		int fd = open(file, flags, mode);
+		if( fd == -1 )
+			return -1;
+
+		ZstdFile *f = new ZstdFile;
+		f->fd = fd;
+		f->cctx = 0;
+		f->dctx = 0;
+		f->in.src = 0;
+		f->in.size = f->in.pos = 0;
+		f->eof = false;
+
+		if( flags & O_WRONLY ) {
+			f->cctx = ZSTD_createCCtx();
+			f->buffer.resize(ZSTD_CStreamOutSize());
+
+			// let libzstd use its own worker threads, if it
+			// was built with them... harmless if not
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			if( f->cctx && cpus > 1 )
+				ZSTD_CCtx_setParameter(f->cctx, ZSTD_c_nbWorkers, cpus);
+		}
+		else {
+			f->dctx = ZSTD_createDCtx();
+			f->buffer.resize(ZSTD_DStreamInSize());
+		}
+
+		if( !f->cctx && !f->dctx ) {
+			Free(f);
+			close(fd);
+			return -1;
+		}
+
+		unsigned int index = 0;
+		for( ; index < handles.size(); index++ ) {
+			if( handles[index] == 0 )
+				break;
+		}
+		if( index == handles.size() )
+			handles.push_back(f);
+		else
+			handles[index] = f;
+		return index;
+	}
+
+	int close_compressed(int fd)
+	{
+		ZstdFile *f = Lookup(fd);
+		handles[fd] = 0;
+
+		bool ok = true;
+		if( f->cctx ) {
+			ZSTD_inBuffer in = { 0, 0, 0 };
+			ok = Compress(f, in, ZSTD_e_end);
+		}
+
+		if( close(f->fd) != 0 )
+			ok = false;
+		Free(f);
+		return ok ? 0 : -1;
+	}
+
+	ssize_t read_compressed(int fd, void *buf, size_t size)
+	{
+		ZstdFile *f = Lookup(fd);
+		if( !f->dctx )
+			return -1;
+
+		ZSTD_outBuffer out = { buf, size, 0 };
+		while( out.pos < out.size ) {
+			size_t ret = ZSTD_decompressStream(f->dctx, &out, &f->in);
+			if( ZSTD_isError(ret) )
+				return -1;
+
+			// an output buffer that is not full means the
+			// decoder has nothing more without new input
+			if( out.pos == out.size || f->in.pos < f->in.size )
+				continue;
+			if( f->eof )
+				break;
+
+			ssize_t n = read(f->fd, &f->buffer[0], f->buffer.size());
+			if( n < 0 ) {
+				if( errno == EINTR )
+					continue;
+				return -1;
+			}
+			if( n == 0 )
+				f->eof = true;
+			f->in.src = &f->buffer[0];
+			f->in.size = n;
+			f->in.pos = 0;
+		}
+		return out.pos;
+	}
+
+	ssize_t write_compressed(int fd, const void *buf, size_t size)
+	{
+		ZstdFile *f = Lookup(fd);
+		if( !f->cctx )
+			return -1;
+
+		ZSTD_inBuffer in = { buf, size, 0 };
+		if( !Compress(f, in, ZSTD_e_continue) )
+			return -1;
+		return size;
+	}
+
+} // namespace zstdtar_nonthread
+
+
+tartype_t zstdtar_ops_nonthread = {
+	(openfunc_t) zstdtar_nonthread::open_compressed,
+	zstdtar_nonthread::close_compressed,
+	zstdtar_nonthread::read_compressed,
+	zstdtar_nonthread::write_compressed
+};
+
+
+} // namespace reuse
+
+#endif // HAVE_LIBZSTD
@@ -19,6 +19,7 @@
     root directory of this project for more details.
 */
 
+#include <config.h>
 #include "i18n.h"
 #include "tarfile.h"
 #include "data.h"
@@ -27,14 +28,85 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 namespace reuse {
 
+namespace {
+
+	bool EndsWith(const std::string &str, const char *suffix)
+	{
+		size_t len = strlen(suffix);
+		return str.size() >= len &&
+			str.compare(str.size() - len, len, suffix) == 0;
+	}
+
+}
+
+tartype_t* TarFile::GetWriteOps(const std::string &filename,
+				tartype_t *gzip_ops)
+{
+	if( EndsWith(filename, ".zst") || EndsWith(filename, ".tzst") ) {
+#ifdef HAVE_LIBZSTD
+		return &zstdtar_ops_nonthread;
+#else
+		throw TarError(_("zstd compression not supported in this build: ") + filename);
+#endif
+	}
+
+	if( EndsWith(filename, ".lz4") ) {
+#ifdef HAVE_LIBLZ4
+		return &lz4tar_ops_nonthread;
+#else
+		throw TarError(_("lz4 compression not supported in this build: ") + filename);
+#endif
+	}
+
+	return gzip_ops;
+}
+
+tartype_t* TarFile::GetReadOps(const std::string &filename,
+				tartype_t *gzip_ops)
+{
+	static const unsigned char zstd_magic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+	static const unsigned char lz4_magic[4] = { 0x04, 0x22, 0x4d, 0x18 };
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if( fd == -1 )
+		throw TarError(std::string(_("Unable to open tar file: ")) + strerror(errno));
+
+	unsigned char magic[4];
+	ssize_t n = read(fd, magic, sizeof(magic));
+	close(fd);
+	if( n != sizeof(magic) )
+		return gzip_ops;	// let zlib sort it out
+
+	if( memcmp(magic, zstd_magic, sizeof(magic)) == 0 ) {
+#ifdef HAVE_LIBZSTD
+		return &zstdtar_ops_nonthread;
+#else
+		throw TarError(_("zstd compression not supported in this build: ") + filename);
+#endif
+	}
+
+	if( memcmp(magic, lz4_magic, sizeof(magic)) == 0 ) {
+#ifdef HAVE_LIBLZ4
+		return &lz4tar_ops_nonthread;
+#else
+		throw TarError(_("lz4 compression not supported in this build: ") + filename);
+#endif
+	}
+
+	// gzip, or plain tar, which zlib reads transparently
+	return gzip_ops;
+}
+
 TarFile::TarFile(const char *filename,
 		 bool create,
 		 tartype_t *compress_ops,
 		 bool always_throw)
 	: m_tar(0),
+	m_ops(compress_ops),
 	m_throw(always_throw),
 	m_writemode(create)
 {
@@ -284,6 +356,67 @@ bool TarFile::ReadNextFilenameOnly(std::string &tarpath)
 	return true;
 }
 
+/// Write mode: fills pos with where the next file will be written,
+/// after starting a new restart point there, if restart is true.
+/// Returns false, without error, if the op set does not support it.
+bool TarFile::GetPosition(TarOffset &pos, bool restart)
+{
+	if( !m_writemode || m_ops != &gztar_ops_parallel )
+		return false;
+
+	if( restart && !gztar_parallel::restart_compressed(tar_fd(m_tar)) )
+		return False(_("Unable to start tar restart point"), errno);
+	if( !gztar_parallel::tell_compressed(tar_fd(m_tar), pos) )
+		return False(_("Unable to get tar position"));
+	return true;
+}
+
+bool TarFile::SetIndexPosition(const TarOffset &pos)
+{
+	if( !m_writemode || m_ops != &gztar_ops_parallel || pos.skip != 0 )
+		return False(_("Tar index must be at a restart point"));
+
+	if( !gztar_parallel::set_index_compressed(tar_fd(m_tar), pos.member) )
+		return False(_("Unable to set tar index position"));
+	return true;
+}
+
+bool TarFile::Seek(const TarOffset &pos)
+{
+	if( m_writemode || m_ops != &gztar_ops_nonthread )
+		return False(_("Seeking not supported for this tar file"));
+
+	if( !gztar_nonthread::seek_compressed(tar_fd(m_tar), pos) )
+		return False(_("Unable to seek in tar file"), errno);
+	return true;
+}
+
+bool TarFile::FindIndex(const std::string &filename, TarOffset &pos)
+{
+	unsigned char m[TAR_INDEX_MARKER_SIZE];
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if( fd == -1 )
+		return false;
+	bool ok = lseek(fd, -(off_t)sizeof(m), SEEK_END) != (off_t)-1 &&
+		read(fd, m, sizeof(m)) == (ssize_t)sizeof(m);
+	close(fd);
+
+	// gzip magic with only FEXTRA set, XLEN 12, 'B','I' subfield of 8
+	if( !ok || m[0] != 0x1f || m[1] != 0x8b || m[2] != 8 || m[3] != 4 ||
+	    m[10] != 12 || m[11] != 0 || m[12] != 'B' || m[13] != 'I' ||
+	    m[14] != 8 || m[15] != 0 )
+		return false;
+
+	uint64_t offset = 0;
+	for( int i = 7; i >= 0; i-- )
+		offset = (offset << 8) | m[16 + i];
+
+	pos.member = offset;
+	pos.skip = 0;
+	return true;
+}
+
 
 } // namespace reuse
 
@@ -25,6 +25,8 @@
 #include "dll.h"
 #include <string>
 #include <stdexcept>
+#include <sys/types.h>
+#include <stdint.h>
 #include <libtar.h>
 
 namespace Barry {
@@ -41,9 +43,51 @@ namespace reuse {
 /// Compression op set for zlib, non-threadsafe.
 extern tartype_t gztar_ops_nonthread;
 
+/// Compression op set for zlib, threadsafe.  Compresses on a pool
+/// of worker threads when writing, producing a standard gzip file.
+extern tartype_t gztar_ops_parallel;
+
+/// Compression op sets for zstd and lz4, non-threadsafe.  These only
+/// exist when built with libzstd or liblz4 (HAVE_LIBZSTD, HAVE_LIBLZ4),
+/// so use TarFile::GetWriteOps() and GetReadOps() to pick an op set.
+extern tartype_t zstdtar_ops_nonthread;
+extern tartype_t lz4tar_ops_nonthread;
+
+/// Position of a file header inside a compressed tarball: the file
+/// offset of the compressed member (restart point) it is in, and
+/// how many uncompressed bytes into that member it starts.
+struct TarOffset
+{
+	off_t member;
+	uint64_t skip;
+
+	TarOffset() : member(0), skip(0) {}
+};
+
+//
+// Restart point and seek support, for the op sets that have it.
+// Use the TarFile members instead of calling these directly.
+//
+namespace gztar_nonthread {
+	bool seek_compressed(int fd, const TarOffset &pos);
+}
+
+// The index marker written by set_index_compressed() is an empty
+// gzip member at the very end of the file, whose FEXTRA field holds
+// a 'B','I' subfield containing the 64 bit little endian file offset
+// of the member holding the index file.
+#define TAR_INDEX_MARKER_SIZE	34
+
+namespace gztar_parallel {
+	bool restart_compressed(int fd);
+	bool tell_compressed(int fd, TarOffset &pos);
+	bool set_index_compressed(int fd, off_t member);
+}
+
 class BXLOCAL TarFile
 {
 	TAR *m_tar;
+	tartype_t *m_ops;
 	bool m_throw;
 	bool m_writemode;
 	std::string m_last_error;
@@ -61,6 +105,21 @@ public:
 	};
 
 public:
+	/// Returns the op set to create filename with, chosen by its
+	/// extension: .zst or .tzst for zstd, .lz4 for lz4, and gzip_ops
+	/// for anything else.  Throws TarError if the chosen format
+	/// is not available in this build.
+	static tartype_t* GetWriteOps(const std::string &filename,
+		tartype_t *gzip_ops = &gztar_ops_nonthread);
+
+	/// Returns the op set to read filename with, chosen by the
+	/// magic number at the start of the file.  gzip_ops is used
+	/// for gzip and anything unrecognized.  Throws TarError if the
+	/// file cannot be opened, or its format is not available in
+	/// this build.
+	static tartype_t* GetReadOps(const std::string &filename,
+		tartype_t *gzip_ops = &gztar_ops_nonthread);
+
 	explicit TarFile(const char *filename, bool write = false,
 		tartype_t *compress_ops = 0, bool always_throw = false);
 	~TarFile();
@@ -83,6 +142,34 @@ public:
 	/// Read next available filename, skipping the data if it is
 	/// a regular file
 	bool ReadNextFilenameOnly(std::string &tarpath);
+
+	//
+	// Indexed tarballs
+	//
+	// Tarballs written with gztar_ops_parallel can be cut into
+	// separately compressed gzip members (restart points), and
+	// end with a marker giving the position of an index file.
+	// Readers using gztar_ops_nonthread can then jump straight to
+	// any file, given its position.  The result is still a normal
+	// gzip compressed tarball to everyone else.
+	//
+
+	/// Write mode: fills pos with where the next file will be
+	/// written.  If restart is true, a new restart point is started
+	/// there first.  Returns false if the op set cannot do this.
+	bool GetPosition(TarOffset &pos, bool restart = false);
+
+	/// Write mode: records pos, which must be a restart point, as
+	/// the location of the index file, to be found by FindIndex()
+	bool SetIndexPosition(const TarOffset &pos);
+
+	/// Read mode: continues reading at pos, as returned by
+	/// GetPosition() when the tarball was written
+	bool Seek(const TarOffset &pos);
+
+	/// Checks the end of filename for an index marker, filling pos
+	/// with the index file's position.  Returns false if none.
+	static bool FindIndex(const std::string &filename, TarOffset &pos);
 };
 
 }
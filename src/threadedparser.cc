@@ -0,0 +1,265 @@
+///
+/// \file	threadedparser.cc
+///		Parser wrapper that runs another parser on its own thread
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "threadedparser.h"
+#include "scoped_lock.h"
+#include "error.h"
+#include <iostream>
+#include <iomanip>
+#include <string.h>
+#include <sys/time.h>
+
+namespace Barry {
+
+namespace {
+
+	double Now()
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		return now.tv_sec + now.tv_usec / 1000000.0;
+	}
+
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ThreadedParser::Stats
+
+ThreadedParser::Stats::Stats()
+	: Records(0)
+	, Bytes(0)
+	, MaxDepth(0)
+	, SourceSeconds(0)
+	, SourceWaitSeconds(0)
+	, WriteSeconds(0)
+	, WriteWaitSeconds(0)
+{
+}
+
+std::ostream& operator<<(std::ostream &os, const ThreadedParser::Stats &stats)
+{
+	std::ios::fmtflags oldflags = os.setf(std::ios::fixed);
+	std::streamsize oldprec = os.precision(3);
+
+	os << _("Records: ") << stats.Records
+	   << _(", bytes: ") << stats.Bytes
+	   << _(", max queued: ") << stats.MaxDepth << "\n"
+	   << _("  Source: ") << stats.SourceSeconds << _("s working, ")
+		<< stats.SourceWaitSeconds << _("s waiting on writer") << "\n"
+	   << _("  Writer: ") << stats.WriteSeconds << _("s working, ")
+		<< stats.WriteWaitSeconds << _("s waiting on source");
+
+	os.precision(oldprec);
+	os.flags(oldflags);
+	return os;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// ThreadedParser
+
+ThreadedParser::ThreadedParser(Parser &parser, size_t depth)
+	: m_parser(parser)
+	, m_depth(depth ? depth : 1)
+	, m_busy(false)
+	, m_stop(false)
+	, m_failed(false)
+	, m_source_mark(0)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_notEmpty, NULL);
+	pthread_cond_init(&m_notFull, NULL);
+
+	int ret = pthread_create(&m_thread, NULL, &ThreadedParser::WriterThread, this);
+	if( ret ) {
+		pthread_cond_destroy(&m_notFull);
+		pthread_cond_destroy(&m_notEmpty);
+		pthread_mutex_destroy(&m_mutex);
+		throw Barry::ErrnoError(_("ThreadedParser: pthread_create failed."), ret);
+	}
+}
+
+ThreadedParser::~ThreadedParser()
+{
+	// the writer drains the queue before it stops
+	{
+		scoped_lock lock(m_mutex);
+		m_stop = true;
+		pthread_cond_broadcast(&m_notEmpty);
+	}
+	pthread_join(m_thread, NULL);
+
+	for( queue_type::iterator i = m_queue.begin(); i != m_queue.end(); ++i )
+		delete i->data;
+	for( free_type::iterator i = m_free.begin(); i != m_free.end(); ++i )
+		delete *i;
+
+	pthread_cond_destroy(&m_notFull);
+	pthread_cond_destroy(&m_notEmpty);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+void* ThreadedParser::WriterThread(void *arg)
+{
+	ThreadedParser *tp = (ThreadedParser*) arg;
+	tp->Writer();
+	return 0;
+}
+
+void ThreadedParser::Writer()
+{
+	scoped_lock lock(m_mutex);
+
+	for(;;) {
+		if( m_queue.empty() ) {
+			if( m_stop )
+				break;
+
+			double start = Now();
+			pthread_cond_wait(&m_notEmpty, &m_mutex);
+			m_stats.WriteWaitSeconds += Now() - start;
+			continue;
+		}
+
+		Item item = m_queue.front();
+		m_queue.pop_front();
+		m_busy = true;
+		pthread_cond_broadcast(&m_notFull);
+
+		// a failed parser gets nothing more, but the queue
+		// still drains so nobody is left waiting
+		if( !m_failed ) {
+			pthread_mutex_unlock(&m_mutex);
+
+			double start = Now();
+			std::string error;
+			try {
+				m_parser.ParseRecord(*item.data, item.ic);
+			}
+			catch( std::exception &e ) {
+				error = e.what();
+				if( error.empty() )
+					error = _("ThreadedParser: unknown error");
+			}
+			catch( ... ) {
+				error = _("ThreadedParser: unknown error");
+			}
+			double elapsed = Now() - start;
+
+			while( pthread_mutex_lock(&m_mutex) != 0 )
+				;
+
+			m_stats.WriteSeconds += elapsed;
+			if( error.size() ) {
+				m_failed = true;
+				m_error = error;
+			}
+		}
+
+		m_free.push_back(item.data);
+		m_busy = false;
+		pthread_cond_broadcast(&m_notFull);
+	}
+}
+
+/// Must be called with m_mutex held
+void ThreadedParser::ThrowIfFailed()
+{
+	if( m_failed )
+		throw Barry::Error(m_error);
+}
+
+void ThreadedParser::Flush()
+{
+	scoped_lock lock(m_mutex);
+	while( !m_failed && (m_queue.size() || m_busy) )
+		pthread_cond_wait(&m_notFull, &m_mutex);
+	ThrowIfFailed();
+}
+
+ThreadedParser::Stats ThreadedParser::GetStats() const
+{
+	scoped_lock lock(m_mutex);
+	return m_stats;
+}
+
+void ThreadedParser::ParseRecord(const DBData &data, const IConverter *ic)
+{
+	double start = Now();
+	DBData *slot = 0;
+
+	{
+		scoped_lock lock(m_mutex);
+		if( m_source_mark )
+			m_stats.SourceSeconds += start - m_source_mark;
+
+		if( !m_failed && m_queue.size() >= m_depth ) {
+			while( !m_failed && m_queue.size() >= m_depth )
+				pthread_cond_wait(&m_notFull, &m_mutex);
+			m_stats.SourceWaitSeconds += Now() - start;
+		}
+		ThrowIfFailed();
+
+		if( m_free.size() ) {
+			slot = m_free.back();
+			m_free.pop_back();
+		}
+	}
+
+	if( !slot )
+		slot = new DBData;
+
+	// always a deep copy, since data may point into a buffer
+	// that the caller reuses as soon as we return... the
+	// slot's own buffer is reused if it is big enough
+	try {
+		size_t size = data.GetData().GetSize();
+		unsigned char *buf = slot->UseData().GetBuffer(size);
+		memcpy(buf, data.GetData().GetData(), size);
+		slot->UseData().ReleaseBuffer(size);
+		slot->CopyMeta(data);
+	}
+	catch( ... ) {
+		delete slot;
+		throw;
+	}
+
+	{
+		scoped_lock lock(m_mutex);
+		Item item;
+		item.data = slot;
+		item.ic = ic;
+		m_queue.push_back(item);
+
+		m_stats.Records++;
+		m_stats.Bytes += data.GetData().GetSize() - data.GetOffset();
+		if( m_queue.size() > m_stats.MaxDepth )
+			m_stats.MaxDepth = m_queue.size();
+
+		pthread_cond_signal(&m_notEmpty);
+	}
+
+	m_source_mark = Now();
+}
+
+} // namespace Barry
+
@@ -0,0 +1,139 @@
+///
+/// \file	threadedparser.h
+///		Parser wrapper that runs another parser on its own thread
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __BARRY_THREADEDPARSER_H__
+#define __BARRY_THREADEDPARSER_H__
+
+#include "dll.h"
+#include "parser.h"
+#include <deque>
+#include <vector>
+#include <string>
+#include <iosfwd>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace Barry {
+
+//
+// ThreadedParser
+//
+/// Copies each incoming record into a bounded queue, and feeds them
+/// to another parser from a writer thread of its own.  This lets a
+/// slow parser, such as Backup writing a compressed tarball, work on
+/// one record while the device is sending the next.
+///
+/// When the queue is full, ParseRecord() blocks until the writer
+/// catches up, so memory use stays bounded.  Record buffers are
+/// recycled once the writer is done with them.
+///
+/// If the wrapped parser throws, the writer stops, and the error is
+/// thrown as a Barry::Error from the next call to ParseRecord() or
+/// Flush().  Call Flush() before using the wrapped parser's results,
+/// or before closing it.
+///
+/// This parser does NOT own the wrapped parser, and the IConverter
+/// passed to ParseRecord() must live until the record is written.
+///
+class BXEXPORT ThreadedParser : public Parser
+{
+public:
+	/// Per-stage counters.  The source is whatever calls
+	/// ParseRecord(), such as Desktop::LoadDatabase() reading
+	/// from the device.  Compare the wait times to find the
+	/// bottleneck: a source that waits on a full queue is faster
+	/// than the writer, and a writer that waits on an empty queue
+	/// is faster than the source.
+	struct BXEXPORT Stats
+	{
+		unsigned int Records;		//< records queued
+		uint64_t Bytes;			//< record data queued
+		unsigned int MaxDepth;		//< most records queued at once
+
+		double SourceSeconds;		//< time between ParseRecord() calls
+		double SourceWaitSeconds;	//< time blocked on a full queue
+		double WriteSeconds;		//< time in the wrapped parser
+		double WriteWaitSeconds;	//< time waiting on an empty queue
+
+		Stats();
+	};
+
+private:
+	struct Item
+	{
+		DBData *data;
+		const IConverter *ic;
+	};
+
+	typedef std::deque<Item>			queue_type;
+	typedef std::vector<DBData*>			free_type;
+
+	Parser &m_parser;
+	size_t m_depth;
+
+	mutable pthread_mutex_t m_mutex;	// protects everything below
+	pthread_cond_t m_notEmpty;		// signalled by ParseRecord()
+	pthread_cond_t m_notFull;		// signalled by writer
+
+	queue_type m_queue;
+	free_type m_free;
+	bool m_busy;			// writer is inside the wrapped parser
+	bool m_stop;
+	bool m_failed;
+	std::string m_error;
+
+	Stats m_stats;
+	double m_source_mark;		// when ParseRecord() last returned
+
+	pthread_t m_thread;
+
+protected:
+	static void* WriterThread(void *arg);
+	void Writer();
+	void ThrowIfFailed();
+
+public:
+	/// Starts the writer thread.  depth is the maximum number of
+	/// records waiting in the queue.
+	explicit ThreadedParser(Parser &parser, size_t depth = 64);
+
+	/// Waits for any queued records to be written, and stops the
+	/// writer thread.  Errors are thrown away; call Flush() first
+	/// to see them.
+	~ThreadedParser();
+
+	/// Waits until every queued record has been handed to the
+	/// wrapped parser.  Throws Barry::Error if the parser failed.
+	void Flush();
+
+	Stats GetStats() const;
+
+	// Barry::Parser overrides
+	virtual void ParseRecord(const DBData &data, const IConverter *ic);
+};
+
+BXEXPORT std::ostream& operator<<(std::ostream &os,
+	const ThreadedParser::Stats &stats);
+
+} // namespace Barry
+
+#endif
+
@@ -267,6 +267,11 @@ struct timespec* ThreadTimeout(int timeout_ms, struct timespec *spec)
 
 	spec->tv_sec = now.tv_sec + timeout_ms / 1000;
 	spec->tv_nsec = (now.tv_usec + timeout_ms % 1000 * 1000) * 1000;
+	if( spec->tv_nsec >= 1000000000 ) {
+		// pthread_cond_timedwait() rejects anything over a second
+		spec->tv_sec++;
+		spec->tv_nsec -= 1000000000;
+	}
 	return spec;
 }
 
@@ -0,0 +1,429 @@
+///
+/// \file	usbcapture.cc
+///		Binary pcap capture of USB traffic
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+#include "usbcapture.h"
+#include "usbwrap.h"
+#include "dataqueue.h"
+#include "scoped_lock.h"
+#include "error.h"
+#include "debug.h"
+#include "data.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <iostream>
+#include <algorithm>
+
+#define PCAP_MAGIC			0xa1b2c3d4
+#define LINKTYPE_USB_LINUX		189	// 48 byte usbmon header
+#define LINKTYPE_USB_LINUX_MMAPPED	220	// 64 byte usbmon header
+
+// usbmon transfer types
+#define USBMON_XFER_INTERRUPT		1
+#define USBMON_XFER_BULK		3
+
+namespace Usb {
+
+namespace {
+
+	struct PcapFileHeader
+	{
+		uint32_t magic;
+		uint16_t version_major;
+		uint16_t version_minor;
+		int32_t thiszone;
+		uint32_t sigfigs;
+		uint32_t snaplen;
+		uint32_t linktype;
+	};
+
+	struct PcapRecordHeader
+	{
+		uint32_t ts_sec;
+		uint32_t ts_usec;
+		uint32_t incl_len;
+		uint32_t orig_len;
+	};
+
+	// struct usbmon_packet, from the kernel's usbmon documentation,
+	// in host byte order
+	struct UsbmonHeader
+	{
+		uint64_t id;
+		uint8_t type;		// 'S'ubmit, 'C'omplete, 'E'rror
+		uint8_t xfer_type;
+		uint8_t epnum;		// with direction bit
+		uint8_t devnum;
+		uint16_t busnum;
+		char flag_setup;	// '-' when there is no setup packet
+		char flag_data;		// 0 when data follows
+		int64_t ts_sec;
+		int32_t ts_usec;
+		int32_t status;
+		uint32_t length;
+		uint32_t len_cap;
+		uint8_t setup[8];
+	};
+
+	// Device packets are never this big, but a short read into a
+	// large buffer should not write the whole buffer out either
+	const size_t MaxCaptureSize = 0x10000;
+
+	// Largest record WriteDump() accepts, whatever the file's
+	// snaplen says, so a corrupt capture can't ask for gigabytes
+	const uint32_t MaxDumpRecordSize = 0x400000;
+
+	// Packets waiting for the writer before new ones are dropped
+	const size_t MaxPending = 4096;
+
+	// Returns the number at the end of a usbwrap bus name, such
+	// as "003" or "libusb1-3", or 0 if there is none
+	uint16_t BusNumber(const char *busname)
+	{
+		if( !busname )
+			return 0;
+		const char *end = busname + strlen(busname);
+		const char *start = end;
+		while( start > busname && start[-1] >= '0' && start[-1] <= '9' )
+			start--;
+		return start == end ? 0 : (uint16_t) atoi(start);
+	}
+
+
+	//
+	// CaptureWriter
+	//
+	/// Owns the capture file and its writer thread.  Once created,
+	/// the writer is never deleted, since Record() may still be
+	/// holding a pointer to it while another thread calls Stop().
+	///
+	class CaptureWriter
+	{
+		FILE *m_file;
+		pthread_t m_thread;
+		bool m_running;
+		volatile bool m_stop;
+
+		Barry::DataRing m_pending;
+		Barry::DataRing m_free;
+		volatile unsigned long m_dropped;
+		volatile unsigned long m_next_id;
+
+	protected:
+		static void* WriterThread(void *arg);
+		void Writer();
+
+	public:
+		CaptureWriter();
+
+		bool IsRunning() const { return m_running; }
+		unsigned long GetDropped() const { return m_dropped; }
+
+		void Start(const std::string &filename);
+		void Stop();
+
+		void Record(uint16_t bus, uint8_t dev, int ep, bool interrupt,
+			const unsigned char *data, size_t size, int status);
+	};
+
+	CaptureWriter::CaptureWriter()
+		: m_file(0)
+		, m_running(false)
+		, m_stop(false)
+		, m_pending(MaxPending)
+		, m_free(256)
+		, m_dropped(0)
+		, m_next_id(0)
+	{
+	}
+
+	void CaptureWriter::Start(const std::string &filename)
+	{
+		m_file = fopen(filename.c_str(), "wb");
+		if( !m_file )
+			throw Barry::ErrnoError(_("Usb::Capture: Unable to create capture file: ") + filename, errno);
+
+		// plenty of buffering, since the writer flushes
+		// whenever it runs out of packets anyway
+		setvbuf(m_file, NULL, _IOFBF, 0x40000);
+
+		PcapFileHeader header;
+		header.magic = PCAP_MAGIC;
+		header.version_major = 2;
+		header.version_minor = 4;
+		header.thiszone = 0;
+		header.sigfigs = 0;
+		header.snaplen = sizeof(UsbmonHeader) + MaxCaptureSize;
+		header.linktype = LINKTYPE_USB_LINUX;
+		fwrite(&header, sizeof(header), 1, m_file);
+
+		// throw away anything recorded after the last Stop()
+		while( Barry::Data *buf = m_pending.pop() ) {
+			if( !m_free.try_push(buf) )
+				delete buf;
+		}
+
+		m_dropped = 0;
+		m_stop = false;
+		int ret = pthread_create(&m_thread, NULL, &CaptureWriter::WriterThread, this);
+		if( ret ) {
+			fclose(m_file);
+			m_file = 0;
+			throw Barry::ErrnoError(_("Usb::Capture: Error creating writer thread."), ret);
+		}
+		m_running = true;
+	}
+
+	void CaptureWriter::Stop()
+	{
+		if( !m_running )
+			return;
+
+		// the writer drains the queue before it stops
+		m_stop = true;
+		pthread_join(m_thread, NULL);
+		m_running = false;
+
+		fclose(m_file);
+		m_file = 0;
+
+		if( m_dropped )
+			eout(_("Usb::Capture: dropped ") << std::dec << m_dropped << _(" packets"));
+	}
+
+	void* CaptureWriter::WriterThread(void *arg)
+	{
+		CaptureWriter *cw = (CaptureWriter*) arg;
+		cw->Writer();
+		return 0;
+	}
+
+	void CaptureWriter::Writer()
+	{
+		bool failed = false;
+
+		for(;;) {
+			Barry::Data *buf = m_pending.wait_pop(250);
+			if( !buf ) {
+				if( m_stop )
+					break;
+				fflush(m_file);
+				continue;
+			}
+
+			if( !failed &&
+			    fwrite(buf->GetData(), buf->GetSize(), 1, m_file) != 1 )
+			{
+				eout(_("Usb::Capture: error writing capture file: ") << strerror(errno));
+				failed = true;
+			}
+
+			if( !m_free.try_push(buf) )
+				delete buf;
+		}
+	}
+
+	void CaptureWriter::Record(uint16_t bus, uint8_t dev, int ep,
+				bool interrupt, const unsigned char *data,
+				size_t size, int status)
+	{
+		if( m_pending.size() >= MaxPending ) {
+			__sync_fetch_and_add(&m_dropped, 1);
+			return;
+		}
+
+		Barry::Data *buf = m_free.pop();
+		if( !buf )
+			buf = new Barry::Data;
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		size_t caplen = std::min(size, MaxCaptureSize);
+		size_t total = sizeof(PcapRecordHeader) + sizeof(UsbmonHeader) + caplen;
+		unsigned char *p = buf->GetBuffer(total);
+
+		PcapRecordHeader *rec = (PcapRecordHeader*) p;
+		rec->ts_sec = now.tv_sec;
+		rec->ts_usec = now.tv_usec;
+		rec->incl_len = sizeof(UsbmonHeader) + caplen;
+		rec->orig_len = sizeof(UsbmonHeader) + size;
+
+		// reads show up when they complete, and writes when
+		// they are submitted, which is when each has its data
+		bool in = (ep & 0x80) != 0;
+		UsbmonHeader *mon = (UsbmonHeader*) (p + sizeof(PcapRecordHeader));
+		memset(mon, 0, sizeof(UsbmonHeader));
+		mon->id = __sync_fetch_and_add(&m_next_id, 1);
+		mon->type = in ? 'C' : 'S';
+		mon->xfer_type = interrupt ? USBMON_XFER_INTERRUPT : USBMON_XFER_BULK;
+		mon->epnum = ep;
+		mon->devnum = dev;
+		mon->busnum = bus;
+		mon->flag_setup = '-';
+		mon->flag_data = 0;
+		mon->ts_sec = now.tv_sec;
+		mon->ts_usec = now.tv_usec;
+		mon->status = status;
+		mon->length = size;
+		mon->len_cap = caplen;
+
+		memcpy(p + sizeof(PcapRecordHeader) + sizeof(UsbmonHeader), data, caplen);
+		buf->ReleaseBuffer(total);
+
+		m_pending.push(buf);
+	}
+
+	pthread_mutex_t g_capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+	CaptureWriter * volatile g_writer = 0;
+
+} // anonymous namespace
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Capture
+
+volatile bool Capture::s_active = false;
+
+void Capture::Start(const std::string &filename)
+{
+	Barry::scoped_lock lock(g_capture_mutex);
+
+	s_active = false;
+	if( !g_writer )
+		g_writer = new CaptureWriter;
+	g_writer->Stop();
+	g_writer->Start(filename);
+	s_active = true;
+}
+
+void Capture::Stop()
+{
+	Barry::scoped_lock lock(g_capture_mutex);
+
+	s_active = false;
+	if( g_writer )
+		g_writer->Stop();
+}
+
+unsigned long Capture::GetDropped()
+{
+	Barry::scoped_lock lock(g_capture_mutex);
+	return g_writer ? g_writer->GetDropped() : 0;
+}
+
+void Capture::Record(const Device &dev, int ep, bool interrupt,
+			const unsigned char *data, size_t size, int status)
+{
+	CaptureWriter *writer = g_writer;
+	if( !s_active || !writer )
+		return;
+
+	const DeviceID &id = dev.GetID();
+	writer->Record(BusNumber(id.GetBusName()), id.GetNumber(), ep,
+		interrupt, data, size, status);
+}
+
+bool Capture::IsCapture(std::istream &is)
+{
+	uint32_t magic = 0;
+	std::streampos start = is.tellg();
+	is.read((char*) &magic, sizeof(magic));
+	is.clear();
+	is.seekg(start);
+	return magic == PCAP_MAGIC;
+}
+
+//
+// WriteDump
+//
+/// Writes the data half of each bulk and interrupt transfer in the
+/// capture as a "sep: N" or "rep: N" hex dump record, with N in hex.
+/// Works with captures from Wireshark's own usbmon interfaces as well,
+/// as long as they were made on a host with the same byte order.
+/// Stops and returns false at a record larger than the file's snaplen,
+/// which only a corrupt capture has.
+///
+bool Capture::WriteDump(std::istream &is, std::ostream &os)
+{
+	PcapFileHeader header;
+	if( !is.read((char*) &header, sizeof(header)) || header.magic != PCAP_MAGIC )
+		return false;
+
+	size_t monsize;
+	if( header.linktype == LINKTYPE_USB_LINUX )
+		monsize = sizeof(UsbmonHeader);
+	else if( header.linktype == LINKTYPE_USB_LINUX_MMAPPED )
+		monsize = 64;
+	else
+		return false;
+
+	std::ios::fmtflags oldflags = os.flags();
+
+	Barry::Data record;
+	PcapRecordHeader rec;
+	while( is.read((char*) &rec, sizeof(rec)) ) {
+		if( rec.incl_len > header.snaplen ||
+		    rec.incl_len > MaxDumpRecordSize )
+		{
+			os.flags(oldflags);
+			return false;
+		}
+
+		unsigned char *p = record.GetBuffer(rec.incl_len);
+		if( !is.read((char*) p, rec.incl_len) )
+			break;
+		record.ReleaseBuffer(rec.incl_len);
+
+		if( rec.incl_len < monsize )
+			continue;
+
+		const UsbmonHeader *mon = (const UsbmonHeader*) p;
+		if( mon->xfer_type != USBMON_XFER_BULK &&
+		    mon->xfer_type != USBMON_XFER_INTERRUPT )
+			continue;
+
+		// only the event that carries the data
+		bool in = (mon->epnum & 0x80) != 0;
+		if( mon->type != (in ? 'C' : 'S') || mon->flag_data != 0 )
+			continue;
+
+		size_t len = std::min((size_t) mon->len_cap,
+			(size_t) rec.incl_len - monsize);
+		if( len == 0 )
+			continue;
+
+		Barry::Data packet(p + monsize, len);
+		os << (in ? "\nrep: " : "\nsep: ") << std::hex
+		   << (unsigned int) (in ? mon->epnum : (mon->epnum & 0x7f))
+		   << "\n" << packet;
+	}
+
+	os.flags(oldflags);
+	return true;
+}
+
+} // namespace Usb
+
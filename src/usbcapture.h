@@ -0,0 +1,94 @@
+///
+/// \file	usbcapture.h
+///		Binary pcap capture of USB traffic
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __SB_USBCAPTURE_H__
+#define __SB_USBCAPTURE_H__
+
+#include "dll.h"
+#include <string>
+#include <iosfwd>
+#include <stddef.h>
+
+// Environment variable holding a capture filename.  If set,
+// Barry::Init() starts a capture into that file.
+#define USB_CAPTURE_ENV		"BARRY_USB_CAPTURE"
+
+namespace Usb {
+
+class Device;
+
+//
+// Capture
+//
+/// Records every bulk and interrupt transfer made through usbwrap
+/// into a pcap file, using the Linux usbmon link type, so captures
+/// open directly in Wireshark.  Unlike the hex dumps from data dump
+/// mode, nothing is formatted or written on the calling thread: each
+/// packet is copied into a recycled buffer and handed to a writer
+/// thread.  If the writer falls too far behind, packets are dropped
+/// and counted rather than slowing down the device.
+///
+/// Reads are recorded as usbmon completion events, and writes as
+/// submission events, so each transfer appears exactly once.
+///
+/// WriteDump() converts a capture into the "sep: N" / "rep: N" hex
+/// dump format read by Barry::LoadDataArray() and the replay USB
+/// backend, which also accepts capture files directly.
+///
+class BXEXPORT Capture
+{
+	static volatile bool s_active;
+
+public:
+	/// Starts capturing into filename, replacing any capture
+	/// already running.  Throws Barry::ErrnoError if the file
+	/// cannot be created, or the writer thread cannot start.
+	static void Start(const std::string &filename);
+
+	/// Writes out everything queued so far, and closes the file
+	static void Stop();
+
+	static bool IsActive() { return s_active; }
+
+	/// Number of packets dropped since Start() because the writer
+	/// could not keep up
+	static unsigned long GetDropped();
+
+	/// Records one transfer.  ep includes the direction bit,
+	/// and status is 0 or a negative errno value.  Backends call
+	/// this only if IsActive() is true.
+	static void Record(const Device &dev, int ep, bool interrupt,
+		const unsigned char *data, size_t size, int status = 0);
+
+	/// Returns true if the stream starts with a pcap file header.
+	/// The stream is left where it was.
+	static bool IsCapture(std::istream &is);
+
+	/// Converts a capture into LoadDataArray() format.  Returns
+	/// false if the stream is not a usbmon pcap capture, or is
+	/// corrupt.
+	static bool WriteDump(std::istream &is, std::ostream &os);
+};
+
+} // namespace Usb
+
+#endif
+
@@ -43,6 +43,8 @@
 #include "usbwrap_libusb.h"
 #elif defined USE_LIBUSB_1_0
 #include "usbwrap_libusb_1_0.h"
+#elif defined USE_USB_REPLAY
+#include "usbwrap_replay.h"
 #else
 #error No usb library interface selected.
 #endif
@@ -121,6 +121,12 @@ public:
 	static bool Init(int *libusb_errno = 0);
 	static void Uninit();
 	static void SetDataDump(bool data_dump_mode);
+
+	/// Handles pending asynchronous transfer events for every open
+	/// device, waiting at most timeout milliseconds for one to
+	/// happen.  This is where read pipeline callbacks run.
+	/// Returns false if the USB library has no asynchronous API.
+	static bool HandleEvents(int timeout);
 };
 
 // Forward declaration of descriptor types.
@@ -305,6 +311,36 @@ public:
 	bool ControlMsg(int requesttype, int request, int value,
 			int index, char *bytes, int size, int timeout);
 
+	/////////////////////////////
+	// Asynchronous read pipeline
+	//
+	// Keeps count bulk read transfers of bufsize bytes queued on
+	// the given read endpoint at all times.  While the pipeline is
+	// running, BulkRead() on that endpoint returns completed
+	// transfers in the order they were submitted, and resubmits
+	// each one right away, so the bus does not sit idle between
+	// reads.  A bufsize of 0 uses the default Data buffer size.
+	//
+	// Returns false if the USB library does not support
+	// asynchronous transfers, or if the transfers could not be
+	// submitted.  BulkRead() stays synchronous in that case.
+	//
+	// If ready is not null, it is called with context each time
+	// a transfer completes, from whichever thread is handling
+	// libusb events at the time.  It must not block, and must not
+	// call back into this Device.  Use PollRead() afterwards,
+	// from any one thread, to collect the data without waiting.
+	// PollRead() returns false if no transfer has completed yet,
+	// and throws Error just like BulkRead() on transfer errors.
+
+	typedef void (*ReadReadyCallback)(void *context);
+
+	bool StartReadPipeline(int ep, int count, size_t bufsize = 0,
+		ReadReadyCallback ready = 0, void *context = 0);
+	void StopReadPipeline();
+	bool IsReadPipelined(int ep) const;
+	bool PollRead(int ep, Barry::Data &data);
+
 	/////////////////////////////
 	// Combo functions
 
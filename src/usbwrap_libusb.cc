@@ -23,6 +23,7 @@
 #include "i18n.h"
 
 #include "usbwrap_libusb.h"
+#include "usbcapture.h"
 
 #include "debug.h"
 #include "data.h"
@@ -87,6 +88,13 @@ void LibraryInterface::SetDataDump(bool data_dump_mode)
 		usb_set_debug(0);
 }
 
+// No asynchronous transfers in libusb 0.1, so there are never any
+// events to handle
+bool LibraryInterface::HandleEvents(int timeout)
+{
+	return false;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // DeviceID
 
@@ -268,7 +276,8 @@ bool Device::BulkRead(int ep, Barry::Data &data, int timeout)
 	do {
 		data.QuickZap();
 		ret = usb_bulk_read(m_handle->m_handle, ep,
-			(char*) data.GetBuffer(), data.GetBufSize(),
+			(char*) data.GetBuffer(BARRY_DATA_DEFAULT_SIZE),
+			data.GetBufSize(),
 			timeout == -1 ? m_timeout : timeout);
 		if( ret < 0 && ret != -EINTR && ret != -EAGAIN ) {
 			m_lasterror = ret;
@@ -287,6 +296,9 @@ bool Device::BulkRead(int ep, Barry::Data &data, int timeout)
 			data.ReleaseBuffer(ret);
 	} while( ret == -EINTR || ret == -EAGAIN );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep | USB_ENDPOINT_IN, false, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 }
 
@@ -307,6 +319,9 @@ bool Device::BulkWrite(int ep, const Barry::Data &data, int timeout)
 		}
 	} while( ret == -EINTR || ret == -EAGAIN );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep & ~USB_ENDPOINT_IN, false, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 }
 
@@ -331,6 +346,9 @@ bool Device::BulkWrite(int ep, const void *data, size_t size, int timeout)
 		}
 	} while( ret == -EINTR || ret == -EAGAIN );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep & ~USB_ENDPOINT_IN, false, (const unsigned char*) data, size);
+
 	return ret >= 0;
 }
 
@@ -340,7 +358,8 @@ bool Device::InterruptRead(int ep, Barry::Data &data, int timeout)
 	do {
 		data.QuickZap();
 		ret = usb_interrupt_read(m_handle->m_handle, ep,
-			(char*) data.GetBuffer(), data.GetBufSize(),
+			(char*) data.GetBuffer(BARRY_DATA_DEFAULT_SIZE),
+			data.GetBufSize(),
 			timeout == -1 ? m_timeout : timeout);
 		if( ret < 0 && ret != -EINTR && ret != -EAGAIN ) {
 			m_lasterror = ret;
@@ -353,6 +372,9 @@ bool Device::InterruptRead(int ep, Barry::Data &data, int timeout)
 			data.ReleaseBuffer(ret);
 	} while( ret == -EINTR || ret == -EAGAIN );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep | USB_ENDPOINT_IN, true, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 }
 
@@ -374,6 +396,9 @@ bool Device::InterruptWrite(int ep, const Barry::Data &data, int timeout)
 		}
 	} while( ret == -EINTR || ret == -EAGAIN );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep & ~USB_ENDPOINT_IN, true, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 }
 
@@ -473,6 +498,29 @@ bool Device::ControlMsg(int requesttype, int request, int value,
 	return result >= 0;
 }
 
+// libusb 0.1 has no asynchronous transfer API, so reads always stay
+// synchronous with this library
+bool Device::StartReadPipeline(int ep, int count, size_t bufsize,
+				ReadReadyCallback ready, void *context)
+{
+	m_lasterror = -ENOSYS;
+	return false;
+}
+
+void Device::StopReadPipeline()
+{
+}
+
+bool Device::IsReadPipelined(int ep) const
+{
+	return false;
+}
+
+bool Device::PollRead(int ep, Barry::Data &data)
+{
+	return false;
+}
+
 
 int Device::FindInterface(int ifaceClass)
 {
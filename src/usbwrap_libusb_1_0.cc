@@ -23,10 +23,12 @@
 #include "i18n.h"
 
 #include "usbwrap_libusb_1_0.h"
+#include "usbcapture.h"
 
 #include "debug.h"
 #include "data.h"
 #include <errno.h>
+#include <sys/time.h>
 #include <sstream>
 #include <iostream>
 #include <sstream>
@@ -184,6 +186,18 @@ void LibraryInterface::SetDataDump(bool data_dump_mode)
 		libusb_set_debug(libusbctx, 0);
 }
 
+bool LibraryInterface::HandleEvents(int timeout)
+{
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	int ret = libusb_handle_events_timeout(libusbctx, &tv);
+	if( ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED )
+		throw Error(ret, _("Error handling libusb events"));
+	return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // DeviceIDImpl
 
@@ -323,6 +337,334 @@ std::vector<DeviceID> DeviceList::MatchDevices(int vendor, int product,
 	return ret;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// ReadPipeline
+
+#ifndef LIBUSB_CALL
+#define LIBUSB_CALL
+#endif
+
+class ReadPipeline;
+
+// One in-flight bulk read transfer and the Data buffer it reads into
+struct ReadSlot
+{
+	libusb_transfer *m_xfer;
+	Barry::Data *m_data;
+	ReadPipeline *m_pipeline;
+	int m_completed;	//< set by the completion callback
+	bool m_submitted;	//< true while libusb owns the transfer
+
+	// outside of libusb, m_completed is only accessed through these
+	// full barrier builtins, so the transfer's contents are visible to
+	// whoever sees the flag set
+	bool IsCompleted() { return __sync_fetch_and_add(&m_completed, 0) != 0; }
+	void MarkCompleted() { __sync_fetch_and_or(&m_completed, 1); }
+	void ClearCompleted() { __sync_fetch_and_and(&m_completed, 0); }
+};
+
+static void LIBUSB_CALL ReadPipelineCallback(struct libusb_transfer *xfer);
+
+// Translates a completed transfer status into a libusb error code
+static int TransferStatusToErrcode(enum libusb_transfer_status status)
+{
+	switch( status )
+	{
+	case LIBUSB_TRANSFER_COMPLETED:
+		return LIBUSB_SUCCESS;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_STALL:
+		return LIBUSB_ERROR_PIPE;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return LIBUSB_ERROR_OVERFLOW;
+	case LIBUSB_TRANSFER_CANCELLED:
+		return LIBUSB_ERROR_INTERRUPTED;
+	default:
+		return LIBUSB_ERROR_IO;
+	}
+}
+
+//
+// ReadPipeline
+//
+/// Ring of bulk read transfers kept queued on a single endpoint.
+/// Bulk transfers on one endpoint complete in the order they were
+/// submitted, so the oldest slot (m_next) is always the next one
+/// to finish.
+///
+class ReadPipeline
+{
+	libusb_device_handle *m_handle;
+	int m_ep;
+	size_t m_bufsize;
+	std::vector<ReadSlot> m_slots;
+	size_t m_next;
+
+	Device::ReadReadyCallback m_ready;
+	void *m_context;
+
+protected:
+	int Submit(ReadSlot &slot);
+	bool Wait(ReadSlot &slot, int timeout);
+	void Complete(ReadSlot &slot, Barry::Data &data, int &lasterror);
+
+public:
+	ReadPipeline(libusb_device_handle *handle, int ep,
+		Device::ReadReadyCallback ready, void *context);
+	~ReadPipeline();
+
+	int GetEndpoint() const { return m_ep; }
+
+	int Allocate(int count, size_t bufsize);
+	int SubmitIdle();
+	void Read(Barry::Data &data, int timeout, int &lasterror);
+	bool Poll(Barry::Data &data, int &lasterror);
+
+	void Notify(libusb_transfer *xfer);
+};
+
+// Completion callback... this runs in whichever thread happens to be
+// handling libusb events at the time, which may be a thread doing
+// synchronous writes.  libusb checks m_completed under its own event
+// lock, but Poll() does not, so the flag is set with a barrier.
+static void LIBUSB_CALL ReadPipelineCallback(struct libusb_transfer *xfer)
+{
+	ReadSlot *slot = (ReadSlot*) xfer->user_data;
+	slot->MarkCompleted();
+	slot->m_pipeline->Notify(xfer);
+}
+
+ReadPipeline::ReadPipeline(libusb_device_handle *handle, int ep,
+			Device::ReadReadyCallback ready, void *context)
+	: m_handle(handle)
+	, m_ep(ep)
+	, m_bufsize(0)
+	, m_next(0)
+	, m_ready(ready)
+	, m_context(context)
+{
+}
+
+ReadPipeline::~ReadPipeline()
+{
+	// cancel everything still on the bus
+	for( size_t i = 0; i < m_slots.size(); i++ ) {
+		ReadSlot &slot = m_slots[i];
+		if( slot.m_submitted && !slot.IsCompleted() )
+			libusb_cancel_transfer(slot.m_xfer);
+	}
+
+	// and wait for the cancellations to come back, since libusb
+	// still owns the buffers until then
+	for( size_t i = 0; i < m_slots.size(); i++ ) {
+		ReadSlot &slot = m_slots[i];
+		while( slot.m_submitted && !slot.IsCompleted() ) {
+			if( libusb_handle_events_completed(libusbctx,
+					&slot.m_completed) < 0 )
+				break;
+		}
+	}
+
+	for( size_t i = 0; i < m_slots.size(); i++ ) {
+		libusb_free_transfer(m_slots[i].m_xfer);
+		delete m_slots[i].m_data;
+	}
+}
+
+//
+// Allocate
+//
+/// Creates count transfers of bufsize bytes each.  Nothing is
+/// submitted yet.  Returns a libusb error code.
+///
+int ReadPipeline::Allocate(int count, size_t bufsize)
+{
+	m_bufsize = bufsize;
+
+	// size the vector once, so the user_data pointers below stay valid
+	ReadSlot blank = { 0, 0, this, 0, false };
+	m_slots.resize(count, blank);
+
+	for( int i = 0; i < count; i++ ) {
+		ReadSlot &slot = m_slots[i];
+		slot.m_xfer = libusb_alloc_transfer(0);
+		if( !slot.m_xfer )
+			return LIBUSB_ERROR_NO_MEM;
+		slot.m_data = new Barry::Data(m_ep, bufsize);
+	}
+	return LIBUSB_SUCCESS;
+}
+
+//
+// Submit
+//
+/// Points the slot's transfer at its current Data buffer, which may
+/// have been swapped in from the caller by Read(), and queues it.
+///
+int ReadPipeline::Submit(ReadSlot &slot)
+{
+	Barry::Data &data = *slot.m_data;
+	data.QuickZap();
+	unsigned char *buf = data.GetBuffer(m_bufsize);
+
+	// no transfer timeout... Read() applies the caller's
+	// timeout to the wait instead, so an idle bus never
+	// costs us a resubmit
+	libusb_fill_bulk_transfer(slot.m_xfer, m_handle, m_ep,
+		buf, m_bufsize, &ReadPipelineCallback, &slot, 0);
+
+	slot.ClearCompleted();
+	int ret = libusb_submit_transfer(slot.m_xfer);
+	if( ret == 0 )
+		slot.m_submitted = true;
+	return ret;
+}
+
+//
+// SubmitIdle
+//
+/// Submits every slot not currently owned by libusb, oldest first,
+/// so that ring order keeps matching bus order.  Returns a libusb
+/// error code.
+///
+int ReadPipeline::SubmitIdle()
+{
+	for( size_t i = 0; i < m_slots.size(); i++ ) {
+		ReadSlot &slot = m_slots[(m_next + i) % m_slots.size()];
+		if( !slot.m_submitted ) {
+			int ret = Submit(slot);
+			if( ret < 0 )
+				return ret;
+		}
+	}
+	return LIBUSB_SUCCESS;
+}
+
+//
+// Wait
+//
+/// Handles libusb events until slot completes.  Returns false on
+/// timeout.  Timeout is in milliseconds.
+///
+bool ReadPipeline::Wait(ReadSlot &slot, int timeout)
+{
+	struct timeval start, now;
+	gettimeofday(&start, NULL);
+
+	while( !slot.IsCompleted() ) {
+		gettimeofday(&now, NULL);
+		long elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+			(now.tv_usec - start.tv_usec) / 1000;
+		if( elapsed >= timeout )
+			return false;
+
+		long remaining = timeout - elapsed;
+		struct timeval tv;
+		tv.tv_sec = remaining / 1000;
+		tv.tv_usec = (remaining % 1000) * 1000;
+
+		int ret = libusb_handle_events_timeout_completed(libusbctx,
+			&tv, &slot.m_completed);
+		if( ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED )
+			throw Error(ret, _("Error handling libusb events in pipelined BulkRead"));
+	}
+	return true;
+}
+
+//
+// Read
+//
+/// Waits for the oldest transfer to complete, and swaps its buffer
+/// with data, so nothing is copied.  The caller's old buffer is then
+/// put straight back on the bus in the transfer's place.
+/// Throws Timeout if nothing arrives within timeout milliseconds,
+/// and Error on transfer failures, just like a synchronous BulkRead.
+///
+void ReadPipeline::Read(Barry::Data &data, int timeout, int &lasterror)
+{
+	// resubmit anything left idle by an earlier error
+	int ret = SubmitIdle();
+	if( ret < 0 ) {
+		lasterror = ret;
+		throw Error(ret, _("Error submitting pipelined BulkRead"));
+	}
+
+	ReadSlot &slot = m_slots[m_next];
+	if( !Wait(slot, timeout) ) {
+		lasterror = LIBUSB_ERROR_TIMEOUT;
+		throw Timeout(LIBUSB_ERROR_TIMEOUT, _("Timeout in pipelined BulkRead"));
+	}
+
+	Complete(slot, data, lasterror);
+}
+
+//
+// Poll
+//
+/// Same as Read(), but never waits or handles events itself.
+/// Returns false if the oldest transfer has not completed yet.
+///
+bool ReadPipeline::Poll(Barry::Data &data, int &lasterror)
+{
+	int ret = SubmitIdle();
+	if( ret < 0 ) {
+		lasterror = ret;
+		throw Error(ret, _("Error submitting pipelined BulkRead"));
+	}
+
+	ReadSlot &slot = m_slots[m_next];
+	if( !slot.IsCompleted() )
+		return false;
+
+	Complete(slot, data, lasterror);
+	return true;
+}
+
+//
+// Complete
+//
+/// Takes the data out of a completed slot, and puts it back on the bus.
+///
+void ReadPipeline::Complete(ReadSlot &slot, Barry::Data &data, int &lasterror)
+{
+	// the slot is ours again
+	slot.m_submitted = false;
+	m_next = (m_next + 1) % m_slots.size();
+
+	libusb_transfer *xfer = slot.m_xfer;
+	int ret = TransferStatusToErrcode(xfer->status);
+	if( ret < 0 ) {
+		// leave the slot idle, the next Read() will retry it
+		lasterror = ret;
+		throw Error(ret, _("Error in pipelined BulkRead"));
+	}
+
+	slot.m_data->ReleaseBuffer(xfer->actual_length);
+	data.Swap(*slot.m_data);
+
+	ret = Submit(slot);
+	if( ret < 0 ) {
+		// not fatal for this packet... next Read() will try again
+		dout("Failed to resubmit pipelined read: " << ret);
+	}
+}
+
+//
+// Notify
+//
+/// Passes a completion on to the owner's ready callback, if any.
+/// Cancellations only happen while the pipeline is being torn
+/// down, so they are not worth reporting.
+///
+void ReadPipeline::Notify(libusb_transfer *xfer)
+{
+	if( m_ready && xfer->status != LIBUSB_TRANSFER_CANCELLED )
+		(*m_ready)(m_context);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Device
 
@@ -342,6 +684,8 @@ Device::Device(const Usb::DeviceID& id, int timeout)
 
 Device::~Device()
 {
+	StopReadPipeline();
+
 	dout("libusb_close(" << std::dec << m_handle->m_handle << ")");
 	libusb_close(m_handle->m_handle);
 }
@@ -372,6 +716,15 @@ bool Device::Reset()
 
 bool Device::BulkRead(int ep, Barry::Data &data, int timeout)
 {
+	if( IsReadPipelined(ep) ) {
+		m_handle->m_pipeline->Read(data,
+			timeout == -1 ? m_timeout : timeout, m_lasterror);
+		ddout("BulkRead (pipelined) from endpoint 0x" << std::hex << ep << ":\n" << data);
+		if( Capture::IsActive() )
+			Capture::Record(*this, ep | LIBUSB_ENDPOINT_IN, false, data.GetData(), data.GetSize());
+		return true;
+	}
+
 	ddout("BulkRead to endpoint 0x" << std::hex << ep << ":\n" << data);
 	int ret;
 	do {
@@ -379,7 +732,8 @@ bool Device::BulkRead(int ep, Barry::Data &data, int timeout)
 		data.QuickZap();
 		ret = libusb_bulk_transfer(m_handle->m_handle,
                         ep |= LIBUSB_ENDPOINT_IN,
-		        data.GetBuffer(), data.GetBufSize(),
+		        data.GetBuffer(BARRY_DATA_DEFAULT_SIZE),
+		        data.GetBufSize(),
 		        &transferred,
 			timeout == -1 ? m_timeout : timeout);
 		if( ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED ) {
@@ -409,6 +763,9 @@ bool Device::BulkRead(int ep, Barry::Data &data, int timeout)
 
 	} while( ret == LIBUSB_ERROR_INTERRUPTED );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep | LIBUSB_ENDPOINT_IN, false, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 }
 
@@ -443,6 +800,9 @@ bool Device::BulkWrite(int ep, const Barry::Data &data, int timeout)
 
 	} while( ret == LIBUSB_ERROR_INTERRUPTED );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep | LIBUSB_ENDPOINT_OUT, false, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 }
 
@@ -479,6 +839,9 @@ bool Device::BulkWrite(int ep, const void *data, size_t size, int timeout)
 
 	} while( ret == LIBUSB_ERROR_INTERRUPTED );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep | LIBUSB_ENDPOINT_OUT, false, (const unsigned char*) data, size);
+
 	return ret >= 0;
 }
 
@@ -491,7 +854,8 @@ bool Device::InterruptRead(int ep, Barry::Data &data, int timeout)
 		data.QuickZap();
 		ret = libusb_interrupt_transfer(m_handle->m_handle,
                         ep | LIBUSB_ENDPOINT_IN,
-		        data.GetBuffer(), data.GetBufSize(),
+		        data.GetBuffer(BARRY_DATA_DEFAULT_SIZE),
+		        data.GetBufSize(),
 		        &transferred,
 			timeout == -1 ? m_timeout : timeout);
 		if( ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED ) {
@@ -512,6 +876,9 @@ bool Device::InterruptRead(int ep, Barry::Data &data, int timeout)
 
 	} while( ret == LIBUSB_ERROR_INTERRUPTED );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep | LIBUSB_ENDPOINT_IN, true, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 
 }
@@ -547,6 +914,9 @@ bool Device::InterruptWrite(int ep, const Barry::Data &data, int timeout)
 
 	} while( ret == LIBUSB_ERROR_INTERRUPTED );
 
+	if( ret >= 0 && Capture::IsActive() )
+		Capture::Record(*this, ep | LIBUSB_ENDPOINT_OUT, true, data.GetData(), data.GetSize());
+
 	return ret >= 0;
 }
 
@@ -652,6 +1022,83 @@ bool Device::ControlMsg(int requesttype, int request, int value,
 	return result >= 0;
 }
 
+//
+// StartReadPipeline
+//
+/// Keeps count bulk read transfers queued on ep, so that the
+/// device can fill the next buffer while the previous one is
+/// being routed.  Any existing pipeline is stopped first.
+/// Returns false on failure, leaving BulkRead() synchronous.
+///
+bool Device::StartReadPipeline(int ep, int count, size_t bufsize,
+				ReadReadyCallback ready, void *context)
+{
+	StopReadPipeline();
+
+	if( count < 1 )
+		return false;
+
+	dout("StartReadPipeline(" << std::dec << m_handle->m_handle << ", 0x" << std::hex << ep << ", " << std::dec << count << ")");
+
+	std::auto_ptr<ReadPipeline> pipeline(
+		new ReadPipeline(m_handle->m_handle, ep | LIBUSB_ENDPOINT_IN,
+			ready, context));
+
+	int ret = pipeline->Allocate(count,
+		bufsize ? bufsize : BARRY_DATA_DEFAULT_SIZE);
+	if( ret >= 0 )
+		ret = pipeline->SubmitIdle();
+	m_lasterror = ret;
+	if( ret < 0 )
+		return false;
+
+	m_handle->m_pipeline = pipeline.release();
+	return true;
+}
+
+//
+// StopReadPipeline
+//
+/// Cancels all queued read transfers and returns BulkRead() to
+/// synchronous operation.  Any data in transfers that completed
+/// but were not yet read is discarded.
+///
+void Device::StopReadPipeline()
+{
+	if( m_handle->m_pipeline ) {
+		dout("StopReadPipeline(" << std::dec << m_handle->m_handle << ")");
+		delete m_handle->m_pipeline;
+		m_handle->m_pipeline = 0;
+	}
+}
+
+bool Device::IsReadPipelined(int ep) const
+{
+	return m_handle->m_pipeline &&
+		m_handle->m_pipeline->GetEndpoint() == (ep | LIBUSB_ENDPOINT_IN);
+}
+
+//
+// PollRead
+//
+/// Returns the oldest completed pipelined read in data, without
+/// waiting.  Returns false if nothing has completed yet, or if the
+/// endpoint is not pipelined.
+///
+bool Device::PollRead(int ep, Barry::Data &data)
+{
+	if( !IsReadPipelined(ep) )
+		return false;
+
+	if( !m_handle->m_pipeline->Poll(data, m_lasterror) )
+		return false;
+
+	ddout("PollRead (pipelined) from endpoint 0x" << std::hex << ep << ":\n" << data);
+	if( Capture::IsActive() )
+		Capture::Record(*this, ep | LIBUSB_ENDPOINT_IN, false, data.GetData(), data.GetSize());
+	return true;
+}
+
 int Device::FindInterface(int ifaceClass)
 {
 	struct libusb_config_descriptor* cfg = NULL;
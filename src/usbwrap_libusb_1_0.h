@@ -47,9 +47,13 @@ public:
 	~DeviceIDImpl();
 };
 
+// Asynchronous read pipeline state, see Device::StartReadPipeline()
+class ReadPipeline;
+
 struct DeviceHandle
 {
 	libusb_device_handle *m_handle;
+	ReadPipeline *m_pipeline;	//< null if reads are synchronous
 };
 
 struct DeviceListImpl
@@ -0,0 +1,830 @@
+///
+/// \file	usbwrap_replay.cc
+///		USB API wrapper that plays back recorded USB conversations
+///
+
+/*
+    Copyright (C) 2005-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include "i18n.h"
+
+#include "usbwrap_replay.h"
+#include "usbcapture.h"
+
+#include "common.h"
+#include "scoped_lock.h"
+#include "time.h"
+#include "debug.h"
+#include "data.h"
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace Barry;
+
+namespace Usb {
+
+// helper functions to make deleting pointers in maps and vectors easier
+template<typename T> static void deletePtr(T* ptr)
+{
+	delete ptr;
+}
+
+template<typename K, typename T> static void deleteMapPtr(std::pair<K,T*> ptr)
+{
+	delete ptr.second;
+}
+
+// endpoint address bits, same values as in the USB spec
+#define REPLAY_EP_DIR_IN	0x80
+#define REPLAY_EP_ADDR_MASK	0x0f
+
+static const size_t npos = (size_t) -1;
+
+///////////////////////////////////////////////////////////////////////////////
+// Script parsing
+
+// Checks for "sep: N" or "rep: N", with N in hex
+static bool IsPacketStart(const std::string &line, bool &read, int &ep)
+{
+	if( strncmp(line.c_str(), "sep: ", 5) == 0 )
+		read = false;
+	else if( strncmp(line.c_str(), "rep: ", 5) == 0 )
+		read = true;
+	else
+		return false;
+
+	char *end = 0;
+	ep = strtol(line.c_str() + 5, &end, 16);
+	return end != line.c_str() + 5;
+}
+
+static int HexValue(char c)
+{
+	if( c >= '0' && c <= '9' )
+		return c - '0';
+	if( c >= 'a' && c <= 'f' )
+		return c - 'a' + 10;
+	if( c >= 'A' && c <= 'F' )
+		return c - 'A' + 10;
+	return -1;
+}
+
+//
+// ParseHexLine
+//
+/// Parses one "    xxxxxxxx: hh hh hh ...  ascii" line from a Data dump,
+/// appending the bytes into data at the given address.  Bytes are
+/// separated by single spaces, and the ASCII column by at least two,
+/// which keeps short last lines from having their ASCII text mistaken
+/// for hex.  Returns false if this is not a hex dump line.
+///
+static bool ParseHexLine(const std::string &line, Barry::Data &data)
+{
+	const char *str = line.c_str();
+	for( int i = 0; i < 4; str++, i++ )
+		if( *str != ' ' )
+			return false;
+
+	size_t address = 0;
+	for( int i = 0; i < 8; str++, i++ ) {
+		int v = HexValue(*str);
+		if( v < 0 )
+			return false;
+		address = (address << 4) | v;
+	}
+	if( *str++ != ':' )
+		return false;
+
+	unsigned char bytes[16];
+	size_t count = 0;
+	while( count < 16 && str[0] == ' ' ) {
+		int hi = HexValue(str[1]);
+		int lo = hi < 0 ? -1 : HexValue(str[2]);
+		if( lo < 0 || (str[3] != ' ' && str[3] != '\0') )
+			break;
+		bytes[count++] = (unsigned char) ((hi << 4) | lo);
+		str += 3;
+	}
+
+	data.MemCpy(address, bytes, count);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReplayScript
+
+ReplayScript::ReplayScript(const std::string &filename)
+	: m_filename(filename)
+	, m_writes_done(0)
+	, m_next_write(0)
+	, m_next_read(REPLAY_EP_ADDR_MASK + 1, npos)
+	, m_mismatches(0)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+}
+
+ReplayScript::~ReplayScript()
+{
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+//
+// Load
+//
+/// Reads the script file.  Returns false if it cannot be opened
+/// or contains no packets.  Binary Usb::Capture files are converted
+/// to a hex dump first.
+///
+bool ReplayScript::Load()
+{
+	std::ifstream file(m_filename.c_str(), std::ios::in | std::ios::binary);
+	if( !file )
+		return false;
+
+	std::stringstream dump;
+	if( Capture::IsCapture(file) ) {
+		if( !Capture::WriteDump(file, dump) )
+			return false;
+		return Load(dump);
+	}
+	return Load(file);
+}
+
+bool ReplayScript::Load(std::istream &in)
+{
+	size_t writes = 0;
+	Packet *current = 0;
+	std::string line;
+	while( std::getline(in, line) ) {
+		bool read;
+		int ep;
+		if( IsPacketStart(line, read, ep) ) {
+			Packet packet;
+			packet.m_read = read;
+			packet.m_ep = ep;
+			packet.m_writes_before = writes;
+			m_packets.push_back(packet);
+			current = &m_packets.back();
+
+			if( !read )
+				writes++;
+		}
+		else if( !current || !ParseHexLine(line, current->m_data) ) {
+			// anything else in between is commentary
+			current = 0;
+		}
+	}
+
+	dout("ReplayScript: loaded " << std::dec << m_packets.size()
+		<< " packets, " << writes << " sends, from " << m_filename);
+
+	m_next_write = FindWrite(0);
+	for( size_t i = 0; i < m_next_read.size(); i++ )
+		m_next_read[i] = FindRead(i, 0);
+
+	BuildEndpoints();
+	return m_packets.size() > 0;
+}
+
+//
+// BuildEndpoints
+//
+/// Makes up an endpoint list for the fake interface descriptor, pairing
+/// send and receive endpoints in the order the script first uses them.
+/// An unused pair is placed in front, since Probe starts looking at the
+/// second pair when there is more than one.
+///
+void ReplayScript::BuildEndpoints()
+{
+	std::vector<unsigned char> writes, reads;
+	bool used[REPLAY_EP_ADDR_MASK + 1] = { false };
+
+	for( size_t i = 0; i < m_packets.size(); i++ ) {
+		unsigned char addr = m_packets[i].m_ep & REPLAY_EP_ADDR_MASK;
+		std::vector<unsigned char> &list =
+			m_packets[i].m_read ? reads : writes;
+		if( std::find(list.begin(), list.end(), addr) == list.end() )
+			list.push_back(addr);
+		used[addr] = true;
+	}
+
+	// placeholder pair, on the lowest free endpoint number
+	for( unsigned char addr = 1; addr <= REPLAY_EP_ADDR_MASK; addr++ ) {
+		if( !used[addr] ) {
+			m_endpoints.push_back(addr);
+			m_endpoints.push_back(addr | REPLAY_EP_DIR_IN);
+			break;
+		}
+	}
+
+	size_t count = std::max(writes.size(), reads.size());
+	for( size_t i = 0; i < count; i++ ) {
+		if( i < writes.size() )
+			m_endpoints.push_back(writes[i]);
+		if( i < reads.size() )
+			m_endpoints.push_back(reads[i] | REPLAY_EP_DIR_IN);
+	}
+}
+
+// Returns the index of the next received packet on ep, at or after start
+size_t ReplayScript::FindRead(int ep, size_t start) const
+{
+	for( size_t i = start; i < m_packets.size(); i++ ) {
+		const Packet &p = m_packets[i];
+		if( p.m_read && (p.m_ep & REPLAY_EP_ADDR_MASK) == (ep & REPLAY_EP_ADDR_MASK) )
+			return i;
+	}
+	return npos;
+}
+
+// Returns the index of the next sent packet, at or after start
+size_t ReplayScript::FindWrite(size_t start) const
+{
+	for( size_t i = start; i < m_packets.size(); i++ ) {
+		if( !m_packets[i].m_read )
+			return i;
+	}
+	return npos;
+}
+
+//
+// Write
+//
+/// Takes a packet sent by the host.  Packets for an endpoint other than
+/// the one the script expects next are accepted and dropped, like a
+/// device that is not listening there.  Packets whose contents differ
+/// from the script are counted as mismatches, but still advance the
+/// conversation.  Returns the number of bytes written.
+///
+int ReplayScript::Write(int ep, const unsigned char *data, size_t size)
+{
+	scoped_lock lock(m_mutex);
+
+	if( m_next_write == npos ) {
+		dout("ReplayScript: send past end of script, ignored");
+		return size;
+	}
+
+	const Packet &expected = m_packets[m_next_write];
+	if( (expected.m_ep & REPLAY_EP_ADDR_MASK) != (ep & REPLAY_EP_ADDR_MASK) ) {
+		dout("ReplayScript: send to endpoint 0x" << std::hex << ep
+			<< " while script expects 0x" << expected.m_ep
+			<< ", ignored");
+		return size;
+	}
+
+	if( expected.m_data.GetSize() != size ||
+	    memcmp(expected.m_data.GetData(), data, size) != 0 )
+	{
+		m_mismatches++;
+		Barry::Data actual(data, size);
+		dout("ReplayScript: send does not match script, expected:\n"
+			<< expected.m_data << "got:\n" << actual);
+	}
+
+	m_writes_done++;
+	m_next_write = FindWrite(m_next_write + 1);
+
+	// readers may have something to hand out now
+	pthread_cond_broadcast(&m_cond);
+	return size;
+}
+
+//
+// Read
+//
+/// Hands out the next packet received on ep, waiting up to timeout
+/// milliseconds for the sends recorded ahead of it to be performed.
+/// Returns the number of bytes read, or -ETIMEDOUT.
+///
+int ReplayScript::Read(int ep, Barry::Data &data, int timeout)
+{
+	struct timespec to;
+	ThreadTimeout(timeout, &to);
+
+	scoped_lock lock(m_mutex);
+
+	size_t &next = m_next_read[ep & REPLAY_EP_ADDR_MASK];
+	while( next == npos || m_packets[next].m_writes_before > m_writes_done ) {
+		if( pthread_cond_timedwait(&m_cond, &m_mutex, &to) != 0 )
+			return -ETIMEDOUT;
+	}
+
+	const Barry::Data &recorded = m_packets[next].m_data;
+	data.QuickZap();
+	size_t offset = 0;
+	data.MemCpy(offset, recorded.GetData(), recorded.GetSize());
+
+	next = FindRead(ep, next + 1);
+	return recorded.GetSize();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Global replay state, one script per virtual device
+
+static std::vector<ReplayScript*> replayScripts;
+static bool replayLoaded = false;
+
+static void FreeScripts()
+{
+	std::for_each(replayScripts.begin(), replayScripts.end(),
+		deletePtr<ReplayScript>);
+	replayScripts.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Static functions
+
+std::string LibraryInterface::GetLastErrorString(int libusb_errcode)
+{
+	return std::string(strerror(-libusb_errcode));
+}
+
+int LibraryInterface::TranslateErrcode(int libusb_errcode)
+{
+	// replay errcode == system errcode
+	return libusb_errcode;
+}
+
+//
+// Init
+//
+/// Loads every script named in the BARRY_USB_REPLAY environment
+/// variable.  With the variable unset, the bus is simply empty.
+///
+bool LibraryInterface::Init(int *libusb_errno)
+{
+	if( replayLoaded )
+		return true;
+
+	const char *env = getenv(USB_REPLAY_ENV);
+	std::istringstream names(env ? env : "");
+	std::string filename;
+	while( std::getline(names, filename, ':') ) {
+		if( filename.empty() )
+			continue;
+
+		std::auto_ptr<ReplayScript> script(new ReplayScript(filename));
+		if( !script->Load() ) {
+			eout(_("Unable to load USB replay script: ") << filename);
+			FreeScripts();
+			if( libusb_errno )
+				*libusb_errno = -ENOENT;
+			return false;
+		}
+		replayScripts.push_back(script.release());
+	}
+
+	replayLoaded = true;
+	return true;
+}
+
+void LibraryInterface::Uninit()
+{
+	FreeScripts();
+	replayLoaded = false;
+}
+
+void LibraryInterface::SetDataDump(bool data_dump_mode)
+{
+	// Nothing to do, all the dumping happens in Device
+}
+
+// Replayed transfers are all synchronous
+bool LibraryInterface::HandleEvents(int timeout)
+{
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DeviceID
+
+DeviceID::DeviceID(DeviceIDImpl* impl)
+	: m_impl(impl)
+{
+}
+
+DeviceID::~DeviceID()
+{
+}
+
+const char* DeviceID::GetBusName() const
+{
+	return m_impl->m_busname.c_str();
+}
+
+uint16_t DeviceID::GetNumber() const
+{
+	return m_impl->m_number;
+}
+
+const char* DeviceID::GetFilename() const
+{
+	return m_impl->m_filename.c_str();
+}
+
+uint16_t DeviceID::GetIdProduct() const
+{
+	return PRODUCT_RIM_BLACKBERRY;
+}
+
+std::string DeviceID::GetUsbName() const
+{
+	std::ostringstream oss;
+	oss << GetBusName() << ":" << GetNumber();
+	return oss.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DeviceList
+
+DeviceList::DeviceList()
+	: m_impl(new DeviceListImpl())
+{
+	for( size_t i = 0; i < replayScripts.size(); i++ ) {
+		std::auto_ptr<DeviceIDImpl> impl( new DeviceIDImpl() );
+		impl->m_script = replayScripts[i];
+		impl->m_number = i + 1;
+		impl->m_busname = "replay";
+		impl->m_filename = replayScripts[i]->GetFilename();
+		DeviceID devID(impl.release());
+		m_impl->m_devices.push_back(devID);
+	}
+}
+
+DeviceList::~DeviceList()
+{
+}
+
+std::vector<DeviceID> DeviceList::MatchDevices(int vendor, int product,
+					    const char *busname, const char *devname)
+{
+	std::vector<DeviceID> ret;
+
+	std::vector<DeviceID>::iterator iter = m_impl->m_devices.begin();
+
+	for( ; iter != m_impl->m_devices.end() ; ++iter ) {
+		// only search on given bus
+		if( busname && strcmp(busname, iter->GetBusName()) != 0 )
+			continue;
+
+		// search for specific device
+		if( devname && atoi(devname) != iter->GetNumber() )
+			continue;
+
+		// every replayed device is a plain BlackBerry
+		if( vendor == VENDOR_RIM &&
+		    ( product == PRODUCT_RIM_BLACKBERRY ||
+		      product == PRODUCT_ANY )) {
+			ret.push_back(*iter);
+		}
+	}
+
+	return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Device
+
+Device::Device(const Usb::DeviceID& id, int timeout)
+	: m_id(id),
+	m_handle(new DeviceHandle()),
+	m_timeout(timeout),
+	m_lasterror(0)
+{
+	dout("replay open(" << std::dec << id.m_impl.get() << ")");
+	if( !id.m_impl.get() )
+		throw Error(_("invalid USB device ID"));
+	m_handle->m_script = id.m_impl->m_script;
+	m_handle->m_config = 0;
+}
+
+Device::~Device()
+{
+	dout("replay close(" << std::dec << m_handle->m_script << "), "
+		<< m_handle->m_script->GetMismatchCount()
+		<< " sends did not match the script");
+}
+
+bool Device::SetConfiguration(unsigned char cfg)
+{
+	dout("replay set_configuration(0x" << std::hex << (unsigned int) cfg << ")");
+	m_handle->m_config = cfg;
+	m_lasterror = 0;
+	return true;
+}
+
+bool Device::ClearHalt(int ep)
+{
+	m_lasterror = 0;
+	return true;
+}
+
+bool Device::Reset()
+{
+	m_lasterror = 0;
+	return true;
+}
+
+bool Device::BulkRead(int ep, Barry::Data &data, int timeout)
+{
+	int ret = m_handle->m_script->Read(ep, data,
+		timeout == -1 ? m_timeout : timeout);
+	if( ret < 0 ) {
+		m_lasterror = ret;
+		throw Timeout(ret, _("Timeout in replayed BulkRead"));
+	}
+
+	ddout("BulkRead (replay) from endpoint 0x" << std::hex << ep << ":\n" << data);
+	return true;
+}
+
+bool Device::BulkWrite(int ep, const Barry::Data &data, int timeout)
+{
+	ddout("BulkWrite (replay) to endpoint 0x" << std::hex << ep << ":\n" << data);
+	m_handle->m_script->Write(ep, data.GetData(), data.GetSize());
+	return true;
+}
+
+bool Device::BulkWrite(int ep, const void *data, size_t size, int timeout)
+{
+#ifdef __DEBUG_MODE__
+	Barry::Data dump(data, size);
+	ddout("BulkWrite (replay) to endpoint 0x" << std::hex << ep << ":\n" << dump);
+#endif
+
+	m_handle->m_script->Write(ep, (const unsigned char*) data, size);
+	return true;
+}
+
+bool Device::InterruptRead(int ep, Barry::Data &data, int timeout)
+{
+	int ret = m_handle->m_script->Read(ep, data,
+		timeout == -1 ? m_timeout : timeout);
+	if( ret < 0 ) {
+		m_lasterror = ret;
+		throw Timeout(ret, _("Timeout in replayed InterruptRead"));
+	}
+
+	ddout("InterruptRead (replay) from endpoint 0x" << std::hex << ep << ":\n" << data);
+	return true;
+}
+
+bool Device::InterruptWrite(int ep, const Barry::Data &data, int timeout)
+{
+	ddout("InterruptWrite (replay) to endpoint 0x" << std::hex << ep << ":\n" << data);
+	m_handle->m_script->Write(ep, data.GetData(), data.GetSize());
+	return true;
+}
+
+//
+// BulkDrain
+//
+/// Reads anything available on the given endpoint, with a low timeout,
+/// in order to clear any pending reads.
+///
+void Device::BulkDrain(int ep, int timeout)
+{
+	try {
+		Barry::Data data;
+		while( BulkRead(ep, data, timeout) )
+		;
+	}
+	catch( Usb::Error & ) {}
+}
+
+//
+// GetConfiguration
+//
+/// Returns the configuration last selected with SetConfiguration(),
+/// or 0 if none yet, just like an unconfigured device.
+///
+bool Device::GetConfiguration(unsigned char &cfg)
+{
+	cfg = m_handle->m_config;
+	m_lasterror = 0;
+	return true;
+}
+
+// Returns the current power level of the device, or 0 if unknown
+int Device::GetPowerLevel()
+{
+	return 0;
+}
+
+std::string Device::GetSimpleSerialNumber()
+{
+	return std::string();
+}
+
+bool Device::IsAttachKernelDriver(int iface)
+{
+	return false;
+}
+
+bool Device::DetachKernelDriver(int iface)
+{
+	m_lasterror = -ENOSYS;
+	return false;
+}
+
+// Control messages are not part of the recorded conversation, so
+// answer them with zeros
+bool Device::ControlMsg(int requesttype, int request, int value,
+			int index, char *bytes, int size, int timeout)
+{
+	if( bytes && size > 0 && (requesttype & REPLAY_EP_DIR_IN) )
+		memset(bytes, 0, size);
+	m_lasterror = size;
+	return true;
+}
+
+// Replayed reads never wait on the bus, so there is nothing to pipeline
+bool Device::StartReadPipeline(int ep, int count, size_t bufsize,
+				ReadReadyCallback ready, void *context)
+{
+	m_lasterror = -ENOSYS;
+	return false;
+}
+
+void Device::StopReadPipeline()
+{
+}
+
+bool Device::IsReadPipelined(int ep) const
+{
+	return false;
+}
+
+bool Device::PollRead(int ep, Barry::Data &data)
+{
+	return false;
+}
+
+int Device::FindInterface(int ifaceClass)
+{
+	return ifaceClass == BLACKBERRY_DB_CLASS ? BLACKBERRY_INTERFACE : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Interface
+
+Interface::Interface(Device &dev, int iface)
+	: m_dev(dev), m_iface(iface)
+{
+	dout("replay claim_interface(0x" << std::hex << iface << ")");
+}
+
+Interface::~Interface()
+{
+	dout("replay release_interface(0x" << std::hex << m_iface << ")");
+}
+
+bool Interface::SetAltInterface(int altSetting)
+{
+	m_dev.SetLastError(0);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DeviceDescriptor
+//
+// Every replayed device has a single BLACKBERRY_CONFIGURATION with a
+// single BLACKBERRY_DB_CLASS interface, whose bulk endpoints are made
+// up from the script.
+
+DeviceDescriptor::DeviceDescriptor(DeviceID& devid)
+	: m_impl(new DeviceDescriptorImpl())
+{
+	if( !devid.m_impl.get() ) {
+		return;
+	}
+	m_impl->m_devid = devid;
+
+	std::auto_ptr<ConfigDescriptor> ptr(new ConfigDescriptor(*this, 0));
+	(*this)[ptr->GetNumber()] = ptr.get();
+	ptr.release();
+}
+
+DeviceDescriptor::~DeviceDescriptor()
+{
+	// Delete any pointers in the vector
+	std::for_each(begin(),
+		      end(),
+		      deleteMapPtr<int, ConfigDescriptor>);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ConfigDescriptor
+
+ConfigDescriptor::ConfigDescriptor(DeviceDescriptor& dev, int cfgnumber)
+	: m_impl(new ConfigDescriptorImpl())
+{
+	m_impl->m_number = BLACKBERRY_CONFIGURATION;
+	m_impl->m_script = dev.m_impl->m_devid.m_impl->m_script;
+
+	std::auto_ptr<InterfaceDescriptor> ptr(
+		new InterfaceDescriptor(*this, BLACKBERRY_INTERFACE, 0));
+	(*this)[ptr->GetNumber()] = ptr.get();
+	ptr.release();
+}
+
+ConfigDescriptor::~ConfigDescriptor()
+{
+	// Delete any pointers in the vector
+	std::for_each(begin(),
+		      end(),
+		      deleteMapPtr<int, InterfaceDescriptor>);
+}
+
+uint8_t ConfigDescriptor::GetNumber() const
+{
+	return m_impl->m_number;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// InterfaceDescriptor
+
+InterfaceDescriptor::InterfaceDescriptor(ConfigDescriptor& cfgdesc,
+					 int iface, int altsetting)
+	: m_impl(new InterfaceDescriptorImpl())
+{
+	m_impl->m_number = iface;
+	m_impl->m_class = BLACKBERRY_DB_CLASS;
+	m_impl->m_endpoints = cfgdesc.m_impl->m_script->GetEndpoints();
+
+	// Create all the endpoints
+	for( size_t i = 0; i < m_impl->m_endpoints.size(); ++i ) {
+		std::auto_ptr<EndpointDescriptor> ptr (
+			new EndpointDescriptor(*this, i));
+		push_back(ptr.get());
+		ptr.release();
+	}
+}
+
+InterfaceDescriptor::~InterfaceDescriptor()
+{
+	// Delete any pointers in the vector
+	std::for_each(begin(),
+		      end(),
+		      deletePtr<EndpointDescriptor>);
+}
+
+uint8_t InterfaceDescriptor::GetClass() const
+{
+	return m_impl->m_class;
+}
+
+uint8_t InterfaceDescriptor::GetNumber() const
+{
+	return m_impl->m_number;
+}
+
+uint8_t InterfaceDescriptor::GetAltSetting() const
+{
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EndpointDescriptor
+
+EndpointDescriptor::EndpointDescriptor(InterfaceDescriptor& intdesc, int endpoint)
+	: m_impl(new EndpointDescriptorImpl()),
+	  m_read(false),
+	  m_addr(0),
+	  m_type(InvalidType)
+{
+	m_impl->m_address = intdesc.m_impl->m_endpoints[endpoint];
+	m_impl->m_attributes = BulkType;
+
+	m_read = (m_impl->m_address & REPLAY_EP_DIR_IN) != 0;
+	m_addr = m_impl->m_address & REPLAY_EP_ADDR_MASK;
+	m_type = static_cast<Usb::EndpointDescriptor::EpType>(m_impl->m_attributes);
+}
+
+EndpointDescriptor::~EndpointDescriptor()
+{
+}
+
+} // namespace Usb
+
@@ -0,0 +1,145 @@
+///
+/// \file	usbwrap_replay.h
+///		USB API wrapper that plays back recorded USB conversations
+///
+
+/*
+    Copyright (C) 2005-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#ifndef __SB_USBWRAP_REPLAY_H__
+#define __SB_USBWRAP_REPLAY_H__
+
+#include "usbwrap.h"
+#include "data.h"
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <pthread.h>
+
+// Environment variable holding the colon separated list of replay
+// scripts.  Each script becomes one virtual device on the bus.
+#define USB_REPLAY_ENV		"BARRY_USB_REPLAY"
+
+namespace Usb
+{
+
+//
+// ReplayScript
+//
+/// A recorded USB conversation with one device, in the "sep: N" /
+/// "rep: N" hex dump format written by convo.awk, btranslate, and
+/// bktrans, and read by Barry::LoadDataArray().  "sep" records are
+/// packets sent to the device, "rep" records are packets received
+/// from it.  Endpoint numbers are in hex.  Usb::Capture pcap files
+/// are accepted as well.
+///
+/// Writes are matched against the script in order.  Each received
+/// packet is handed out once every write recorded ahead of it has
+/// been performed, so a reader thread and a writer thread see the
+/// same interleaving they saw when the script was recorded.
+///
+class ReplayScript
+{
+public:
+	struct Packet
+	{
+		bool m_read;		//< true for "rep", false for "sep"
+		int m_ep;
+		Barry::Data m_data;
+		size_t m_writes_before;	//< count of sends ahead of this one
+	};
+
+private:
+	std::string m_filename;
+	std::vector<Packet> m_packets;
+	std::vector<unsigned char> m_endpoints;	//< synthesized descriptor order
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+	size_t m_writes_done;		//< sends performed so far
+	size_t m_next_write;		//< index of next "sep" packet
+	std::vector<size_t> m_next_read;	//< next "rep" index, per endpoint
+	unsigned int m_mismatches;
+
+protected:
+	bool Load(std::istream &in);
+	void BuildEndpoints();
+	size_t FindRead(int ep, size_t start) const;
+	size_t FindWrite(size_t start) const;
+
+public:
+	explicit ReplayScript(const std::string &filename);
+	~ReplayScript();
+
+	bool Load();
+
+	const std::string& GetFilename() const { return m_filename; }
+	const std::vector<unsigned char>& GetEndpoints() const
+		{ return m_endpoints; }
+	unsigned int GetMismatchCount() const { return m_mismatches; }
+
+	// Device side of the conversation
+	int Write(int ep, const unsigned char *data, size_t size);
+	int Read(int ep, Barry::Data &data, int timeout);
+};
+
+class DeviceIDImpl
+{
+public:
+	ReplayScript *m_script;
+	int m_number;
+	std::string m_busname;
+	std::string m_filename;
+};
+
+struct DeviceHandle
+{
+	ReplayScript *m_script;
+	unsigned char m_config;	//< as set by SetConfiguration()
+};
+
+struct DeviceListImpl
+{
+	std::vector<DeviceID> m_devices;
+};
+
+struct EndpointDescriptorImpl
+{
+	unsigned char m_address;
+	unsigned char m_attributes;
+};
+
+struct InterfaceDescriptorImpl
+{
+	unsigned char m_number;
+	unsigned char m_class;
+	std::vector<unsigned char> m_endpoints;
+};
+
+struct ConfigDescriptorImpl
+{
+	unsigned char m_number;
+	ReplayScript *m_script;
+};
+
+struct DeviceDescriptorImpl
+{
+	DeviceID m_devid;
+};
+
+}; // namespace Usb
+
+#endif // __SB_USBWRAP_REPLAY_H__
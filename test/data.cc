@@ -53,7 +53,7 @@ bool TestData()
 //	}
 
 	Data d;
-	TEST( d.GetBufSize() == 0x4000, "Unexpected default buffer size");
+	TEST( d.GetBufSize() == BARRY_DATA_INITIAL_SIZE, "Unexpected default buffer size");
 
 	const char *str = "hello world";
 	Data ed(str, strlen(str));
@@ -113,6 +113,37 @@ bool TestData()
 	ed.Prechop(3);
 	TEST( ed.GetData() == old, "Prechop failed");
 
+	Data big, small(str, strlen(str));
+	big.Append(str3, strlen(str3));
+	const unsigned char *bigbuf = big.GetData();
+	big.Swap(small);
+	TEST( small.GetData() == bigbuf && Equal(small, ed3),
+		"Swap did not move internal buffer");
+	TEST( big.GetData() == (unsigned char*) str && big.GetSize() == strlen(str),
+		"Swap did not move external data");
+
+	Data packet;
+	packet.Append(str, strlen(str));
+	packet.ShrinkToFit();
+	TEST( packet.GetBufSize() < 0x4000 && Equal(packet, Data(str, strlen(str))),
+		"ShrinkToFit did not move data to a smaller block");
+	packet.Prepend("pre", 3);
+	packet.GetBuffer(0x4000);
+	TEST( packet.GetBufSize() >= 0x4000 && packet.GetSize() == strlen(str) + 3,
+		"Data did not grow back after ShrinkToFit");
+
+	Data grown;
+	memset(grown.GetBuffer(), 0xff, grown.GetBufSize());
+	grown.ReleaseBuffer(grown.GetBufSize());
+	const size_t small_size = grown.GetBufSize();
+	unsigned char *gb = grown.GetBuffer(0x1000);
+	TEST( grown.GetSize() == small_size && gb[small_size] == 0 &&
+		gb[grown.GetBufSize() - 1] == 0,
+		"Data did not zero the space it grew into");
+
+	DataPool::Stats totals = DataPool::GetTotals();
+	TEST( totals.Hits + totals.Misses > 0, "DataPool stats not counting");
+
 	cout << "Examples of Diff() output" << endl;
 	Data one, two;
 	one.GetBuffer()[0] = 0x01;
@@ -0,0 +1,329 @@
+///
+/// \file	record.cc
+///		Tests for record parsing
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include <barry/barry.h>
+#include "libtest.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+using namespace std;
+using namespace Barry;
+
+static Contact MakeContact(uint32_t id, const char *first, const char *company)
+{
+	Contact c;
+	c.SetIds(Contact::GetDefaultRecType(), id);
+	c.FirstName = first;
+	c.LastName = "Smith";
+	c.Company = company;
+	c.Notes = "Some notes";
+	c.EmailAddresses.push_back("someone@example.com");
+	c.WorkAddress.City = "Waterloo";
+	c.Categories.push_back("Work");
+	return c;
+}
+
+static DBData MakeDBData(const Contact &c, Data &raw)
+{
+	size_t size = 0;
+	c.BuildFields(raw, size);
+	return DBData(DBData::REC_VERSION_1, Contact::GetDBName(),
+		c.GetRecType(), c.GetUniqueId(), 0, raw, true);
+}
+
+static const FieldHandle<Contact>& Handle(const char *name)
+{
+	FieldHandle<Contact>::ListT::const_iterator
+		b = Contact::GetFieldHandles().begin(),
+		e = Contact::GetFieldHandles().end();
+	for( ; b != e; ++b ) {
+		if( string(name) == b->GetIdentity().Name )
+			break;
+	}
+	return *b;
+}
+
+static string DumpStr(const Contact &c)
+{
+	ostringstream oss;
+	c.Dump(oss);
+	return oss.str();
+}
+
+bool TestLazyRecord()
+{
+	Data raw;
+	Contact full = MakeContact(0x1234, "Ann", "Acme");
+	DBData dbdata = MakeDBData(full, raw);
+
+	LazyRecord<Contact> lazy(dbdata);
+	TEST( lazy.GetUniqueId() == 0x1234, "Wrong unique ID");
+	TEST( lazy.GetIndex().GetCount() > 0, "No fields indexed");
+	TEST( !lazy.IsComplete(), "Record decoded too soon");
+
+	const Contact &partial = lazy.Decode(Handle("Company"));
+	TEST( partial.Company == "Acme", "Company field not decoded");
+	TEST( partial.Notes.empty(), "Notes decoded along with Company");
+	TEST( !lazy.IsComplete(), "Decoding one field decoded the record");
+
+	// first and last names share a device field type
+	TEST( lazy.Decode(Handle("FirstName")).FirstName == "Ann",
+		"FirstName not decoded");
+	TEST( lazy.IsComplete(), "FirstName should decode the whole record");
+
+	Contact parsed;
+	ParseDBData(dbdata, parsed, 0);
+	TEST( DumpStr(lazy.GetRecord()) == DumpStr(parsed),
+		"Lazy record differs from fully parsed record");
+	TEST( lazy.GetRecord().LastName == "Smith", "LastName lost");
+
+	// sort by company, decoding only that
+	const char *companies[] = { "Zeta", "Acme", "Midway" };
+	vector<LazyRecord<Contact> > records;
+	for( int i = 0; i < 3; i++ ) {
+		Data r;
+		Contact c = MakeContact(i, "Bob", companies[i]);
+		records.push_back(LazyRecord<Contact>(MakeDBData(c, r)));
+	}
+	string key = "Company";
+	sort(records.begin(), records.end(), LazyNamedFieldCmp<Contact>(key));
+	TEST( records[0].GetDecoded().Company == "Acme" &&
+		records[1].GetDecoded().Company == "Midway" &&
+		records[2].GetDecoded().Company == "Zeta",
+		"Lazy records sorted incorrectly");
+	TEST( records[0].GetDecoded().Notes.empty() && !records[0].IsComplete(),
+		"Sorting decoded more than the sort key");
+
+	return true;
+}
+
+NewTest testlazyrecord("LazyRecord class", &TestLazyRecord);
+
+bool TestRecordArena()
+{
+	// records from many packets, kept together in one arena
+	LazyRecordStore<Contact> store;
+	RecordArena &arena = store.Arena;
+	LazyRecordParser<Contact, LazyRecordStore<Contact> > parser(store, &arena);
+
+	const int count = 50;
+	store.Reserve(count);
+	for( int i = 0; i < count; i++ ) {
+		ostringstream name;
+		name << "Name" << i;
+		Contact c = MakeContact(i, name.str().c_str(), "Acme");
+
+		// records arrive somewhere in the middle of a packet
+		Data packet;
+		size_t offset = 10;
+		memset(packet.GetBuffer(offset), 0xff, offset);
+		packet.ReleaseBuffer(offset);
+		c.BuildFields(packet, offset);
+
+		DBData dbdata(DBData::REC_VERSION_1, Contact::GetDBName(),
+			c.GetRecType(), c.GetUniqueId(), 10, packet, false);
+		parser.ParseRecord(dbdata, 0);
+	}
+
+	TEST( store.Records.size() == count, "Wrong number of records stored");
+	TEST( arena.GetBlockCount() == 1, "Records should share one block");
+
+	for( int i = 0; i < count; i++ ) {
+		ostringstream name;
+		name << "Name" << i;
+		const Contact &c = store.Records[i].GetRecord();
+		TEST( c.GetUniqueId() == (uint32_t) i &&
+			c.FirstName == name.str() &&
+			c.WorkAddress.City == "Waterloo",
+			"Record from arena parsed incorrectly");
+	}
+
+	// a copy shares the arena data
+	LazyRecord<Contact> copy = store.Records[7];
+	TEST( copy.GetDBData().GetData().GetData() ==
+		store.Records[7].GetDBData().GetData().GetData(),
+		"Copy of arena record copied its data");
+	TEST( copy.GetIndex().begin() == store.Records[7].GetIndex().begin() &&
+		copy.GetIndex().GetCount() > 0,
+		"Copy of arena record copied its field index");
+
+	store.Clear();
+	TEST( arena.GetBlockCount() == 0 && arena.GetSize() == 0,
+		"Arena not cleared");
+
+	// small block sizes, and records bigger than a block
+	RecordArena small(64);
+	char big[200], tiny[10];
+	memset(big, 'b', sizeof(big));
+	memset(tiny, 't', sizeof(tiny));
+	const unsigned char *t1 = small.Copy(tiny, sizeof(tiny));
+	const unsigned char *b1 = small.Copy(big, sizeof(big));
+	const unsigned char *t2 = small.Copy(tiny, sizeof(tiny));
+	TEST( small.GetBlockCount() == 2, "Big copy should get its own block");
+	TEST( t2 == t1 + 16, "Small copies should share a block");
+	TEST( memcmp(b1, big, sizeof(big)) == 0 &&
+		memcmp(t2, tiny, sizeof(tiny)) == 0,
+		"Arena copy corrupted");
+	TEST( small.GetSize() == sizeof(big) + 2 * sizeof(tiny),
+		"Wrong arena size");
+
+	return true;
+}
+
+NewTest testrecordarena("RecordArena class", &TestRecordArena);
+
+bool TestFieldStringConvert()
+{
+	IConverter ic("UTF-8");
+
+	// plain ASCII, and Latin-1 that needs converting
+	string dest = "old contents";
+	ic.FromBB("Waterloo", 8, dest);
+	TEST( dest == "Waterloo", "ASCII string not copied");
+	ic.FromBB("Caf\xe9", 4, dest);
+	TEST( dest == "Caf\xc3\xa9", "Latin-1 string not converted");
+	TEST( ic.FromBB(string("Caf\xe9")) == dest,
+		"String and raw conversions differ");
+
+	// fields parse the same with or without a converter, when
+	// they are plain ASCII
+	Data raw;
+	Contact full = MakeContact(0x55, "Ann", "Acme");
+	full.EmailAddresses.push_back("second@example.com");
+	DBData dbdata = MakeDBData(full, raw);
+
+	Contact plain, converted;
+	ParseDBData(dbdata, plain, 0);
+	ParseDBData(dbdata, converted, &ic);
+	TEST( DumpStr(plain) == DumpStr(converted),
+		"Converter changed an ASCII record");
+	TEST( converted.EmailAddresses.size() == 2 &&
+		converted.EmailAddresses[1] == "second@example.com",
+		"Email addresses parsed incorrectly");
+
+	// and the rest go through iconv
+	full.Company = "Caf\xe9";
+	Data raw2;
+	DBData dbdata2 = MakeDBData(full, raw2);
+	ParseDBData(dbdata2, converted, &ic);
+	TEST( converted.Company == "Caf\xc3\xa9", "Field not converted");
+
+	return true;
+}
+
+NewTest testfieldstringconvert("Field string conversion", &TestFieldStringConvert);
+
+template <class RecordT>
+static bool FieldsSizeMatches(const RecordT &rec, const IConverter *ic)
+{
+	// build at an offset, as the packet code does
+	Data data;
+	size_t offset = 20;
+	size_t expected = rec.GetFieldsSize(ic);
+	rec.BuildFields(data, offset, ic);
+	return expected == offset - 20;
+}
+
+bool TestFieldsSize()
+{
+	IConverter ic("UTF-8");
+
+	Contact contact = MakeContact(0x77, "Ann", "Acme");
+	contact.EmailAddresses.push_back("second@example.com");
+	contact.GroupLinks.push_back(Contact::GroupLink(0x10, 1));
+	contact.Birthday.FromYYYYMMDD("19700102");
+	contact.Categories.push_back("Friends");
+	TEST( FieldsSizeMatches(contact, 0), "Wrong Contact size");
+	TEST( FieldsSizeMatches(contact, &ic), "Wrong ASCII Contact size");
+	contact.FirstName.clear();
+	TEST( FieldsSizeMatches(contact, &ic), "Wrong last name only size");
+
+	// strings that need converting aren't measured, so the size
+	// is unknown, unless there is no converter
+	Contact cafe = contact;
+	cafe.Company = "Caf\xc3\xa9";
+	TEST( cafe.GetFieldsSize(&ic) == 0, "Non-ASCII Contact size should be unknown");
+	TEST( FieldsSizeMatches(cafe, 0), "Wrong unconverted Contact size");
+	cafe = contact;
+	cafe.Categories.push_back("Caf\xc3\xa9");
+	TEST( cafe.GetFieldsSize(&ic) == 0, "Non-ASCII category size should be unknown");
+
+	Calendar cal;
+	cal.Subject = "Lunch at the caf\xc3\xa9";
+	cal.StartTime.Time = 1000000;
+	cal.EndTime.Time = 1003600;
+	cal.Organizer.push_back(EmailAddress("Bob <bob@example.com>"));
+	cal.Recurring = true;
+	cal.RecurringType = Calendar::Day;
+	cal.Interval = 1;
+	cal.TimeZoneValid = true;
+	cal.CalendarID = 5;
+	TEST( FieldsSizeMatches(cal, 0), "Wrong Calendar size");
+	TEST( cal.GetFieldsSize(&ic) == 0, "Non-ASCII Calendar size should be unknown");
+	cal.Subject = "Lunch";
+	TEST( FieldsSizeMatches(cal, &ic), "Wrong ASCII Calendar size");
+
+	Memo memo;
+	memo.Title = "Title";
+	memo.Body = "Body";
+	memo.Categories.push_back("Personal");
+	memo.Categories.push_back("Work");
+	TEST( FieldsSizeMatches(memo, &ic), "Wrong Memo size");
+
+	Task task;
+	task.Summary = "Summary";
+	task.Notes = "Notes";
+	task.DueTime.Time = 1000000;
+	task.AlarmTime.Time = 999000;
+	task.TimeZoneValid = true;
+	TEST( FieldsSizeMatches(task, &ic), "Wrong Task size");
+
+	ContentStore cs;
+	cs.Filename = "/BlackBerry/pictures/big.jpg";
+	cs.FileContent.assign(0x1fffd, 'x');
+	TEST( FieldsSizeMatches(cs, 0), "Wrong ContentStore size");
+	cs.FileContent.clear();
+	cs.FolderFlag = true;
+	TEST( FieldsSizeMatches(cs, 0), "Wrong ContentStore folder size");
+
+	// a record built by SetDBData() is sized once, up front
+	DBData dbdata;
+	size_t offset = 0;
+	SetDBData(contact, dbdata, offset, &ic);
+	TEST( dbdata.GetData().GetSize() == contact.GetFieldsSize(&ic),
+		"SetDBData() built the wrong size");
+
+	// one whose size is unknown grows its buffer as usual
+	offset = 0;
+	SetDBData(cafe, dbdata, offset, &ic);
+	Contact parsed;
+	ParseDBData(dbdata, parsed, &ic);
+	TEST( parsed.Categories.size() == cafe.Categories.size() &&
+		parsed.Categories.back() == "Caf\xc3\xa9",
+		"SetDBData() built a converted record incorrectly");
+
+	return true;
+}
+
+NewTest testfieldssize("Record field sizes", &TestFieldsSize);
+
@@ -95,7 +95,8 @@ void Usage()
    "             Multiple outputs are allowed, as long as they don't\n"
    "             conflict (such as two outputs writing to the same file\n"
    "             or device).\n"
-   "             Can be one of: device, tar, %sldif, mime, dump, sha1, cstore\n"
+   "             Can be one of: device, tar, store, %sldif, mime, dump, sha1,\n"
+   "             cstore\n"
    "\n"
    " Options to use for 'device' type:\n"
    "   -d db     Name of input database. Can be used multiple times.\n"
@@ -117,7 +118,15 @@ void Usage()
    "             then all databases are automatically selected.  Using -D\n"
    "             allows a filtering selection.  If -d and -D are used for\n"
    "             the same database, -D takes precedence.\n"
-   "   -f file   Tar backup file to read from or write to\n"
+   "   -f file   Tar backup file to read from or write to.  Written\n"
+   "             with zstd or lz4 if named .tar.zst or .tar.lz4, and\n"
+   "             gzip otherwise.  Format is detected when reading.\n"
+   "             When reading, may also be a snapshot in a backup store.\n"
+   "\n"
+   " Options to use for 'store' deduplicated backup output type:\n"
+   "   -f dir    Backup store directory, created if needed.  Each run\n"
+   "             adds a snapshot named by the date and time, which can\n"
+   "             be read back with: -i tar -f dir/snapshots/<name>\n"
    "%s"
    "\n"
    " Options to use for 'ldif' type:\n"
@@ -568,6 +577,29 @@ public:
 	}
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Mode: Output, Type: store
+
+class StoreOutput : public OutputBase
+{
+	auto_ptr<StoreBackup> m_backup;
+	string m_storepath;
+
+public:
+	void SetFilename(const std::string &name)
+	{
+		m_storepath = name;
+		if( name == "-" )
+			throw runtime_error(_("Cannot use stdout as backup store, sorry."));
+	}
+
+	Parser& GetParser(Barry::Probe *probe, IConverter &ic)
+	{
+		m_backup.reset( new StoreBackup(m_storepath) );
+		return *m_backup;
+	}
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // Mode: Output, Type: boost
 
@@ -924,6 +956,10 @@ bool App::ParseOutMode(const string &mode)
 		Outputs.push_back( OutputPtr(new TarOutput) );
 		return true;
 	}
+	else if( mode == "store" ) {
+		Outputs.push_back( OutputPtr(new StoreOutput) );
+		return true;
+	}
 #ifdef __BARRY_BOOST_MODE__
 	else if( mode == "boost" ) {
 		Outputs.push_back( OutputPtr(new BoostOutput) );
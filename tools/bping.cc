@@ -0,0 +1,259 @@
+///
+/// \file	bping.cc
+///		Round trip latency and throughput benchmark for Blackberry
+///		devices, for qualifying cables, hubs, and host controllers
+///
+
+/*
+    Copyright (C) 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the GNU General Public License in the COPYING file at the
+    root directory of this project for more details.
+*/
+
+#include <barry/barry.h>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <stdlib.h>
+#include "barrygetopt.h"
+#include "i18n.h"
+
+using namespace std;
+using namespace Barry;
+
+void Usage()
+{
+   int logical, major, minor;
+   const char *Version = Barry::Version(logical, major, minor);
+
+   cerr << string_vprintf(
+   _("bping - USB Blackberry latency and throughput benchmark\n"
+   "        Copyright 2010-2013, Net Direct Inc. (http://www.netdirect.ca/)\n"
+   "        Using: %s\n"
+   "\n"
+   "   -p pin    PIN of device to talk with\n"
+   "             If only one device is plugged in, this flag is optional\n"
+   "   -P pass   Simplistic method to specify device password\n"
+   "   -B bus    Specify which USB bus to search on\n"
+   "   -N dev    Specify which system device, using system specific string\n"
+   "\n"
+   "   -c count  Number of socket zero echoes to send (default 100)\n"
+   "             Use 0 to skip the echo test\n"
+   "   -b burst  Number of echoes outstanding at once (default 1)\n"
+   "   -d db     Also time loading the named database over a\n"
+   "             desktop data socket\n"
+   "   -r count  Number of times to load the database (default 1)\n"
+   "   -W win    Number of records to request at once when loading\n"
+   "   -Q depth  Number of USB reads the router keeps queued\n"
+   "   -z        Use non-threaded sockets\n"
+   "   -Z        Use threaded socket router (default)\n"
+   "\n"
+   "   -h        This help\n"
+   "   -v        Dump protocol data during operation\n"), Version)
+   << endl;
+}
+
+// bytes per microsecond happens to be megabytes per second
+double MBps(unsigned long long bytes, unsigned long usec)
+{
+	return usec ? (double) bytes / usec : 0;
+}
+
+void EchoTest(Controller &con, int count, int burst)
+{
+	Histogram rtt;
+	ProtocolMetrics before = con.GetProtocolMetrics();
+
+	Stopwatch elapsed;
+	con.Echo(count, burst, rtt);
+	unsigned long usec = elapsed.GetElapsed();
+
+	ProtocolMetrics after = con.GetProtocolMetrics();
+	unsigned long long bytes =
+		(after.BytesSent - before.BytesSent) +
+		(after.BytesReceived - before.BytesReceived);
+
+	cout << _("Echo: ") << count << _(" packets, burst ") << burst << "\n"
+	     << _("   min ") << rtt.GetMin()
+	     << _("us, avg ") << rtt.GetAverage()
+	     << _("us, p99 <= ") << rtt.GetPercentile(99)
+	     << _("us, max ") << rtt.GetMax() << "us\n"
+	     << "   " << fixed << setprecision(1)
+	     << (usec ? count * 1000000.0 / usec : 0) << _(" echoes/s, ")
+	     << setprecision(3) << MBps(bytes, usec) << _(" MB/s")
+	     << endl;
+}
+
+void DataTest(Controller &con, const string &password, const string &dbname,
+		int repeats, int fetch_window)
+{
+	Mode::Desktop desktop(con);
+	desktop.Open(password.c_str());
+	if( fetch_window > 0 )
+		desktop.SetFetchWindow(fetch_window);
+
+	unsigned int id = desktop.GetDBID(dbname);
+
+	con.ClearMetrics();
+	Stopwatch elapsed;
+	for( int i = 0; i < repeats; i++ ) {
+		NullParser parser;
+		desktop.LoadDatabase(id, parser);
+	}
+	unsigned long usec = elapsed.GetElapsed();
+
+	ProtocolMetrics m = con.GetProtocolMetrics();
+	unsigned long long bytes = m.BytesSent + m.BytesReceived;
+
+	cout << _("Database: ") << dbname << _(", loaded ") << repeats
+	     << _(" times") << "\n"
+	     << "   " << m.PacketsSent << _(" packets sent, ")
+	     << m.PacketsReceived << _(" received, ")
+	     << bytes << _(" bytes in ") << usec << "us\n"
+	     << "   " << fixed << setprecision(3) << MBps(bytes, usec)
+	     << _(" MB/s") << "\n"
+	     << _("   Packet round trip: ") << m.PacketRoundTrip << "\n"
+	     << _("   Response wait: ") << m.ReceiveWait
+	     << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	INIT_I18N(PACKAGE);
+
+	cout.sync_with_stdio(true);	// leave this on, since libusb uses
+					// stdio for debug messages
+
+	try {
+
+		uint32_t pin = 0;
+		bool data_dump = false,
+			threaded_sockets = true;
+		string busname, devname, password, dbname;
+		int count = 100,
+			burst = 1,
+			repeats = 1,
+			fetch_window = 0,
+			read_pipeline_depth = 0;
+
+		// process command line options
+		for(;;) {
+			int cmd = getopt(argc, argv, "b:B:c:d:hN:p:P:Q:r:vW:zZ");
+			if( cmd == -1 )
+				break;
+
+			switch( cmd )
+			{
+			case 'b':	// echo burst
+				burst = atoi(optarg);
+				break;
+
+			case 'B':	// busname
+				busname = optarg;
+				break;
+
+			case 'c':	// echo count
+				count = atoi(optarg);
+				break;
+
+			case 'd':	// database to load
+				dbname = optarg;
+				break;
+
+			case 'N':	// Devname
+				devname = optarg;
+				break;
+
+			case 'p':	// Blackberry PIN
+				pin = strtoul(optarg, NULL, 16);
+				break;
+
+			case 'P':	// Device password
+				password = optarg;
+				break;
+
+			case 'Q':	// read pipeline depth
+				read_pipeline_depth = atoi(optarg);
+				break;
+
+			case 'r':	// database repeats
+				repeats = atoi(optarg);
+				break;
+
+			case 'v':	// data dump on
+				data_dump = true;
+				break;
+
+			case 'W':	// record fetch window
+				fetch_window = atoi(optarg);
+				break;
+
+			case 'z':	// non-threaded sockets
+				threaded_sockets = false;
+				break;
+
+			case 'Z':	// threaded socket router
+				threaded_sockets = true;
+				break;
+
+			case 'h':	// help
+			default:
+				Usage();
+				return 0;
+			}
+		}
+
+		Barry::Init(data_dump, &std::cerr);
+
+		Barry::Probe probe(busname.c_str(), devname.c_str());
+		int activeDevice = probe.FindActive(pin);
+		if( activeDevice == -1 ) {
+			cerr << _("No device selected, or PIN not found") << endl;
+			return 1;
+		}
+
+		// the router must outlive the controller
+		auto_ptr<SocketRoutingQueue> router;
+		auto_ptr<Controller> con;
+		if( threaded_sockets ) {
+			router.reset( new SocketRoutingQueue );
+			router->SetReadPipelineDepth(read_pipeline_depth);
+			router->SpinoffSimpleReadThread();
+			con.reset( new Controller(probe.Get(activeDevice), *router) );
+		}
+		else {
+			con.reset( new Controller(probe.Get(activeDevice)) );
+		}
+
+		cout << probe.Get(activeDevice).m_pin.Str() << ", "
+		     << (threaded_sockets ? _("threaded router") : _("non-threaded sockets"))
+		     << endl;
+
+		// echoes go first, since socket zero is quiet until
+		// a mode is opened
+		if( count > 0 )
+			EchoTest(*con, count, burst);
+
+		if( dbname.size() )
+			DataTest(*con, password, dbname, repeats, fetch_window);
+
+	}
+	catch( std::exception &e ) {
+		cerr << _("exception caught: ") << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
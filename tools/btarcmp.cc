@@ -58,6 +58,7 @@ void Usage()
    "      Using: %s\n"
    "\n"
    " Usage:  btarcmp [options...] tarball_0 tarball_1\n"
+   "         (gzip, zstd, or lz4 compressed, or backup store snapshots)\n"
    "\n"
    "   -b        Use brief filename output\n"
    "   -d db     Specify a specific database to compare.  Can be used\n"
@@ -355,6 +356,7 @@ private:
 public:
 	App();
 
+	bool LoadSnapshots();
 	void LoadTarballs();
 	void CompareDatabaseNames();
 	void CompareData();
@@ -428,8 +430,84 @@ void App::AddParsersToCompare()
 	ALL_KNOWN_PARSER_TYPES
 }
 
+/// If both arguments are snapshots in the same backup store, records
+/// with matching hashes are known to be identical, so only the
+/// records that differ are loaded.  Returns false if not snapshots.
+bool App::LoadSnapshots()
+{
+	if( !BackupSnapshot::IsSnapshot(m_tarpaths[0]) ||
+	    !BackupSnapshot::IsSnapshot(m_tarpaths[1]) )
+		return false;
+
+	std::string storepath = BackupStore::GetStorePath(m_tarpaths[0]);
+	if( storepath != BackupStore::GetStorePath(m_tarpaths[1]) )
+		return false;
+
+	BackupStore store(storepath);
+	BackupSnapshot snapshots[2];
+	snapshots[0].Load(m_tarpaths[0]);
+	snapshots[1].Load(m_tarpaths[1]);
+
+	for( int i = 0; i < 2; i++ ) {
+		int other = i == 0 ? 1 : 0;
+
+		const BackupSnapshot::DatabaseArrayType &dbs =
+			snapshots[i].GetDatabases();
+		for( BackupSnapshot::DatabaseArrayType::const_iterator
+				db = dbs.begin();
+			db != dbs.end();
+			++db )
+		{
+			// database must exist in the map, even if empty,
+			// for CompareDatabaseNames()
+			DBDataList &list = m_tars[i][db->Name];
+
+			std::map<uint32_t, const BackupSnapshot::Entry*> others;
+			const BackupSnapshot::Database *odb =
+				snapshots[other].FindDB(db->Name);
+			if( odb ) {
+				for( BackupSnapshot::EntryArrayType::const_iterator
+						e = odb->Entries.begin();
+					e != odb->Entries.end();
+					++e )
+				{
+					others[e->UniqueId] = &(*e);
+				}
+			}
+
+			for( BackupSnapshot::EntryArrayType::const_iterator
+					e = db->Entries.begin();
+				e != db->Entries.end();
+				++e )
+			{
+				std::map<uint32_t, const BackupSnapshot::Entry*>::iterator
+					match = others.find(e->UniqueId);
+				if( match != others.end() &&
+				    match->second->RecType == e->RecType &&
+				    match->second->Hash == e->Hash )
+					continue;	// same in both
+
+				DBData data;
+				store.LoadObject(e->Hash, data.UseData());
+				data.SetVersion(DBData::REC_VERSION_1);
+				data.SetDBName(db->Name);
+				data.SetIds(e->RecType, e->UniqueId);
+				data.SetOffset(0);
+				list.push_back(data);
+			}
+
+			if( m_sort_on_load )
+				sort(list.begin(), list.end(), DBDataCmp);
+		}
+	}
+	return true;
+}
+
 void App::LoadTarballs()
 {
+	if( LoadSnapshots() )
+		return;
+
 	for( int i = 0; i < 2; i++ ) {
 		// load data into memory
 		Restore builder(m_tarpaths[i]);
@@ -58,7 +58,8 @@ void Usage()
    "             Valid values here are available with 'iconv --list'\n"
    "%s\n"
    "\n"
-   "   [files...] Backup file(s), created by btool or the backup GUI.\n"),
+   "   [files...] Backup file(s), created by btool or the backup GUI.\n"
+   "             gzip, zstd, and lz4 compressed backups are accepted.\n"),
 	Version,
 	sync_mode.c_str())
    << endl;
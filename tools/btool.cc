@@ -90,6 +90,7 @@ void Usage()
    "        %s\n"
    "\n"
    "   -b file   Filename to save or load a Barry Backup to (tar.gz)\n"
+   "             Use a .tar.zst or .tar.lz4 extension for zstd or lz4\n"
    "   -B bus    Specify which USB bus to search on\n"
    "   -N dev    Specify which system device, using system specific string\n"
    "\n"
@@ -117,6 +118,7 @@ void Usage()
    "   -i cs     International charset for string conversions\n"
    "             Valid values here are available with 'iconv --list'\n"
    "   -I        Sort records before output\n"
+   "   -k        Print protocol and router statistics to stderr when done\n"
    "   -l        List devices\n"
    "   -L        List Contact field names\n"
    "   -m        Map LDIF name to Contact field / Unmap LDIF name\n"
@@ -127,13 +129,21 @@ void Usage()
    "   -p pin    PIN of device to talk with\n"
    "             If only one device is plugged in, this flag is optional\n"
    "   -P pass   Simplistic method to specify device password\n"
+   "   -Q n      Keep n USB reads in flight in the threaded router\n"
+   "             (libusb 1.0 only, default is 0 for synchronous reads)\n"
    "   -s db     Save database 'db' TO device from data loaded from -f file\n"
    "   -S        Show list of supported database parsers.  Use twice to\n"
    "             display fields names as well.\n"
    "   -t        Show database database table\n"
    "   -T db     Show record state table for given database\n"
+   "   -u base   With -b, make an incremental backup containing only the\n"
+   "             records changed since the backup file 'base'\n"
+   "   -U        Read USB through a shared MultiRouter pool, instead of\n"
+   "             a read thread of the router's own (implies -Z)\n"
    "   -v        Dump protocol data during operation\n"
    "%s\n"
+   "   -W n      Keep n record requests outstanding while loading\n"
+   "             databases (default is 1, one request at a time)\n"
    "   -X        Reset device\n"
    "   -z        Use non-threaded sockets\n"
    "   -Z        Use threaded socket router (default)\n"
@@ -155,6 +165,36 @@ void Usage()
    << endl;
 }
 
+//
+// MetricsDump
+//
+/// Prints the controller's statistics on the way out, however btool
+/// gets there.
+///
+class MetricsDump
+{
+	const Controller *m_con;
+
+public:
+	MetricsDump()
+		: m_con(0)
+	{
+	}
+
+	~MetricsDump()
+	{
+		if( !m_con )
+			return;
+
+		cerr << m_con->GetProtocolMetrics();
+		RouterMetrics router;
+		if( m_con->GetRouterMetrics(router) )
+			cerr << router;
+	}
+
+	void Set(const Controller &con) { m_con = &con; }
+};
+
 class Contact2Ldif
 {
 public:
@@ -528,6 +568,8 @@ int main(int argc, char *argv[])
 	try {
 
 		uint32_t pin = 0;
+		int read_pipeline_depth = 0;
+		int fetch_window = 1;
 		bool	list_only = false,
 			show_dbdb = false,
 			ldif_contacts = false,
@@ -544,20 +586,23 @@ int main(int argc, char *argv[])
 			bbackup_mode = false,
 			sort_records = false,
 			show_parsers = false,
-			show_fields = false;
+			show_fields = false,
+			show_metrics = false,
+			shared_reads = false;
 		string ldifBaseDN, ldifDnAttr;
 		string filename;
 		string password;
 		string busname;
 		string devname;
 		string iconvCharset;
+		string incrementalBase;
 		vector<string> dbNames, saveDbNames, mapCommands, clearDbNames;
 		vector<StateTableCommand> stCommands;
 		Usb::EndpointPair epOverride;
 
 		// process command line options
 		for(;;) {
-			int cmd = getopt(argc, argv, "a:b:B:c:C:d:D:e:f:F:hi:IlLm:MnN:p:P:r:R:Ss:tT:vVXzZ");
+			int cmd = getopt(argc, argv, "a:b:B:c:C:d:D:e:f:F:hi:IklLm:MnN:p:P:Q:r:R:Ss:tT:u:UvVW:XzZ");
 			if( cmd == -1 )
 				break;
 
@@ -641,6 +686,10 @@ int main(int argc, char *argv[])
 				sort_records = true;
 				break;
 
+			case 'k':	// statistics on exit
+				show_metrics = true;
+				break;
+
 			case 'l':	// list only
 				list_only = true;
 				break;
@@ -673,6 +722,14 @@ int main(int argc, char *argv[])
 				password = optarg;
 				break;
 
+			case 'Q':	// read pipeline depth
+				read_pipeline_depth = atoi(optarg);
+				break;
+
+			case 'W':	// record fetch window
+				fetch_window = atoi(optarg);
+				break;
+
 			case 'r':	// get specific record index
 				stCommands.push_back(
 					StateTableCommand('r', false, atoi(optarg)));
@@ -703,6 +760,20 @@ int main(int argc, char *argv[])
 				dbNames.push_back(string(optarg));
 				break;
 
+			case 'u':	// incremental backup base
+#ifdef __BARRY_BACKUP_MODE__
+				incrementalBase = optarg;
+#else
+				cerr << _("-u option not supported - no Barry Backup library support available\n");
+				return 1;
+#endif
+				break;
+
+			case 'U':	// shared MultiRouter reads
+				shared_reads = true;
+				threaded_sockets = true;
+				break;
+
 			case 'v':	// data dump on
 				data_dump = true;
 				break;
@@ -735,6 +806,11 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		if( incrementalBase.size() && !bbackup_mode ) {
+			cerr << _("-u requires -b") << endl;
+			return 1;
+		}
+
 		if( show_parsers ) {
 			ShowParsers(show_fields, true);
 			ShowBuilders();
@@ -883,10 +959,23 @@ int main(int argc, char *argv[])
 		// rules would guarantee this safety for you, but
 		// here we want the user to pick.
 		//
+		// The MultiRouter comes first, since it must outlive
+		// both of them.
+		//
+		auto_ptr<MultiRouter> pool;
 		auto_ptr<SocketRoutingQueue> router;
 		if( threaded_sockets ) {
 			router.reset( new SocketRoutingQueue );
-			router->SpinoffSimpleReadThread();
+			router->SetReadPipelineDepth(read_pipeline_depth);
+			if( shared_reads ) {
+				// the pool reads once Controller
+				// sets the USB device
+				pool.reset( new MultiRouter );
+				pool->Add(*router);
+			}
+			else {
+				router->SpinoffSimpleReadThread();
+			}
 		}
 
 		DesktopConnector connector(password.c_str(),
@@ -897,7 +986,12 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
+		MetricsDump metrics;
+		if( show_metrics )
+			metrics.Set(connector.GetController());
+
 		Barry::Mode::Desktop &desktop = connector.GetDesktop();
+		desktop.SetFetchWindow(fetch_window > 0 ? fetch_window : 1);
 
 		// Dump list of all databases to stdout
 		if( show_dbdb ) {
@@ -964,6 +1058,17 @@ int main(int argc, char *argv[])
 		// Dump contents of selected databases to stdout, or
 		// to file if specified.
 		// This is retrieving data from the Blackberry.
+#ifdef __BARRY_BACKUP_MODE__
+		if( dbNames.size() && incrementalBase.size() ) {
+			// only fetch what changed since the base backup
+			shared_ptr<Parser> parse = GetParser(dbNames[0],
+				filename, false, !sort_records,
+				vformat_mode, bbackup_mode);
+			Backup &backup = dynamic_cast<Backup&>(*parse.get());
+			backup.Incremental(desktop, incrementalBase, dbNames);
+		}
+		else
+#endif
 		if( dbNames.size() ) {
 			vector<string>::iterator b = dbNames.begin();
 
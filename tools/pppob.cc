@@ -123,7 +123,9 @@ void ProcessStdin(Modem &modem)
 			perror("select()");
 		}
 		else if( ret && FD_ISSET(read_fd, &rfds) ) {
-			bytes_read = read(read_fd, data.GetBuffer(), data.GetBufSize());
+			bytes_read = read(read_fd,
+				data.GetBuffer(BARRY_DATA_DEFAULT_SIZE),
+				data.GetBufSize());
 			if( bytes_read == 0 )
 				break;	// end of file
 			else if( bytes_read > 0 ) {